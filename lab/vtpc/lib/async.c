@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "stats.h"
+#include "vtpc.h"
+
+/*
+ * Operations waiting for a worker, in submission order. Workers are started
+ * by the first submission and never exit.
+ */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  vtpc_async_t* head;
+  vtpc_async_t* tail;
+  uint32_t workers;
+} queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * The operation is not touched after the callback, which may already have
+ * released it.
+ */
+void async_complete(vtpc_async_t* async, ssize_t result, int error) {
+  void (*callback)(vtpc_async_t*) = async->callback;
+  const int eventfd = async->eventfd;
+  stats_op(
+      async->write ? VTPC_LATENCY_WRITE : VTPC_LATENCY_READ,
+      async->started,
+      result
+  );
+  async->result = result;
+  async->error = error;
+  atomic_store_explicit((_Atomic int*)&async->done, 1, memory_order_release);
+  if (callback != NULL) {
+    callback(async);
+  }
+  if (eventfd != -1) {
+    const uint64_t one = 1;
+    (void)write(eventfd, &one, sizeof(one));
+  }
+}
+
+int vtpc_async_done(const vtpc_async_t* async) {
+  return atomic_load_explicit((_Atomic int*)&async->done, memory_order_acquire);
+}
+
+static void* async_main(void* arg) {
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.head == NULL) {
+      pthread_cond_wait(&queue.ready, &queue.lock);
+    }
+    vtpc_async_t* async = queue.head;
+    queue.head = async->next;
+    if (queue.head == NULL) {
+      queue.tail = NULL;
+    }
+    pthread_mutex_unlock(&queue.lock);
+    async_run(async);
+  }
+  return NULL;
+}
+
+/* Called under the queue lock. */
+static void async_start(void) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  while (queue.workers < vtpc_cache.async_workers) {
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, async_main, NULL) != 0) {
+      break;
+    }
+    queue.workers += 1;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/* Without any worker the operation is done by the caller. */
+void async_submit(vtpc_async_t* async) {
+  async->next = NULL;
+  pthread_mutex_lock(&queue.lock);
+  if (queue.workers < vtpc_cache.async_workers) {
+    async_start();
+  }
+  if (queue.workers == 0) {
+    pthread_mutex_unlock(&queue.lock);
+    async_run(async);
+    return;
+  }
+  if (queue.tail == NULL) {
+    queue.head = async;
+  } else {
+    queue.tail->next = async;
+  }
+  queue.tail = async;
+  pthread_cond_signal(&queue.ready);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+/* Queued operations belong to the parent, whose workers will finish them. */
+void async_atfork_child(void) {
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.ready, NULL);
+  queue.head = NULL;
+  queue.tail = NULL;
+  queue.workers = 0;
+}
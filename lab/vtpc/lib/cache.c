@@ -0,0 +1,1261 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dedup.h"
+#include "io.h"
+#include "manifest.h"
+#include "policy.h"
+#include "shm.h"
+#include "stats.h"
+#include "tier.h"
+#include "vtpc.h"
+
+struct vtpc_cache vtpc_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+};
+
+static const struct vtpc_policy* const policies[] = {
+    [VTPC_POLICY_LRU] = &vtpc_policy_lru,
+    [VTPC_POLICY_CLOCK] = &vtpc_policy_clock,
+    [VTPC_POLICY_2Q] = &vtpc_policy_2q,
+    [VTPC_POLICY_LFU] = &vtpc_policy_lfu,
+    [VTPC_POLICY_ARC] = &vtpc_policy_arc,
+    [VTPC_POLICY_MRU] = &vtpc_policy_mru,
+    [VTPC_POLICY_OPTIMAL] = &vtpc_policy_optimal,
+};
+
+enum {
+  VTPC_POLICY_COUNT = sizeof(policies) / sizeof(policies[0]),
+  VTPC_DIRTY_RATIO = 50,
+  VTPC_DIRTY_EXPIRE_MS = 3000,
+  VTPC_QUEUE_DEPTH = 32,
+  VTPC_QUEUE_DEPTH_MAX = 4096,
+  VTPC_ASYNC_WORKERS = 4,
+  VTPC_ASYNC_WORKERS_MAX = 256,
+  VTPC_WAIT_MS = 50,
+};
+
+#define VTPC_HUGE_PAGE ((size_t)2 << 20U)
+#define VTPC_MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+
+static const struct vtpc_policy* policy_from_env(void) {
+  const char* name = getenv("VTPC_POLICY");
+  if (name == NULL) {
+    return &vtpc_policy_lru;
+  }
+  for (size_t i = 0; i < VTPC_POLICY_COUNT; ++i) {
+    if (strcasecmp(name, policies[i]->name) == 0) {
+      return policies[i];
+    }
+  }
+  return &vtpc_policy_lru;
+}
+
+static long env_long(const char* name, long fallback) {
+  const char* value = getenv(name);
+  if (value == NULL) {
+    return fallback;
+  }
+  char* end = NULL;
+  const long result = strtol(value, &end, 10);
+  return (end != value && *end == '\0' && result >= 0) ? result : fallback;
+}
+
+int vtpc_set_policy(vtpc_policy_t policy) {
+  pthread_mutex_lock(&vtpc_cache.lock);
+  int result = 0;
+  if (vtpc_cache.ready) {
+    errno = EBUSY;
+    result = -1;
+  } else if ((unsigned)policy >= VTPC_POLICY_COUNT) {
+    errno = EINVAL;
+    result = -1;
+  } else {
+    vtpc_cache.policy = policies[policy];
+  }
+  pthread_mutex_unlock(&vtpc_cache.lock);
+  return result;
+}
+
+static uint32_t policy_index(const struct vtpc_policy* policy) {
+  uint32_t i = 0;
+  while (policies[i] != policy) {
+    i += 1;
+  }
+  return i;
+}
+
+static size_t align_up(size_t value, size_t to) {
+  return (value + to - 1) / to * to;
+}
+
+/* Shared locks are robust: a process dying with one held leaves it usable. */
+static void lock_init(pthread_mutex_t* lock, bool shared) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  if (shared) {
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  }
+  pthread_mutex_init(lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/* Index entries of a shard: a power of two, at least two per frame. */
+static uint32_t index_size(uint32_t frames) {
+  uint32_t size = 1;
+  while (size < 2 * frames) {
+    size <<= 1U;
+  }
+  return size;
+}
+
+static void shard_init(
+    struct vtpc_pool* pool,
+    struct vtpc_shard* shard,
+    uint32_t base,
+    void* state,
+    uint64_t* index,
+    bool shared
+) {
+  const uint32_t frames = pool->frame_count / VTPC_SHARDS;
+  shard->policy_state = state;
+  vtpc_cache.policy->init(shard->policy_state, frames);
+
+  lock_init(&shard->lock, shared);
+  shard->base = base;
+  shard->index = index;
+  shard->mask = index_size(frames) - 1;
+  vtpc_list_init(&shard->dirty);
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    vtpc_list_init(&shard->nodes[i]);
+  }
+  for (uint32_t i = 0; i < frames; ++i) {
+    pool->links[base + i] = (i + 1 < frames) ? base + i + 1 : VTPC_NIL;
+  }
+  shard->free = base;
+}
+
+/*
+ * Where the arrays of a pool start. Only a shared pool has pins for every
+ * slot, only a private one dedup. The data starts on a huge page and the
+ * size is rounded up to one.
+ */
+struct vtpc_layout {
+  size_t states;
+  size_t state;
+  size_t pins;
+  size_t frames;
+  size_t uses;
+  size_t dirtied;
+  size_t seqs;
+  size_t links;
+  size_t dirty_links;
+  size_t node_links;
+  size_t index;
+  size_t dedup;
+  size_t data;
+  size_t size;
+  uint32_t pages;
+};
+
+static void pool_layout(
+    const struct vtpc_policy* policy,
+    uint32_t frames,
+    bool shared,
+    struct vtpc_layout* layout
+) {
+  const uint32_t slots = shared ? VTPC_SLOTS : 1;
+  const bool dedup = !shared && vtpc_cache.dedup;
+  layout->pages = dedup ? frames / VTPC_DEDUP_FRAMES : frames;
+  size_t at = align_up(sizeof(struct vtpc_pool), 64);
+  layout->states = at;
+  layout->state = align_up(policy->size(frames / VTPC_SHARDS), 64);
+  at += VTPC_SHARDS * layout->state;
+  layout->pins = at;
+  at = align_up(at + (size_t)slots * frames * sizeof(uint32_t), 64);
+  layout->frames = at;
+  at = align_up(at + (size_t)frames * sizeof(struct vtpc_frame), 64);
+  layout->uses = at;
+  at = align_up(at + (size_t)frames * sizeof(uint16_t), 64);
+  layout->dirtied = at;
+  at = align_up(at + (size_t)frames * sizeof(uint64_t), 64);
+  layout->seqs = at;
+  at = align_up(at + (size_t)frames * sizeof(uint32_t), 64);
+  layout->links = at;
+  at = align_up(at + (size_t)frames * sizeof(uint32_t), 64);
+  layout->dirty_links = at;
+  at = align_up(at + (size_t)frames * sizeof(struct vtpc_link), 64);
+  layout->node_links = at;
+  at = align_up(at + (size_t)frames * sizeof(struct vtpc_link), 64);
+  layout->index = at;
+  at = align_up(
+      at + (size_t)VTPC_SHARDS * index_size(frames / VTPC_SHARDS) *
+               sizeof(uint64_t),
+      64
+  );
+  layout->dedup = at;
+  if (dedup) {
+    at += dedup_size(frames, layout->pages);
+  }
+  layout->data = align_up(at, VTPC_HUGE_PAGE);
+  layout->size = align_up(
+      layout->data + (size_t)layout->pages * VTPC_BLOCK_SIZE, VTPC_HUGE_PAGE
+  );
+}
+
+size_t pool_size(const struct vtpc_policy* policy, uint32_t frames) {
+  struct vtpc_layout layout;
+  pool_layout(policy, frames, vtpc_cache.shared, &layout);
+  return layout.size;
+}
+
+/* Initializes zeroed memory of pool_size() for the policy of the cache. */
+void pool_init(struct vtpc_pool* pool, uint32_t frames, bool shared) {
+  const struct vtpc_policy* policy = vtpc_cache.policy;
+  struct vtpc_layout layout;
+  pool_layout(policy, frames, shared, &layout);
+  char* memory = (char*)pool;
+  pool->base = (uintptr_t)pool;
+  pool->size = layout.size;
+  pool->data = layout.data;
+  pool->policy = policy_index(policy);
+  pool->frame_count = frames;
+  pool->page_count = layout.pages;
+  pool->frames = (struct vtpc_frame*)(memory + layout.frames);
+  pool->uses = (uint16_t*)(memory + layout.uses);
+  pool->dirtied = (uint64_t*)(memory + layout.dirtied);
+  pool->seqs = (_Atomic uint32_t*)(memory + layout.seqs);
+  pool->links = (uint32_t*)(memory + layout.links);
+  pool->dirty_links = (struct vtpc_link*)(memory + layout.dirty_links);
+  pool->node_links = (struct vtpc_link*)(memory + layout.node_links);
+  lock_init(&pool->lock, shared);
+
+  uint32_t* pins = (uint32_t*)(memory + layout.pins);
+  for (uint32_t i = 0; i < (shared ? VTPC_SLOTS : 1); ++i) {
+    pool->slots[i].pins = pins + (size_t)i * frames;
+  }
+  const uint32_t shard_frames = frames / VTPC_SHARDS;
+  const size_t index_entries = index_size(shard_frames);
+  uint64_t* index = (uint64_t*)(memory + layout.index);
+  for (uint32_t i = 0; i < VTPC_SHARDS; ++i) {
+    void* state = memory + layout.states + i * layout.state;
+    shard_init(
+        pool,
+        &pool->shards[i],
+        i * shard_frames,
+        state,
+        index + i * index_entries,
+        shared
+    );
+  }
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    lock_init(&pool->nodes[i].lock, shared);
+  }
+  if (layout.pages < frames) {
+    dedup_init(memory + layout.dedup, frames, layout.pages);
+  }
+}
+
+/* Points the cache at the pool and adopts its policy and size. */
+void pool_use(struct vtpc_pool* pool) {
+  struct vtpc_cache* c = &vtpc_cache;
+  c->policy = policies[pool->policy];
+  c->pool = pool;
+  c->data = (char*)pool + pool->data;
+  c->shards = pool->shards;
+  c->frames = pool->frames;
+  c->uses = pool->uses;
+  c->dirtied = pool->dirtied;
+  c->seqs = pool->seqs;
+  c->links = pool->links;
+  c->dirty_links = pool->dirty_links;
+  c->node_links = pool->node_links;
+  c->nodes = pool->nodes;
+  c->frame_count = pool->frame_count;
+  c->page_count = pool->page_count;
+  c->shard_frames = pool->frame_count / VTPC_SHARDS;
+}
+
+/* Lets transparent huge pages back the pool where huge pages are not used. */
+void pool_advise(void* memory, size_t size) {
+  (void)madvise(memory, size, MADV_HUGEPAGE);
+}
+
+/* Anonymous memory aligned to a huge page, so that they can back it. */
+static void* map_aligned(size_t size) {
+  char* memory = mmap(
+      NULL,
+      size + VTPC_HUGE_PAGE,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0
+  );
+  if (memory == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  char* start = (char*)align_up((uintptr_t)memory, VTPC_HUGE_PAGE);
+  if (start > memory) {
+    munmap(memory, (size_t)(start - memory));
+  }
+  if ((size_t)(start - memory) < VTPC_HUGE_PAGE) {
+    munmap(start + size, VTPC_HUGE_PAGE - (size_t)(start - memory));
+  }
+  pool_advise(start, size);
+  return start;
+}
+
+/*
+ * A private pool is one mapping of 2 MiB pages when enough are reserved,
+ * and one that transparent huge pages can back otherwise.
+ */
+static int pool_create(uint32_t frames) {
+  const size_t size = pool_size(vtpc_cache.policy, frames);
+  void* memory = mmap(
+      NULL,
+      size,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | VTPC_MAP_HUGE_2MB,
+      -1,
+      0
+  );
+  if (memory == MAP_FAILED) {
+    memory = map_aligned(size);
+  }
+  if (memory == MAP_FAILED) {
+    errno = ENOMEM;
+    return -1;
+  }
+  pool_init(memory, frames, false);
+  pool_use(memory);
+  vtpc_cache.slot = 0;
+  vtpc_cache.pool->slots[0].pid = getpid();
+  return 0;
+}
+
+/* Reads a size in bytes with an optional K, M or G suffix. */
+static size_t env_size(const char* name, size_t fallback) {
+  const char* value = getenv(name);
+  if (value == NULL) {
+    return fallback;
+  }
+  char* end = NULL;
+  const unsigned long long result = strtoull(value, &end, 10);
+  unsigned shift = 0;
+  if (end != value && *end != '\0' && end[1] == '\0') {
+    const char* suffixes = "KMG";
+    const char* suffix = strchr(suffixes, *end & ~0x20);
+    if (suffix != NULL) {
+      shift = 10U * (unsigned)(suffix - suffixes + 1);
+      end += 1;
+    }
+  }
+  if (end == value || *end != '\0' || result > (SIZE_MAX >> shift)) {
+    return fallback;
+  }
+  return (size_t)result << shift;
+}
+
+/* The most frames whose pool fits in `budget`, never fewer than the minimum. */
+static uint32_t frames_for(const struct vtpc_policy* policy, size_t budget) {
+  const uint64_t unit = VTPC_SHARDS;
+  uint64_t low = VTPC_SHARD_FRAMES_MIN;
+  uint64_t high = budget / VTPC_BLOCK_SIZE / unit + 1;
+  if (vtpc_cache.dedup) {
+    low *= VTPC_DEDUP_FRAMES;
+    high *= VTPC_DEDUP_FRAMES;
+  }
+  if (high > VTPC_NIL / unit) {
+    high = VTPC_NIL / unit;
+  }
+  while (low + 1 < high) {
+    const uint64_t mid = low + (high - low) / 2;
+    if (pool_size(policy, (uint32_t)(mid * unit)) <= budget) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return (uint32_t)(low * unit);
+}
+
+/*
+ * Called under the cache lock by the first open. With VTPC_SHM set the
+ * pool is shared with the other processes that use the same name.
+ */
+int cache_init(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  if (c->ready) {
+    return 0;
+  }
+
+  if (c->policy == NULL) {
+    c->policy = policy_from_env();
+  }
+  const char* name = getenv("VTPC_SHM");
+  c->shared = name != NULL && *name != '\0';
+  c->dedup = !c->shared && env_long("VTPC_DEDUP", 0) > 0;
+  const size_t budget = env_size(
+      "VTPC_MEMORY", pool_size(c->policy, VTPC_FRAMES_DEFAULT)
+  );
+  const uint32_t frames = frames_for(c->policy, budget);
+  if ((c->shared ? shm_attach(name, frames) : pool_create(frames)) == -1) {
+    c->shared = false;
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    c->locals[i].wfd = -1;
+    pthread_mutex_init(&c->files[i].lock, NULL);
+    pthread_mutex_init(&c->files[i].streams_lock, NULL);
+  }
+
+  const long ratio = env_long("VTPC_DIRTY_RATIO", VTPC_DIRTY_RATIO);
+  const long expire = env_long("VTPC_DIRTY_EXPIRE_MS", VTPC_DIRTY_EXPIRE_MS);
+  c->dirty_high =
+      (uint32_t)(c->frame_count * (uint64_t)(ratio < 100 ? ratio : 100) / 100);
+  c->dirty_expire = (uint64_t)expire * 1000000ULL;
+  const long depth = env_long("VTPC_QUEUE_DEPTH", VTPC_QUEUE_DEPTH);
+  c->queue_depth =
+      (uint32_t)(depth < VTPC_QUEUE_DEPTH_MAX ? depth : VTPC_QUEUE_DEPTH_MAX);
+  const long workers = env_long("VTPC_ASYNC_WORKERS", VTPC_ASYNC_WORKERS);
+  c->async_workers = (uint32_t)(
+      workers < VTPC_ASYNC_WORKERS_MAX ? workers : VTPC_ASYNC_WORKERS_MAX
+  );
+  stats_init();
+  if (!c->shared) {
+    tier_init(env_size("VTPC_TIER_MEMORY", 0));
+  }
+
+  c->ready = true;
+  manifest_init();
+  return 0;
+}
+
+uint64_t cache_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+bool event_sleep(struct vtpc_event* event, uint32_t seq) {
+  static const struct timespec timeout = {0, VTPC_WAIT_MS * 1000000L};
+  const bool shared = vtpc_cache.shared;
+  const int saved = errno;
+  const long result = syscall(
+      SYS_futex,
+      (void*)&event->seq,
+      shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+      seq,
+      shared ? &timeout : NULL,
+      NULL,
+      0
+  );
+  const bool woken = result == 0 || errno != ETIMEDOUT;
+  errno = saved;
+  return woken;
+}
+
+void event_wake(struct vtpc_event* event) {
+  if (event->waiters == 0) {
+    return;
+  }
+  atomic_fetch_add(&event->seq, 1);
+  syscall(
+      SYS_futex,
+      (void*)&event->seq,
+      vtpc_cache.shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+      INT_MAX,
+      NULL,
+      NULL,
+      0
+  );
+}
+
+static void shard_recover(struct vtpc_shard* shard);
+
+void shard_lock(struct vtpc_shard* shard) {
+  if (pthread_mutex_lock(&shard->lock) == EOWNERDEAD) {
+    shard_recover(shard);
+    pthread_mutex_consistent(&shard->lock);
+  }
+}
+
+void node_lock(struct vtpc_node* n) {
+  if (pthread_mutex_lock(&n->lock) == EOWNERDEAD) {
+    pthread_mutex_consistent(&n->lock);
+  }
+}
+
+void pool_lock(void) {
+  pthread_mutex_t* lock = &vtpc_cache.pool->lock;
+  if (pthread_mutex_lock(lock) == EOWNERDEAD) {
+    pthread_mutex_consistent(lock);
+  }
+}
+
+void pool_unlock(void) {
+  pthread_mutex_unlock(&vtpc_cache.pool->lock);
+}
+
+void shard_wait(struct vtpc_shard* shard) {
+  struct vtpc_event* changed = &shard->changed;
+  const uint32_t seq = changed->seq;
+  changed->waiters += 1;
+  pthread_mutex_unlock(&shard->lock);
+  const bool woken = event_sleep(changed, seq);
+  shard_lock(shard);
+  changed->waiters -= 1;
+  if (!woken) {
+    shm_reap_shard(shard, shm_dead());
+  }
+}
+
+void shard_wake(struct vtpc_shard* shard) {
+  event_wake(&shard->changed);
+}
+
+/*
+ * Writes in flight of a dead process are only given back by the shards
+ * their frames are in, which cannot be locked with the node held.
+ */
+void node_wait(struct vtpc_node* n) {
+  struct vtpc_event* idle = &n->idle;
+  const uint32_t seq = idle->seq;
+  idle->waiters += 1;
+  pthread_mutex_unlock(&n->lock);
+  const bool woken = event_sleep(idle, seq);
+  const uint64_t dead = woken ? 0 : shm_dead();
+  for (uint32_t s = 0; dead != 0 && s < VTPC_SHARDS; ++s) {
+    struct vtpc_shard* shard = &vtpc_cache.shards[s];
+    shard_lock(shard);
+    shm_reap_shard(shard, dead);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  node_lock(n);
+  idle->waiters -= 1;
+  shm_reap_node(n, dead);
+}
+
+static bool frame_busy(const struct vtpc_frame* f) {
+  return f->pins > 0 || f->loading || f->writeback;
+}
+
+/* Pins the frame for this process. */
+static void frame_pin(uint32_t frame) {
+  vtpc_cache.frames[frame].pins += 1;
+  vtpc_cache.pool->slots[vtpc_cache.slot].pins[frame] += 1;
+}
+
+static uint32_t index_hash(uint64_t key) {
+  return (uint32_t)((key * 0xC2B2AE3D27D4EB4FULL) >> 32U);
+}
+
+static uint64_t index_entry(uint32_t hash, uint32_t frame) {
+  return ((uint64_t)hash << 32U) | (frame + 1);
+}
+
+static uint32_t index_slot(
+    const struct vtpc_shard* shard, uint64_t key, uint32_t hash
+) {
+  for (uint32_t i = hash & shard->mask;; i = (i + 1) & shard->mask) {
+    const uint64_t entry = shard->index[i];
+    if (entry == 0) {
+      return i;
+    }
+    if ((uint32_t)(entry >> 32U) == hash &&
+        vtpc_cache.frames[(uint32_t)entry - 1].key == key) {
+      return i;
+    }
+  }
+}
+
+uint32_t index_find(struct vtpc_shard* shard, uint32_t node, uint64_t block) {
+  const uint64_t key = key_of(node, block);
+  const uint64_t entry = shard->index[index_slot(shard, key, index_hash(key))];
+  return entry == 0 ? VTPC_NIL : (uint32_t)entry - 1;
+}
+
+/* Also adds the frame to the list of its node. */
+static void index_insert(struct vtpc_shard* shard, uint32_t frame) {
+  const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  const uint32_t hash = index_hash(f->key);
+  shard->index[index_slot(shard, f->key, hash)] = index_entry(hash, frame);
+  struct vtpc_list* list = &shard->nodes[key_node(f->key)];
+  if (f->dirty != 0) {
+    vtpc_list_push(list, vtpc_cache.node_links, frame);
+  } else {
+    vtpc_list_insert_after(list, vtpc_cache.node_links, list->tail, frame);
+  }
+}
+
+/*
+ * Empties the entry of the frame and moves later entries of the run back
+ * into the hole when that brings them closer to where they hash, so that
+ * probes never need tombstones. Also takes the frame off its node list.
+ */
+static void index_remove(struct vtpc_shard* shard, uint32_t frame) {
+  const uint64_t key = vtpc_cache.frames[frame].key;
+  const uint32_t mask = shard->mask;
+  vtpc_list_unlink(&shard->nodes[key_node(key)], vtpc_cache.node_links, frame);
+  uint32_t hole = index_slot(shard, key, index_hash(key));
+  shard->index[hole] = 0;
+  for (uint32_t i = (hole + 1) & mask; shard->index[i] != 0;
+       i = (i + 1) & mask) {
+    const uint64_t entry = shard->index[i];
+    const uint32_t home = (uint32_t)(entry >> 32U) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      shard->index[hole] = entry;
+      shard->index[i] = 0;
+      hole = i;
+    }
+  }
+}
+
+void frame_free(struct vtpc_shard* shard, uint32_t frame) {
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  f->used = false;
+  f->dirty = 0;
+  dedup_release(frame);
+  vtpc_cache.links[frame] = shard->free;
+  shard->free = frame;
+}
+
+/* Counts the readahead that was never used once its frame goes away. */
+static void frame_unfetch(struct vtpc_frame* f) {
+  if (f->fetch == VTPC_FETCH_AHEAD) {
+    stats_add(VTPC_STAT_PREFETCH_WASTED, 1);
+  }
+  f->fetch = VTPC_FETCH_NONE;
+}
+
+/* Counts a use of the frame, its first one may turn a hit into a miss. */
+static void frame_used(uint32_t frame, bool miss) {
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  if (f->fetch == VTPC_FETCH_AHEAD) {
+    stats_add(VTPC_STAT_READAHEAD_HITS, 1);
+  } else if (f->fetch == VTPC_FETCH_BATCH) {
+    miss = true;
+  }
+  f->fetch = VTPC_FETCH_NONE;
+  if (vtpc_cache.uses[frame] < UINT16_MAX) {
+    vtpc_cache.uses[frame] += 1;
+  }
+  stats_add(miss ? VTPC_STAT_MISSES : VTPC_STAT_HITS, 1);
+}
+
+/*
+ * Takes a victim of the policy out of the index for reuse, its block goes
+ * to the compressed tier if it is whole and the policy may remember it.
+ * Returns false, with the frame freed, when it is left without a page.
+ */
+static bool frame_reclaim(struct vtpc_shard* shard, uint32_t frame) {
+  const struct vtpc_policy* policy = vtpc_cache.policy;
+  const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  if (f->valid == VTPC_SECTORS_ALL) {
+    tier_store(f->key, frame_data(frame));
+  }
+  if (policy->evict != NULL) {
+    policy->evict(shard->policy_state, frame - shard->base);
+  }
+  index_remove(shard, frame);
+  frame_unfetch(&vtpc_cache.frames[frame]);
+  stats_add(VTPC_STAT_EVICTIONS, 1);
+  if (dedup_reuse(frame)) {
+    return true;
+  }
+  frame_free(shard, frame);
+  return false;
+}
+
+void frame_drop(struct vtpc_shard* shard, uint32_t frame) {
+  frame_unfetch(&vtpc_cache.frames[frame]);
+  index_remove(shard, frame);
+  vtpc_cache.policy->remove(shard->policy_state, frame - shard->base);
+  frame_free(shard, frame);
+}
+
+void frame_install(
+    struct vtpc_shard* shard,
+    uint32_t frame,
+    uint32_t node,
+    uint64_t block,
+    uint8_t valid
+) {
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  f->used = true;
+  f->loading = false;
+  f->writeback = false;
+  f->valid = valid;
+  f->dirty = 0;
+  f->fetch = VTPC_FETCH_NONE;
+  f->pins = 0;
+  f->key = key_of(node, block);
+  if (tier_load(f->key, frame_data(frame))) {
+    f->valid = VTPC_SECTORS_ALL;
+  }
+  vtpc_cache.uses[frame] = 0;
+  index_insert(shard, frame);
+  vtpc_cache.policy->insert(shard->policy_state, frame - shard->base, f->key);
+  dedup_merge(frame);
+}
+
+/* Busy victims set aside by frame_alloc, the last taken first. */
+struct vtpc_aside {
+  uint32_t head;
+};
+
+static void aside_push(struct vtpc_aside* aside, uint32_t frame) {
+  vtpc_cache.links[frame] = aside->head;
+  aside->head = frame;
+}
+
+/* Gives the victims back to the policy where they were. */
+static void policy_restore(
+    struct vtpc_shard* shard, struct vtpc_aside* aside
+) {
+  for (uint32_t i = aside->head; i != VTPC_NIL; i = vtpc_cache.links[i]) {
+    vtpc_cache.policy->restore(shard->policy_state, i - shard->base);
+  }
+  aside->head = VTPC_NIL;
+}
+
+/*
+ * Rebuilds the index, free list, policy and dirty list of a shard whose
+ * lock was held by a process that died, maybe halfway through changing
+ * them. Pins are counted again from those of the slots. Busy and dirty
+ * frames are kept, idle clean ones are dropped since they may have been
+ * reused halfway.
+ */
+static void shard_recover(struct vtpc_shard* shard) {
+  const struct vtpc_policy* policy = vtpc_cache.policy;
+  const struct vtpc_slot* slots = vtpc_cache.pool->slots;
+  const uint32_t frames = vtpc_cache.shard_frames;
+  policy->init(shard->policy_state, frames);
+  vtpc_list_init(&shard->dirty);
+  memset(shard->index, 0, ((size_t)shard->mask + 1) * sizeof(uint64_t));
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    vtpc_list_init(&shard->nodes[i]);
+  }
+  shard->free = VTPC_NIL;
+
+  for (uint32_t i = frames; i-- > 0;) {
+    const uint32_t frame = shard->base + i;
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    f->pins = 0;
+    for (uint32_t s = 0; s < VTPC_SLOTS; ++s) {
+      f->pins += slots[s].pins[frame];
+    }
+    /* A write left half done by a dead process must not stall readers. */
+    if ((vtpc_cache.seqs[frame] & 1U) != 0) {
+      vtpc_cache.seqs[frame] += 1;
+    }
+    if (!f->used || (f->dirty == 0 && !frame_busy(f))) {
+      f->fetch = VTPC_FETCH_NONE;
+      frame_free(shard, frame);
+      continue;
+    }
+    index_insert(shard, frame);
+    policy->insert(shard->policy_state, i, f->key);
+    if (f->dirty != 0) {
+      vtpc_list_push(&shard->dirty, vtpc_cache.dirty_links, frame);
+    }
+  }
+}
+
+static uint32_t shard_alloc(
+    struct vtpc_shard* shard, uint64_t key, bool wait, bool steal
+);
+
+/*
+ * With dedup, pages run out before frames when the blocks of other shards
+ * hold them: has another shard evict until it frees one. Releases the lock
+ * meanwhile.
+ */
+static bool page_steal(struct vtpc_shard* shard, uint64_t key) {
+  const uint32_t first = (uint32_t)(shard - vtpc_cache.shards);
+  uint32_t frame = VTPC_NIL;
+  pthread_mutex_unlock(&shard->lock);
+  for (uint32_t i = 1; i < VTPC_SHARDS && frame == VTPC_NIL; ++i) {
+    struct vtpc_shard* other = &vtpc_cache.shards[(first + i) % VTPC_SHARDS];
+    shard_lock(other);
+    frame = shard_alloc(other, key, false, false);
+    if (frame != VTPC_NIL) {
+      frame_free(other, frame);
+    }
+    pthread_mutex_unlock(&other->lock);
+  }
+  shard_lock(shard);
+  return frame != VTPC_NIL;
+}
+
+/*
+ * Busy victims are set aside and given back to the policy once a frame is
+ * found. Dirty victims are given back as well, then written back, which
+ * releases the lock, and evicted if they stayed clean and idle. When
+ * every frame is busy, waits for one to become idle, unless `wait` is false.
+ * Free frames may lack a page with dedup, victims are then evicted until
+ * one is freed, by other shards if `steal` allows it.
+ */
+static uint32_t shard_alloc(
+    struct vtpc_shard* shard, uint64_t key, bool wait, bool steal
+) {
+  const struct vtpc_policy* policy = vtpc_cache.policy;
+  struct vtpc_aside busy = {VTPC_NIL};
+
+  for (;;) {
+    if (shard->free != VTPC_NIL && dedup_reserve(shard->free)) {
+      const uint32_t frame = shard->free;
+      shard->free = vtpc_cache.links[frame];
+      policy_restore(shard, &busy);
+      return frame;
+    }
+
+    const uint32_t victim = policy->victim(shard->policy_state, key);
+    if (victim == VTPC_NIL) {
+      policy_restore(shard, &busy);
+      const bool full = shard->free == VTPC_NIL;
+      if (!full && steal && page_steal(shard, key)) {
+        continue;
+      }
+      if (!wait) {
+        errno = EAGAIN;
+        return VTPC_NIL;
+      }
+      if (full) {
+        shard_wait(shard);
+      } else {
+        pthread_mutex_unlock(&shard->lock);
+        dedup_wait();
+        shard_lock(shard);
+      }
+      continue;
+    }
+
+    const uint32_t frame = shard->base + victim;
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    if (frame_busy(f)) {
+      aside_push(&busy, frame);
+      continue;
+    }
+    if (f->dirty == 0) {
+      policy_restore(shard, &busy);
+      if (frame_reclaim(shard, frame)) {
+        return frame;
+      }
+      continue;
+    }
+    if (!node_writable(key_node(f->key))) {
+      /* Only a process with the file open for writing can write it back. */
+      atomic_fetch_add(&vtpc_cache.pool->flush_requests, 1);
+      aside_push(&busy, frame);
+      continue;
+    }
+
+    aside_push(&busy, frame);
+    policy_restore(shard, &busy);
+    if (frame_writeback(shard, frame) == -1) {
+      return VTPC_NIL;
+    }
+    if (!frame_busy(f) && f->dirty == 0) {
+      policy->remove(shard->policy_state, victim);
+      if (frame_reclaim(shard, frame)) {
+        return frame;
+      }
+    }
+  }
+}
+
+uint32_t frame_alloc(struct vtpc_shard* shard, uint64_t key, bool wait) {
+  return shard_alloc(shard, key, wait, true);
+}
+
+/*
+ * Loads the sectors of the frame that are not valid yet, without the lock.
+ * Sectors that were written in the cache are newer than the disk and are
+ * kept.
+ */
+int block_fill(struct vtpc_shard* shard, int fd, uint32_t frame) {
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  const off_t pos = (off_t)(key_block(f->key) * VTPC_BLOCK_SIZE);
+  const uint8_t valid = f->valid;
+  char* data = frame_data(frame);
+  _Alignas(VTPC_BLOCK_SIZE) char disk[VTPC_BLOCK_SIZE];
+  char* into = valid == 0 ? data : disk;
+
+  f->loading = true;
+  f->owner = (uint8_t)vtpc_cache.slot;
+  pthread_mutex_unlock(&shard->lock);
+  const ssize_t got = io_pread(fd, into, VTPC_BLOCK_SIZE, pos);
+  const int error = errno;
+  shard_lock(shard);
+  f->loading = false;
+  shard_wake(shard);
+  if (got < 0) {
+    errno = error;
+    return -1;
+  }
+
+  memset(into + got, 0, VTPC_BLOCK_SIZE - got);
+  for (uint32_t s = 0; valid != 0 && s < VTPC_SECTORS; ++s) {
+    if ((valid & (1U << s)) == 0) {
+      const size_t at = (size_t)s * VTPC_SECTOR_SIZE;
+      memcpy(data + at, disk + at, VTPC_SECTOR_SIZE);
+    }
+  }
+  f->valid = VTPC_SECTORS_ALL;
+  dedup_merge(frame);
+  return 0;
+}
+
+/* Sectors wholly past the end of the file on disk are zero, not read. */
+static uint8_t zero_past_disk(uint32_t frame, uint32_t node, uint64_t block) {
+  const off_t pos = (off_t)(block * VTPC_BLOCK_SIZE);
+  const off_t disk_size = vtpc_cache.nodes[node].disk_size;
+  if (disk_size - pos >= VTPC_BLOCK_SIZE) {
+    return 0;
+  }
+
+  uint32_t first = 0;
+  if (disk_size > pos) {
+    const size_t tail = (size_t)(disk_size - pos);
+    first = (uint32_t)((tail + VTPC_SECTOR_SIZE - 1) / VTPC_SECTOR_SIZE);
+  }
+  const size_t at = (size_t)first * VTPC_SECTOR_SIZE;
+  memset(frame_data(frame) + at, 0, VTPC_BLOCK_SIZE - at);
+  return (uint8_t)(VTPC_SECTORS_ALL & ~((1U << first) - 1));
+}
+
+/*
+ * Returns the frame of the block with the sectors in `need` loaded. With
+ * `stable`, also waits until the frame can be modified and gives it a page
+ * of its own. The lock may be released meanwhile.
+ */
+static uint32_t shard_lookup(
+    struct vtpc_shard* shard,
+    int fd,
+    uint32_t node,
+    uint64_t block,
+    uint8_t need,
+    bool stable
+) {
+  bool fresh = false;
+  bool filled = false;
+  for (;;) {
+    uint32_t frame = index_find(shard, node, block);
+    if (frame == VTPC_NIL) {
+      frame = frame_alloc(shard, key_of(node, block), true);
+      if (frame == VTPC_NIL) {
+        return VTPC_NIL;
+      }
+      if (index_find(shard, node, block) != VTPC_NIL) {
+        frame_free(shard, frame);
+        continue;
+      }
+      const uint8_t valid = zero_past_disk(frame, node, block);
+      frame_install(shard, frame, node, block, valid);
+      fresh = true;
+    }
+
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    if (f->loading || (stable && f->writeback)) {
+      shard_wait(shard);
+      continue;
+    }
+    if ((need & ~f->valid) != 0) {
+      if (block_fill(shard, fd, frame) == -1) {
+        return VTPC_NIL;
+      }
+      filled = true;
+      continue;
+    }
+    if (stable && !dedup_own(frame)) {
+      /* Frees a page for the copy of a shared block, maybe this one. */
+      const uint32_t spare = frame_alloc(shard, f->key, true);
+      if (spare == VTPC_NIL) {
+        return VTPC_NIL;
+      }
+      frame_free(shard, spare);
+      continue;
+    }
+    frame_used(frame, fresh || filled);
+    if (!fresh) {
+      vtpc_cache.policy->touch(shard->policy_state, frame - shard->base);
+    }
+    return frame;
+  }
+}
+
+/* Returns the frame pinned, it can be read without the lock until put. */
+uint32_t frame_get(int fd, uint32_t node, uint64_t block, uint8_t need) {
+  struct vtpc_shard* shard = shard_of(node, block);
+  shard_lock(shard);
+  const uint32_t frame = shard_lookup(shard, fd, node, block, need, false);
+  if (frame != VTPC_NIL) {
+    frame_pin(frame);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return frame;
+}
+
+/*
+ * Looks up the cached block with the sectors in `need` loaded, without
+ * loading it or waiting. Returns the frame pinned, or VTPC_NIL.
+ */
+uint32_t frame_find(uint32_t node, uint64_t block, uint8_t need) {
+  struct vtpc_shard* shard = shard_of(node, block);
+  shard_lock(shard);
+  uint32_t frame = index_find(shard, node, block);
+  if (frame != VTPC_NIL) {
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    if (f->loading || (need & ~f->valid) != 0) {
+      frame = VTPC_NIL;
+    } else {
+      frame_pin(frame);
+      frame_used(frame, false);
+      vtpc_cache.policy->touch(shard->policy_state, frame - shard->base);
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return frame;
+}
+
+/* Unpins the frame, with `drop` also evicts it if it is clean and idle. */
+void frame_put(uint32_t frame, bool drop) {
+  struct vtpc_shard* shard = shard_of_frame(frame);
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  shard_lock(shard);
+  f->pins -= 1;
+  vtpc_cache.pool->slots[vtpc_cache.slot].pins[frame] -= 1;
+  if (f->pins == 0) {
+    dedup_unpin(frame);
+    if (drop && f->dirty == 0 && !f->loading && !f->writeback) {
+      frame_drop(shard, frame);
+    }
+    shard_wake(shard);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/* Sectors that the byte range [from, to) covers only partly. */
+static uint8_t partial_sectors(size_t from, size_t to) {
+  uint8_t mask = 0;
+  if (from % VTPC_SECTOR_SIZE != 0) {
+    mask |= sector_mask(from, from + 1);
+  }
+  if (to % VTPC_SECTOR_SIZE != 0) {
+    mask |= sector_mask(to - 1, to);
+  }
+  return mask;
+}
+
+/*
+ * Writes a range that does not cross a block boundary into the cache, the
+ * iterator only moves if it succeeds.
+ */
+int block_write(
+    int fd, uint32_t node, off_t pos, struct vtpc_iter* it, size_t count
+) {
+  const uint64_t block = (uint64_t)pos / VTPC_BLOCK_SIZE;
+  const size_t shift = (size_t)pos % VTPC_BLOCK_SIZE;
+  const uint8_t need = partial_sectors(shift, shift + count);
+  struct vtpc_shard* shard = shard_of(node, block);
+
+  shard_lock(shard);
+  const uint32_t frame = shard_lookup(shard, fd, node, block, need, true);
+  if (frame == VTPC_NIL) {
+    pthread_mutex_unlock(&shard->lock);
+    return -1;
+  }
+  /* Readers that pinned the frame copy again what this tears. */
+  _Atomic uint32_t* seqs = &vtpc_cache.seqs[frame];
+  const uint32_t seq = atomic_load_explicit(seqs, memory_order_relaxed);
+  atomic_store_explicit(seqs, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  iter_gather(it, frame_data(frame) + shift, count);
+  atomic_store_explicit(seqs, seq + 2, memory_order_release);
+  const uint8_t written = sector_mask(shift, shift + count);
+  vtpc_cache.frames[frame].valid |= written;
+  atomic_max(&vtpc_cache.nodes[node].size, pos + (off_t)count);
+  frame_set_dirty(shard, frame, written);
+  pthread_mutex_unlock(&shard->lock);
+  return 0;
+}
+
+/* Returns VTPC_NIL if every node is used. */
+uint32_t node_acquire(const struct stat* st) {
+  struct vtpc_cache* c = &vtpc_cache;
+  const uint64_t self = 1ULL << c->slot;
+  uint32_t spare = VTPC_NIL;
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    struct vtpc_node* n = &c->nodes[i];
+    if (n->opened != 0 && n->dev == st->st_dev && n->ino == st->st_ino) {
+      n->opened |= self;
+      c->locals[i].refs += 1;
+      return i;
+    }
+    if (n->opened == 0 && spare == VTPC_NIL) {
+      node_lock(n);
+      if (c->locals[i].users == 0 && n->writeback == 0) {
+        spare = i;
+      }
+      pthread_mutex_unlock(&n->lock);
+    }
+  }
+  if (spare == VTPC_NIL) {
+    errno = ENFILE;
+    return VTPC_NIL;
+  }
+
+  struct vtpc_node* n = &c->nodes[spare];
+  n->dev = st->st_dev;
+  n->ino = st->st_ino;
+  n->opened = self;
+  n->size = st->st_size;
+  n->disk_size = st->st_size;
+  n->align = 1;
+  c->locals[spare].refs = 1;
+  node_lock(n);
+  c->locals[spare].wfd = -1;
+  pthread_mutex_unlock(&n->lock);
+  return spare;
+}
+
+/* The last fd of the file in every process drops the blocks of the node. */
+void node_release(uint32_t node) {
+  struct vtpc_cache* c = &vtpc_cache;
+  c->locals[node].refs -= 1;
+  if (c->locals[node].refs > 0) {
+    return;
+  }
+  c->nodes[node].opened &= ~(1ULL << c->slot);
+  if (c->nodes[node].opened == 0) {
+    node_invalidate(node);
+  }
+}
+
+/* Drops every cached block of the node, dirty ones are discarded. */
+void node_invalidate(uint32_t node) {
+  node_wait_writeback(node);
+  for (uint32_t s = 0; s < VTPC_SHARDS; ++s) {
+    struct vtpc_shard* shard = &vtpc_cache.shards[s];
+    shard_lock(shard);
+    const struct vtpc_list* list = &shard->nodes[node];
+    while (list->head != VTPC_NIL) {
+      const uint32_t frame = list->head;
+      const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+      if (frame_busy(f)) {
+        shard_wait(shard);
+        continue;
+      }
+      if (f->dirty != 0) {
+        frame_clean(shard, frame);
+      }
+      frame_drop(shard, frame);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  tier_drop_node(node);
+}
+
+/* Evicts an idle frame, writing it back first if needed. Busy ones stay. */
+static int frame_evict(struct vtpc_shard* shard, uint32_t frame) {
+  const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  if (!frame_busy(f) && f->dirty != 0 && frame_writeback(shard, frame) == -1) {
+    return -1;
+  }
+  if (!frame_busy(f) && f->dirty == 0) {
+    frame_drop(shard, frame);
+  }
+  return 0;
+}
+
+/*
+ * Evicts the idle frames of the node in the shard with blocks in
+ * [first, last]. Clean ones go as they are found, dirty ones are written
+ * back a batch at a time since that releases the lock.
+ */
+static int shard_drop_range(
+    struct vtpc_shard* shard, uint32_t node, uint64_t first, uint64_t last
+) {
+  const struct vtpc_list* list = &shard->nodes[node];
+  uint64_t dirty[VTPC_FLUSH_BATCH];
+  uint32_t len = 0;
+  do {
+    len = 0;
+    for (uint32_t frame = list->head; frame != VTPC_NIL;) {
+      const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+      const uint32_t next = vtpc_cache.node_links[frame].next;
+      const uint64_t block = key_block(f->key);
+      if (block >= first && block <= last && !frame_busy(f)) {
+        if (f->dirty == 0) {
+          frame_drop(shard, frame);
+        } else if (len < VTPC_FLUSH_BATCH) {
+          dirty[len++] = block;
+        }
+      }
+      frame = next;
+    }
+    for (uint32_t k = 0; k < len; ++k) {
+      const uint32_t frame = index_find(shard, node, dirty[k]);
+      if (frame != VTPC_NIL && frame_evict(shard, frame) == -1) {
+        return -1;
+      }
+    }
+  } while (len == VTPC_FLUSH_BATCH);
+  return 0;
+}
+
+static uint64_t node_cached(uint32_t node) {
+  uint64_t cached = 0;
+  for (uint32_t s = 0; s < VTPC_SHARDS; ++s) {
+    struct vtpc_shard* shard = &vtpc_cache.shards[s];
+    shard_lock(shard);
+    cached += shard->nodes[node].len;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return cached;
+}
+
+/* Looks the blocks up one by one when there are fewer than cached ones. */
+int node_drop_range(uint32_t node, uint64_t first, uint64_t last) {
+  int result = 0;
+  if (last - first < node_cached(node)) {
+    for (uint64_t block = first; block <= last && result == 0; ++block) {
+      struct vtpc_shard* shard = shard_of(node, block);
+      shard_lock(shard);
+      const uint32_t frame = index_find(shard, node, block);
+      if (frame != VTPC_NIL) {
+        result = frame_evict(shard, frame);
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+    return result;
+  }
+
+  for (uint32_t s = 0; s < VTPC_SHARDS && result == 0; ++s) {
+    struct vtpc_shard* shard = &vtpc_cache.shards[s];
+    shard_lock(shard);
+    result = shard_drop_range(shard, node, first, last);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return result;
+}
@@ -0,0 +1,463 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "policy.h"
+#include "vtpc.h"
+
+enum {
+  VTPC_BLOCK_SIZE = 4096,
+  VTPC_SECTOR_SIZE = 512,
+  VTPC_SECTORS = VTPC_BLOCK_SIZE / VTPC_SECTOR_SIZE,
+  VTPC_SECTORS_ALL = (1U << VTPC_SECTORS) - 1,
+  VTPC_FRAMES_DEFAULT = 1024,
+  VTPC_SHARDS = 8,
+  VTPC_SHARD_FRAMES_MIN = 64,
+  VTPC_MAX_FILES = 1024,
+  VTPC_STREAMS = 4,
+  VTPC_READAHEAD_MIN = 4,
+  VTPC_READAHEAD_MAX = 64,
+  VTPC_FLUSH_BATCH = 256,
+  VTPC_SLOTS = 64,
+  VTPC_DEDUP_FRAMES = 4,
+};
+
+/*
+ * A futex word to sleep on with a mutex released, like a condition variable
+ * that a process dying while it waits leaves usable. `waiters` is protected
+ * by the mutex.
+ */
+struct vtpc_event {
+  _Atomic uint32_t seq;
+  uint32_t waiters;
+};
+
+/*
+ * Nodes live in the pool, so with a shared cache every process that opens a
+ * file uses the same node. `opened` has a bit for each process slot that
+ * has the file open, it is protected by the lock of the pool.
+ *
+ * `size` and `disk_size` only grow while the file is open, `size` is raised
+ * before the block that extends it is marked dirty.
+ *
+ * `lock` protects the state of writes in flight, no other lock is taken
+ * while it is held. `writeback` has the bits of the slots with writes of
+ * the node in flight. Writes that cut the file back to `size` set
+ * `truncating` to the slot of their process plus one and wait until no
+ * other writeback runs, `reading` has the bits of the slots running any.
+ * Processes count their own in their local state, the masks are what a
+ * dead process leaves behind and are simply cleared.
+ * `align` is the number of sectors writeback has to write together, direct
+ * I/O may require more than one.
+ */
+struct vtpc_node {
+  dev_t dev;
+  ino_t ino;
+  uint64_t opened;
+  _Atomic off_t size;
+  _Atomic off_t disk_size;
+  _Atomic uint32_t align;
+  _Atomic uint32_t dirty;
+  pthread_mutex_t lock;
+  struct vtpc_event idle;
+  uint64_t writeback;
+  uint64_t reading;
+  uint32_t truncating;
+};
+
+/*
+ * What a process keeps of a node: its fds of the file and the one used for
+ * writeback. Under the lock of the node, `users` counts its writebacks
+ * using the fd, `writeback` its frames under writeback and `readers` its
+ * writebacks inside the file.
+ */
+struct vtpc_node_local {
+  int refs;
+  int wfd;
+  uint32_t users;
+  uint32_t writeback;
+  uint32_t readers;
+};
+
+/*
+ * A sequential reader: `pos` is where its next read is expected to start,
+ * blocks before `ahead` have already been prefetched.
+ */
+struct vtpc_stream {
+  off_t pos;
+  uint64_t ahead;
+  uint32_t window;
+  uint32_t stamp;
+};
+
+/*
+ * `lock` serializes the calls that use the file offset, `streams_lock` the
+ * readahead state. Positional I/O takes only the latter. `stats` holds the
+ * events of the fd that threads moved out of their own counters, `stats_gen`
+ * tells its opens apart (stats.c).
+ */
+struct vtpc_file {
+  _Atomic bool used;
+  _Atomic bool sequential;
+  int flags;
+  uint32_t node;
+  pthread_mutex_t lock;
+  pthread_mutex_t streams_lock;
+  off_t offset;
+  uint32_t clock;
+  struct vtpc_stream streams[VTPC_STREAMS];
+  _Atomic uint64_t stats[VTPC_STAT_COUNT];
+  _Atomic uint32_t stats_gen;
+};
+
+/* How a loaded frame came into the cache, until it is first used. */
+enum vtpc_fetch {
+  VTPC_FETCH_NONE,
+  VTPC_FETCH_AHEAD,
+  VTPC_FETCH_BATCH,
+};
+
+/*
+ * `valid` and `dirty` are masks of sectors: a block is only read from disk
+ * when an access needs a sector that was never loaded or written.
+ *
+ * A frame is busy while readers copying from it pin it, while it is loading
+ * and while it is under writeback. Busy frames are never evicted. A frame
+ * under writeback stays readable but must not be modified until the write
+ * completes, a loading frame cannot be used at all.
+ *
+ * `key` is the node and block of a used frame (key_of). `fetch` tells
+ * whether the block was loaded by readahead or by a batch of a long read
+ * before anybody asked for it, only for statistics. `owner` is the slot of
+ * the process loading the frame or writing it back.
+ *
+ * The descriptor is kept to 16 bytes so that lookups and scans touch few
+ * cache lines however many frames there are. What they do not need lives in
+ * arrays of the pool indexed by frame as well: the accesses since the block
+ * was loaded in `uses`, up to its maximum, when the frame became dirty in
+ * `dirtied`, and in `seqs` a count of the writes to its data, odd while one
+ * is in progress.
+ */
+struct vtpc_frame {
+  uint64_t key;
+  uint32_t pins;
+  uint8_t valid;
+  uint8_t dirty;
+  uint8_t owner;
+  bool used : 1;
+  bool loading : 1;
+  bool writeback : 1;
+  uint8_t fetch : 2;
+};
+
+_Static_assert(sizeof(struct vtpc_frame) == 16, "frame descriptor size");
+
+/*
+ * The pool is split into shards, each owns a fixed range of frames with
+ * their index, eviction policy and dirty list under its own lock. A block
+ * always maps to the same shard. Disk I/O is done without the lock on busy
+ * frames, `changed` is broadcast when a frame stops being busy.
+ *
+ * The index is an open addressing table of `mask` + 1 entries, at least two
+ * per frame, probed linearly. An entry holds the hash of the key in its
+ * high half and the frame plus one in its low half, 0 when empty, so that
+ * a probe reads neighbouring entries of one cache line and only looks at
+ * a frame whose hash matches.
+ *
+ * `nodes` lists the frames of each node in the shard, the dirty ones first,
+ * so that flushing or dropping the blocks of a file takes time in proportion
+ * to what it has cached rather than to the size of the cache.
+ */
+struct vtpc_shard {
+  _Alignas(64) pthread_mutex_t lock;
+  struct vtpc_event changed;
+  uint32_t base;
+  uint32_t free;
+  void* policy_state;
+  struct vtpc_list dirty;
+  uint64_t* index;
+  uint32_t mask;
+  struct vtpc_list nodes[VTPC_MAX_FILES];
+};
+
+/*
+ * A process attached to the pool, `pins` counts the pins it holds on each
+ * frame so that they can be taken back if it dies.
+ */
+struct vtpc_slot {
+  _Atomic pid_t pid;
+  uint32_t* pins;
+};
+
+/*
+ * Everything that is shared when the cache is in shared memory, in one
+ * mapping sized for `frame_count` frames: the arrays that describe the
+ * frames and the state of the policy of every shard follow the pool, then
+ * the data of the frames at `data` from the start. A shared pool is mapped
+ * at the same address in every process, `base`, since it holds pointers
+ * into itself.
+ *
+ * `lock` protects the node table and the slots. It is taken before the
+ * lock of a shard. There are as many pages of data as frames, but fewer
+ * with dedup, whose state then follows the index.
+ */
+struct vtpc_pool {
+  _Atomic uint64_t magic;
+  uintptr_t base;
+  size_t size;
+  size_t data;
+  uint32_t policy;
+  uint32_t frame_count;
+  uint32_t page_count;
+  pthread_mutex_t lock;
+  _Atomic uint32_t dirty;
+  _Atomic uint32_t flush_requests;
+  struct vtpc_frame* frames;
+  uint16_t* uses;
+  uint64_t* dirtied;
+  _Atomic uint32_t* seqs;
+  uint32_t* links;
+  struct vtpc_link* dirty_links;
+  struct vtpc_link* node_links;
+  struct vtpc_slot slots[VTPC_SLOTS];
+  struct vtpc_shard shards[VTPC_SHARDS];
+  struct vtpc_node nodes[VTPC_MAX_FILES];
+};
+
+/*
+ * `lock` protects the file table, the local state of nodes and the
+ * flusher. It is taken before the lock of the pool. `shards`, `nodes` and
+ * the arrays of frames point into the pool, `slot` is the one of this
+ * process, always 0 for a private pool. `links` chains the free frames of a
+ * shard and the busy victims a frame_alloc call took out of the policy,
+ * a frame is never in both. With dedup, `pages` maps a used frame to its
+ * page of data, which is the frame itself otherwise.
+ */
+struct vtpc_cache {
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  _Atomic bool ready;
+  bool flusher;
+  bool shared;
+  bool dedup;
+  uint32_t slot;
+  const struct vtpc_policy* policy;
+  struct vtpc_pool* pool;
+  char* data;
+  struct vtpc_shard* shards;
+  struct vtpc_frame* frames;
+  uint16_t* uses;
+  uint64_t* dirtied;
+  _Atomic uint32_t* seqs;
+  uint32_t* links;
+  struct vtpc_link* dirty_links;
+  struct vtpc_link* node_links;
+  struct vtpc_node* nodes;
+  _Atomic uint32_t* pages;
+  uint32_t frame_count;
+  uint32_t page_count;
+  uint32_t shard_frames;
+  uint32_t dirty_high;
+  uint64_t dirty_expire;
+  uint32_t queue_depth;
+  uint32_t async_workers;
+  struct vtpc_node_local locals[VTPC_MAX_FILES];
+  struct vtpc_file files[VTPC_MAX_FILES];
+};
+
+extern struct vtpc_cache vtpc_cache;
+
+int cache_init(void);
+uint64_t cache_now(void);
+size_t pool_size(const struct vtpc_policy* policy, uint32_t frames);
+void pool_init(struct vtpc_pool* pool, uint32_t frames, bool shared);
+void pool_advise(void* memory, size_t size);
+void pool_use(struct vtpc_pool* pool);
+void pool_lock(void);
+void pool_unlock(void);
+
+static inline char* frame_data(uint32_t frame) {
+  const uint32_t page =
+      vtpc_cache.pages == NULL ? frame : vtpc_cache.pages[frame];
+  return vtpc_cache.data + (size_t)page * VTPC_BLOCK_SIZE;
+}
+
+/*
+ * Readers copy from a frame they pinned without the lock, while a writer
+ * holding it may modify the data. A copy taken after frame_read_begin is
+ * whole when frame_read_retry returns false for the sequence it returned,
+ * otherwise it has to be taken again.
+ */
+static inline uint32_t frame_read_begin(uint32_t frame) {
+  for (;;) {
+    const uint32_t seq =
+        atomic_load_explicit(&vtpc_cache.seqs[frame], memory_order_acquire);
+    if ((seq & 1U) == 0) {
+      return seq;
+    }
+  }
+}
+
+static inline bool frame_read_retry(uint32_t frame, uint32_t seq) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(
+             &vtpc_cache.seqs[frame], memory_order_relaxed
+         ) != seq;
+}
+
+/* Sectors of a block touched by the byte range [from, to). */
+static inline uint8_t sector_mask(size_t from, size_t to) {
+  const uint32_t first = (uint32_t)(from / VTPC_SECTOR_SIZE);
+  const uint32_t last = (uint32_t)((to - 1) / VTPC_SECTOR_SIZE);
+  return (uint8_t)(((2U << last) - 1) & ~((1U << first) - 1));
+}
+
+/*
+ * A position in the buffers of a caller, moved along as data is copied to
+ * or from them. The copies never run past the end of the buffers.
+ */
+struct vtpc_iter {
+  const struct iovec* iov;
+  size_t skip;
+};
+
+/* Copies the next `count` bytes of the buffers to `dst`. */
+static inline void iter_gather(struct vtpc_iter* it, void* dst, size_t count) {
+  char* out = dst;
+  while (count > 0) {
+    const size_t left = it->iov->iov_len - it->skip;
+    if (left == 0) {
+      it->iov += 1;
+      it->skip = 0;
+      continue;
+    }
+    const size_t chunk = left < count ? left : count;
+    memcpy(out, (const char*)it->iov->iov_base + it->skip, chunk);
+    out += chunk;
+    count -= chunk;
+    it->skip += chunk;
+  }
+}
+
+/* Copies `count` bytes of `src` to the next bytes of the buffers. */
+static inline void iter_scatter(
+    struct vtpc_iter* it, const void* src, size_t count
+) {
+  const char* in = src;
+  while (count > 0) {
+    const size_t left = it->iov->iov_len - it->skip;
+    if (left == 0) {
+      it->iov += 1;
+      it->skip = 0;
+      continue;
+    }
+    const size_t chunk = left < count ? left : count;
+    memcpy((char*)it->iov->iov_base + it->skip, in, chunk);
+    in += chunk;
+    count -= chunk;
+    it->skip += chunk;
+  }
+}
+
+static inline uint64_t key_of(uint32_t node, uint64_t block) {
+  return (block << 16U) | node;
+}
+
+static inline uint32_t key_node(uint64_t key) {
+  return (uint32_t)(key & 0xFFFFU);
+}
+
+static inline uint64_t key_block(uint64_t key) {
+  return key >> 16U;
+}
+
+static inline struct vtpc_shard* shard_of(uint32_t node, uint64_t block) {
+  const uint64_t hash = key_of(node, block) * 0x9E3779B97F4A7C15ULL;
+  return &vtpc_cache.shards[(hash >> 32U) % VTPC_SHARDS];
+}
+
+static inline struct vtpc_shard* shard_of_frame(uint32_t frame) {
+  return &vtpc_cache.shards[frame / vtpc_cache.shard_frames];
+}
+
+static inline void atomic_max(_Atomic off_t* value, off_t other) {
+  off_t current = atomic_load(value);
+  while (current < other &&
+         !atomic_compare_exchange_weak(value, &current, other)) {
+  }
+}
+
+/*
+ * Sleeps until the event is woken after `seq` was read from it. Waits of a
+ * shared cache time out now and then, returning false, so that the waiter
+ * can take back what dead processes left behind.
+ */
+bool event_sleep(struct vtpc_event* event, uint32_t seq);
+void event_wake(struct vtpc_event* event);
+
+/*
+ * Lock a shard or a node, making it consistent again when a process died
+ * holding the lock. node_wait expects the lock of the node to be held.
+ */
+void shard_lock(struct vtpc_shard* shard);
+void node_lock(struct vtpc_node* n);
+void node_wait(struct vtpc_node* n);
+
+/* Functions taking a shard expect its lock to be held. */
+void shard_wait(struct vtpc_shard* shard);
+void shard_wake(struct vtpc_shard* shard);
+uint32_t index_find(struct vtpc_shard* shard, uint32_t node, uint64_t block);
+void frame_free(struct vtpc_shard* shard, uint32_t frame);
+void frame_drop(struct vtpc_shard* shard, uint32_t frame);
+void frame_install(
+    struct vtpc_shard* shard,
+    uint32_t frame,
+    uint32_t node,
+    uint64_t block,
+    uint8_t valid
+);
+uint32_t frame_alloc(struct vtpc_shard* shard, uint64_t key, bool wait);
+int block_fill(struct vtpc_shard* shard, int fd, uint32_t frame);
+
+uint32_t frame_get(int fd, uint32_t node, uint64_t block, uint8_t need);
+/* Like frame_get, but only pins a frame that needs no I/O and no waiting. */
+uint32_t frame_find(uint32_t node, uint64_t block, uint8_t need);
+void frame_put(uint32_t frame, bool drop);
+int block_write(
+    int fd, uint32_t node, off_t pos, struct vtpc_iter* it, size_t count
+);
+
+/* Called under the lock of the pool. */
+uint32_t node_acquire(const struct stat* st);
+void node_release(uint32_t node);
+void node_invalidate(uint32_t node);
+int node_drop_range(uint32_t node, uint64_t first, uint64_t last);
+
+void frame_set_dirty(struct vtpc_shard* shard, uint32_t frame, uint8_t sectors);
+void frame_clean(struct vtpc_shard* shard, uint32_t frame);
+int frame_writeback(struct vtpc_shard* shard, uint32_t frame);
+int node_flush(uint32_t node, int fd, uint64_t before);
+void node_wait_writeback(uint32_t node);
+bool node_writable(uint32_t node);
+int flusher_start(void);
+
+uint32_t stream_update(
+    struct vtpc_file* file, off_t pos, off_t end, uint64_t* start
+);
+void stream_readahead(struct vtpc_file* file, int fd, off_t pos, off_t end);
+void prefetch(
+    int fd, uint32_t node, uint64_t first, uint32_t count, bool ahead
+);
+
+void async_submit(vtpc_async_t* async);
+void async_complete(vtpc_async_t* async, ssize_t result, int error);
+void async_run(vtpc_async_t* async);
+void async_atfork_child(void);
@@ -0,0 +1,307 @@
+#include "dedup.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "policy.h"
+#include "stats.h"
+
+enum {
+  VTPC_DEDUP_WAIT_MS = 10,
+};
+
+/*
+ * `lock` protects everything, but a frame only reads the hash of its own
+ * page without it: a page is only put in or taken out of the table by the
+ * frame that is alone to use it, under the lock of its shard.
+ *
+ * `refs` counts the frames using each page, and `stale` the page a frame
+ * was copied from while pinned, until it is unpinned. Pages with a hash are
+ * in the table, chained from `buckets` through `next`, free pages are
+ * chained through `next` as well.
+ */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t freed;
+  uint32_t frames;
+  uint32_t buckets_mask;
+  uint32_t free_page;
+  uint32_t free_pages;
+  uint64_t* hashes;
+  uint32_t* stale;
+  uint32_t* refs;
+  uint32_t* next;
+  uint32_t* buckets;
+} dedup = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .freed = PTHREAD_COND_INITIALIZER,
+};
+
+/* At least one bucket per page, a power of two. */
+static uint32_t bucket_count(uint32_t pages) {
+  uint32_t count = 1;
+  while (count < pages) {
+    count <<= 1U;
+  }
+  return count;
+}
+
+size_t dedup_size(uint32_t frames, uint32_t pages) {
+  return (size_t)pages * sizeof(uint64_t) +
+         (size_t)frames * 2 * sizeof(uint32_t) +
+         (size_t)pages * 2 * sizeof(uint32_t) +
+         (size_t)bucket_count(pages) * sizeof(uint32_t);
+}
+
+void dedup_init(void* memory, uint32_t frames, uint32_t pages) {
+  const uint32_t buckets = bucket_count(pages);
+  dedup.frames = frames;
+  dedup.buckets_mask = buckets - 1;
+  dedup.hashes = memory;
+  _Atomic uint32_t* frame_pages = (_Atomic uint32_t*)(dedup.hashes + pages);
+  dedup.stale = (uint32_t*)(frame_pages + frames);
+  dedup.refs = dedup.stale + frames;
+  dedup.next = dedup.refs + pages;
+  dedup.buckets = dedup.next + pages;
+
+  for (uint32_t i = 0; i < frames; ++i) {
+    frame_pages[i] = VTPC_NIL;
+    dedup.stale[i] = VTPC_NIL;
+  }
+  for (uint32_t i = 0; i < pages; ++i) {
+    dedup.hashes[i] = 0;
+    dedup.refs[i] = 0;
+    dedup.next[i] = i + 1 < pages ? i + 1 : VTPC_NIL;
+  }
+  for (uint32_t i = 0; i < buckets; ++i) {
+    dedup.buckets[i] = VTPC_NIL;
+  }
+  dedup.free_page = 0;
+  dedup.free_pages = pages;
+  vtpc_cache.pages = frame_pages;
+}
+
+static char* page_data(uint32_t page) {
+  return vtpc_cache.data + (size_t)page * VTPC_BLOCK_SIZE;
+}
+
+static uint64_t rotl(uint64_t value, unsigned bits) {
+  return (value << bits) | (value >> (64U - bits));
+}
+
+/*
+ * A 64-bit hash in the manner of xxHash: four lanes of multiplies and
+ * rotations over the block, then mixed. Never 0, which marks the pages out
+ * of the table.
+ */
+static uint64_t block_hash(const char* data) {
+  const uint64_t p1 = 0x9E3779B185EBCA87ULL;
+  const uint64_t p2 = 0xC2B2AE3D27D4EB4FULL;
+  uint64_t lanes[4] = {p1 + p2, p2, 0, 0 - p1};
+  for (size_t at = 0; at < VTPC_BLOCK_SIZE; at += sizeof(lanes)) {
+    for (size_t k = 0; k < 4; ++k) {
+      uint64_t word = 0;
+      memcpy(&word, data + at + k * sizeof(word), sizeof(word));
+      lanes[k] = rotl(lanes[k] + word * p2, 31) * p1;
+    }
+  }
+  uint64_t hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) +
+                  rotl(lanes[2], 12) + rotl(lanes[3], 18);
+  hash ^= hash >> 33U;
+  hash *= p2;
+  hash ^= hash >> 29U;
+  return hash | 1U;
+}
+
+static uint32_t* page_bucket(uint64_t hash) {
+  return &dedup.buckets[(uint32_t)(hash >> 32U) & dedup.buckets_mask];
+}
+
+static void table_remove(uint32_t page) {
+  uint32_t* link = page_bucket(dedup.hashes[page]);
+  while (*link != page) {
+    link = &dedup.next[*link];
+  }
+  *link = dedup.next[page];
+  dedup.hashes[page] = 0;
+}
+
+static uint32_t page_take(void) {
+  const uint32_t page = dedup.free_page;
+  if (page != VTPC_NIL) {
+    dedup.free_page = dedup.next[page];
+    dedup.free_pages -= 1;
+    dedup.refs[page] = 1;
+  }
+  return page;
+}
+
+static void page_put(uint32_t page) {
+  dedup.refs[page] -= 1;
+  if (dedup.refs[page] > 0) {
+    return;
+  }
+  if (dedup.hashes[page] != 0) {
+    table_remove(page);
+  }
+  dedup.next[page] = dedup.free_page;
+  dedup.free_page = page;
+  dedup.free_pages += 1;
+  pthread_cond_broadcast(&dedup.freed);
+}
+
+bool dedup_reserve(uint32_t frame) {
+  if (vtpc_cache.pages == NULL) {
+    return true;
+  }
+  pthread_mutex_lock(&dedup.lock);
+  const uint32_t page = page_take();
+  vtpc_cache.pages[frame] = page;
+  pthread_mutex_unlock(&dedup.lock);
+  return page != VTPC_NIL;
+}
+
+bool dedup_reuse(uint32_t frame) {
+  if (vtpc_cache.pages == NULL) {
+    return true;
+  }
+  pthread_mutex_lock(&dedup.lock);
+  uint32_t page = vtpc_cache.pages[frame];
+  if (dedup.refs[page] == 1) {
+    if (dedup.hashes[page] != 0) {
+      table_remove(page);
+    }
+  } else {
+    page_put(page);
+    page = page_take();
+    vtpc_cache.pages[frame] = page;
+  }
+  pthread_mutex_unlock(&dedup.lock);
+  return page != VTPC_NIL;
+}
+
+void dedup_release(uint32_t frame) {
+  if (vtpc_cache.pages == NULL || vtpc_cache.pages[frame] == VTPC_NIL) {
+    return;
+  }
+  pthread_mutex_lock(&dedup.lock);
+  page_put(vtpc_cache.pages[frame]);
+  vtpc_cache.pages[frame] = VTPC_NIL;
+  pthread_mutex_unlock(&dedup.lock);
+}
+
+/* Hashes out of the lock, only the frame can change its page meanwhile. */
+void dedup_merge(uint32_t frame) {
+  const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  if (vtpc_cache.pages == NULL || f->dirty != 0 ||
+      f->valid != VTPC_SECTORS_ALL || f->pins > 0 || f->loading ||
+      f->writeback) {
+    return;
+  }
+  const uint32_t page = vtpc_cache.pages[frame];
+  if (dedup.hashes[page] != 0) {
+    return;
+  }
+  const char* data = page_data(page);
+  const uint64_t hash = block_hash(data);
+
+  pthread_mutex_lock(&dedup.lock);
+  uint32_t* bucket = page_bucket(hash);
+  uint32_t same = *bucket;
+  while (same != VTPC_NIL &&
+         (dedup.hashes[same] != hash ||
+          memcmp(page_data(same), data, VTPC_BLOCK_SIZE) != 0)) {
+    same = dedup.next[same];
+  }
+  if (same != VTPC_NIL) {
+    dedup.refs[same] += 1;
+    vtpc_cache.pages[frame] = same;
+    page_put(page);
+  } else {
+    dedup.hashes[page] = hash;
+    dedup.next[page] = *bucket;
+    *bucket = page;
+  }
+  pthread_mutex_unlock(&dedup.lock);
+  if (same != VTPC_NIL) {
+    stats_add(VTPC_STAT_DEDUP_HITS, 1);
+  }
+}
+
+bool dedup_own(uint32_t frame) {
+  if (vtpc_cache.pages == NULL) {
+    return true;
+  }
+  const uint32_t page = vtpc_cache.pages[frame];
+  if (dedup.hashes[page] == 0) {
+    return true;
+  }
+
+  pthread_mutex_lock(&dedup.lock);
+  uint32_t copy = page;
+  if (dedup.refs[page] == 1) {
+    table_remove(page);
+  } else if ((copy = page_take()) != VTPC_NIL) {
+    memcpy(page_data(copy), page_data(page), VTPC_BLOCK_SIZE);
+    vtpc_cache.pages[frame] = copy;
+    if (vtpc_cache.frames[frame].pins > 0) {
+      dedup.stale[frame] = page;
+    } else {
+      page_put(page);
+    }
+  }
+  pthread_mutex_unlock(&dedup.lock);
+  if (copy != page && copy != VTPC_NIL) {
+    stats_add(VTPC_STAT_DEDUP_COPIES, 1);
+  }
+  return copy != VTPC_NIL;
+}
+
+void dedup_unpin(uint32_t frame) {
+  if (vtpc_cache.pages == NULL || dedup.stale[frame] == VTPC_NIL) {
+    return;
+  }
+  pthread_mutex_lock(&dedup.lock);
+  page_put(dedup.stale[frame]);
+  dedup.stale[frame] = VTPC_NIL;
+  pthread_mutex_unlock(&dedup.lock);
+}
+
+/* Pages freed by other shards do not wake it up, hence the timeout. */
+void dedup_wait(void) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += (long)VTPC_DEDUP_WAIT_MS * 1000000L;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+  deadline.tv_nsec %= 1000000000L;
+  pthread_mutex_lock(&dedup.lock);
+  if (dedup.free_pages == 0) {
+    pthread_cond_timedwait(&dedup.freed, &dedup.lock, &deadline);
+  }
+  pthread_mutex_unlock(&dedup.lock);
+}
+
+void dedup_atfork_prepare(void) {
+  pthread_mutex_lock(&dedup.lock);
+}
+
+void dedup_atfork_parent(void) {
+  pthread_mutex_unlock(&dedup.lock);
+}
+
+/* The child has no pins, so the pages kept for them are given back. */
+void dedup_atfork_child(void) {
+  pthread_mutex_init(&dedup.lock, NULL);
+  pthread_cond_init(&dedup.freed, NULL);
+  for (uint32_t i = 0; vtpc_cache.pages != NULL && i < dedup.frames; ++i) {
+    if (dedup.stale[i] != VTPC_NIL) {
+      page_put(dedup.stale[i]);
+      dedup.stale[i] = VTPC_NIL;
+    }
+  }
+}
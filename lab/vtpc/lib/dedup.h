@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * With VTPC_DEDUP set, a private pool has VTPC_DEDUP_FRAMES frames for each
+ * page of data and identical blocks share a page. A whole clean block is
+ * fingerprinted once it is loaded or written back and takes the page of an
+ * identical one instead of its own. A write to a shared block copies it to
+ * a page of its own first. When pages run out before frames, victims are
+ * evicted until one is freed.
+ *
+ * The page of a frame only changes with the lock of its shard held, and
+ * while it is pinned only by a write, which keeps the page the pins were
+ * taken on until they are released. The dedup lock is taken last.
+ */
+
+/* Bytes of the pool that dedup_init takes for that many frames and pages. */
+size_t dedup_size(uint32_t frames, uint32_t pages);
+void dedup_init(void* memory, uint32_t frames, uint32_t pages);
+
+/* Gives the frame a page of its own, false if none is free. */
+bool dedup_reserve(uint32_t frame);
+
+/*
+ * Keeps the page of a reclaimed frame for its next block, or replaces it if
+ * other frames share it. False, with the frame left without a page, if none
+ * is free.
+ */
+bool dedup_reuse(uint32_t frame);
+
+/* Gives back the page of a frame that is freed, if it has one. */
+void dedup_release(uint32_t frame);
+
+/* Shares the page of an identical block, if the frame is idle and whole. */
+void dedup_merge(uint32_t frame);
+
+/* Copies a shared block before it is written, false if no page is free. */
+bool dedup_own(uint32_t frame);
+
+/* Called when the last pin of the frame is released. */
+void dedup_unpin(uint32_t frame);
+
+/* Waits a while for a page to be freed, without any lock held. */
+void dedup_wait(void);
+
+void dedup_atfork_prepare(void);
+void dedup_atfork_parent(void);
+void dedup_atfork_child(void);
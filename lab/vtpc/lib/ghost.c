@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+static uint32_t ghost_buckets(uint32_t capacity) {
+  uint32_t buckets = 1;
+  while (buckets < 2 * capacity) {
+    buckets <<= 1U;
+  }
+  return buckets;
+}
+
+static uint32_t ghost_bucket(const struct vtpc_ghost* ghost, uint64_t key) {
+  key *= 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(key >> 32U) & ghost->buckets_mask;
+}
+
+size_t vtpc_ghost_size(uint32_t capacity) {
+  return capacity * sizeof(struct vtpc_ghost_entry) +
+         capacity * sizeof(struct vtpc_link) +
+         ghost_buckets(capacity) * sizeof(uint32_t);
+}
+
+void vtpc_ghost_init(
+    struct vtpc_ghost* ghost, void* memory, uint32_t capacity
+) {
+  const uint32_t buckets = ghost_buckets(capacity);
+
+  ghost->capacity = capacity;
+  ghost->buckets_mask = buckets - 1;
+  ghost->entries = memory;
+  ghost->links = (struct vtpc_link*)(ghost->entries + capacity);
+  ghost->buckets = (uint32_t*)(ghost->links + capacity);
+
+  for (uint32_t i = 0; i < VTPC_GHOST_LISTS; ++i) {
+    vtpc_list_init(&ghost->lists[i]);
+  }
+  for (uint32_t i = 0; i < buckets; ++i) {
+    ghost->buckets[i] = VTPC_NIL;
+  }
+  for (uint32_t i = 0; i < capacity; ++i) {
+    ghost->entries[i].hnext = (i + 1 < capacity) ? i + 1 : VTPC_NIL;
+  }
+  ghost->free = capacity > 0 ? 0 : VTPC_NIL;
+}
+
+uint32_t vtpc_ghost_find(const struct vtpc_ghost* ghost, uint64_t key) {
+  uint32_t i = ghost->buckets[ghost_bucket(ghost, key)];
+  while (i != VTPC_NIL && ghost->entries[i].key != key) {
+    i = ghost->entries[i].hnext;
+  }
+  return i;
+}
+
+void vtpc_ghost_remove(struct vtpc_ghost* ghost, uint32_t entry) {
+  struct vtpc_ghost_entry* e = &ghost->entries[entry];
+  uint32_t* link = &ghost->buckets[ghost_bucket(ghost, e->key)];
+  while (*link != entry) {
+    link = &ghost->entries[*link].hnext;
+  }
+  *link = e->hnext;
+
+  vtpc_list_unlink(&ghost->lists[e->list], ghost->links, entry);
+  e->hnext = ghost->free;
+  ghost->free = entry;
+}
+
+void vtpc_ghost_pop(struct vtpc_ghost* ghost, uint32_t list) {
+  const uint32_t tail = ghost->lists[list].tail;
+  if (tail != VTPC_NIL) {
+    vtpc_ghost_remove(ghost, tail);
+  }
+}
+
+void vtpc_ghost_push(struct vtpc_ghost* ghost, uint32_t list, uint64_t key) {
+  if (ghost->capacity == 0) {
+    return;
+  }
+  if (ghost->free == VTPC_NIL) {
+    const uint32_t other = (list + 1) % VTPC_GHOST_LISTS;
+    const bool own = ghost->lists[list].len >= ghost->lists[other].len;
+    vtpc_ghost_pop(ghost, own ? list : other);
+  }
+
+  const uint32_t entry = ghost->free;
+  struct vtpc_ghost_entry* e = &ghost->entries[entry];
+  ghost->free = e->hnext;
+
+  uint32_t* bucket = &ghost->buckets[ghost_bucket(ghost, key)];
+  e->key = key;
+  e->list = list;
+  e->hnext = *bucket;
+  *bucket = entry;
+  vtpc_list_push(&ghost->lists[list], ghost->links, entry);
+}
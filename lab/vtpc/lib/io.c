@@ -0,0 +1,474 @@
+#include "io.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "stats.h"
+
+enum {
+  VTPC_RING_UNSET,
+  VTPC_RING_READY,
+  VTPC_RING_NONE,
+};
+
+enum {
+  VTPC_FIXED_CHUNK = 1 << 30,
+  VTPC_FIXED_MAX = 64,
+  /* IORING_REGISTER_CLONE_BUFFERS, which older headers lack. */
+  VTPC_REGISTER_CLONE = 30,
+};
+
+/* Asks for the whole table of fixed buffers of the ring `src_fd`. */
+struct vtpc_clone_buffers {
+  uint32_t src_fd;
+  uint32_t flags;
+  uint32_t pad[6];
+};
+
+/*
+ * The rings of an io_uring mapped into the process, used only by the thread
+ * that set it up. Indices the kernel writes are read with acquire, the ones
+ * it reads are published with release.
+ */
+struct vtpc_ring {
+  int state;
+  int fd;
+  size_t fixed;
+  uint32_t entries;
+  void* sq_ptr;
+  size_t sq_len;
+  void* cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe* sqes;
+  size_t sqes_len;
+  _Atomic uint32_t* sq_head;
+  _Atomic uint32_t* sq_tail;
+  uint32_t sq_mask;
+  uint32_t* sq_array;
+  _Atomic uint32_t* cq_head;
+  _Atomic uint32_t* cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+/*
+ * The ring holding the fixed buffers of the process, so that the frame pool
+ * is registered and its pages pinned once however many threads do I/O. It
+ * takes no requests: the rings of threads attach to its async workers and
+ * get a copy of its table, which the kernel makes without pinning anything
+ * again. `fixed` is the length of the pool the table covers.
+ */
+struct vtpc_buffers {
+  pthread_mutex_t lock;
+  int state;
+  int fd;
+  size_t fixed;
+};
+
+static _Thread_local struct vtpc_ring ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static struct vtpc_buffers buffers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .state = VTPC_RING_UNSET,
+    .fd = -1,
+};
+
+static int ring_setup(uint32_t entries, struct io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, uint32_t submit, uint32_t wait) {
+  return (int)syscall(
+      __NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0
+  );
+}
+
+static int ring_register(int fd, const struct iovec* buffers, uint32_t count) {
+  return (int)syscall(
+      __NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, count
+  );
+}
+
+static int ring_clone(int fd, int src) {
+  struct vtpc_clone_buffers clone;
+  memset(&clone, 0, sizeof(clone));
+  clone.src_fd = (uint32_t)src;
+  return (int)syscall(
+      __NR_io_uring_register, fd, VTPC_REGISTER_CLONE, &clone, 1
+  );
+}
+
+static void* ring_map(int fd, size_t len, off_t offset) {
+  void* ptr = mmap(
+      NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset
+  );
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void ring_close(struct vtpc_ring* r) {
+  if (r->sqes != NULL) {
+    munmap(r->sqes, r->sqes_len);
+  }
+  if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr) {
+    munmap(r->cq_ptr, r->cq_len);
+  }
+  if (r->sq_ptr != NULL) {
+    munmap(r->sq_ptr, r->sq_len);
+  }
+  close(r->fd);
+  *r = (struct vtpc_ring){.state = VTPC_RING_UNSET};
+}
+
+static void ring_destroy(void* arg) {
+  ring_close(arg);
+}
+
+static void ring_key_init(void) {
+  pthread_key_create(&ring_key, ring_destroy);
+}
+
+static bool ring_map_all(struct vtpc_ring* r, const struct io_uring_params* p) {
+  r->sq_len = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+  r->cq_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = (p->features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && r->cq_len > r->sq_len) {
+    r->sq_len = r->cq_len;
+  }
+  r->sq_ptr = ring_map(r->fd, r->sq_len, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == NULL) {
+    return false;
+  }
+  r->cq_ptr =
+      single ? r->sq_ptr : ring_map(r->fd, r->cq_len, IORING_OFF_CQ_RING);
+  if (r->cq_ptr == NULL) {
+    return false;
+  }
+  r->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = ring_map(r->fd, r->sqes_len, IORING_OFF_SQES);
+  if (r->sqes == NULL) {
+    return false;
+  }
+
+  char* sq = r->sq_ptr;
+  r->sq_head = (_Atomic uint32_t*)(sq + p->sq_off.head);
+  r->sq_tail = (_Atomic uint32_t*)(sq + p->sq_off.tail);
+  r->sq_mask = *(uint32_t*)(sq + p->sq_off.ring_mask);
+  r->sq_array = (uint32_t*)(sq + p->sq_off.array);
+  char* cq = r->cq_ptr;
+  r->cq_head = (_Atomic uint32_t*)(cq + p->cq_off.head);
+  r->cq_tail = (_Atomic uint32_t*)(cq + p->cq_off.tail);
+  r->cq_mask = *(uint32_t*)(cq + p->cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+  r->entries = p->sq_entries;
+  return true;
+}
+
+/*
+ * Registers the frame pool as fixed buffers, so single frame transfers skip
+ * pinning its pages on every request. The kernel takes at most 1 GiB per
+ * buffer. Without them the rings still work with plain vectored requests.
+ */
+static void buffers_open(struct vtpc_buffers* b) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  b->fd = ring_setup(1, &params);
+  if (b->fd == -1) {
+    return;
+  }
+
+  const size_t size = (size_t)vtpc_cache.page_count * VTPC_BLOCK_SIZE;
+  struct iovec pool[VTPC_FIXED_MAX];
+  uint32_t count = 0;
+  size_t covered = 0;
+  while (covered < size && count < VTPC_FIXED_MAX) {
+    const size_t left = size - covered;
+    pool[count].iov_base = vtpc_cache.data + covered;
+    pool[count].iov_len = left < VTPC_FIXED_CHUNK ? left : VTPC_FIXED_CHUNK;
+    covered += pool[count].iov_len;
+    count += 1;
+  }
+  b->fixed = ring_register(b->fd, pool, count) == 0 ? covered : 0;
+}
+
+/* The ring with the fixed buffers of the process, -1 if there is none. */
+static int buffers_get(void) {
+  struct vtpc_buffers* b = &buffers;
+  pthread_mutex_lock(&b->lock);
+  if (b->state == VTPC_RING_UNSET) {
+    buffers_open(b);
+    b->state = b->fd != -1 ? VTPC_RING_READY : VTPC_RING_NONE;
+  }
+  pthread_mutex_unlock(&b->lock);
+  return b->fd;
+}
+
+/*
+ * Sets up the ring of the thread, sharing the async workers and the fixed
+ * buffers of the ring of the process. Kernels that cannot copy the table
+ * leave the ring with plain vectored requests.
+ */
+static bool ring_open(struct vtpc_ring* r) {
+  if (vtpc_cache.queue_depth == 0) {
+    return false;
+  }
+  const int shared = buffers_get();
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  if (shared != -1) {
+    params.flags = IORING_SETUP_ATTACH_WQ;
+    params.wq_fd = (uint32_t)shared;
+  }
+  r->fd = ring_setup(vtpc_cache.queue_depth, &params);
+  if (r->fd == -1 && shared != -1) {
+    memset(&params, 0, sizeof(params));
+    r->fd = ring_setup(vtpc_cache.queue_depth, &params);
+  }
+  if (r->fd == -1) {
+    return false;
+  }
+  if (!ring_map_all(r, &params)) {
+    ring_close(r);
+    return false;
+  }
+
+  if (buffers.fixed > 0 && ring_clone(r->fd, shared) == 0) {
+    r->fixed = buffers.fixed;
+  }
+  pthread_once(&ring_once, ring_key_init);
+  pthread_setspecific(ring_key, r);
+  return true;
+}
+
+static struct vtpc_ring* ring_get(void) {
+  if (ring.state == VTPC_RING_UNSET) {
+    ring.state = ring_open(&ring) ? VTPC_RING_READY : VTPC_RING_NONE;
+  }
+  return ring.state == VTPC_RING_READY ? &ring : NULL;
+}
+
+/*
+ * The fixed buffers of the parent pin its own pages, the child registers
+ * the pool again.
+ */
+void io_atfork_child(void) {
+  if (ring.state == VTPC_RING_READY) {
+    ring_close(&ring);
+  }
+  if (buffers.fd != -1) {
+    close(buffers.fd);
+  }
+  buffers = (struct vtpc_buffers){
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .state = VTPC_RING_UNSET,
+      .fd = -1,
+  };
+}
+
+/*
+ * The buffers a transfer goes on with after `done` bytes. When that is in
+ * the middle of one, what is left of it is kept in `rest` and goes alone.
+ */
+static const struct iovec* io_remaining(struct vtpc_io* io, uint32_t* count) {
+  size_t skip = io->done;
+  uint32_t i = 0;
+  while (i < io->iovcnt && skip >= io->iov[i].iov_len) {
+    skip -= io->iov[i].iov_len;
+    i += 1;
+  }
+  if (skip == 0) {
+    *count = io->iovcnt - i;
+    return io->iov + i;
+  }
+  io->rest.iov_base = (char*)io->iov[i].iov_base + skip;
+  io->rest.iov_len = io->iov[i].iov_len - skip;
+  *count = 1;
+  return &io->rest;
+}
+
+/*
+ * Adds what a request transferred, `res` being its result, and returns
+ * whether the transfer is over. A short one goes on when it stopped on a
+ * sector, as direct I/O needs, anywhere else it ended at the end of the
+ * file. An error or the end of the file after some progress ends it short.
+ */
+static bool io_progress(struct vtpc_io* io, int32_t res) {
+  if (res > 0) {
+    io->done += (size_t)res;
+    size_t length = 0;
+    for (uint32_t i = 0; i < io->iovcnt; ++i) {
+      length += io->iov[i].iov_len;
+    }
+    if (io->done < length && io->done % VTPC_SECTOR_SIZE == 0) {
+      return false;
+    }
+  }
+  const bool failed = res < 0 && io->done == 0;
+  io->result = failed ? -1 : (ssize_t)io->done;
+  io->error = failed ? -res : 0;
+  return true;
+}
+
+static bool in_fixed(const struct vtpc_ring* r, const struct iovec* iov) {
+  const char* base = iov->iov_base;
+  const char* pool = vtpc_cache.data;
+  return base >= pool && base + iov->iov_len <= pool + r->fixed;
+}
+
+/*
+ * Queues what is left of the transfer. A single frame uses the fixed
+ * buffer. Longer transfers stay one vectored request, so that the device
+ * still gets a single large I/O.
+ */
+static void ring_queue(
+    struct vtpc_ring* r, struct vtpc_io* io, uint32_t slot
+) {
+  const uint32_t tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+  const uint32_t index = tail & r->sq_mask;
+  const bool read = io->op == VTPC_IO_READ;
+  struct io_uring_sqe* sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  uint32_t iovcnt = 0;
+  const struct iovec* iov = io_remaining(io, &iovcnt);
+  sqe->fd = io->fd;
+  sqe->off = (uint64_t)(io->pos + (off_t)io->done);
+  if (iovcnt == 1 && in_fixed(r, iov)) {
+    const size_t offset = (size_t)((char*)iov->iov_base - vtpc_cache.data);
+    sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->addr = (uint64_t)(uintptr_t)iov->iov_base;
+    sqe->len = (uint32_t)iov->iov_len;
+    sqe->buf_index = (uint16_t)(offset / VTPC_FIXED_CHUNK);
+  } else {
+    sqe->opcode = read ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+  }
+  sqe->user_data = slot;
+  r->sq_array[index] = index;
+  atomic_store_explicit(r->sq_tail, tail + 1, memory_order_release);
+}
+
+static void io_complete(struct vtpc_io* io, uint64_t now) {
+  stats_latency(
+      io->op == VTPC_IO_READ ? VTPC_LATENCY_DISK_READ : VTPC_LATENCY_DISK_WRITE,
+      now - io->start
+  );
+}
+
+/* Returns how many transfers are over, the short ones are queued again. */
+static uint32_t ring_reap(struct vtpc_ring* r, struct vtpc_io* ios) {
+  uint32_t head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+  const uint32_t tail = atomic_load_explicit(r->cq_tail, memory_order_acquire);
+  const uint64_t now = head != tail ? cache_now() : 0;
+  uint32_t count = 0;
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe* cqe = &r->cqes[head & r->cq_mask];
+    const uint32_t slot = (uint32_t)cqe->user_data;
+    if (io_progress(&ios[slot], cqe->res)) {
+      io_complete(&ios[slot], now);
+      count += 1;
+    } else {
+      ring_queue(r, &ios[slot], slot);
+    }
+  }
+  atomic_store_explicit(r->cq_head, head, memory_order_release);
+  return count;
+}
+
+/* Takes back the requests the kernel refused, they fail with `error`. */
+static uint32_t ring_retract(
+    struct vtpc_ring* r, struct vtpc_io* ios, int error
+) {
+  const uint32_t head = atomic_load_explicit(r->sq_head, memory_order_acquire);
+  uint32_t tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+  const uint32_t count = tail - head;
+  const uint64_t now = cache_now();
+  for (; tail != head; --tail) {
+    const uint64_t slot = r->sqes[(tail - 1) & r->sq_mask].user_data;
+    io_progress(&ios[slot], -error);
+    io_complete(&ios[slot], now);
+  }
+  atomic_store_explicit(r->sq_tail, head, memory_order_relaxed);
+  return count;
+}
+
+/* Keeps up to the ring size of requests in flight until all complete. */
+static void ring_run(struct vtpc_ring* r, struct vtpc_io* ios, uint32_t count) {
+  uint32_t next = 0;
+  uint32_t inflight = 0;
+  while (next < count || inflight > 0) {
+    const uint64_t now = next < count ? cache_now() : 0;
+    for (; next < count && inflight < r->entries; ++next, ++inflight) {
+      ios[next].start = now;
+      ios[next].done = 0;
+      ring_queue(r, &ios[next], next);
+    }
+    const uint32_t pending =
+        atomic_load_explicit(r->sq_tail, memory_order_relaxed) -
+        atomic_load_explicit(r->sq_head, memory_order_acquire);
+    if (ring_enter(r->fd, pending, 1) == -1 && errno != EINTR &&
+        errno != EAGAIN && errno != EBUSY) {
+      inflight -= ring_retract(r, ios, errno);
+    }
+    inflight -= ring_reap(r, ios);
+  }
+}
+
+static void sync_run(struct vtpc_io* ios, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    struct vtpc_io* io = &ios[i];
+    io->start = cache_now();
+    io->done = 0;
+    bool over = false;
+    while (!over) {
+      uint32_t iovcnt = 0;
+      const struct iovec* iov = io_remaining(io, &iovcnt);
+      const off_t pos = io->pos + (off_t)io->done;
+      ssize_t result = 0;
+      if (io->op == VTPC_IO_READ) {
+        result = preadv(io->fd, iov, (int)iovcnt, pos);
+      } else {
+        result = pwritev(io->fd, iov, (int)iovcnt, pos);
+      }
+      over = io_progress(io, result < 0 ? -errno : (int32_t)result);
+    }
+    io_complete(io, cache_now());
+  }
+}
+
+void io_run(struct vtpc_io* ios, uint32_t count) {
+  struct vtpc_ring* r = ring_get();
+  if (r != NULL) {
+    ring_run(r, ios, count);
+  } else {
+    sync_run(ios, count);
+  }
+}
+
+ssize_t io_pread(int fd, void* buf, size_t count, off_t pos) {
+  const struct iovec iov = {.iov_base = buf, .iov_len = count};
+  struct vtpc_io io = {
+      .fd = fd,
+      .op = VTPC_IO_READ,
+      .iov = &iov,
+      .iovcnt = 1,
+      .pos = pos,
+  };
+  io_run(&io, 1);
+  if (io.result < 0) {
+    errno = io.error;
+  }
+  return io.result;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+enum vtpc_io_op {
+  VTPC_IO_READ,
+  VTPC_IO_WRITE,
+};
+
+/*
+ * One positioned vectored transfer of a batch. `result` and `error` are set
+ * as preadv or pwritev would set the return value and errno. io_run uses
+ * the remaining fields: `start` to time it, `done` and `rest` to ask for
+ * what a short transfer left.
+ */
+struct vtpc_io {
+  int fd;
+  enum vtpc_io_op op;
+  const struct iovec* iov;
+  uint32_t iovcnt;
+  off_t pos;
+  ssize_t result;
+  int error;
+  uint64_t start;
+  size_t done;
+  struct iovec rest;
+};
+
+/*
+ * Performs every transfer of the batch and waits for all of them. Uses an
+ * io_uring of the calling thread when the kernel has one, keeping up to the
+ * queue depth of requests in flight, and plain preadv/pwritev otherwise.
+ * A short transfer goes on from where it stopped, so it only ends short at
+ * the end of the file or on an error.
+ */
+void io_run(struct vtpc_io* ios, uint32_t count);
+ssize_t io_pread(int fd, void* buf, size_t count, off_t pos);
+
+/* Forgets the rings of the parent, the child sets up its own. */
+void io_atfork_child(void);
@@ -0,0 +1,167 @@
+#include "lz.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+  LZ_MIN_MATCH = 4,
+  LZ_MAX_OFFSET = 0xFFFF,
+  LZ_HASH_BITS = 12,
+  LZ_NIBBLE = 15,
+};
+
+static uint32_t read32(const uint8_t* p) {
+  uint32_t value = 0;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32U - LZ_HASH_BITS);
+}
+
+/* Writes the extension bytes of a length that did not fit its nibble. */
+static uint8_t* put_length(uint8_t* op, const uint8_t* end, size_t length) {
+  for (; length >= 255; length -= 255) {
+    if (op == end) {
+      return NULL;
+    }
+    *op++ = 255;
+  }
+  if (op == end) {
+    return NULL;
+  }
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+/* Writes literals and a match of `match` bytes, none for the last one. */
+static uint8_t* put_sequence(
+    uint8_t* op,
+    const uint8_t* end,
+    const uint8_t* literals,
+    size_t count,
+    size_t match,
+    size_t offset
+) {
+  if (op == end) {
+    return NULL;
+  }
+  uint8_t* token = op++;
+  const size_t extra = match > 0 ? match - LZ_MIN_MATCH : 0;
+  *token = (uint8_t)(((count < LZ_NIBBLE ? count : LZ_NIBBLE) << 4U) |
+                     (extra < LZ_NIBBLE ? extra : LZ_NIBBLE));
+  if (count >= LZ_NIBBLE &&
+      (op = put_length(op, end, count - LZ_NIBBLE)) == NULL) {
+    return NULL;
+  }
+  if ((size_t)(end - op) < count) {
+    return NULL;
+  }
+  memcpy(op, literals, count);
+  op += count;
+  if (match == 0) {
+    return op;
+  }
+  if (end - op < 2) {
+    return NULL;
+  }
+  *op++ = (uint8_t)(offset & 0xFFU);
+  *op++ = (uint8_t)(offset >> 8U);
+  if (extra >= LZ_NIBBLE) {
+    op = put_length(op, end, extra - LZ_NIBBLE);
+  }
+  return op;
+}
+
+size_t lz_compress(const void* src, size_t len, void* dst, size_t capacity) {
+  const uint8_t* in = src;
+  uint8_t* op = dst;
+  const uint8_t* end = op + capacity;
+  uint16_t table[1U << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  size_t anchor = 0;
+  size_t ip = 0;
+  while (op != NULL && ip + LZ_MIN_MATCH <= len) {
+    const uint32_t sequence = read32(in + ip);
+    const uint32_t h = lz_hash(sequence);
+    const size_t ref = table[h];
+    table[h] = (uint16_t)(ip + 1);
+    if (ref == 0 || ip + 1 - ref > LZ_MAX_OFFSET ||
+        read32(in + ref - 1) != sequence) {
+      ip += 1;
+      continue;
+    }
+    size_t match = LZ_MIN_MATCH;
+    while (ip + match < len && in[ref - 1 + match] == in[ip + match]) {
+      match += 1;
+    }
+    op = put_sequence(
+        op, end, in + anchor, ip - anchor, match, ip + 1 - ref
+    );
+    ip += match;
+    anchor = ip;
+  }
+  if (op != NULL) {
+    op = put_sequence(op, end, in + anchor, len - anchor, 0, 0);
+  }
+  return op == NULL ? 0 : (size_t)(op - (uint8_t*)dst);
+}
+
+/* Reads the extension bytes of a length, false if they run past the end. */
+static bool get_length(const uint8_t** ip, const uint8_t* end, size_t* length) {
+  uint8_t byte = 255;
+  while (byte == 255) {
+    if (*ip == end) {
+      return false;
+    }
+    byte = *(*ip)++;
+    *length += byte;
+  }
+  return true;
+}
+
+bool lz_decompress(const void* src, size_t size, void* dst, size_t len) {
+  const uint8_t* ip = src;
+  const uint8_t* end = ip + size;
+  uint8_t* out = dst;
+  size_t op = 0;
+  while (ip != end) {
+    const uint8_t token = *ip++;
+    size_t count = token >> 4U;
+    if (count == LZ_NIBBLE && !get_length(&ip, end, &count)) {
+      return false;
+    }
+    if ((size_t)(end - ip) < count || len - op < count) {
+      return false;
+    }
+    memcpy(out + op, ip, count);
+    ip += count;
+    op += count;
+    if (ip == end) {
+      break;
+    }
+
+    if (end - ip < 2) {
+      return false;
+    }
+    const size_t offset = ip[0] | ((size_t)ip[1] << 8U);
+    ip += 2;
+    size_t match = token & LZ_NIBBLE;
+    if (match == LZ_NIBBLE && !get_length(&ip, end, &match)) {
+      return false;
+    }
+    match += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || len - op < match) {
+      return false;
+    }
+    /* Byte by byte, the match may overlap what it produces. */
+    for (size_t i = 0; i < match; ++i, ++op) {
+      out[op] = out[op - offset];
+    }
+  }
+  return op == len;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A small LZ77 codec in the spirit of LZ4, for blocks of up to 64 KiB. A
+ * compressed block is a series of sequences: a token with the number of
+ * literals in its high half and of matched bytes less 4 in its low half,
+ * each extended by bytes of 255 and one less when it is 15, the literals,
+ * then a 2-byte little-endian offset back to the match. The last sequence
+ * has literals only.
+ */
+
+/* Returns the compressed size, 0 if it would not fit in `capacity`. */
+size_t lz_compress(const void* src, size_t len, void* dst, size_t capacity);
+
+/* Whether `src` decompresses to exactly `len` bytes. */
+bool lz_decompress(const void* src, size_t size, void* dst, size_t len);
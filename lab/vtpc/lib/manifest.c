@@ -0,0 +1,485 @@
+#include "manifest.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "policy.h"
+#include "vtpc.h"
+
+/*
+ * The most files the prewarm keeps open, so that most of the file table is
+ * left to the program.
+ */
+enum { VTPC_MANIFEST_OPEN = VTPC_MAX_FILES / 16 };
+
+static const char manifest_magic[8] = {'V', 'T', 'P', 'C', 'M', 'A', 'N', '1'};
+
+/*
+ * The manifest starts with a header, then comes every file: its record, its
+ * path without the terminating zero and its runs of adjacent blocks. Files
+ * are sorted hottest first, runs by their first block.
+ */
+struct manifest_header {
+  char magic[8];
+  uint32_t files;
+  uint32_t blocks;
+};
+
+struct manifest_file {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t path_len;
+  uint32_t runs;
+};
+
+struct manifest_run {
+  uint64_t first;
+  uint32_t count;
+  uint32_t uses;
+};
+
+/* A file whose blocks were recorded, `uses` is the sum of theirs. */
+struct manifest_entry {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  uint64_t uses;
+  char* path;
+};
+
+struct manifest_block {
+  uint32_t file;
+  uint32_t uses;
+  uint64_t block;
+};
+
+/*
+ * `lock` is taken after the cache lock and before the lock of a shard.
+ * `paths` are those the nodes were last opened with. `blocks` has room for
+ * twice the frames of the cache, `runs` for as many.
+ */
+static struct {
+  pthread_mutex_t lock;
+  bool enabled;
+  char path[PATH_MAX];
+  char* paths[VTPC_MAX_FILES];
+  uint32_t files_len;
+  struct manifest_entry files[VTPC_MAX_FILES];
+  uint32_t len;
+  uint32_t capacity;
+  struct manifest_block* blocks;
+  struct manifest_run* runs;
+} manifest = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int by_uses(const void* a, const void* b) {
+  const struct manifest_block* x = a;
+  const struct manifest_block* y = b;
+  return (x->uses < y->uses) - (x->uses > y->uses);
+}
+
+/* Hottest files first, then in the order of the file. */
+static int by_file(const void* a, const void* b) {
+  const struct manifest_block* x = a;
+  const struct manifest_block* y = b;
+  if (x->file != y->file) {
+    const uint64_t hx = manifest.files[x->file].uses;
+    const uint64_t hy = manifest.files[y->file].uses;
+    if (hx != hy) {
+      return hx < hy ? 1 : -1;
+    }
+    return x->file < y->file ? -1 : 1;
+  }
+  return (x->block > y->block) - (x->block < y->block);
+}
+
+/* Keeps the hottest blocks that fit in the cache. */
+static void blocks_trim(void) {
+  if (manifest.len <= vtpc_cache.frame_count) {
+    return;
+  }
+  qsort(manifest.blocks, manifest.len, sizeof(manifest.blocks[0]), by_uses);
+  manifest.len = vtpc_cache.frame_count;
+}
+
+static void blocks_drop(uint32_t file) {
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < manifest.len; ++i) {
+    if (manifest.blocks[i].file != file) {
+      manifest.blocks[len++] = manifest.blocks[i];
+    }
+  }
+  manifest.len = len;
+}
+
+/* Forgets the files that have no block left. */
+static void files_trim(void) {
+  bool kept[VTPC_MAX_FILES] = {false};
+  uint32_t map[VTPC_MAX_FILES];
+  for (uint32_t i = 0; i < manifest.len; ++i) {
+    kept[manifest.blocks[i].file] = true;
+  }
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < manifest.files_len; ++i) {
+    if (kept[i]) {
+      map[i] = len;
+      manifest.files[len++] = manifest.files[i];
+    } else {
+      free(manifest.files[i].path);
+    }
+  }
+  manifest.files_len = len;
+  for (uint32_t i = 0; i < manifest.len; ++i) {
+    manifest.blocks[i].file = map[manifest.blocks[i].file];
+  }
+}
+
+/* The entry of the file, with the blocks recorded before dropped. */
+static uint32_t entry_of(const struct stat* st, const char* path) {
+  uint32_t file = 0;
+  for (; file < manifest.files_len; ++file) {
+    const struct manifest_entry* entry = &manifest.files[file];
+    if (entry->dev == st->st_dev && entry->ino == st->st_ino) {
+      break;
+    }
+  }
+  if (file == VTPC_MAX_FILES) {
+    files_trim();
+    file = manifest.files_len;
+  }
+  if (file == VTPC_MAX_FILES) {
+    return VTPC_NIL;
+  }
+
+  char* copy = strdup(path);
+  if (copy == NULL) {
+    return VTPC_NIL;
+  }
+  struct manifest_entry* entry = &manifest.files[file];
+  if (file == manifest.files_len) {
+    manifest.files_len += 1;
+  } else {
+    free(entry->path);
+    blocks_drop(file);
+  }
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtim;
+  entry->path = copy;
+  return file;
+}
+
+/* Called under the manifest lock. */
+static void collect(uint32_t node) {
+  const char* path = manifest.paths[node];
+  const struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct stat st;
+  if (path == NULL || stat(path, &st) == -1 || st.st_dev != n->dev ||
+      st.st_ino != n->ino) {
+    return;
+  }
+  const uint32_t file = entry_of(&st, path);
+  if (file == VTPC_NIL) {
+    return;
+  }
+
+  for (uint32_t s = 0; s < VTPC_SHARDS; ++s) {
+    struct vtpc_shard* shard = &vtpc_cache.shards[s];
+    shard_lock(shard);
+    for (uint32_t frame = shard->nodes[node].head; frame != VTPC_NIL;
+         frame = vtpc_cache.node_links[frame].next) {
+      const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+      if (f->loading || f->valid == 0) {
+        continue;
+      }
+      if (manifest.len == manifest.capacity) {
+        blocks_trim();
+      }
+      manifest.blocks[manifest.len++] = (struct manifest_block){
+          .file = file,
+          .uses = vtpc_cache.uses[frame],
+          .block = key_block(f->key),
+      };
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+static bool write_all(int fd, const void* data, size_t len) {
+  const char* from = data;
+  while (len > 0) {
+    const ssize_t done = write(fd, from, len);
+    if (done <= 0) {
+      return false;
+    }
+    from += done;
+    len -= (size_t)done;
+  }
+  return true;
+}
+
+/* Writes one file of the sorted blocks from `*at`, coalescing runs. */
+static bool write_file(int fd, uint32_t* at) {
+  struct manifest_run* runs = manifest.runs;
+  const uint32_t file = manifest.blocks[*at].file;
+  uint32_t count = 0;
+  for (; *at < manifest.len && manifest.blocks[*at].file == file; *at += 1) {
+    const struct manifest_block* b = &manifest.blocks[*at];
+    struct manifest_run* last = count > 0 ? &runs[count - 1] : NULL;
+    if (last != NULL && last->first + last->count == b->block) {
+      last->count += 1;
+      last->uses += b->uses;
+    } else {
+      runs[count++] = (struct manifest_run){
+          .first = b->block,
+          .count = 1,
+          .uses = b->uses,
+      };
+    }
+  }
+
+  const struct manifest_entry* entry = &manifest.files[file];
+  const struct manifest_file record = {
+      .dev = entry->dev,
+      .ino = entry->ino,
+      .size = entry->size,
+      .mtime_sec = entry->mtime.tv_sec,
+      .mtime_nsec = entry->mtime.tv_nsec,
+      .path_len = (uint32_t)strlen(entry->path),
+      .runs = count,
+  };
+  return write_all(fd, &record, sizeof(record)) &&
+         write_all(fd, entry->path, record.path_len) &&
+         write_all(fd, runs, count * sizeof(runs[0]));
+}
+
+/* Writes a temporary file renamed over the manifest, never half of one. */
+static void manifest_write(void) {
+  blocks_trim();
+  for (uint32_t i = 0; i < manifest.files_len; ++i) {
+    manifest.files[i].uses = 0;
+  }
+  for (uint32_t i = 0; i < manifest.len; ++i) {
+    manifest.files[manifest.blocks[i].file].uses += manifest.blocks[i].uses;
+  }
+  qsort(manifest.blocks, manifest.len, sizeof(manifest.blocks[0]), by_file);
+
+  struct manifest_header header = {.blocks = manifest.len};
+  memcpy(header.magic, manifest_magic, sizeof(header.magic));
+  for (uint32_t i = 0; i < manifest.len; ++i) {
+    if (i == 0 || manifest.blocks[i].file != manifest.blocks[i - 1].file) {
+      header.files += 1;
+    }
+  }
+
+  char temp[PATH_MAX + 8];
+  snprintf(temp, sizeof(temp), "%s.tmp", manifest.path);
+  const int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return;
+  }
+  bool ok = write_all(fd, &header, sizeof(header));
+  for (uint32_t at = 0; ok && at < manifest.len;) {
+    ok = write_file(fd, &at);
+  }
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temp, manifest.path) == -1) {
+    unlink(temp);
+  }
+}
+
+static void manifest_save(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  pthread_mutex_lock(&c->lock);
+  pthread_mutex_lock(&manifest.lock);
+  if (manifest.enabled) {
+    for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+      if (c->locals[i].refs > 0) {
+        collect(i);
+      }
+    }
+    manifest_write();
+  }
+  pthread_mutex_unlock(&manifest.lock);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static bool unchanged(const struct stat* st, const struct manifest_file* file) {
+  return (uint64_t)st->st_dev == file->dev &&
+         (uint64_t)st->st_ino == file->ino && st->st_size == file->size &&
+         st->st_mtim.tv_sec == file->mtime_sec &&
+         st->st_mtim.tv_nsec == file->mtime_nsec;
+}
+
+/*
+ * Loads the runs of the file if it did not change since they were recorded.
+ * The file is left open so that its blocks stay until the process exits,
+ * returns whether it was.
+ */
+static bool prewarm_file(
+    const char* path, const struct manifest_file* file, const char* runs
+) {
+  struct stat st;
+  if (stat(path, &st) == -1 || !unchanged(&st, file)) {
+    return false;
+  }
+  const int fd = vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    return false;
+  }
+  const uint32_t node = vtpc_cache.files[fd].node;
+  const struct vtpc_node* n = &vtpc_cache.nodes[node];
+  if (n->dev != st.st_dev || n->ino != st.st_ino || n->size != file->size) {
+    vtpc_close(fd);
+    return false;
+  }
+
+  const uint64_t end = ((uint64_t)file->size + VTPC_BLOCK_SIZE - 1) /
+                       VTPC_BLOCK_SIZE;
+  for (uint32_t i = 0; i < file->runs; ++i) {
+    struct manifest_run run;
+    memcpy(&run, runs + i * sizeof(run), sizeof(run));
+    if (run.first < end) {
+      const uint64_t left = end - run.first;
+      prefetch(fd, node, run.first, run.count < left ? run.count : left, true);
+    }
+  }
+  return true;
+}
+
+static void prewarm(const char* data, size_t size) {
+  struct manifest_header header;
+  if (size < sizeof(header)) {
+    return;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, manifest_magic, sizeof(header.magic)) != 0) {
+    return;
+  }
+
+  size_t pos = sizeof(header);
+  uint32_t opened = 0;
+  for (uint32_t i = 0; i < header.files && opened < VTPC_MANIFEST_OPEN; ++i) {
+    struct manifest_file file;
+    if (size - pos < sizeof(file)) {
+      return;
+    }
+    memcpy(&file, data + pos, sizeof(file));
+    pos += sizeof(file);
+    if (file.path_len >= PATH_MAX || size - pos < file.path_len ||
+        (size - pos - file.path_len) / sizeof(struct manifest_run) <
+            file.runs) {
+      return;
+    }
+    char path[PATH_MAX];
+    memcpy(path, data + pos, file.path_len);
+    path[file.path_len] = '\0';
+    pos += file.path_len;
+    opened += prewarm_file(path, &file, data + pos) ? 1 : 0;
+    pos += file.runs * sizeof(struct manifest_run);
+  }
+}
+
+static void* prewarm_main(void* arg) {
+  (void)arg;
+  const int fd = open(manifest.path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1) {
+    return NULL;
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    const size_t size = (size_t)st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      prewarm(data, size);
+      munmap(data, size);
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+void manifest_init(void) {
+  const char* path = getenv("VTPC_MANIFEST");
+  if (path == NULL || *path == '\0' || strlen(path) >= sizeof(manifest.path)) {
+    return;
+  }
+  const uint32_t frames = vtpc_cache.frame_count;
+  manifest.blocks = calloc(2 * (size_t)frames, sizeof(manifest.blocks[0]));
+  manifest.runs = calloc(frames, sizeof(manifest.runs[0]));
+  if (manifest.blocks == NULL || manifest.runs == NULL) {
+    free(manifest.blocks);
+    free(manifest.runs);
+    return;
+  }
+  manifest.capacity = 2 * frames;
+  strcpy(manifest.path, path);
+  manifest.enabled = true;
+  atexit(manifest_save);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  (void)pthread_create(&thread, &attr, prewarm_main, NULL);
+  pthread_attr_destroy(&attr);
+}
+
+void manifest_track(int fd, const char* path) {
+  if (!manifest.enabled) {
+    return;
+  }
+  char* resolved = realpath(path, NULL);
+  if (resolved == NULL) {
+    return;
+  }
+  const uint32_t node = vtpc_cache.files[fd].node;
+  pthread_mutex_lock(&manifest.lock);
+  free(manifest.paths[node]);
+  manifest.paths[node] = resolved;
+  pthread_mutex_unlock(&manifest.lock);
+}
+
+void manifest_record(uint32_t node) {
+  if (!manifest.enabled) {
+    return;
+  }
+  pthread_mutex_lock(&manifest.lock);
+  collect(node);
+  free(manifest.paths[node]);
+  manifest.paths[node] = NULL;
+  pthread_mutex_unlock(&manifest.lock);
+}
+
+void manifest_atfork_prepare(void) {
+  pthread_mutex_lock(&manifest.lock);
+}
+
+void manifest_atfork_parent(void) {
+  pthread_mutex_unlock(&manifest.lock);
+}
+
+/* The manifest belongs to the parent, the child leaves it alone. */
+void manifest_atfork_child(void) {
+  pthread_mutex_init(&manifest.lock, NULL);
+  manifest.enabled = false;
+}
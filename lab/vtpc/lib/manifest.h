@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * With VTPC_MANIFEST set to a path, the blocks cached for each file are
+ * recorded when the process closes it for the last time and when it exits,
+ * and the hottest of them are saved there on exit. The next process that
+ * starts with the same path loads them again in the background.
+ *
+ * A file is identified by its path, device, inode, size and modification
+ * time, and is skipped unless all of them still match: the manifest only
+ * says which blocks to read, never what they contain.
+ */
+
+/* Reads VTPC_MANIFEST and starts the prewarm, called once by cache_init. */
+void manifest_init(void);
+
+/* Remembers the path the fd was opened with. */
+void manifest_track(int fd, const char* path);
+
+/* Records the cached blocks of the node, under the cache lock. */
+void manifest_record(uint32_t node);
+
+void manifest_atfork_prepare(void);
+void manifest_atfork_parent(void);
+void manifest_atfork_child(void);
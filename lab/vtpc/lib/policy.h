@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VTPC_NIL UINT32_MAX
+#define VTPC_NEVER UINT64_MAX
+
+/*
+ * An eviction policy tracks the frames that may be evicted. Frames are
+ * identified by their index in the pool, keys identify the cached block and
+ * are only needed by policies that remember evicted blocks. Operations run
+ * under the lock of the shard and should be O(1) amortized, at most
+ * O(log n) for policies that keep their frames ordered, like Optimal.
+ *
+ * `init` also starts over on state in use, when a shard is rebuilt after a
+ * process died holding its lock: no frame is tracked afterwards. The cache
+ * calls `victim` only when there is no free frame. The returned frame is no
+ * longer tracked by the policy. A victim that cannot be evicted yet is given
+ * back with `restore`, last taken first, which puts it where it was without
+ * counting as a use or a new block. Once the block of a victim is evicted,
+ * it is passed to `evict`, which is optional and lets the policy remember
+ * the block.
+ *
+ * `advise` is optional: it receives the next expected access time of a block
+ * (CLOCK_MONOTONIC nanoseconds, VTPC_NEVER if unknown), `frame` is VTPC_NIL
+ * if the block is not cached.
+ */
+struct vtpc_policy {
+  const char* name;
+  size_t (*size)(uint32_t frames);
+  void (*init)(void* state, uint32_t frames);
+  void (*insert)(void* state, uint32_t frame, uint64_t key);
+  void (*touch)(void* state, uint32_t frame);
+  void (*remove)(void* state, uint32_t frame);
+  uint32_t (*victim)(void* state, uint64_t key);
+  void (*restore)(void* state, uint32_t frame);
+  void (*evict)(void* state, uint32_t frame);
+  void (*advise)(void* state, uint32_t frame, uint64_t key, uint64_t when);
+};
+
+extern const struct vtpc_policy vtpc_policy_lru;
+extern const struct vtpc_policy vtpc_policy_clock;
+extern const struct vtpc_policy vtpc_policy_2q;
+extern const struct vtpc_policy vtpc_policy_lfu;
+extern const struct vtpc_policy vtpc_policy_arc;
+extern const struct vtpc_policy vtpc_policy_mru;
+extern const struct vtpc_policy vtpc_policy_optimal;
+
+struct vtpc_link {
+  uint32_t prev;
+  uint32_t next;
+};
+
+struct vtpc_list {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t len;
+};
+
+static inline void vtpc_list_init(struct vtpc_list* list) {
+  list->head = VTPC_NIL;
+  list->tail = VTPC_NIL;
+  list->len = 0;
+}
+
+static inline void vtpc_list_push(
+    struct vtpc_list* list, struct vtpc_link* links, uint32_t i
+) {
+  links[i].prev = VTPC_NIL;
+  links[i].next = list->head;
+  if (list->head != VTPC_NIL) {
+    links[list->head].prev = i;
+  } else {
+    list->tail = i;
+  }
+  list->head = i;
+  list->len += 1;
+}
+
+static inline void vtpc_list_unlink(
+    struct vtpc_list* list, struct vtpc_link* links, uint32_t i
+) {
+  if (links[i].prev != VTPC_NIL) {
+    links[links[i].prev].next = links[i].next;
+  } else {
+    list->head = links[i].next;
+  }
+  if (links[i].next != VTPC_NIL) {
+    links[links[i].next].prev = links[i].prev;
+  } else {
+    list->tail = links[i].prev;
+  }
+  list->len -= 1;
+}
+
+static inline void vtpc_list_insert_after(
+    struct vtpc_list* list, struct vtpc_link* links, uint32_t at, uint32_t i
+) {
+  if (at == VTPC_NIL) {
+    vtpc_list_push(list, links, i);
+    return;
+  }
+  links[i].prev = at;
+  links[i].next = links[at].next;
+  if (links[at].next != VTPC_NIL) {
+    links[links[at].next].prev = i;
+  } else {
+    list->tail = i;
+  }
+  links[at].next = i;
+  list->len += 1;
+}
+
+/*
+ * A bounded set of keys of recently evicted blocks, split into several LRU
+ * lists. Used by 2Q and ARC to recognize blocks that come back.
+ */
+enum {
+  VTPC_GHOST_LISTS = 2,
+};
+
+struct vtpc_ghost_entry {
+  uint64_t key;
+  uint32_t hnext;
+  uint32_t list;
+};
+
+struct vtpc_ghost {
+  uint32_t capacity;
+  uint32_t buckets_mask;
+  uint32_t free;
+  struct vtpc_list lists[VTPC_GHOST_LISTS];
+  struct vtpc_ghost_entry* entries;
+  struct vtpc_link* links;
+  uint32_t* buckets;
+};
+
+size_t vtpc_ghost_size(uint32_t capacity);
+void vtpc_ghost_init(struct vtpc_ghost* ghost, void* memory, uint32_t capacity);
+uint32_t vtpc_ghost_find(const struct vtpc_ghost* ghost, uint64_t key);
+void vtpc_ghost_remove(struct vtpc_ghost* ghost, uint32_t entry);
+void vtpc_ghost_push(struct vtpc_ghost* ghost, uint32_t list, uint64_t key);
+void vtpc_ghost_pop(struct vtpc_ghost* ghost, uint32_t list);
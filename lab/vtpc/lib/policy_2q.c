@@ -0,0 +1,125 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+/*
+ * Full 2Q (Johnson and Shasha): new blocks enter the FIFO A1in, blocks
+ * evicted from A1in are remembered in the ghost queue A1out, and blocks
+ * that come back while remembered are promoted to the LRU queue Am.
+ */
+enum {
+  QUEUE_A1IN = 0,
+  QUEUE_AM = 1,
+  A1OUT = 0,
+};
+
+struct twoq_slot {
+  uint64_t key;
+  uint32_t queue;
+};
+
+struct twoq_state {
+  uint32_t kin;
+  struct vtpc_list a1in;
+  struct vtpc_list am;
+  struct vtpc_ghost a1out;
+  struct vtpc_link* links;
+  struct twoq_slot* slots;
+};
+
+static uint32_t twoq_kout(uint32_t frames) {
+  return frames / 2 > 0 ? frames / 2 : 1;
+}
+
+static size_t twoq_size(uint32_t frames) {
+  return sizeof(struct twoq_state) + frames * sizeof(struct twoq_slot) +
+         frames * sizeof(struct vtpc_link) +
+         vtpc_ghost_size(twoq_kout(frames));
+}
+
+static void twoq_init(void* state, uint32_t frames) {
+  struct twoq_state* s = state;
+  s->kin = frames / 4 > 0 ? frames / 4 : 1;
+  vtpc_list_init(&s->a1in);
+  vtpc_list_init(&s->am);
+  s->slots = (struct twoq_slot*)(s + 1);
+  s->links = (struct vtpc_link*)(s->slots + frames);
+  vtpc_ghost_init(&s->a1out, s->links + frames, twoq_kout(frames));
+}
+
+static struct vtpc_list* twoq_queue(struct twoq_state* s, uint32_t frame) {
+  return s->slots[frame].queue == QUEUE_AM ? &s->am : &s->a1in;
+}
+
+static void twoq_insert(void* state, uint32_t frame, uint64_t key) {
+  struct twoq_state* s = state;
+  const uint32_t ghost = vtpc_ghost_find(&s->a1out, key);
+
+  s->slots[frame].key = key;
+  if (ghost != VTPC_NIL) {
+    vtpc_ghost_remove(&s->a1out, ghost);
+    s->slots[frame].queue = QUEUE_AM;
+    vtpc_list_push(&s->am, s->links, frame);
+  } else {
+    s->slots[frame].queue = QUEUE_A1IN;
+    vtpc_list_push(&s->a1in, s->links, frame);
+  }
+}
+
+static void twoq_touch(void* state, uint32_t frame) {
+  struct twoq_state* s = state;
+  if (s->slots[frame].queue == QUEUE_AM) {
+    vtpc_list_unlink(&s->am, s->links, frame);
+    vtpc_list_push(&s->am, s->links, frame);
+  }
+}
+
+static void twoq_remove(void* state, uint32_t frame) {
+  struct twoq_state* s = state;
+  vtpc_list_unlink(twoq_queue(s, frame), s->links, frame);
+}
+
+static uint32_t twoq_victim(void* state, uint64_t key) {
+  (void)key;
+  struct twoq_state* s = state;
+
+  if (s->a1in.len > s->kin || s->am.len == 0) {
+    const uint32_t frame = s->a1in.tail;
+    if (frame != VTPC_NIL) {
+      vtpc_list_unlink(&s->a1in, s->links, frame);
+    }
+    return frame;
+  }
+
+  const uint32_t frame = s->am.tail;
+  vtpc_list_unlink(&s->am, s->links, frame);
+  return frame;
+}
+
+/* Victims are taken from the tail of either queue. */
+static void twoq_restore(void* state, uint32_t frame) {
+  struct twoq_state* s = state;
+  struct vtpc_list* queue = twoq_queue(s, frame);
+  vtpc_list_insert_after(queue, s->links, queue->tail, frame);
+}
+
+/* Only blocks evicted from A1in are remembered. */
+static void twoq_evict(void* state, uint32_t frame) {
+  struct twoq_state* s = state;
+  if (s->slots[frame].queue == QUEUE_A1IN) {
+    vtpc_ghost_push(&s->a1out, A1OUT, s->slots[frame].key);
+  }
+}
+
+const struct vtpc_policy vtpc_policy_2q = {
+    .name = "2q",
+    .size = twoq_size,
+    .init = twoq_init,
+    .insert = twoq_insert,
+    .touch = twoq_touch,
+    .remove = twoq_remove,
+    .victim = twoq_victim,
+    .restore = twoq_restore,
+    .evict = twoq_evict,
+};
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+/*
+ * ARC (Megiddo and Modha): T1 holds blocks seen once, T2 blocks seen at
+ * least twice, B1 and B2 remember blocks recently evicted from them. The
+ * target size of T1 adapts on every ghost hit.
+ */
+enum {
+  ARC_T1 = 0,
+  ARC_T2 = 1,
+  ARC_B1 = 0,
+  ARC_B2 = 1,
+};
+
+struct arc_slot {
+  uint64_t key;
+  uint32_t list;
+};
+
+struct arc_state {
+  uint32_t frames;
+  uint32_t target;
+  struct vtpc_list t[2];
+  struct vtpc_ghost b;
+  struct arc_slot* slots;
+  struct vtpc_link* links;
+};
+
+static size_t arc_size(uint32_t frames) {
+  return sizeof(struct arc_state) + frames * sizeof(struct arc_slot) +
+         frames * sizeof(struct vtpc_link) + vtpc_ghost_size(frames + 1);
+}
+
+static void arc_init(void* state, uint32_t frames) {
+  struct arc_state* s = state;
+  s->frames = frames;
+  s->target = 0;
+  vtpc_list_init(&s->t[ARC_T1]);
+  vtpc_list_init(&s->t[ARC_T2]);
+  s->slots = (struct arc_slot*)(s + 1);
+  s->links = (struct vtpc_link*)(s->slots + frames);
+  vtpc_ghost_init(&s->b, s->links + frames, frames + 1);
+}
+
+static uint32_t arc_ratio(uint32_t num, uint32_t den) {
+  const uint32_t ratio = den > 0 ? num / den : num;
+  return ratio > 1 ? ratio : 1;
+}
+
+static void arc_insert(void* state, uint32_t frame, uint64_t key) {
+  struct arc_state* s = state;
+  const uint32_t b1 = s->b.lists[ARC_B1].len;
+  const uint32_t b2 = s->b.lists[ARC_B2].len;
+  const uint32_t ghost = vtpc_ghost_find(&s->b, key);
+
+  uint32_t list = ARC_T1;
+  if (ghost != VTPC_NIL && s->b.entries[ghost].list == ARC_B1) {
+    const uint32_t delta = arc_ratio(b2, b1);
+    s->target = (s->frames - s->target > delta) ? s->target + delta : s->frames;
+    list = ARC_T2;
+  } else if (ghost != VTPC_NIL) {
+    const uint32_t delta = arc_ratio(b1, b2);
+    s->target = (s->target > delta) ? s->target - delta : 0;
+    list = ARC_T2;
+  }
+  if (ghost != VTPC_NIL) {
+    vtpc_ghost_remove(&s->b, ghost);
+  }
+
+  s->slots[frame].key = key;
+  s->slots[frame].list = list;
+  vtpc_list_push(&s->t[list], s->links, frame);
+
+  const uint32_t t1 = s->t[ARC_T1].len;
+  while (t1 + s->b.lists[ARC_B1].len > s->frames &&
+         s->b.lists[ARC_B1].len > 0) {
+    vtpc_ghost_pop(&s->b, ARC_B1);
+  }
+  while (t1 + s->t[ARC_T2].len + s->b.lists[ARC_B1].len +
+                 s->b.lists[ARC_B2].len >
+             2 * s->frames &&
+         s->b.lists[ARC_B2].len > 0) {
+    vtpc_ghost_pop(&s->b, ARC_B2);
+  }
+}
+
+static void arc_touch(void* state, uint32_t frame) {
+  struct arc_state* s = state;
+  struct arc_slot* slot = &s->slots[frame];
+  vtpc_list_unlink(&s->t[slot->list], s->links, frame);
+  slot->list = ARC_T2;
+  vtpc_list_push(&s->t[ARC_T2], s->links, frame);
+}
+
+static void arc_remove(void* state, uint32_t frame) {
+  struct arc_state* s = state;
+  vtpc_list_unlink(&s->t[s->slots[frame].list], s->links, frame);
+}
+
+static uint32_t arc_victim(void* state, uint64_t key) {
+  struct arc_state* s = state;
+  const uint32_t t1 = s->t[ARC_T1].len;
+  const uint32_t ghost = vtpc_ghost_find(&s->b, key);
+  const bool in_b2 = ghost != VTPC_NIL && s->b.entries[ghost].list == ARC_B2;
+
+  uint32_t list = ARC_T2;
+  if (t1 > 0 && (t1 > s->target || (in_b2 && t1 == s->target))) {
+    list = ARC_T1;
+  } else if (s->t[ARC_T2].len == 0) {
+    list = ARC_T1;
+  }
+
+  const uint32_t frame = s->t[list].tail;
+  if (frame == VTPC_NIL) {
+    return VTPC_NIL;
+  }
+  vtpc_list_unlink(&s->t[list], s->links, frame);
+  return frame;
+}
+
+static void arc_restore(void* state, uint32_t frame) {
+  struct arc_state* s = state;
+  struct vtpc_list* list = &s->t[s->slots[frame].list];
+  vtpc_list_insert_after(list, s->links, list->tail, frame);
+}
+
+/* A block evicted from T1 goes to B1, one evicted from T2 to B2. */
+static void arc_evict(void* state, uint32_t frame) {
+  struct arc_state* s = state;
+  const struct arc_slot* slot = &s->slots[frame];
+  vtpc_ghost_push(&s->b, slot->list == ARC_T1 ? ARC_B1 : ARC_B2, slot->key);
+}
+
+const struct vtpc_policy vtpc_policy_arc = {
+    .name = "arc",
+    .size = arc_size,
+    .init = arc_init,
+    .insert = arc_insert,
+    .touch = arc_touch,
+    .remove = arc_remove,
+    .victim = arc_victim,
+    .restore = arc_restore,
+    .evict = arc_evict,
+};
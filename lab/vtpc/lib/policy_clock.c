@@ -0,0 +1,83 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "policy.h"
+
+enum {
+  CLOCK_PRESENT = 1U << 0U,
+  CLOCK_REFERENCED = 1U << 1U,
+};
+
+struct clock_state {
+  uint32_t frames;
+  uint32_t present;
+  uint32_t hand;
+  uint8_t bits[];
+};
+
+static size_t clock_size(uint32_t frames) {
+  return sizeof(struct clock_state) + frames;
+}
+
+static void clock_init(void* state, uint32_t frames) {
+  struct clock_state* s = state;
+  s->frames = frames;
+  s->present = 0;
+  s->hand = 0;
+  memset(s->bits, 0, frames);
+}
+
+static void clock_insert(void* state, uint32_t frame, uint64_t key) {
+  (void)key;
+  struct clock_state* s = state;
+  s->bits[frame] = CLOCK_PRESENT;
+  s->present += 1;
+}
+
+static void clock_touch(void* state, uint32_t frame) {
+  struct clock_state* s = state;
+  s->bits[frame] |= CLOCK_REFERENCED;
+}
+
+static void clock_remove(void* state, uint32_t frame) {
+  struct clock_state* s = state;
+  s->bits[frame] = 0;
+  s->present -= 1;
+}
+
+static uint32_t clock_victim(void* state, uint64_t key) {
+  (void)key;
+  struct clock_state* s = state;
+  if (s->present == 0) {
+    return VTPC_NIL;
+  }
+
+  for (;;) {
+    const uint32_t frame = s->hand;
+    s->hand = (s->hand + 1 == s->frames) ? 0 : s->hand + 1;
+
+    if ((s->bits[frame] & CLOCK_REFERENCED) != 0) {
+      s->bits[frame] &= ~CLOCK_REFERENCED;
+    } else if ((s->bits[frame] & CLOCK_PRESENT) != 0) {
+      clock_remove(s, frame);
+      return frame;
+    }
+  }
+}
+
+/* The hand has gone past the frame, which stays unreferenced. */
+static void clock_restore(void* state, uint32_t frame) {
+  clock_insert(state, frame, 0);
+}
+
+const struct vtpc_policy vtpc_policy_clock = {
+    .name = "clock",
+    .size = clock_size,
+    .init = clock_init,
+    .insert = clock_insert,
+    .touch = clock_touch,
+    .remove = clock_remove,
+    .victim = clock_victim,
+    .restore = clock_restore,
+};
@@ -0,0 +1,147 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+/*
+ * O(1) LFU (Shah, Mitra, Matani): frames with the same use count share a
+ * bucket, buckets are kept in a list sorted by count. Ties are broken by
+ * recency inside a bucket.
+ */
+struct lfu_bucket {
+  uint32_t count;
+  struct vtpc_list frames;
+};
+
+struct lfu_state {
+  uint32_t free;
+  struct vtpc_list order;
+  struct lfu_bucket* buckets;
+  struct vtpc_link* bucket_links;
+  struct vtpc_link* frame_links;
+  uint32_t* owner;
+};
+
+static size_t lfu_size(uint32_t frames) {
+  const size_t buckets = (size_t)frames + 1;
+  return sizeof(struct lfu_state) + buckets * sizeof(struct lfu_bucket) +
+         buckets * sizeof(struct vtpc_link) +
+         frames * sizeof(struct vtpc_link) + frames * sizeof(uint32_t);
+}
+
+static void lfu_init(void* state, uint32_t frames) {
+  struct lfu_state* s = state;
+  const uint32_t buckets = frames + 1;
+
+  s->buckets = (struct lfu_bucket*)(s + 1);
+  s->bucket_links = (struct vtpc_link*)(s->buckets + buckets);
+  s->frame_links = s->bucket_links + buckets;
+  s->owner = (uint32_t*)(s->frame_links + frames);
+
+  vtpc_list_init(&s->order);
+  for (uint32_t i = 0; i < buckets; ++i) {
+    s->bucket_links[i].next = (i + 1 < buckets) ? i + 1 : VTPC_NIL;
+  }
+  s->free = 0;
+}
+
+static uint32_t lfu_bucket_new(
+    struct lfu_state* s, uint32_t after, uint32_t count
+) {
+  const uint32_t bucket = s->free;
+  s->free = s->bucket_links[bucket].next;
+  s->buckets[bucket].count = count;
+  vtpc_list_init(&s->buckets[bucket].frames);
+  vtpc_list_insert_after(&s->order, s->bucket_links, after, bucket);
+  return bucket;
+}
+
+static void lfu_detach(struct lfu_state* s, uint32_t frame) {
+  const uint32_t bucket = s->owner[frame];
+  struct lfu_bucket* b = &s->buckets[bucket];
+  vtpc_list_unlink(&b->frames, s->frame_links, frame);
+  if (b->frames.len == 0) {
+    vtpc_list_unlink(&s->order, s->bucket_links, bucket);
+    s->bucket_links[bucket].next = s->free;
+    s->free = bucket;
+  }
+}
+
+static void lfu_insert(void* state, uint32_t frame, uint64_t key) {
+  (void)key;
+  struct lfu_state* s = state;
+
+  uint32_t bucket = s->order.head;
+  if (bucket == VTPC_NIL || s->buckets[bucket].count != 1) {
+    bucket = lfu_bucket_new(s, VTPC_NIL, 1);
+  }
+  s->owner[frame] = bucket;
+  vtpc_list_push(&s->buckets[bucket].frames, s->frame_links, frame);
+}
+
+static void lfu_touch(void* state, uint32_t frame) {
+  struct lfu_state* s = state;
+  const uint32_t bucket = s->owner[frame];
+  const uint32_t count = s->buckets[bucket].count;
+  if (count == UINT32_MAX) {
+    return;
+  }
+
+  uint32_t next = s->bucket_links[bucket].next;
+  if (next == VTPC_NIL || s->buckets[next].count != count + 1) {
+    next = lfu_bucket_new(s, bucket, count + 1);
+  }
+  lfu_detach(s, frame);
+  s->owner[frame] = next;
+  vtpc_list_push(&s->buckets[next].frames, s->frame_links, frame);
+}
+
+static void lfu_remove(void* state, uint32_t frame) {
+  lfu_detach(state, frame);
+}
+
+static uint32_t lfu_victim(void* state, uint64_t key) {
+  (void)key;
+  struct lfu_state* s = state;
+  const uint32_t bucket = s->order.head;
+  if (bucket == VTPC_NIL) {
+    return VTPC_NIL;
+  }
+
+  const uint32_t frame = s->buckets[bucket].frames.tail;
+  lfu_detach(s, frame);
+  s->owner[frame] = s->buckets[bucket].count;
+  return frame;
+}
+
+/*
+ * `owner` holds the count of a victim until it is restored, as its bucket
+ * may be gone. Victims come from the lowest counts, so the walk is short.
+ */
+static void lfu_restore(void* state, uint32_t frame) {
+  struct lfu_state* s = state;
+  const uint32_t count = s->owner[frame];
+  uint32_t after = VTPC_NIL;
+  uint32_t bucket = s->order.head;
+  while (bucket != VTPC_NIL && s->buckets[bucket].count < count) {
+    after = bucket;
+    bucket = s->bucket_links[bucket].next;
+  }
+  if (bucket == VTPC_NIL || s->buckets[bucket].count != count) {
+    bucket = lfu_bucket_new(s, after, count);
+  }
+  s->owner[frame] = bucket;
+  struct vtpc_list* frames = &s->buckets[bucket].frames;
+  vtpc_list_insert_after(frames, s->frame_links, frames->tail, frame);
+}
+
+const struct vtpc_policy vtpc_policy_lfu = {
+    .name = "lfu",
+    .size = lfu_size,
+    .init = lfu_init,
+    .insert = lfu_insert,
+    .touch = lfu_touch,
+    .remove = lfu_remove,
+    .victim = lfu_victim,
+    .restore = lfu_restore,
+};
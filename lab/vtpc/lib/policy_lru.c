@@ -0,0 +1,93 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+/*
+ * LRU and MRU share one recency list: the head is the most recently used
+ * frame, the tail is the least recently used one.
+ */
+struct lru_state {
+  struct vtpc_list list;
+  struct vtpc_link links[];
+};
+
+static size_t lru_size(uint32_t frames) {
+  return sizeof(struct lru_state) + frames * sizeof(struct vtpc_link);
+}
+
+static void lru_init(void* state, uint32_t frames) {
+  (void)frames;
+  struct lru_state* s = state;
+  vtpc_list_init(&s->list);
+}
+
+static void lru_insert(void* state, uint32_t frame, uint64_t key) {
+  (void)key;
+  struct lru_state* s = state;
+  vtpc_list_push(&s->list, s->links, frame);
+}
+
+static void lru_touch(void* state, uint32_t frame) {
+  struct lru_state* s = state;
+  vtpc_list_unlink(&s->list, s->links, frame);
+  vtpc_list_push(&s->list, s->links, frame);
+}
+
+static void lru_remove(void* state, uint32_t frame) {
+  struct lru_state* s = state;
+  vtpc_list_unlink(&s->list, s->links, frame);
+}
+
+static uint32_t lru_victim(void* state, uint64_t key) {
+  (void)key;
+  struct lru_state* s = state;
+  const uint32_t frame = s->list.tail;
+  if (frame != VTPC_NIL) {
+    vtpc_list_unlink(&s->list, s->links, frame);
+  }
+  return frame;
+}
+
+/* The victim was the tail, the least recently used frame. */
+static void lru_restore(void* state, uint32_t frame) {
+  struct lru_state* s = state;
+  vtpc_list_insert_after(&s->list, s->links, s->list.tail, frame);
+}
+
+static uint32_t mru_victim(void* state, uint64_t key) {
+  (void)key;
+  struct lru_state* s = state;
+  const uint32_t frame = s->list.head;
+  if (frame != VTPC_NIL) {
+    vtpc_list_unlink(&s->list, s->links, frame);
+  }
+  return frame;
+}
+
+static void mru_restore(void* state, uint32_t frame) {
+  struct lru_state* s = state;
+  vtpc_list_push(&s->list, s->links, frame);
+}
+
+const struct vtpc_policy vtpc_policy_lru = {
+    .name = "lru",
+    .size = lru_size,
+    .init = lru_init,
+    .insert = lru_insert,
+    .touch = lru_touch,
+    .remove = lru_remove,
+    .victim = lru_victim,
+    .restore = lru_restore,
+};
+
+const struct vtpc_policy vtpc_policy_mru = {
+    .name = "mru",
+    .size = lru_size,
+    .init = lru_init,
+    .insert = lru_insert,
+    .touch = lru_touch,
+    .remove = lru_remove,
+    .victim = mru_victim,
+    .restore = mru_restore,
+};
@@ -0,0 +1,252 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "policy.h"
+
+/*
+ * Belady's OPT driven by user hints: evicts the frame whose next hinted
+ * access is the furthest in the future. Frames without a hint are treated
+ * as never used again and go first, ties are broken by recency. Frames live
+ * in a binary max-heap, hints for blocks that are not cached yet are kept in
+ * a bounded open-addressing table until the block is loaded. The table has
+ * room for four entries per frame and is never filled past three quarters:
+ * hints that do not fit are dropped, as if never given.
+ */
+#define OPT_EMPTY UINT64_MAX
+
+struct opt_pending {
+  uint64_t key;
+  uint64_t when;
+};
+
+struct opt_slot {
+  uint64_t when;
+  uint64_t seq;
+  uint32_t pos;
+};
+
+struct opt_state {
+  uint32_t len;
+  uint32_t pending_mask;
+  uint32_t pending_len;
+  uint64_t clock;
+  uint32_t* heap;
+  struct opt_slot* slots;
+  struct opt_pending* pending;
+};
+
+static uint32_t opt_pending_capacity(uint32_t frames) {
+  uint32_t capacity = 1;
+  while (capacity < 4 * frames) {
+    capacity <<= 1U;
+  }
+  return capacity;
+}
+
+static size_t opt_size(uint32_t frames) {
+  return sizeof(struct opt_state) + frames * sizeof(struct opt_slot) +
+         opt_pending_capacity(frames) * sizeof(struct opt_pending) +
+         frames * sizeof(uint32_t);
+}
+
+static void opt_init(void* state, uint32_t frames) {
+  struct opt_state* s = state;
+  const uint32_t capacity = opt_pending_capacity(frames);
+
+  s->len = 0;
+  s->clock = 0;
+  s->pending_len = 0;
+  s->pending_mask = capacity - 1;
+  s->slots = (struct opt_slot*)(s + 1);
+  s->pending = (struct opt_pending*)(s->slots + frames);
+  s->heap = (uint32_t*)(s->pending + capacity);
+  for (uint32_t i = 0; i < capacity; ++i) {
+    s->pending[i].key = OPT_EMPTY;
+  }
+}
+
+/* Whether frame `a` should be evicted before frame `b`. */
+static bool opt_before(const struct opt_state* s, uint32_t a, uint32_t b) {
+  const struct opt_slot* x = &s->slots[a];
+  const struct opt_slot* y = &s->slots[b];
+  return x->when != y->when ? x->when > y->when : x->seq < y->seq;
+}
+
+static void opt_place(struct opt_state* s, uint32_t pos, uint32_t frame) {
+  s->heap[pos] = frame;
+  s->slots[frame].pos = pos;
+}
+
+static void opt_sift_up(struct opt_state* s, uint32_t pos) {
+  const uint32_t frame = s->heap[pos];
+  while (pos > 0) {
+    const uint32_t parent = (pos - 1) / 2;
+    if (!opt_before(s, frame, s->heap[parent])) {
+      break;
+    }
+    opt_place(s, pos, s->heap[parent]);
+    pos = parent;
+  }
+  opt_place(s, pos, frame);
+}
+
+static void opt_sift_down(struct opt_state* s, uint32_t pos) {
+  const uint32_t frame = s->heap[pos];
+  for (;;) {
+    uint32_t child = 2 * pos + 1;
+    if (child >= s->len) {
+      break;
+    }
+    const uint32_t right = child + 1;
+    if (right < s->len && opt_before(s, s->heap[right], s->heap[child])) {
+      child = right;
+    }
+    if (!opt_before(s, s->heap[child], frame)) {
+      break;
+    }
+    opt_place(s, pos, s->heap[child]);
+    pos = child;
+  }
+  opt_place(s, pos, frame);
+}
+
+static void opt_update(struct opt_state* s, uint32_t frame) {
+  opt_sift_up(s, s->slots[frame].pos);
+  opt_sift_down(s, s->slots[frame].pos);
+}
+
+static uint32_t opt_probe(const struct opt_state* s, uint64_t key) {
+  uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+  uint32_t i = (uint32_t)(hash >> 32U) & s->pending_mask;
+  while (s->pending[i].key != OPT_EMPTY && s->pending[i].key != key) {
+    i = (i + 1) & s->pending_mask;
+  }
+  return i;
+}
+
+/* Backward-shift deletion keeps probe sequences intact without tombstones. */
+static void opt_pending_erase(struct opt_state* s, uint32_t i) {
+  uint32_t hole = i;
+  uint32_t j = i;
+  for (;;) {
+    j = (j + 1) & s->pending_mask;
+    if (s->pending[j].key == OPT_EMPTY) {
+      break;
+    }
+    const uint64_t hash = s->pending[j].key * 0x9E3779B97F4A7C15ULL;
+    const uint32_t home = (uint32_t)(hash >> 32U) & s->pending_mask;
+    const uint32_t dist_home = (j - home) & s->pending_mask;
+    const uint32_t dist_hole = (j - hole) & s->pending_mask;
+    if (dist_home >= dist_hole) {
+      s->pending[hole] = s->pending[j];
+      hole = j;
+    }
+  }
+  s->pending[hole].key = OPT_EMPTY;
+  s->pending_len -= 1;
+}
+
+static uint64_t opt_pending_take(struct opt_state* s, uint64_t key) {
+  const uint32_t i = opt_probe(s, key);
+  if (s->pending[i].key == OPT_EMPTY) {
+    return VTPC_NEVER;
+  }
+  const uint64_t when = s->pending[i].when;
+  opt_pending_erase(s, i);
+  return when;
+}
+
+static void opt_pending_put(struct opt_state* s, uint64_t key, uint64_t when) {
+  const uint32_t i = opt_probe(s, key);
+  if (s->pending[i].key == key) {
+    if (when == VTPC_NEVER) {
+      opt_pending_erase(s, i);
+    } else {
+      s->pending[i].when = when;
+    }
+    return;
+  }
+  const uint32_t capacity = s->pending_mask + 1;
+  if (when == VTPC_NEVER || 4 * (s->pending_len + 1) > 3 * capacity) {
+    return;
+  }
+  s->pending[i].key = key;
+  s->pending[i].when = when;
+  s->pending_len += 1;
+}
+
+static void opt_insert(void* state, uint32_t frame, uint64_t key) {
+  struct opt_state* s = state;
+  struct opt_slot* slot = &s->slots[frame];
+  slot->when = s->pending_len > 0 ? opt_pending_take(s, key) : VTPC_NEVER;
+  slot->seq = s->clock++;
+  s->len += 1;
+  opt_place(s, s->len - 1, frame);
+  opt_sift_up(s, s->len - 1);
+}
+
+static void opt_touch(void* state, uint32_t frame) {
+  struct opt_state* s = state;
+  struct opt_slot* slot = &s->slots[frame];
+  if (slot->when != VTPC_NEVER && slot->when <= cache_now()) {
+    slot->when = VTPC_NEVER;
+  }
+  slot->seq = s->clock++;
+  opt_update(s, frame);
+}
+
+static void opt_remove(void* state, uint32_t frame) {
+  struct opt_state* s = state;
+  const uint32_t pos = s->slots[frame].pos;
+  s->len -= 1;
+  if (pos == s->len) {
+    return;
+  }
+  opt_place(s, pos, s->heap[s->len]);
+  opt_update(s, s->heap[pos]);
+}
+
+static uint32_t opt_victim(void* state, uint64_t key) {
+  (void)key;
+  struct opt_state* s = state;
+  if (s->len == 0) {
+    return VTPC_NIL;
+  }
+  const uint32_t frame = s->heap[0];
+  opt_remove(s, frame);
+  return frame;
+}
+
+/* The hint and recency of the frame are kept, so it goes back on top. */
+static void opt_restore(void* state, uint32_t frame) {
+  struct opt_state* s = state;
+  s->len += 1;
+  opt_place(s, s->len - 1, frame);
+  opt_sift_up(s, s->len - 1);
+}
+
+static void opt_advise(
+    void* state, uint32_t frame, uint64_t key, uint64_t when
+) {
+  struct opt_state* s = state;
+  if (frame == VTPC_NIL) {
+    opt_pending_put(s, key, when);
+    return;
+  }
+  s->slots[frame].when = when;
+  opt_update(s, frame);
+}
+
+const struct vtpc_policy vtpc_policy_optimal = {
+    .name = "optimal",
+    .size = opt_size,
+    .init = opt_init,
+    .insert = opt_insert,
+    .touch = opt_touch,
+    .remove = opt_remove,
+    .victim = opt_victim,
+    .restore = opt_restore,
+    .advise = opt_advise,
+};
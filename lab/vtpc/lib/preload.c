@@ -0,0 +1,723 @@
+/* The fortified entry points are defined here, not wrapped. */
+#undef _FORTIFY_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "vtpc.h"
+
+/*
+ * libvtpc_preload.so routes the files of programs that do not know about
+ * the cache through it:
+ *
+ *   LD_PRELOAD=libvtpc_preload.so VTPC_PRELOAD_PREFIX=/data/ program ...
+ *
+ * Regular files whose absolute path starts with the prefix are opened with
+ * vtpc_open, and read, write, pread, pwrite, their vectored variants, lseek,
+ * fsync, fdatasync, ftruncate and close on them go to the cache, as do
+ * streams of fopen and fdopen. Every other file and call goes to libc
+ * untouched, and so does every call made by the cache itself. The rest of
+ * the environment configures the cache as usual, so policies are compared
+ * by running the same program with another VTPC_POLICY.
+ *
+ * The program gets an O_PATH fd of the file, which answers fstat with the
+ * size on disk and fails any other call that would bypass the cache, such
+ * as preadv2 or mmap. dup, dup2 and dup3 share the routing, fcntl(F_DUPFD)
+ * does not. Files still open at exit are closed and written back. Routed
+ * fds do not survive exec, and stdin, stdout and stderr write to their fd
+ * within libc, so a file moved onto them is only routed for calls on fds.
+ */
+
+/* The 64-bit variants of the calls are the plain ones. */
+_Static_assert(sizeof(off_t) == 8, "off_t is 64-bit");
+
+static struct {
+  int (*openat)(int, const char*, int, ...);
+  ssize_t (*read)(int, void*, size_t);
+  ssize_t (*write)(int, const void*, size_t);
+  ssize_t (*pread)(int, void*, size_t, off_t);
+  ssize_t (*pwrite)(int, const void*, size_t, off_t);
+  ssize_t (*readv)(int, const struct iovec*, int);
+  ssize_t (*writev)(int, const struct iovec*, int);
+  ssize_t (*preadv)(int, const struct iovec*, int, off_t);
+  ssize_t (*pwritev)(int, const struct iovec*, int, off_t);
+  off_t (*lseek)(int, off_t, int);
+  int (*fsync)(int);
+  int (*fdatasync)(int);
+  int (*ftruncate)(int, off_t);
+  int (*close)(int);
+  int (*dup)(int);
+  int (*dup2)(int, int);
+  int (*dup3)(int, int, int);
+  ssize_t (*copy_file_range)(int, off_t*, int, off_t*, size_t, unsigned);
+  FILE* (*fopen)(const char*, const char*);
+  FILE* (*fdopen)(int, const char*);
+} libc;
+
+/*
+ * `targets` has the cache fd each fd of the program stands for, plus one so
+ * that 0 is none. `refs` counts the fds of the program standing for each
+ * cache fd. Calls from [text_start, text_end), the code of the shim and the
+ * cache, go to libc.
+ */
+static struct {
+  pthread_once_t once;
+  size_t prefix_len;
+  char prefix[PATH_MAX];
+  uintptr_t text_start;
+  uintptr_t text_end;
+  _Atomic int targets[VTPC_MAX_FILES];
+  _Atomic int refs[VTPC_MAX_FILES];
+} shim = {.once = PTHREAD_ONCE_INIT};
+
+/* Only evaluated directly in the exported functions. */
+#define PRELOAD_CALLER() ((uintptr_t)__builtin_return_address(0))
+
+static int text_find(struct dl_phdr_info* info, size_t size, void* data) {
+  (void)size;
+  const uintptr_t self = *(const uintptr_t*)data;
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+    const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X) != 0 &&
+        self >= start && self < start + phdr->p_memsz) {
+      shim.text_start = start;
+      shim.text_end = start + phdr->p_memsz;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void shim_init(void) {
+  libc.openat = dlsym(RTLD_NEXT, "openat");
+  libc.read = dlsym(RTLD_NEXT, "read");
+  libc.write = dlsym(RTLD_NEXT, "write");
+  libc.pread = dlsym(RTLD_NEXT, "pread");
+  libc.pwrite = dlsym(RTLD_NEXT, "pwrite");
+  libc.readv = dlsym(RTLD_NEXT, "readv");
+  libc.writev = dlsym(RTLD_NEXT, "writev");
+  libc.preadv = dlsym(RTLD_NEXT, "preadv");
+  libc.pwritev = dlsym(RTLD_NEXT, "pwritev");
+  libc.lseek = dlsym(RTLD_NEXT, "lseek");
+  libc.fsync = dlsym(RTLD_NEXT, "fsync");
+  libc.fdatasync = dlsym(RTLD_NEXT, "fdatasync");
+  libc.ftruncate = dlsym(RTLD_NEXT, "ftruncate");
+  libc.close = dlsym(RTLD_NEXT, "close");
+  libc.dup = dlsym(RTLD_NEXT, "dup");
+  libc.dup2 = dlsym(RTLD_NEXT, "dup2");
+  libc.dup3 = dlsym(RTLD_NEXT, "dup3");
+  libc.copy_file_range = dlsym(RTLD_NEXT, "copy_file_range");
+  libc.fopen = dlsym(RTLD_NEXT, "fopen");
+  libc.fdopen = dlsym(RTLD_NEXT, "fdopen");
+
+  const char* prefix = getenv("VTPC_PRELOAD_PREFIX");
+  if (prefix != NULL && strlen(prefix) < sizeof(shim.prefix)) {
+    strcpy(shim.prefix, prefix);
+    shim.prefix_len = strlen(prefix);
+  }
+  const uintptr_t self = (uintptr_t)&shim_init;
+  dl_iterate_phdr(text_find, (void*)&self);
+}
+
+static void shim_ready(void) {
+  pthread_once(&shim.once, shim_init);
+}
+
+static bool from_shim(uintptr_t caller) {
+  return caller >= shim.text_start && caller < shim.text_end;
+}
+
+/* The cache fd `fd` stands for, -1 if it is not routed. */
+static int target_of(int fd) {
+  if (fd < 0 || fd >= VTPC_MAX_FILES) {
+    return -1;
+  }
+  return atomic_load(&shim.targets[fd]) - 1;
+}
+
+/* Closes the cache fd once no fd of the program stands for it. */
+static int target_put(int target) {
+  if (atomic_fetch_sub(&shim.refs[target], 1) > 1) {
+    return 0;
+  }
+  return vtpc_close(target);
+}
+
+/* Makes `fd`, just opened or duplicated onto, stand for `target`. */
+static void target_assign(int fd, int target) {
+  if (target != -1) {
+    atomic_fetch_add(&shim.refs[target], 1);
+  }
+  const int old = atomic_exchange(&shim.targets[fd], target + 1) - 1;
+  if (old != -1) {
+    (void)target_put(old);
+  }
+}
+
+/*
+ * The absolute path of a regular file or a file to create to route through
+ * the cache, NULL to leave it to libc. Relative paths are resolved against
+ * the directory without following symbolic links.
+ */
+static const char* route_path(
+    int dir, const char* path, int flags, char* full
+) {
+  if (shim.prefix_len == 0 || (flags & (O_PATH | O_DIRECTORY)) != 0) {
+    return NULL;
+  }
+  const char* absolute = path;
+  if (path[0] != '/') {
+    size_t len = 0;
+    if (dir == AT_FDCWD) {
+      if (getcwd(full, PATH_MAX) == NULL) {
+        return NULL;
+      }
+      len = strlen(full);
+    } else {
+      char link[32];
+      snprintf(link, sizeof(link), "/proc/self/fd/%d", dir);
+      const ssize_t got = readlink(link, full, PATH_MAX);
+      if (got <= 0 || got == PATH_MAX) {
+        return NULL;
+      }
+      len = (size_t)got;
+    }
+    if (len + 1 + strlen(path) >= PATH_MAX) {
+      return NULL;
+    }
+    full[len] = '/';
+    strcpy(full + len + 1, path);
+    absolute = full;
+  }
+  struct stat st;
+  if (strncmp(absolute, shim.prefix, shim.prefix_len) != 0 ||
+      (stat(absolute, &st) == 0 && !S_ISREG(st.st_mode))) {
+    return NULL;
+  }
+  return absolute;
+}
+
+/*
+ * Opens the file in the cache and gives the program an O_PATH fd of it. If
+ * the cache or the table has no room for another fd, the file is opened as
+ * usual instead.
+ */
+static int route_open(const char* path, int flags, mode_t mode) {
+  const int target = vtpc_open(path, flags | O_CLOEXEC, (int)mode);
+  if (target != -1) {
+    const int fd =
+        libc.openat(AT_FDCWD, path, O_PATH | (flags & O_CLOEXEC));
+    if (fd >= 0 && fd < VTPC_MAX_FILES) {
+      target_assign(fd, target);
+      return fd;
+    }
+    if (fd != -1) {
+      libc.close(fd);
+    }
+    const int error = errno;
+    (void)vtpc_close(target);
+    errno = error;
+  } else if (errno != EMFILE) {
+    return -1;
+  }
+  return libc.openat(AT_FDCWD, path, flags & ~O_EXCL, mode);
+}
+
+static int open_at(
+    int dir, const char* path, int flags, mode_t mode, uintptr_t caller
+) {
+  shim_ready();
+  char full[PATH_MAX];
+  const char* routed =
+      from_shim(caller) ? NULL : route_path(dir, path, flags, full);
+  if (routed == NULL) {
+    return libc.openat(dir, path, flags, mode);
+  }
+  return route_open(routed, flags, mode);
+}
+
+static bool needs_mode(int flags) {
+  return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+int open(const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open_at(AT_FDCWD, path, flags, mode, PRELOAD_CALLER());
+}
+
+int open64(const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open_at(AT_FDCWD, path, flags, mode, PRELOAD_CALLER());
+}
+
+int openat(int dir, const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open_at(dir, path, flags, mode, PRELOAD_CALLER());
+}
+
+int openat64(int dir, const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open_at(dir, path, flags, mode, PRELOAD_CALLER());
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_read(target, buf, count);
+  }
+  shim_ready();
+  return libc.read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_write(target, buf, count);
+  }
+  shim_ready();
+  return libc.write(fd, buf, count);
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_pread(target, buf, count, offset);
+  }
+  shim_ready();
+  return libc.pread(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void* buf, size_t count, off_t offset) {
+  return pread(fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_pwrite(target, buf, count, offset);
+  }
+  shim_ready();
+  return libc.pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void* buf, size_t count, off_t offset) {
+  return pwrite(fd, buf, count, offset);
+}
+
+/*
+ * The cache has no vectored calls at the file offset: the offset is read,
+ * used and moved apart, so threads sharing the fd must not race on it.
+ */
+static ssize_t route_vectored(
+    int target, const struct iovec* iov, int iovcnt, bool write
+) {
+  const bool append =
+      write && (vtpc_cache.files[target].flags & O_APPEND) != 0;
+  const off_t offset = vtpc_lseek(target, 0, append ? SEEK_END : SEEK_CUR);
+  if (offset == -1) {
+    return -1;
+  }
+  const ssize_t done = write ? vtpc_pwritev(target, iov, iovcnt, offset)
+                             : vtpc_preadv(target, iov, iovcnt, offset);
+  if (done > 0 && vtpc_lseek(target, offset + done, SEEK_SET) == -1) {
+    return -1;
+  }
+  return done;
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return route_vectored(target, iov, iovcnt, false);
+  }
+  shim_ready();
+  return libc.readv(fd, iov, iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return route_vectored(target, iov, iovcnt, true);
+  }
+  shim_ready();
+  return libc.writev(fd, iov, iovcnt);
+}
+
+ssize_t preadv(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_preadv(target, iov, iovcnt, offset);
+  }
+  shim_ready();
+  return libc.preadv(fd, iov, iovcnt, offset);
+}
+
+ssize_t preadv64(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+  return preadv(fd, iov, iovcnt, offset);
+}
+
+ssize_t pwritev(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_pwritev(target, iov, iovcnt, offset);
+  }
+  shim_ready();
+  return libc.pwritev(fd, iov, iovcnt, offset);
+}
+
+ssize_t pwritev64(
+    int fd, const struct iovec* iov, int iovcnt, off_t offset
+) {
+  return pwritev(fd, iov, iovcnt, offset);
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_lseek(target, offset, whence);
+  }
+  shim_ready();
+  return libc.lseek(fd, offset, whence);
+}
+
+off_t lseek64(int fd, off_t offset, int whence) {
+  return lseek(fd, offset, whence);
+}
+
+int fsync(int fd) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_fsync(target);
+  }
+  shim_ready();
+  return libc.fsync(fd);
+}
+
+int fdatasync(int fd) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return vtpc_fsync(target);
+  }
+  shim_ready();
+  return libc.fdatasync(fd);
+}
+
+/*
+ * The cache cannot cut a file: it is emptied by opening it again with
+ * O_TRUNC and grown by writing its last byte, other lengths are refused.
+ */
+static int route_truncate(int target, off_t length) {
+  const struct vtpc_file* file = &vtpc_cache.files[target];
+  const off_t size = vtpc_cache.nodes[file->node].size;
+  if (length == size) {
+    return 0;
+  }
+  if (length > size) {
+    const char zero = 0;
+    return vtpc_pwrite(target, &zero, 1, length - 1) == 1 ? 0 : -1;
+  }
+  if (length == 0) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", target);
+    const int empty = vtpc_open(path, O_WRONLY | O_TRUNC | O_CLOEXEC, 0);
+    return empty == -1 ? -1 : vtpc_close(empty);
+  }
+  errno = ENOTSUP;
+  return -1;
+}
+
+int ftruncate(int fd, off_t length) {
+  const int target = target_of(fd);
+  if (target != -1) {
+    return route_truncate(target, length);
+  }
+  shim_ready();
+  return libc.ftruncate(fd, length);
+}
+
+int ftruncate64(int fd, off_t length) {
+  return ftruncate(fd, length);
+}
+
+/* The fd is closed even if writing the file back fails, like close does. */
+int close(int fd) {
+  shim_ready();
+  const int target =
+      fd >= 0 && fd < VTPC_MAX_FILES
+          ? atomic_exchange(&shim.targets[fd], 0) - 1
+          : -1;
+  if (target == -1) {
+    return libc.close(fd);
+  }
+  const int result = target_put(target);
+  const int error = errno;
+  if (libc.close(fd) == -1) {
+    return -1;
+  }
+  errno = error;
+  return result;
+}
+
+int dup(int fd) {
+  shim_ready();
+  const int target = target_of(fd);
+  const int copy = libc.dup(fd);
+  if (copy == -1 || target == -1) {
+    return copy;
+  }
+  if (copy >= VTPC_MAX_FILES) {
+    libc.close(copy);
+    errno = EMFILE;
+    return -1;
+  }
+  target_assign(copy, target);
+  return copy;
+}
+
+static int dup_onto(int fd, int copy, int flags) {
+  const int target = target_of(fd);
+  if (copy >= VTPC_MAX_FILES && target != -1) {
+    errno = EBADF;
+    return -1;
+  }
+  const int result =
+      flags == -1 ? libc.dup2(fd, copy) : libc.dup3(fd, copy, flags);
+  if (result != -1 && copy < VTPC_MAX_FILES) {
+    target_assign(copy, target);
+  }
+  return result;
+}
+
+int dup2(int fd, int copy) {
+  shim_ready();
+  return dup_onto(fd, copy, -1);
+}
+
+int dup3(int fd, int copy, int flags) {
+  shim_ready();
+  return dup_onto(fd, copy, flags);
+}
+
+/* Programs fall back to read and write, which the cache serves. */
+ssize_t copy_file_range(
+    int in,
+    off_t* in_offset,
+    int out,
+    off_t* out_offset,
+    size_t len,
+    unsigned flags
+) {
+  shim_ready();
+  if (target_of(in) != -1 || target_of(out) != -1) {
+    errno = EXDEV;
+    return -1;
+  }
+  return libc.copy_file_range(in, in_offset, out, out_offset, len, flags);
+}
+
+/* Builds with _FORTIFY_SOURCE call these instead. */
+void __chk_fail(void) __attribute__((noreturn));
+
+int __open_2(const char* path, int flags) {
+  return open_at(AT_FDCWD, path, flags, 0, PRELOAD_CALLER());
+}
+
+int __open64_2(const char* path, int flags) {
+  return open_at(AT_FDCWD, path, flags, 0, PRELOAD_CALLER());
+}
+
+int __openat_2(int dir, const char* path, int flags) {
+  return open_at(dir, path, flags, 0, PRELOAD_CALLER());
+}
+
+int __openat64_2(int dir, const char* path, int flags) {
+  return open_at(dir, path, flags, 0, PRELOAD_CALLER());
+}
+
+ssize_t __read_chk(int fd, void* buf, size_t count, size_t size) {
+  if (count > size) {
+    __chk_fail();
+  }
+  return read(fd, buf, count);
+}
+
+ssize_t __pread_chk(
+    int fd, void* buf, size_t count, off_t offset, size_t size
+) {
+  if (count > size) {
+    __chk_fail();
+  }
+  return pread(fd, buf, count, offset);
+}
+
+ssize_t __pread64_chk(
+    int fd, void* buf, size_t count, off_t offset, size_t size
+) {
+  return __pread_chk(fd, buf, count, offset, size);
+}
+
+/* A stream of a routed fd, whose data libc would read and write itself. */
+static ssize_t stream_read(void* cookie, char* buf, size_t size) {
+  return vtpc_read(target_of((int)(intptr_t)cookie), buf, size);
+}
+
+static ssize_t stream_write(void* cookie, const char* buf, size_t size) {
+  const ssize_t done =
+      vtpc_write(target_of((int)(intptr_t)cookie), buf, size);
+  return done == -1 ? 0 : done;
+}
+
+static int stream_seek(void* cookie, off64_t* offset, int whence) {
+  const off_t result =
+      vtpc_lseek(target_of((int)(intptr_t)cookie), *offset, whence);
+  if (result == -1) {
+    return -1;
+  }
+  *offset = result;
+  return 0;
+}
+
+static int stream_close(void* cookie) {
+  return close((int)(intptr_t)cookie);
+}
+
+static FILE* stream_open(int fd, const char* mode) {
+  const cookie_io_functions_t io = {
+      .read = stream_read,
+      .write = stream_write,
+      .seek = stream_seek,
+      .close = stream_close,
+  };
+  FILE* stream = fopencookie((void*)(intptr_t)fd, mode, io);
+#ifdef __GLIBC__
+  if (stream != NULL) {
+    /* For fileno, glibc itself only uses the functions of the cookie. */
+    stream->_fileno = fd;
+  }
+#endif
+  return stream;
+}
+
+/* The flags of open that a mode of fopen stands for, -1 if invalid. */
+static int mode_flags(const char* mode) {
+  int flags = 0;
+  switch (mode[0]) {
+    case 'r':
+      flags = O_RDONLY;
+      break;
+    case 'w':
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+      break;
+    case 'a':
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      break;
+    default:
+      return -1;
+  }
+  for (const char* c = mode + 1; *c != '\0' && *c != ','; ++c) {
+    if (*c == '+') {
+      flags = (flags & ~O_ACCMODE) | O_RDWR;
+    } else if (*c == 'e') {
+      flags |= O_CLOEXEC;
+    } else if (*c == 'x') {
+      flags |= O_EXCL;
+    }
+  }
+  return flags;
+}
+
+static FILE* stream_at(const char* path, const char* mode, uintptr_t caller) {
+  shim_ready();
+  const int flags = mode_flags(mode);
+  char full[PATH_MAX];
+  const char* routed = from_shim(caller) || flags == -1
+                           ? NULL
+                           : route_path(AT_FDCWD, path, flags, full);
+  if (routed == NULL) {
+    return libc.fopen(path, mode);
+  }
+  const int fd = route_open(routed, flags, 0666);
+  if (fd == -1) {
+    return NULL;
+  }
+  FILE* stream = target_of(fd) != -1 ? stream_open(fd, mode)
+                                     : libc.fdopen(fd, mode);
+  if (stream == NULL) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+  }
+  return stream;
+}
+
+FILE* fopen(const char* path, const char* mode) {
+  return stream_at(path, mode, PRELOAD_CALLER());
+}
+
+FILE* fopen64(const char* path, const char* mode) {
+  return stream_at(path, mode, PRELOAD_CALLER());
+}
+
+FILE* fdopen(int fd, const char* mode) {
+  shim_ready();
+  if (target_of(fd) == -1) {
+    return libc.fdopen(fd, mode);
+  }
+  return stream_open(fd, mode);
+}
+
+/*
+ * Exit closes the files of the program, so what it wrote is written back,
+ * buffers of its streams included. Destructors run after atexit handlers.
+ */
+__attribute__((destructor)) static void shim_exit(void) {
+  fflush(NULL);
+  for (int fd = 0; fd < VTPC_MAX_FILES; ++fd) {
+    const int target = atomic_exchange(&shim.targets[fd], 0) - 1;
+    if (target != -1) {
+      (void)target_put(target);
+    }
+  }
+}
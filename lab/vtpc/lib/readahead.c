@@ -0,0 +1,224 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "dedup.h"
+#include "io.h"
+#include "policy.h"
+
+/*
+ * Takes a frame for the block if it is not cached, without waiting for busy
+ * frames. The frame is installed loading, so that nobody uses it until the
+ * read completes. Returns VTPC_NIL if the block is cached, or was restored
+ * from the compressed tier, or no frame is free, `cached` tells which.
+ */
+static uint32_t prefetch_frame(
+    uint32_t node, uint64_t block, enum vtpc_fetch fetch, bool* cached
+) {
+  struct vtpc_shard* shard = shard_of(node, block);
+  shard_lock(shard);
+  *cached = index_find(shard, node, block) != VTPC_NIL;
+  uint32_t frame = VTPC_NIL;
+  if (!*cached) {
+    frame = frame_alloc(shard, key_of(node, block), false);
+    *cached = index_find(shard, node, block) != VTPC_NIL;
+  }
+  if (frame != VTPC_NIL && *cached) {
+    frame_free(shard, frame);
+    frame = VTPC_NIL;
+  }
+  if (frame != VTPC_NIL) {
+    frame_install(shard, frame, node, block, 0);
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    f->fetch = (uint8_t)fetch;
+    if (f->valid == VTPC_SECTORS_ALL) {
+      /* Restored from the compressed tier, there is nothing to read. */
+      *cached = true;
+      frame = VTPC_NIL;
+    } else {
+      f->loading = true;
+      f->owner = (uint8_t)vtpc_cache.slot;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return frame;
+}
+
+/* Missing blocks being loaded together, adjacent ones share one read. */
+struct vtpc_prefetch {
+  uint32_t len;
+  uint32_t count;
+  uint32_t frames[VTPC_READAHEAD_MAX];
+  struct iovec iov[VTPC_READAHEAD_MAX];
+  struct vtpc_io ios[VTPC_READAHEAD_MAX];
+};
+
+static void prefetch_add(
+    struct vtpc_prefetch* batch, int fd, uint32_t frame, uint64_t block
+) {
+  const off_t pos = (off_t)(block * VTPC_BLOCK_SIZE);
+  struct iovec* iov = &batch->iov[batch->len];
+  iov->iov_base = frame_data(frame);
+  iov->iov_len = VTPC_BLOCK_SIZE;
+  batch->frames[batch->len] = frame;
+  batch->len += 1;
+
+  if (batch->count > 0) {
+    struct vtpc_io* last = &batch->ios[batch->count - 1];
+    if (last->pos + (off_t)last->iovcnt * VTPC_BLOCK_SIZE == pos) {
+      last->iovcnt += 1;
+      return;
+    }
+  }
+  batch->ios[batch->count] = (struct vtpc_io){
+      .fd = fd,
+      .op = VTPC_IO_READ,
+      .iov = iov,
+      .iovcnt = 1,
+      .pos = pos,
+  };
+  batch->count += 1;
+}
+
+/*
+ * Reads the batch at once, blocks past the end of the file on disk are not
+ * read but zeroed. A failed read drops its frames.
+ */
+static void prefetch_load(struct vtpc_prefetch* batch, uint32_t node) {
+  const off_t disk_size = vtpc_cache.nodes[node].disk_size;
+  uint32_t reads = 0;
+  while (reads < batch->count && batch->ios[reads].pos < disk_size) {
+    reads += 1;
+  }
+  io_run(batch->ios, reads);
+
+  uint32_t frame = 0;
+  for (uint32_t i = 0; i < batch->count; ++i) {
+    const struct vtpc_io* io = &batch->ios[i];
+    const ssize_t got = i < reads ? io->result : 0;
+    for (uint32_t k = 0; k < io->iovcnt; ++k, ++frame) {
+      const uint32_t index = batch->frames[frame];
+      const size_t base = (size_t)k * VTPC_BLOCK_SIZE;
+      if (got >= 0 && (size_t)got < base + VTPC_BLOCK_SIZE) {
+        const size_t valid = (size_t)got > base ? (size_t)got - base : 0;
+        memset(frame_data(index) + valid, 0, VTPC_BLOCK_SIZE - valid);
+      }
+
+      struct vtpc_shard* shard = shard_of_frame(index);
+      struct vtpc_frame* f = &vtpc_cache.frames[index];
+      shard_lock(shard);
+      f->loading = false;
+      if (got < 0) {
+        f->fetch = VTPC_FETCH_NONE;
+        frame_drop(shard, index);
+      } else {
+        f->valid = VTPC_SECTORS_ALL;
+        dedup_merge(index);
+      }
+      shard_wake(shard);
+      pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
+/*
+ * Loads the missing blocks of the range in batches of reads submitted
+ * together. Stops when the pool has no free frame left. `ahead` tells
+ * readahead from the batches of a read in progress.
+ */
+void prefetch(
+    int fd, uint32_t node, uint64_t first, uint32_t count, bool ahead
+) {
+  const enum vtpc_fetch fetch = ahead ? VTPC_FETCH_AHEAD : VTPC_FETCH_BATCH;
+  const off_t size = vtpc_cache.nodes[node].size;
+  const uint64_t end = ((uint64_t)size + VTPC_BLOCK_SIZE - 1) / VTPC_BLOCK_SIZE;
+  const uint64_t last = first + count < end ? first + count : end;
+
+  struct vtpc_prefetch batch;
+  uint64_t block = first;
+  bool full = false;
+  while (block < last && !full) {
+    batch.len = 0;
+    batch.count = 0;
+    for (; block < last && batch.len < VTPC_READAHEAD_MAX; ++block) {
+      bool cached = false;
+      const uint32_t frame = prefetch_frame(node, block, fetch, &cached);
+      if (frame != VTPC_NIL) {
+        prefetch_add(&batch, fd, frame, block);
+      } else if (!cached) {
+        full = true;
+        break;
+      }
+    }
+    prefetch_load(&batch, node);
+  }
+}
+
+/*
+ * Detects sequential readers among several interleaved streams of one fd.
+ * A read that continues a stream grows its window and prefetches once the
+ * reader gets within half a window of the prefetched blocks, any other read
+ * replaces the least recently used stream and gets no readahead. Unused
+ * streams expect a read from the start of the file.
+ *
+ * Returns the number of blocks to prefetch from `start`, 0 for none.
+ */
+uint32_t stream_update(
+    struct vtpc_file* file, off_t pos, off_t end, uint64_t* start
+) {
+  pthread_mutex_lock(&file->streams_lock);
+  const uint64_t first = (uint64_t)pos / VTPC_BLOCK_SIZE;
+  const uint64_t last = (uint64_t)(end - 1) / VTPC_BLOCK_SIZE;
+
+  struct vtpc_stream* stream = NULL;
+  struct vtpc_stream* oldest = &file->streams[0];
+  for (size_t i = 0; i < VTPC_STREAMS; ++i) {
+    struct vtpc_stream* s = &file->streams[i];
+    if (s->pos == pos) {
+      stream = s;
+      break;
+    }
+    if (s->stamp < oldest->stamp) {
+      oldest = s;
+    }
+  }
+
+  if (stream == NULL) {
+    stream = oldest;
+    stream->ahead = first;
+    stream->window = file->sequential ? VTPC_READAHEAD_MAX : 0;
+  } else if (stream->window == 0) {
+    stream->window = VTPC_READAHEAD_MIN;
+  }
+  stream->pos = end;
+  stream->stamp = ++file->clock;
+
+  if (stream->window == 0 || last + stream->window / 2 < stream->ahead) {
+    pthread_mutex_unlock(&file->streams_lock);
+    return 0;
+  }
+  *start = stream->ahead > first ? stream->ahead : first;
+  const uint32_t window = stream->window;
+  stream->ahead = *start + window;
+  stream->window *= 2;
+  if (stream->window > VTPC_READAHEAD_MAX) {
+    stream->window = VTPC_READAHEAD_MAX;
+  }
+  pthread_mutex_unlock(&file->streams_lock);
+  return window;
+}
+
+void stream_readahead(
+    struct vtpc_file* file, int fd, off_t pos, off_t end
+) {
+  uint64_t start = 0;
+  const uint32_t window = stream_update(file, pos, end, &start);
+  if (window > 0) {
+    prefetch(fd, file->node, start, window, true);
+  }
+}
@@ -0,0 +1,326 @@
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+/*
+ * The layout of the pool is part of the magic, pools of other builds differ.
+ * The version changes with the layout of the arrays that follow it.
+ */
+#define VTPC_SHM_VERSION 3ULL
+#define VTPC_SHM_MAGIC                                   \
+  (0x7674706300000000ULL ^ (VTPC_SHM_VERSION << 24U) ^ \
+   (sizeof(struct vtpc_frame) << 16U) ^ sizeof(struct vtpc_pool))
+
+/* Where a new pool is mapped if it can be, away from heaps and libraries. */
+#define VTPC_SHM_ADDRESS ((uintptr_t)0x3f0000000000ULL)
+
+static struct {
+  int fd;
+  char name[NAME_MAX];
+} shm = {
+    .fd = -1,
+};
+
+/* Whether a process holds the slot, the lock of this one does not show. */
+static bool slot_alive(uint32_t slot) {
+  if (slot == vtpc_cache.slot) {
+    return true;
+  }
+  struct flock lock = {
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+      .l_start = slot,
+      .l_len = 1,
+  };
+  if (fcntl(shm.fd, F_OFD_GETLK, &lock) == -1) {
+    return true;
+  }
+  return lock.l_type != F_UNLCK;
+}
+
+static bool any_alive(void) {
+  for (uint32_t i = 0; i < VTPC_SLOTS; ++i) {
+    if (slot_alive(i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t shm_dead(void) {
+  if (!vtpc_cache.shared) {
+    return 0;
+  }
+  uint64_t dead = 0;
+  for (uint32_t i = 0; i < VTPC_SLOTS; ++i) {
+    if (vtpc_cache.pool->slots[i].pid != 0 && !slot_alive(i)) {
+      dead |= 1ULL << i;
+    }
+  }
+  return dead;
+}
+
+/*
+ * Maps the pool the object holds at the address it was created at. When
+ * there is none, or nobody uses it and the address is taken here, a new one
+ * is created. Called with the object locked.
+ */
+static struct vtpc_pool* shm_map(uint32_t frames) {
+  struct stat st;
+  if (fstat(shm.fd, &st) == -1) {
+    return NULL;
+  }
+  uint64_t magic = 0;
+  uintptr_t base = 0;
+  size_t mapped = 0;
+  if (st.st_size >= (off_t)sizeof(struct vtpc_pool)) {
+    const struct vtpc_pool* peek =
+        mmap(NULL, VTPC_BLOCK_SIZE, PROT_READ, MAP_SHARED, shm.fd, 0);
+    if (peek != MAP_FAILED) {
+      magic = peek->magic;
+      base = peek->base;
+      mapped = peek->size;
+      munmap((void*)peek, VTPC_BLOCK_SIZE);
+    }
+  }
+
+  const bool valid = magic == VTPC_SHM_MAGIC && mapped == (size_t)st.st_size;
+  if (valid) {
+    void* memory = mmap(
+        (void*)base,
+        mapped,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED_NOREPLACE,
+        shm.fd,
+        0
+    );
+    if (memory == (void*)base) {
+      pool_advise(memory, mapped);
+      return memory;
+    }
+    if (memory != MAP_FAILED) {
+      munmap(memory, mapped);
+    }
+  }
+  if (any_alive()) {
+    errno = valid ? EADDRINUSE : EINVAL;
+    return NULL;
+  }
+
+  const size_t size = pool_size(vtpc_cache.policy, frames);
+  if (ftruncate(shm.fd, 0) == -1 || ftruncate(shm.fd, (off_t)size) == -1) {
+    return NULL;
+  }
+  void* memory = mmap(
+      (void*)VTPC_SHM_ADDRESS,
+      size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_FIXED_NOREPLACE,
+      shm.fd,
+      0
+  );
+  if (memory == MAP_FAILED) {
+    memory =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm.fd, 0);
+  }
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+  pool_advise(memory, size);
+  struct vtpc_pool* pool = memory;
+  pool_init(pool, frames, true);
+  atomic_store(&pool->magic, VTPC_SHM_MAGIC);
+  return pool;
+}
+
+/* Takes a free slot, its lock is held for as long as the process lives. */
+static int slot_take(void) {
+  struct vtpc_pool* pool = vtpc_cache.pool;
+  pool_lock();
+  for (uint32_t i = 0; i < VTPC_SLOTS; ++i) {
+    struct flock lock = {
+        .l_type = F_WRLCK,
+        .l_whence = SEEK_SET,
+        .l_start = i,
+        .l_len = 1,
+    };
+    if (pool->slots[i].pid == 0 && fcntl(shm.fd, F_OFD_SETLK, &lock) == 0) {
+      pool->slots[i].pid = getpid();
+      vtpc_cache.slot = i;
+      pool_unlock();
+      return 0;
+    }
+  }
+  pool_unlock();
+  errno = EUSERS;
+  return -1;
+}
+
+int shm_attach(const char* name, uint32_t frames) {
+  if (strlen(name) >= sizeof(shm.name)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(shm.name, name);
+  shm.fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (shm.fd == -1) {
+    return -1;
+  }
+
+  vtpc_cache.slot = VTPC_SLOTS;
+  while (flock(shm.fd, LOCK_EX) == -1 && errno == EINTR) {
+  }
+  struct vtpc_pool* pool = shm_map(frames);
+  int result = -1;
+  if (pool != NULL) {
+    pool_use(pool);
+    shm_reap();
+    result = slot_take();
+    if (result == -1) {
+      munmap(pool, pool->size);
+    }
+  }
+  const int error = errno;
+  flock(shm.fd, LOCK_UN);
+  if (result == -1) {
+    close(shm.fd);
+    shm.fd = -1;
+  }
+  errno = error;
+  return result;
+}
+
+/*
+ * Loads of dead processes are abandoned, the sectors they did not mark
+ * valid are read again by the next access. Their writes are redone later,
+ * shm_reap_node forgets that they were in flight.
+ */
+void shm_reap_shard(struct vtpc_shard* shard, uint64_t dead) {
+  if (dead == 0) {
+    return;
+  }
+  struct vtpc_slot* slots = vtpc_cache.pool->slots;
+  bool changed = false;
+  for (uint32_t i = 0; i < vtpc_cache.shard_frames; ++i) {
+    const uint32_t frame = shard->base + i;
+    struct vtpc_frame* f = &vtpc_cache.frames[frame];
+    for (uint64_t left = dead; left != 0; left &= left - 1) {
+      uint32_t* pins = &slots[__builtin_ctzll(left)].pins[frame];
+      changed |= *pins != 0;
+      f->pins -= *pins;
+      *pins = 0;
+    }
+
+    const bool owned = (dead & (1ULL << f->owner)) != 0;
+    if (f->loading && owned) {
+      f->loading = false;
+      changed = true;
+    }
+    if (f->writeback && owned) {
+      f->writeback = false;
+      frame_set_dirty(shard, frame, f->valid);
+      changed = true;
+    }
+  }
+  if (changed) {
+    shard_wake(shard);
+  }
+}
+
+void shm_reap_node(struct vtpc_node* n, uint64_t dead) {
+  if (dead == 0) {
+    return;
+  }
+  const uint32_t owner = n->truncating;
+  const bool truncating = owner != 0 && (dead & (1ULL << (owner - 1))) != 0;
+  if (truncating) {
+    n->truncating = 0;
+  }
+  if (truncating || ((n->reading | n->writeback) & dead) != 0) {
+    n->reading &= ~dead;
+    n->writeback &= ~dead;
+    event_wake(&n->idle);
+  }
+}
+
+/*
+ * A file that no live process has open anymore loses its blocks, the dirty
+ * ones too, as if the process that wrote them had cached them privately.
+ */
+void shm_reap(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  if (shm_dead() == 0) {
+    return;
+  }
+  pool_lock();
+  const uint64_t dead = shm_dead();
+  for (uint32_t s = 0; dead != 0 && s < VTPC_SHARDS; ++s) {
+    struct vtpc_shard* shard = &c->shards[s];
+    shard_lock(shard);
+    shm_reap_shard(shard, dead);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  for (uint32_t i = 0; dead != 0 && i < VTPC_MAX_FILES; ++i) {
+    struct vtpc_node* n = &c->nodes[i];
+    node_lock(n);
+    shm_reap_node(n, dead);
+    pthread_mutex_unlock(&n->lock);
+    if ((n->opened & dead) != 0) {
+      n->opened &= ~dead;
+      if (n->opened == 0) {
+        node_invalidate(i);
+      }
+    }
+  }
+  for (uint64_t left = dead; left != 0; left &= left - 1) {
+    c->pool->slots[__builtin_ctzll(left)].pid = 0;
+  }
+  pool_unlock();
+}
+
+/*
+ * The child shares the open file description of the object, and with it
+ * the lock of the slot, with its parent. It opens the object again to take
+ * a slot of its own for the files it inherited, or keeps using the slot of
+ * its parent if it cannot.
+ */
+void shm_atfork_child(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  const int fd = shm_open(shm.name, O_RDWR | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return;
+  }
+  const int inherited = shm.fd;
+  const uint32_t parent = c->slot;
+  shm.fd = fd;
+  c->slot = VTPC_SLOTS;
+  shm_reap();
+  if (slot_take() == -1) {
+    close(fd);
+    shm.fd = inherited;
+    c->slot = parent;
+    return;
+  }
+  close(inherited);
+
+  pool_lock();
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    if (c->locals[i].refs > 0) {
+      c->nodes[i].opened |= 1ULL << c->slot;
+    }
+  }
+  pool_unlock();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cache.h"
+
+/*
+ * A shared pool lives in the POSIX shared memory object named by VTPC_SHM.
+ * Every process attached to it takes a slot and holds an open file
+ * description lock on the byte of the object at the slot's index. The
+ * kernel drops the lock when the process dies, which tells the others to
+ * take back what it left behind.
+ */
+
+/*
+ * Maps the pool, creating it with `frames` frames if needed, and takes a
+ * slot. A pool that exists keeps its size.
+ */
+int shm_attach(const char* name, uint32_t frames);
+
+/* The slots of processes that died and were not reaped yet, 0 if private. */
+uint64_t shm_dead(void);
+
+/* Take back the pins, loads and writes of dead slots, under the lock. */
+void shm_reap_shard(struct vtpc_shard* shard, uint64_t dead);
+void shm_reap_node(struct vtpc_node* n, uint64_t dead);
+
+/* Reaps every dead slot and frees it, taking the lock of the pool. */
+void shm_reap(void);
+
+void shm_atfork_child(void);
@@ -0,0 +1,340 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "vtpc.h"
+
+enum { VTPC_STAT_FILES = 16 };
+
+/* The counters of a fd for one of its opens, told apart by `gen`. */
+struct vtpc_file_counters {
+  int fd;
+  uint32_t gen;
+  _Atomic uint64_t counts[VTPC_STAT_COUNT];
+};
+
+/*
+ * The counters of one thread, thread-local so that its first event
+ * allocates nothing. The owner updates them with a plain load and store,
+ * readers sum them up under the registry lock. A fd is counted in the
+ * entry of `files` its number maps to: the owner claims an entry under the
+ * lock, moving the counts of the fd it held to the vtpc_file if it is still
+ * open, so a thread going back and forth between fds that share an entry
+ * takes the lock each time.
+ */
+struct vtpc_counters {
+  struct vtpc_counters* next;
+  _Atomic uint64_t total[VTPC_STAT_COUNT];
+  _Atomic uint64_t latency[VTPC_LATENCY_COUNT][VTPC_LATENCY_BUCKETS];
+  struct vtpc_file_counters files[VTPC_STAT_FILES];
+};
+
+/* The counters of live threads, those of exited ones are kept in `retired`. */
+static struct {
+  pthread_mutex_t lock;
+  pthread_key_t key;
+  struct vtpc_counters* head;
+  struct vtpc_counters retired;
+  char dump[PATH_MAX];
+} registry = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct vtpc_counters local;
+static _Thread_local bool local_listed;
+static _Thread_local struct vtpc_file_counters* local_file;
+
+static const char* const stat_names[VTPC_STAT_COUNT] = {
+    [VTPC_STAT_HITS] = "hits",
+    [VTPC_STAT_MISSES] = "misses",
+    [VTPC_STAT_BYTES_READ] = "bytes_read",
+    [VTPC_STAT_BYTES_WRITTEN] = "bytes_written",
+    [VTPC_STAT_EVICTIONS] = "evictions",
+    [VTPC_STAT_WRITEBACKS] = "writebacks",
+    [VTPC_STAT_READAHEAD_HITS] = "readahead_hits",
+    [VTPC_STAT_PREFETCH_WASTED] = "prefetch_wasted",
+    [VTPC_STAT_TIER_HITS] = "tier_hits",
+    [VTPC_STAT_TIER_BYTES] = "tier_bytes",
+    [VTPC_STAT_TIER_COMPRESSED] = "tier_compressed",
+    [VTPC_STAT_DEDUP_HITS] = "dedup_hits",
+    [VTPC_STAT_DEDUP_COPIES] = "dedup_copies",
+};
+
+static const char* const latency_names[VTPC_LATENCY_COUNT] = {
+    [VTPC_LATENCY_READ] = "read_ns",
+    [VTPC_LATENCY_WRITE] = "write_ns",
+    [VTPC_LATENCY_DISK_READ] = "disk_read_ns",
+    [VTPC_LATENCY_DISK_WRITE] = "disk_write_ns",
+};
+
+static void bump(_Atomic uint64_t* counter, uint64_t value) {
+  const uint64_t current =
+      atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, current + value, memory_order_relaxed);
+}
+
+static uint64_t load(const _Atomic uint64_t* counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/* Whether the entry counts the fd as it is open now. */
+static bool file_current(const struct vtpc_file_counters* f, int fd) {
+  return f->fd == fd &&
+         f->gen == atomic_load_explicit(
+                       &vtpc_cache.files[fd].stats_gen, memory_order_relaxed
+                   );
+}
+
+/* Moves the counts of the entry to its fd. Called under the registry lock. */
+static void file_fold(struct vtpc_file_counters* f) {
+  if (!file_current(f, f->fd)) {
+    return;
+  }
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    bump(&vtpc_cache.files[f->fd].stats[i], load(&f->counts[i]));
+    atomic_store_explicit(&f->counts[i], 0, memory_order_relaxed);
+  }
+}
+
+/* Called under the registry lock. */
+static void counters_fold(
+    struct vtpc_counters* into, struct vtpc_counters* from
+) {
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    bump(&into->total[i], load(&from->total[i]));
+  }
+  for (uint32_t i = 0; i < VTPC_LATENCY_COUNT; ++i) {
+    for (uint32_t b = 0; b < VTPC_LATENCY_BUCKETS; ++b) {
+      bump(&into->latency[i][b], load(&from->latency[i][b]));
+    }
+  }
+  for (uint32_t i = 0; i < VTPC_STAT_FILES; ++i) {
+    file_fold(&from->files[i]);
+  }
+}
+
+static void counters_retire(void* arg) {
+  struct vtpc_counters* c = arg;
+  pthread_mutex_lock(&registry.lock);
+  struct vtpc_counters** link = &registry.head;
+  while (*link != c) {
+    link = &(*link)->next;
+  }
+  *link = c->next;
+  counters_fold(&registry.retired, c);
+  memset(c, 0, sizeof(*c));
+  pthread_mutex_unlock(&registry.lock);
+  local_listed = false;
+  local_file = NULL;
+}
+
+static void key_init(void) {
+  pthread_key_create(&registry.key, counters_retire);
+}
+
+/*
+ * The counters of the calling thread, listed by its first event and folded
+ * into the retired ones when it exits.
+ */
+static struct vtpc_counters* counters_get(void) {
+  struct vtpc_counters* c = &local;
+  if (local_listed) {
+    return c;
+  }
+  pthread_once(&key_once, key_init);
+  pthread_setspecific(registry.key, c);
+  pthread_mutex_lock(&registry.lock);
+  c->next = registry.head;
+  registry.head = c;
+  pthread_mutex_unlock(&registry.lock);
+  local_listed = true;
+  return c;
+}
+
+void stats_track(int fd) {
+  if (fd == -1) {
+    local_file = NULL;
+    return;
+  }
+  struct vtpc_counters* c = counters_get();
+  struct vtpc_file_counters* f = &c->files[fd % VTPC_STAT_FILES];
+  if (!file_current(f, fd)) {
+    pthread_mutex_lock(&registry.lock);
+    file_fold(f);
+    f->fd = fd;
+    f->gen = atomic_load(&vtpc_cache.files[fd].stats_gen);
+    for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+      atomic_store_explicit(&f->counts[i], 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&registry.lock);
+  }
+  local_file = f;
+}
+
+/*
+ * The counts of the previous open are dropped: those still in threads no
+ * longer match the generation.
+ */
+void stats_open(int fd) {
+  struct vtpc_file* file = &vtpc_cache.files[fd];
+  pthread_mutex_lock(&registry.lock);
+  atomic_fetch_add(&file->stats_gen, 1);
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    atomic_store_explicit(&file->stats[i], 0, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&registry.lock);
+}
+
+void stats_add(vtpc_stat_t stat, uint64_t value) {
+  bump(&counters_get()->total[stat], value);
+  if (local_file != NULL) {
+    bump(&local_file->counts[stat], value);
+  }
+}
+
+void stats_latency(vtpc_latency_t kind, uint64_t ns) {
+  struct vtpc_counters* c = counters_get();
+  uint32_t bucket = ns == 0 ? 0 : 63 - (uint32_t)__builtin_clzll(ns);
+  if (bucket >= VTPC_LATENCY_BUCKETS) {
+    bucket = VTPC_LATENCY_BUCKETS - 1;
+  }
+  bump(&c->latency[kind][bucket], 1);
+}
+
+void stats_op(vtpc_latency_t kind, uint64_t start, ssize_t result) {
+  stats_latency(kind, cache_now() - start);
+  if (result > 0) {
+    const vtpc_stat_t bytes = kind == VTPC_LATENCY_READ
+                                  ? VTPC_STAT_BYTES_READ
+                                  : VTPC_STAT_BYTES_WRITTEN;
+    stats_add(bytes, (uint64_t)result);
+  }
+}
+
+static void counters_sum(
+    vtpc_stats_t* stats, const struct vtpc_counters* c, int fd
+) {
+  const struct vtpc_file_counters* f =
+      fd == -1 ? NULL : &c->files[fd % VTPC_STAT_FILES];
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    if (f == NULL) {
+      stats->counters[i] += load(&c->total[i]);
+    } else if (file_current(f, fd)) {
+      stats->counters[i] += load(&f->counts[i]);
+    }
+  }
+  for (uint32_t i = 0; i < VTPC_LATENCY_COUNT; ++i) {
+    for (uint32_t b = 0; b < VTPC_LATENCY_BUCKETS; ++b) {
+      stats->latency[i][b] += load(&c->latency[i][b]);
+    }
+  }
+}
+
+void stats_read(int fd, vtpc_stats_t* stats) {
+  memset(stats, 0, sizeof(*stats));
+  pthread_mutex_lock(&registry.lock);
+  counters_sum(stats, &registry.retired, fd);
+  for (const struct vtpc_counters* c = registry.head; c != NULL;
+       c = c->next) {
+    counters_sum(stats, c, fd);
+  }
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT && fd != -1; ++i) {
+    stats->counters[i] += load(&vtpc_cache.files[fd].stats[i]);
+  }
+  pthread_mutex_unlock(&registry.lock);
+}
+
+int vtpc_stats(int fd, vtpc_stats_t* stats) {
+  if (fd < -1 || fd >= VTPC_MAX_FILES ||
+      (fd != -1 && !vtpc_cache.files[fd].used)) {
+    errno = EBADF;
+    return -1;
+  }
+  stats_read(fd, stats);
+  return 0;
+}
+
+/* One line per counter and per used bucket, written at once. */
+static void stats_dump(void) {
+  const bool to_stderr = strcmp(registry.dump, "stderr") == 0;
+  const int fd = to_stderr ? STDERR_FILENO
+                           : open(
+                                 registry.dump,
+                                 O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                 0644
+                             );
+  if (fd == -1) {
+    return;
+  }
+
+  vtpc_stats_t stats;
+  stats_read(-1, &stats);
+  char text[8192];
+  size_t len = 0;
+  len += (size_t)snprintf(
+      text + len, sizeof(text) - len, "# vtpc pid %d\n", (int)getpid()
+  );
+  for (uint32_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    len += (size_t)snprintf(
+        text + len,
+        sizeof(text) - len,
+        "%s %" PRIu64 "\n",
+        stat_names[i],
+        stats.counters[i]
+    );
+  }
+  for (uint32_t i = 0; i < VTPC_LATENCY_COUNT; ++i) {
+    for (uint32_t b = 0; b < VTPC_LATENCY_BUCKETS; ++b) {
+      if (stats.latency[i][b] == 0) {
+        continue;
+      }
+      len += (size_t)snprintf(
+          text + len,
+          sizeof(text) - len,
+          "%s %" PRIu64 " %" PRIu64 "\n",
+          latency_names[i],
+          (uint64_t)1 << b,
+          stats.latency[i][b]
+      );
+    }
+  }
+  (void)write(fd, text, len < sizeof(text) ? len : sizeof(text) - 1);
+  if (!to_stderr) {
+    close(fd);
+  }
+}
+
+void stats_init(void) {
+  const char* dump = getenv("VTPC_STATS_DUMP");
+  if (dump != NULL && *dump != '\0' && strlen(dump) < sizeof(registry.dump)) {
+    strcpy(registry.dump, dump);
+    atexit(stats_dump);
+  }
+}
+
+void stats_atfork_prepare(void) {
+  pthread_mutex_lock(&registry.lock);
+}
+
+void stats_atfork_parent(void) {
+  pthread_mutex_unlock(&registry.lock);
+}
+
+/* The counters of the parent's other threads stay, as part of the history. */
+void stats_atfork_child(void) {
+  pthread_mutex_init(&registry.lock, NULL);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "vtpc.h"
+
+/*
+ * Events are counted by the thread that causes them, for the fd of the API
+ * call it is in, -1 outside of one. A thread only writes its own counters,
+ * process-wide and per fd, which takes no lock and no atomic
+ * read-modify-write. Readers sum them up.
+ */
+void stats_track(int fd);
+/* Starts the counters of a fd over, called when it is opened. */
+void stats_open(int fd);
+void stats_add(vtpc_stat_t stat, uint64_t value);
+void stats_latency(vtpc_latency_t kind, uint64_t ns);
+/* Records a read or write started at `start` that returned `result`. */
+void stats_op(vtpc_latency_t kind, uint64_t start, ssize_t result);
+
+/*
+ * Sums up the counters of every thread, or takes those of the fd. Latency
+ * histograms are always those of every thread.
+ */
+void stats_read(int fd, vtpc_stats_t* stats);
+
+/* Reads VTPC_STATS_DUMP, called once by cache_init. */
+void stats_init(void);
+
+void stats_atfork_prepare(void);
+void stats_atfork_parent(void);
+void stats_atfork_child(void);
@@ -0,0 +1,253 @@
+#include "tier.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "cache.h"
+#include "lz.h"
+#include "policy.h"
+#include "stats.h"
+
+enum {
+  VTPC_TIER_CHUNK = 128,
+  /* Blocks that do not shrink to fewer chunks than this are not kept. */
+  VTPC_TIER_MAX_CHUNKS = VTPC_BLOCK_SIZE / VTPC_TIER_CHUNK * 7 / 8,
+};
+
+/*
+ * A compressed block of `size` bytes, in a chain of chunks from `chunk`
+ * linked through `chunk_next`.
+ */
+struct tier_entry {
+  uint64_t key;
+  uint32_t hnext;
+  uint32_t chunk;
+  uint32_t size;
+};
+
+/*
+ * `lock` protects everything but `enabled`, which is set before the cache
+ * is ready. There are as many entries as chunks since a block takes one at
+ * least. `lru` has the entries from the last stored, `nodes` those of each
+ * node. Free entries are linked through `hnext`, free chunks through
+ * `chunk_next`.
+ */
+static struct {
+  pthread_mutex_t lock;
+  bool enabled;
+  uint32_t buckets_mask;
+  uint32_t free_entry;
+  uint32_t free_chunk;
+  uint32_t free_chunks;
+  char* chunks;
+  struct tier_entry* entries;
+  struct vtpc_link* lru_links;
+  struct vtpc_link* node_links;
+  uint32_t* chunk_next;
+  uint32_t* buckets;
+  struct vtpc_list lru;
+  struct vtpc_list nodes[VTPC_MAX_FILES];
+} tier = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void tier_init(size_t size) {
+  const size_t per_chunk = VTPC_TIER_CHUNK + sizeof(struct tier_entry) +
+                           2 * sizeof(struct vtpc_link) + 2 * sizeof(uint32_t);
+  size_t capacity = size / per_chunk;
+  if (capacity > VTPC_NIL - 1) {
+    capacity = VTPC_NIL - 1;
+  }
+  if (capacity < VTPC_TIER_MAX_CHUNKS) {
+    return;
+  }
+  char* memory = mmap(
+      NULL,
+      capacity * per_chunk,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0
+  );
+  if (memory == MAP_FAILED) {
+    return;
+  }
+
+  uint32_t buckets = 1;
+  while ((size_t)buckets * 2 <= capacity) {
+    buckets <<= 1U;
+  }
+  tier.buckets_mask = buckets - 1;
+  tier.chunks = memory;
+  tier.entries =
+      (struct tier_entry*)(tier.chunks + capacity * VTPC_TIER_CHUNK);
+  tier.lru_links = (struct vtpc_link*)(tier.entries + capacity);
+  tier.node_links = tier.lru_links + capacity;
+  tier.chunk_next = (uint32_t*)(tier.node_links + capacity);
+  tier.buckets = tier.chunk_next + capacity;
+
+  for (uint32_t i = 0; i < buckets; ++i) {
+    tier.buckets[i] = VTPC_NIL;
+  }
+  for (uint32_t i = 0; i < capacity; ++i) {
+    const uint32_t next = i + 1 < capacity ? i + 1 : VTPC_NIL;
+    tier.entries[i].hnext = next;
+    tier.chunk_next[i] = next;
+  }
+  tier.free_entry = 0;
+  tier.free_chunk = 0;
+  tier.free_chunks = (uint32_t)capacity;
+  vtpc_list_init(&tier.lru);
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    vtpc_list_init(&tier.nodes[i]);
+  }
+  tier.enabled = true;
+}
+
+static uint32_t* tier_bucket(uint64_t key) {
+  key *= 0x9E3779B97F4A7C15ULL;
+  return &tier.buckets[(uint32_t)(key >> 32U) & tier.buckets_mask];
+}
+
+static uint32_t entry_find(uint64_t key) {
+  uint32_t i = *tier_bucket(key);
+  while (i != VTPC_NIL && tier.entries[i].key != key) {
+    i = tier.entries[i].hnext;
+  }
+  return i;
+}
+
+/* Takes the entry out of every list and gives back its chunks. */
+static void entry_remove(uint32_t entry) {
+  struct tier_entry* e = &tier.entries[entry];
+  uint32_t* link = tier_bucket(e->key);
+  while (*link != entry) {
+    link = &tier.entries[*link].hnext;
+  }
+  *link = e->hnext;
+  vtpc_list_unlink(&tier.lru, tier.lru_links, entry);
+  vtpc_list_unlink(&tier.nodes[key_node(e->key)], tier.node_links, entry);
+
+  uint32_t last = e->chunk;
+  uint32_t count = 1;
+  while (tier.chunk_next[last] != VTPC_NIL) {
+    last = tier.chunk_next[last];
+    count += 1;
+  }
+  tier.chunk_next[last] = tier.free_chunk;
+  tier.free_chunk = e->chunk;
+  tier.free_chunks += count;
+  e->hnext = tier.free_entry;
+  tier.free_entry = entry;
+}
+
+void tier_store(uint64_t key, const void* data) {
+  if (!tier.enabled) {
+    return;
+  }
+  char packed[VTPC_TIER_MAX_CHUNKS * VTPC_TIER_CHUNK];
+  const size_t size =
+      lz_compress(data, VTPC_BLOCK_SIZE, packed, sizeof(packed));
+  if (size == 0) {
+    return;
+  }
+  const uint32_t need =
+      (uint32_t)((size + VTPC_TIER_CHUNK - 1) / VTPC_TIER_CHUNK);
+
+  pthread_mutex_lock(&tier.lock);
+  uint32_t entry = entry_find(key);
+  if (entry != VTPC_NIL) {
+    entry_remove(entry);
+  }
+  while (tier.free_chunks < need) {
+    entry_remove(tier.lru.tail);
+  }
+  entry = tier.free_entry;
+  struct tier_entry* e = &tier.entries[entry];
+  tier.free_entry = e->hnext;
+  e->key = key;
+  e->size = (uint32_t)size;
+  e->chunk = tier.free_chunk;
+
+  uint32_t last = VTPC_NIL;
+  uint32_t chunk = tier.free_chunk;
+  for (size_t at = 0; at < size; at += VTPC_TIER_CHUNK) {
+    const size_t len =
+        size - at < VTPC_TIER_CHUNK ? size - at : VTPC_TIER_CHUNK;
+    memcpy(tier.chunks + (size_t)chunk * VTPC_TIER_CHUNK, packed + at, len);
+    last = chunk;
+    chunk = tier.chunk_next[chunk];
+  }
+  tier.free_chunk = chunk;
+  tier.chunk_next[last] = VTPC_NIL;
+  tier.free_chunks -= need;
+
+  uint32_t* bucket = tier_bucket(key);
+  e->hnext = *bucket;
+  *bucket = entry;
+  vtpc_list_push(&tier.lru, tier.lru_links, entry);
+  vtpc_list_push(&tier.nodes[key_node(key)], tier.node_links, entry);
+  pthread_mutex_unlock(&tier.lock);
+
+  stats_add(VTPC_STAT_TIER_BYTES, VTPC_BLOCK_SIZE);
+  stats_add(VTPC_STAT_TIER_COMPRESSED, size);
+}
+
+/* Decompresses out of the lock, `data` is left alone unless it succeeds. */
+bool tier_load(uint64_t key, void* data) {
+  if (!tier.enabled) {
+    return false;
+  }
+  char packed[VTPC_TIER_MAX_CHUNKS * VTPC_TIER_CHUNK];
+  size_t size = 0;
+  pthread_mutex_lock(&tier.lock);
+  const uint32_t entry = entry_find(key);
+  if (entry != VTPC_NIL) {
+    const struct tier_entry* e = &tier.entries[entry];
+    size = e->size;
+    size_t at = 0;
+    for (uint32_t chunk = e->chunk; chunk != VTPC_NIL;
+         chunk = tier.chunk_next[chunk]) {
+      const size_t len =
+          size - at < VTPC_TIER_CHUNK ? size - at : VTPC_TIER_CHUNK;
+      memcpy(packed + at, tier.chunks + (size_t)chunk * VTPC_TIER_CHUNK, len);
+      at += len;
+    }
+    entry_remove(entry);
+  }
+  pthread_mutex_unlock(&tier.lock);
+
+  char block[VTPC_BLOCK_SIZE];
+  if (size == 0 || !lz_decompress(packed, size, block, VTPC_BLOCK_SIZE)) {
+    return false;
+  }
+  memcpy(data, block, VTPC_BLOCK_SIZE);
+  stats_add(VTPC_STAT_TIER_HITS, 1);
+  return true;
+}
+
+void tier_drop_node(uint32_t node) {
+  if (!tier.enabled) {
+    return;
+  }
+  pthread_mutex_lock(&tier.lock);
+  while (tier.nodes[node].head != VTPC_NIL) {
+    entry_remove(tier.nodes[node].head);
+  }
+  pthread_mutex_unlock(&tier.lock);
+}
+
+void tier_atfork_prepare(void) {
+  pthread_mutex_lock(&tier.lock);
+}
+
+void tier_atfork_parent(void) {
+  pthread_mutex_unlock(&tier.lock);
+}
+
+/* The child keeps a copy of the tier, consistent since the lock was held. */
+void tier_atfork_child(void) {
+  pthread_mutex_init(&tier.lock, NULL);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * With VTPC_TIER_MEMORY set to a size, clean blocks that the policy evicts
+ * are compressed into a second tier of that size instead of being lost, and
+ * a miss on one of them decompresses it instead of reading the disk. The
+ * tier evicts the blocks it stored first when it runs out of room. A block
+ * is either in the pool or in the tier, so the tier never holds stale data.
+ * It is private to the process and stays off when the pool is shared.
+ */
+
+/* Called once by cache_init, a size of 0 leaves the tier off. */
+void tier_init(size_t size);
+
+/* Compresses a block evicted from the pool, under the lock of its shard. */
+void tier_store(uint64_t key, const void* data);
+
+/* Takes the block out of the tier into `data`, false if it is not there. */
+bool tier_load(uint64_t key, void* data);
+
+/* Forgets the blocks of a node, once none of them is left in the pool. */
+void tier_drop_node(uint32_t node);
+
+void tier_atfork_prepare(void);
+void tier_atfork_parent(void);
+void tier_atfork_child(void);
@@ -1,30 +1,798 @@
 #include "vtpc.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "manifest.h"
+#include "policy.h"
+#include "stats.h"
+
+/*
+ * The events of the calling thread are counted for the fd from now on,
+ * until a variable declared FILE_SCOPED goes out of scope.
+ */
+static struct vtpc_file* file_get(int fd) {
+  if (fd < 0 || fd >= VTPC_MAX_FILES || !vtpc_cache.files[fd].used) {
+    errno = EBADF;
+    return NULL;
+  }
+  stats_track(fd);
+  return &vtpc_cache.files[fd];
+}
+
+static void file_untrack(const void* file) {
+  (void)file;
+  stats_track(-1);
+}
+
+#define FILE_SCOPED __attribute__((cleanup(file_untrack)))
+
+static bool is_writable(int flags) {
+  return (flags & O_ACCMODE) != O_RDONLY;
+}
+
+static bool is_readable(int flags) {
+  return (flags & O_ACCMODE) != O_WRONLY;
+}
+
+static int open_direct(const char* path, int flags, int access) {
+  int fd = open(path, flags | O_DIRECT, access);
+  if (fd == -1 && errno == EINVAL) {
+    fd = open(path, flags, access);
+  }
+  return fd;
+}
+
+static int open_file(const char* path, int mode, int access) {
+  const int flags = mode & ~O_APPEND;
+  int fd = -1;
+  if ((flags & O_ACCMODE) == O_WRONLY) {
+    fd = open_direct(path, (flags & ~O_ACCMODE) | O_RDWR, access);
+  }
+  if (fd == -1) {
+    fd = open_direct(path, flags, access);
+  }
+  return fd;
+}
+
+/* Sectors per direct I/O write unit of the file, a whole block if unknown. */
+static uint32_t dio_sectors(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || (flags & O_DIRECT) == 0) {
+    return 1;
+  }
+#ifdef STATX_DIOALIGN
+  struct statx stx;
+  if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+      (stx.stx_mask & STATX_DIOALIGN) != 0) {
+    uint32_t align = stx.stx_dio_offset_align;
+    if (stx.stx_dio_mem_align > align) {
+      align = stx.stx_dio_mem_align;
+    }
+    uint32_t sectors = 1;
+    while (sectors < VTPC_SECTORS && sectors * VTPC_SECTOR_SIZE < align) {
+      sectors *= 2;
+    }
+    return sectors;
+  }
+#endif
+  return VTPC_SECTORS;
+}
+
+static int do_open(int fd, int mode) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+  if (fd >= VTPC_MAX_FILES) {
+    errno = EMFILE;
+    return -1;
+  }
+  if (cache_init() == -1) {
+    return -1;
+  }
+  (void)flusher_start();
+
+  pool_lock();
+  const uint32_t node = node_acquire(&st);
+  if (node == VTPC_NIL) {
+    pool_unlock();
+    return -1;
+  }
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  if ((mode & O_TRUNC) != 0 && is_writable(mode)) {
+    node_invalidate(node);
+    if (ftruncate(fd, 0) == -1) {
+      const int error = errno;
+      node_release(node);
+      pool_unlock();
+      errno = error;
+      return -1;
+    }
+    n->size = 0;
+    n->disk_size = 0;
+  }
+  pool_unlock();
+  node_lock(n);
+  if (is_writable(mode) && vtpc_cache.locals[node].wfd == -1) {
+    vtpc_cache.locals[node].wfd = fd;
+  }
+  pthread_mutex_unlock(&n->lock);
+  const uint32_t align = dio_sectors(fd);
+  uint32_t current = atomic_load(&n->align);
+  while (current < align &&
+         !atomic_compare_exchange_weak(&n->align, &current, align)) {
+  }
+
+  struct vtpc_file* file = &vtpc_cache.files[fd];
+  file->sequential = false;
+  file->flags = mode;
+  file->node = node;
+  file->offset = 0;
+  file->clock = 0;
+  memset(file->streams, 0, sizeof(file->streams));
+  stats_open(fd);
+  file->used = true;
+  return fd;
+}
+
 int vtpc_open(const char* path, int mode, int access) {
-  return open(path, mode, access);
+  const int fd = open_file(path, mode, access);
+  if (fd == -1) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&vtpc_cache.lock);
+  const int result = do_open(fd, mode);
+  pthread_mutex_unlock(&vtpc_cache.lock);
+
+  if (result == -1) {
+    const int saved = errno;
+    close(fd);
+    errno = saved;
+  } else {
+    manifest_track(fd, path);
+  }
+  return result;
+}
+
+/* Another writable fd of the node, -1 if there is none. */
+static int other_writer(int fd, uint32_t node) {
+  for (int i = 0; i < VTPC_MAX_FILES; ++i) {
+    const struct vtpc_file* other = &vtpc_cache.files[i];
+    if (i != fd && other->used && other->node == node &&
+        is_writable(other->flags)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * The closing fd may be the one writeback uses for the node. It is handed
+ * over to another writable fd of the same file, and once no writeback uses
+ * it anymore the dirty blocks are written out with it before it goes away.
+ */
+static int do_close(int fd) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+
+  const uint32_t node = file->node;
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  int result = 0;
+  node_lock(n);
+  const bool writer = local->wfd == fd;
+  if (writer) {
+    local->wfd = other_writer(fd, node);
+    while (local->users > 0) {
+      node_wait(n);
+    }
+  }
+  pthread_mutex_unlock(&n->lock);
+  if (writer) {
+    result = node_flush(node, fd, VTPC_NEVER);
+    node_wait_writeback(node);
+  }
+
+  if (vtpc_cache.locals[node].refs == 1) {
+    manifest_record(node);
+  }
+  pool_lock();
+  node_release(node);
+  pool_unlock();
+  file->used = false;
+  return result;
 }
 
 int vtpc_close(int fd) {
-  return close(fd);
+  pthread_mutex_lock(&vtpc_cache.lock);
+  const bool known = file_get(fd) != NULL;
+  const int result = known ? do_close(fd) : -1;
+  pthread_mutex_unlock(&vtpc_cache.lock);
+
+  if (!known) {
+    return -1;
+  }
+  const int saved = errno;
+  if (close(fd) == -1) {
+    return -1;
+  }
+  errno = saved;
+  return result;
+}
+
+/* Clamps a read at `pos` to the size of the file. */
+static size_t read_clamp(
+    const struct vtpc_file* file, size_t count, off_t pos
+) {
+  const off_t size = vtpc_cache.nodes[file->node].size;
+  if (pos >= size) {
+    return 0;
+  }
+  if ((off_t)count > size - pos) {
+    count = (size_t)(size - pos);
+  }
+  return count;
+}
+
+/* Copies the range out block by block, in a single pass over the index. */
+static ssize_t read_blocks(
+    struct vtpc_file* file,
+    int fd,
+    struct vtpc_iter* it,
+    size_t count,
+    off_t pos
+) {
+  const uint64_t last = (uint64_t)(pos + (off_t)count - 1) / VTPC_BLOCK_SIZE;
+  uint64_t batched = 0;
+
+  size_t done = 0;
+  while (done < count) {
+    const off_t at = pos + (off_t)done;
+    const uint64_t block = (uint64_t)at / VTPC_BLOCK_SIZE;
+    const size_t shift = (size_t)at % VTPC_BLOCK_SIZE;
+    size_t chunk = VTPC_BLOCK_SIZE - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    if (block >= batched && block < last) {
+      /* Missing blocks of a long read are loaded a batch at a time. */
+      const uint64_t left = last - block + 1;
+      const uint32_t batch =
+          left < VTPC_READAHEAD_MAX ? (uint32_t)left : VTPC_READAHEAD_MAX;
+      prefetch(fd, file->node, block, batch, false);
+      batched = block + batch;
+    }
+
+    const uint8_t need = sector_mask(shift, shift + chunk);
+    const uint32_t frame = frame_get(fd, file->node, block, need);
+    if (frame == VTPC_NIL) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    const struct vtpc_iter from = *it;
+    uint32_t seq = 0;
+    do {
+      *it = from;
+      seq = frame_read_begin(frame);
+      iter_scatter(it, frame_data(frame) + shift, chunk);
+    } while (frame_read_retry(frame, seq));
+    done += chunk;
+    frame_put(frame, file->sequential && shift + chunk == VTPC_BLOCK_SIZE);
+  }
+  return (ssize_t)done;
+}
+
+/* Copies the longest prefix of the read that needs no I/O. */
+static size_t read_cached(
+    struct vtpc_file* file, void* buf, size_t count, off_t pos
+) {
+  size_t done = 0;
+  while (done < count) {
+    const off_t at = pos + (off_t)done;
+    const uint64_t block = (uint64_t)at / VTPC_BLOCK_SIZE;
+    const size_t shift = (size_t)at % VTPC_BLOCK_SIZE;
+    size_t chunk = VTPC_BLOCK_SIZE - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    const uint8_t need = sector_mask(shift, shift + chunk);
+    const uint32_t frame = frame_find(file->node, block, need);
+    if (frame == VTPC_NIL) {
+      break;
+    }
+    uint32_t seq = 0;
+    do {
+      seq = frame_read_begin(frame);
+      memcpy((char*)buf + done, frame_data(frame) + shift, chunk);
+    } while (frame_read_retry(frame, seq));
+    done += chunk;
+    frame_put(frame, file->sequential && shift + chunk == VTPC_BLOCK_SIZE);
+  }
+  return done;
+}
+
+static ssize_t read_at(
+    struct vtpc_file* file,
+    int fd,
+    struct vtpc_iter* it,
+    size_t count,
+    off_t pos
+) {
+  if (!is_readable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  count = read_clamp(file, count, pos);
+  if (count > 0) {
+    stream_readahead(file, fd, pos, pos + (off_t)count);
+  }
+  return read_blocks(file, fd, it, count, pos);
+}
+
+/* Pins the blocks of the range, extending the last iovec when they touch. */
+static ssize_t ref_blocks(
+    struct vtpc_file* file, int fd, size_t count, off_t pos, vtpc_ref_t* ref
+) {
+  size_t done = 0;
+  while (done < count) {
+    const off_t at = pos + (off_t)done;
+    const uint64_t block = (uint64_t)at / VTPC_BLOCK_SIZE;
+    const size_t shift = (size_t)at % VTPC_BLOCK_SIZE;
+    size_t chunk = VTPC_BLOCK_SIZE - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    const uint8_t need = sector_mask(shift, shift + chunk);
+    const uint32_t frame = frame_get(fd, file->node, block, need);
+    if (frame == VTPC_NIL) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    char* data = frame_data(frame) + shift;
+    struct iovec* last =
+        ref->iovcnt > 0 ? &ref->iov[ref->iovcnt - 1] : NULL;
+    if (last != NULL && (char*)last->iov_base + last->iov_len == data) {
+      last->iov_len += chunk;
+    } else {
+      ref->iov[ref->iovcnt++] = (struct iovec){data, chunk};
+    }
+    ref->frames[ref->count++] = frame;
+    done += chunk;
+  }
+  return (ssize_t)done;
+}
+
+static ssize_t write_at(
+    struct vtpc_file* file,
+    int fd,
+    struct vtpc_iter* it,
+    size_t count,
+    off_t pos
+) {
+  size_t done = 0;
+  while (done < count) {
+    const off_t at = pos + (off_t)done;
+    const size_t shift = (size_t)at % VTPC_BLOCK_SIZE;
+    size_t chunk = VTPC_BLOCK_SIZE - shift;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+    if (block_write(fd, file->node, at, it, chunk) == -1) {
+      return done > 0 ? (ssize_t)done : -1;
+    }
+    done += chunk;
+  }
+  return (ssize_t)done;
 }
 
 ssize_t vtpc_read(int fd, void* buf, size_t count) {
-  return read(fd, buf, count);
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  const struct iovec iov = {.iov_base = buf, .iov_len = count};
+  struct vtpc_iter it = {.iov = &iov};
+  const uint64_t start = cache_now();
+  pthread_mutex_lock(&file->lock);
+  const ssize_t result = read_at(file, fd, &it, count, file->offset);
+  if (result > 0) {
+    file->offset += result;
+  }
+  pthread_mutex_unlock(&file->lock);
+  stats_op(VTPC_LATENCY_READ, start, result);
+  return result;
 }
 
 ssize_t vtpc_write(int fd, const void* buf, size_t count) {
-  return write(fd, buf, count);
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (!is_writable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  const struct iovec iov = {.iov_base = (void*)buf, .iov_len = count};
+  struct vtpc_iter it = {.iov = &iov};
+  const uint64_t start = cache_now();
+  pthread_mutex_lock(&file->lock);
+  if ((file->flags & O_APPEND) != 0) {
+    file->offset = vtpc_cache.nodes[file->node].size;
+  }
+  const ssize_t result = write_at(file, fd, &it, count, file->offset);
+  if (result > 0) {
+    file->offset += result;
+  }
+  pthread_mutex_unlock(&file->lock);
+  stats_op(VTPC_LATENCY_WRITE, start, result);
+  return result;
+}
+
+/* Total length of the buffers, -1 if there are too many or too much. */
+static ssize_t iov_total(const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return -1;
+  }
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len > (size_t)SSIZE_MAX - total) {
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  return (ssize_t)total;
+}
+
+ssize_t vtpc_pread(int fd, void* buf, size_t count, off_t offset) {
+  const struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return vtpc_preadv(fd, &iov, 1, offset);
+}
+
+ssize_t vtpc_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  const struct iovec iov = {.iov_base = (void*)buf, .iov_len = count};
+  return vtpc_pwritev(fd, &iov, 1, offset);
+}
+
+ssize_t vtpc_preadv(
+    int fd, const struct iovec* iov, int iovcnt, off_t offset
+) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  const ssize_t count = iov_total(iov, iovcnt);
+  if (count == -1 || offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct vtpc_iter it = {.iov = iov};
+  const uint64_t start = cache_now();
+  const ssize_t result = read_at(file, fd, &it, (size_t)count, offset);
+  stats_op(VTPC_LATENCY_READ, start, result);
+  return result;
+}
+
+ssize_t vtpc_pwritev(
+    int fd, const struct iovec* iov, int iovcnt, off_t offset
+) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (!is_writable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  const ssize_t count = iov_total(iov, iovcnt);
+  if (count == -1 || offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct vtpc_iter it = {.iov = iov};
+  const uint64_t start = cache_now();
+  const ssize_t result = write_at(file, fd, &it, (size_t)count, offset);
+  stats_op(VTPC_LATENCY_WRITE, start, result);
+  return result;
+}
+
+ssize_t vtpc_read_ref(int fd, off_t offset, size_t len, vtpc_ref_t* ref) {
+  ref->iovcnt = 0;
+  ref->count = 0;
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (!is_readable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  const uint64_t start = cache_now();
+  const size_t shift = (size_t)offset % VTPC_BLOCK_SIZE;
+  const size_t most = (size_t)VTPC_REF_BLOCKS * VTPC_BLOCK_SIZE - shift;
+  const size_t count = read_clamp(file, len < most ? len : most, offset);
+  if (count > 0) {
+    const off_t end = offset + (off_t)count;
+    const uint64_t first = (uint64_t)offset / VTPC_BLOCK_SIZE;
+    const uint64_t last = (uint64_t)(end - 1) / VTPC_BLOCK_SIZE;
+    stream_readahead(file, fd, offset, end);
+    if (last > first) {
+      prefetch(fd, file->node, first, (uint32_t)(last - first + 1), false);
+    }
+  }
+  const ssize_t result = ref_blocks(file, fd, count, offset, ref);
+  stats_op(VTPC_LATENCY_READ, start, result);
+  return result;
+}
+
+void vtpc_release(vtpc_ref_t* ref) {
+  for (uint32_t i = 0; i < ref->count; ++i) {
+    frame_put(ref->frames[i], false);
+  }
+  ref->iovcnt = 0;
+  ref->count = 0;
+}
+
+static void async_init(
+    vtpc_async_t* async,
+    int fd,
+    off_t offset,
+    void* buf,
+    size_t count,
+    bool write
+) {
+  async->next = NULL;
+  async->fd = fd;
+  async->write = write;
+  async->offset = offset;
+  async->buf = buf;
+  async->count = count;
+  async->copied = 0;
+  async->window = 0;
+  async->started = cache_now();
+  async->done = 0;
+}
+
+/*
+ * Readahead is decided when the read starts, so that reads served from the
+ * cache still move their stream. The prefetch itself and the rest of a read
+ * that misses are left to a worker.
+ */
+int vtpc_read_async(
+    int fd, off_t offset, void* buf, size_t count, vtpc_async_t* async
+) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (!is_readable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  count = read_clamp(file, count, offset);
+  async_init(async, fd, offset, buf, count, false);
+  if (count > 0) {
+    async->window = stream_update(
+        file, offset, offset + (off_t)count, &async->ahead
+    );
+  }
+  if (async->window == 0) {
+    async->copied = read_cached(file, buf, count, offset);
+  }
+  if (async->copied == count) {
+    async_complete(async, (ssize_t)count, 0);
+    return 0;
+  }
+  async_submit(async);
+  return 0;
+}
+
+int vtpc_write_async(
+    int fd, off_t offset, const void* buf, size_t count, vtpc_async_t* async
+) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (!is_writable(file->flags)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  async_init(async, fd, offset, (void*)buf, count, true);
+  async_submit(async);
+  return 0;
+}
+
+/* Called by the worker that took the operation. */
+void async_run(vtpc_async_t* async) {
+  const int fd = async->fd;
+  struct vtpc_file* file FILE_SCOPED = &vtpc_cache.files[fd];
+  stats_track(fd);
+  const size_t copied = async->copied;
+  const struct iovec iov = {
+      .iov_base = (char*)async->buf + copied,
+      .iov_len = async->count - copied,
+  };
+  struct vtpc_iter it = {.iov = &iov};
+  if (async->write) {
+    const ssize_t put = write_at(file, fd, &it, async->count, async->offset);
+    async_complete(async, put, put < 0 ? errno : 0);
+    return;
+  }
+
+  if (async->window > 0) {
+    prefetch(fd, file->node, async->ahead, async->window, true);
+  }
+  const ssize_t got = read_blocks(
+      file, fd, &it, iov.iov_len, async->offset + (off_t)copied
+  );
+  if (got < 0 && copied == 0) {
+    async_complete(async, -1, errno);
+  } else {
+    async_complete(async, (ssize_t)copied + (got > 0 ? got : 0), 0);
+  }
+}
+
+static off_t do_lseek(struct vtpc_file* file, off_t offset, int whence) {
+  off_t base = 0;
+  switch (whence) {
+    case SEEK_SET:
+      base = 0;
+      break;
+    case SEEK_CUR:
+      base = file->offset;
+      break;
+    case SEEK_END:
+      base = vtpc_cache.nodes[file->node].size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  file->offset = base + offset;
+  return file->offset;
 }
 
 off_t vtpc_lseek(int fd, off_t offset, int whence) {
-  return lseek(fd, offset, whence);
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&file->lock);
+  const off_t result = do_lseek(file, offset, whence);
+  pthread_mutex_unlock(&file->lock);
+  return result;
 }
 
+/* Writes back only the blocks of this file and waits for every write. */
 int vtpc_fsync(int fd) {
+  const struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  const int result = node_flush(file->node, -1, VTPC_NEVER);
+  node_wait_writeback(file->node);
+  if (result == -1) {
+    return -1;
+  }
   return fsync(fd);
 }
+
+static uint64_t timespec_ns(struct timespec ts) {
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int advise_time(
+    uint32_t node, uint64_t first, uint64_t last, uint64_t when
+) {
+  const struct vtpc_policy* policy = vtpc_cache.policy;
+  if (policy->advise == NULL) {
+    return 0;
+  }
+  for (uint64_t block = first; block <= last; ++block) {
+    struct vtpc_shard* shard = shard_of(node, block);
+    shard_lock(shard);
+    const uint32_t frame = index_find(shard, node, block);
+    policy->advise(
+        shard->policy_state,
+        frame == VTPC_NIL ? VTPC_NIL : frame - shard->base,
+        key_of(node, block),
+        when
+    );
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return 0;
+}
+
+static int advise_willneed(
+    int fd, uint32_t node, uint64_t first, uint64_t last
+) {
+  const off_t size = vtpc_cache.nodes[node].size;
+  for (uint64_t block = first; block <= last; ++block) {
+    if ((off_t)(block * VTPC_BLOCK_SIZE) >= size) {
+      break;
+    }
+    const uint32_t frame = frame_get(fd, node, block, VTPC_SECTORS_ALL);
+    if (frame == VTPC_NIL) {
+      return -1;
+    }
+    frame_put(frame, false);
+  }
+  return 0;
+}
+
+int vtpc_advise(int fd, off_t offset, off_t len, vtpc_access_hint_t hint) {
+  struct vtpc_file* file FILE_SCOPED = file_get(fd);
+  if (file == NULL) {
+    return -1;
+  }
+  if (offset < 0 || len < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  const off_t size = vtpc_cache.nodes[file->node].size;
+  const off_t end = len > 0 ? offset + len : (size > offset ? size : offset);
+  const uint64_t first = (uint64_t)offset / VTPC_BLOCK_SIZE;
+  const uint64_t last = end > offset ? (uint64_t)(end - 1) / VTPC_BLOCK_SIZE
+                                     : first;
+
+  switch (hint.advice) {
+    case VTPC_ADVICE_NORMAL:
+      file->sequential = false;
+      return advise_time(file->node, first, last, VTPC_NEVER);
+    case VTPC_ADVICE_AT:
+      return advise_time(file->node, first, last, timespec_ns(hint.time));
+    case VTPC_ADVICE_AFTER:
+      return advise_time(
+          file->node, first, last, cache_now() + timespec_ns(hint.time)
+      );
+    case VTPC_ADVICE_WILLNEED:
+      return advise_willneed(fd, file->node, first, last);
+    case VTPC_ADVICE_DONTNEED:
+      return node_drop_range(file->node, first, last);
+    case VTPC_ADVICE_SEQUENTIAL:
+      file->sequential = true;
+      return 0;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
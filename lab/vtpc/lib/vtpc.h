@@ -1,10 +1,231 @@
 #pragma once
 
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 
+typedef enum {
+  VTPC_POLICY_LRU,
+  VTPC_POLICY_CLOCK,
+  VTPC_POLICY_2Q,
+  VTPC_POLICY_LFU,
+  VTPC_POLICY_ARC,
+  VTPC_POLICY_MRU,
+  VTPC_POLICY_OPTIMAL,
+} vtpc_policy_t;
+
+typedef enum {
+  VTPC_ADVICE_NORMAL,
+  VTPC_ADVICE_AT,
+  VTPC_ADVICE_AFTER,
+  VTPC_ADVICE_WILLNEED,
+  VTPC_ADVICE_DONTNEED,
+  VTPC_ADVICE_SEQUENTIAL,
+} vtpc_advice_t;
+
+/*
+ * `time` is the absolute CLOCK_MONOTONIC time of the next access for
+ * VTPC_ADVICE_AT and the interval from now for VTPC_ADVICE_AFTER, it is
+ * ignored by other advices.
+ */
+typedef struct {
+  vtpc_advice_t advice;
+  struct timespec time;
+} vtpc_access_hint_t;
+
+/*
+ * Selects the eviction policy. Must be called before the first vtpc_open,
+ * otherwise fails with EBUSY. Without a call the policy is taken from the
+ * VTPC_POLICY environment variable (lru, clock, 2q, lfu, arc, mru,
+ * optimal), LRU by default.
+ *
+ * With VTPC_SHM set to a shared memory object name, processes using the
+ * same name share one cache and see each other's writes before they reach
+ * the disk. They use the policy of the process that created it. Writes of
+ * a process that dies before they are written back are lost unless another
+ * process has the file open.
+ */
+int vtpc_set_policy(vtpc_policy_t policy);
+
+/*
+ * VTPC_MEMORY is the memory the cache may use in bytes, with an optional K,
+ * M or G suffix. Frame data and metadata come from a single mapping of that
+ * size, backed by 2 MiB pages when possible. By default it is enough for
+ * 1024 blocks. VTPC_TIER_MEMORY adds that much memory where clean blocks
+ * evicted from the cache are kept compressed, unless the cache is shared.
+ * With VTPC_DEDUP=1 and a private cache, identical blocks share their data
+ * and the same memory holds up to four times as many blocks, such as the
+ * zeroes of sparse files or copies of the same data.
+ *
+ * With VTPC_MANIFEST set to a path, the blocks the process had cached are
+ * listed there on exit, and the next process started with the same path
+ * loads them again in the background from its first vtpc_open. Files that
+ * changed in between are skipped. The files it loads stay open until exit,
+ * so only the 64 hottest are loaded.
+ */
 int vtpc_open(const char* path, int mode, int access);
 int vtpc_close(int fd);
 ssize_t vtpc_read(int fd, void* buf, size_t count);
 ssize_t vtpc_write(int fd, const void* buf, size_t count);
+
+/*
+ * Read and write at `offset` without using or moving the file offset. Any
+ * number of threads may use them on the same fd at once, a read sees the
+ * data of a block either before or after each write to it, never between.
+ * The vectored ones fill or drain the buffers in order, as one request.
+ */
+ssize_t vtpc_pread(int fd, void* buf, size_t count, off_t offset);
+ssize_t vtpc_pwrite(int fd, const void* buf, size_t count, off_t offset);
+ssize_t vtpc_preadv(int fd, const struct iovec* iov, int iovcnt, off_t offset);
+ssize_t vtpc_pwritev(
+    int fd, const struct iovec* iov, int iovcnt, off_t offset
+);
+
+enum { VTPC_REF_BLOCKS = 64 };
+
+/*
+ * A read-only view of cached blocks of a file. `iov` describes the data,
+ * the remaining fields are private.
+ */
+typedef struct {
+  struct iovec iov[VTPC_REF_BLOCKS];
+  int iovcnt;
+  uint32_t count;
+  uint32_t frames[VTPC_REF_BLOCKS];
+} vtpc_ref_t;
+
+/*
+ * Like vtpc_pread, but pins the cached blocks and describes them in `ref`
+ * instead of copying them out. At most VTPC_REF_BLOCKS blocks are pinned,
+ * so fewer bytes than asked may be returned. Pinned blocks are never
+ * evicted: references should be few and short lived, and all of them
+ * released before the fd is closed. Writes to the range show through,
+ * except with VTPC_DEDUP=1 where a block sharing its data with another is
+ * copied to be written: references taken before keep the data they saw.
+ */
+ssize_t vtpc_read_ref(int fd, off_t offset, size_t len, vtpc_ref_t* ref);
+void vtpc_release(vtpc_ref_t* ref);
+
 off_t vtpc_lseek(int fd, off_t offset, int whence);
 int vtpc_fsync(int fd);
+
+/*
+ * Tells the cache how the range [offset, offset + len) will be accessed,
+ * len 0 means up to the end of the file. Access times are used by
+ * VTPC_POLICY_OPTIMAL. Those of blocks that are not cached are remembered
+ * until the block is loaded, for up to three times as many blocks as the
+ * cache holds, times given beyond that are ignored. The rest of the advices
+ * work with every policy: WILLNEED loads the range, DONTNEED writes it back
+ * and drops it, SEQUENTIAL drops blocks behind the reader once they are
+ * consumed.
+ */
+int vtpc_advise(int fd, off_t offset, off_t len, vtpc_access_hint_t hint);
+
+/*
+ * An asynchronous read or write, owned by the caller and left untouched
+ * until the operation completes. Before starting it set `callback` or
+ * `eventfd` (-1 for none), `data` is free for the caller.
+ *
+ * On completion `result` and `error` are set as the return value and errno
+ * of vtpc_pread or vtpc_pwrite would be, `callback` is called, then 1 is
+ * added to `eventfd`. The cache does not touch the operation once the
+ * callback is called. The callback runs on a cache worker thread, or on the
+ * calling thread before the start function returns when a read is served
+ * from the cache. The remaining fields are private.
+ */
+typedef struct vtpc_async {
+  void (*callback)(struct vtpc_async* async);
+  void* data;
+  int eventfd;
+  ssize_t result;
+  int error;
+
+  struct vtpc_async* next;
+  int fd;
+  int write;
+  off_t offset;
+  void* buf;
+  size_t count;
+  size_t copied;
+  uint64_t ahead;
+  uint32_t window;
+  uint64_t started;
+  int done;
+} vtpc_async_t;
+
+/*
+ * Start reading or writing `count` bytes at `offset`, like vtpc_pread and
+ * vtpc_pwrite. Return -1 without completing if the arguments are invalid.
+ * Every operation on a fd has to complete before it is closed. Misses and
+ * writes are served by VTPC_ASYNC_WORKERS threads, 4 by default.
+ */
+int vtpc_read_async(
+    int fd, off_t offset, void* buf, size_t count, vtpc_async_t* async
+);
+int vtpc_write_async(
+    int fd, off_t offset, const void* buf, size_t count, vtpc_async_t* async
+);
+
+/* Whether the operation completed, its results can be read then. */
+int vtpc_async_done(const vtpc_async_t* async);
+
+typedef enum {
+  VTPC_STAT_HITS,
+  VTPC_STAT_MISSES,
+  VTPC_STAT_BYTES_READ,
+  VTPC_STAT_BYTES_WRITTEN,
+  VTPC_STAT_EVICTIONS,
+  VTPC_STAT_WRITEBACKS,
+  VTPC_STAT_READAHEAD_HITS,
+  VTPC_STAT_PREFETCH_WASTED,
+  VTPC_STAT_TIER_HITS,
+  VTPC_STAT_TIER_BYTES,
+  VTPC_STAT_TIER_COMPRESSED,
+  VTPC_STAT_DEDUP_HITS,
+  VTPC_STAT_DEDUP_COPIES,
+  VTPC_STAT_COUNT,
+} vtpc_stat_t;
+
+typedef enum {
+  VTPC_LATENCY_READ,
+  VTPC_LATENCY_WRITE,
+  VTPC_LATENCY_DISK_READ,
+  VTPC_LATENCY_DISK_WRITE,
+  VTPC_LATENCY_COUNT,
+} vtpc_latency_t;
+
+enum { VTPC_LATENCY_BUCKETS = 32 };
+
+/*
+ * Hits and misses count block lookups, a miss being a block that was not
+ * cached or lacked the sectors asked for. Readahead hits are the first hits
+ * on blocks readahead loaded, wasted prefetches the blocks it loaded that
+ * were evicted or dropped before any use. Writebacks count blocks written
+ * back to disk. Tier hits count the blocks the compressed tier gave back
+ * instead of the disk, tier bytes the size of the blocks compressed into it
+ * and tier compressed the size they took there. Dedup hits count the blocks
+ * that took the page of an identical block, dedup copies the shared blocks
+ * that were copied to be written.
+ *
+ * Bucket i of a latency histogram counts the operations that took from 2^i
+ * to 2^(i+1) nanoseconds, the last one also the longer ones. Reads and
+ * writes include the asynchronous ones, disk latencies are those of every
+ * transfer the cache makes.
+ */
+typedef struct {
+  uint64_t counters[VTPC_STAT_COUNT];
+  uint64_t latency[VTPC_LATENCY_COUNT][VTPC_LATENCY_BUCKETS];
+} vtpc_stats_t;
+
+/*
+ * Fills `stats` with the counters of the fd since it was opened, or of the
+ * whole process for fd -1. Latency histograms are always process-wide, as
+ * are the events of background writeback. Counting is always on and costs
+ * no lock: threads keep their own counters, process-wide and for the fds
+ * they call on, summed up here.
+ *
+ * With VTPC_STATS_DUMP set to a path, or to "stderr", the process-wide stats
+ * are appended there on exit.
+ */
+int vtpc_stats(int fd, vtpc_stats_t* stats);
@@ -0,0 +1,743 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dedup.h"
+#include "io.h"
+#include "manifest.h"
+#include "policy.h"
+#include "shm.h"
+#include "stats.h"
+#include "tier.h"
+
+enum {
+  VTPC_FLUSH_INTERVAL_MS = 500,
+  VTPC_FRAME_SPANS = VTPC_SECTORS / 2,
+  VTPC_FLUSH_SPANS = 128,
+};
+
+void frame_set_dirty(
+    struct vtpc_shard* shard, uint32_t frame, uint8_t sectors
+) {
+  struct vtpc_cache* c = &vtpc_cache;
+  struct vtpc_frame* f = &c->frames[frame];
+  if (f->dirty != 0) {
+    f->dirty |= sectors;
+    return;
+  }
+
+  /* Counted first, a process dying halfway leaves too many at worst. */
+  atomic_fetch_add(&c->nodes[key_node(f->key)].dirty, 1);
+  const uint32_t dirty = atomic_fetch_add(&c->pool->dirty, 1) + 1;
+  f->dirty = sectors;
+  c->dirtied[frame] = cache_now();
+  vtpc_list_push(&shard->dirty, c->dirty_links, frame);
+  struct vtpc_list* list = &shard->nodes[key_node(f->key)];
+  vtpc_list_unlink(list, c->node_links, frame);
+  vtpc_list_push(list, c->node_links, frame);
+  if (dirty > c->dirty_high) {
+    pthread_cond_signal(&c->wakeup);
+  }
+}
+
+void frame_clean(struct vtpc_shard* shard, uint32_t frame) {
+  struct vtpc_cache* c = &vtpc_cache;
+  struct vtpc_frame* f = &c->frames[frame];
+  vtpc_list_unlink(&shard->dirty, c->dirty_links, frame);
+  struct vtpc_list* list = &shard->nodes[key_node(f->key)];
+  vtpc_list_unlink(list, c->node_links, frame);
+  vtpc_list_insert_after(list, c->node_links, list->tail, frame);
+  f->dirty = 0;
+  atomic_fetch_sub(&c->nodes[key_node(f->key)].dirty, 1);
+  atomic_fetch_sub(&c->pool->dirty, 1);
+}
+
+/* Returns the node's writeback fd, it stays open until released. */
+static int wfd_acquire(uint32_t node) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  node_lock(n);
+  const int fd = local->wfd;
+  if (fd != -1) {
+    local->users += 1;
+  }
+  pthread_mutex_unlock(&n->lock);
+  if (fd == -1) {
+    errno = EBADF;
+  }
+  return fd;
+}
+
+static void wfd_release(uint32_t node) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  node_lock(n);
+  local->users -= 1;
+  if (local->users == 0) {
+    event_wake(&n->idle);
+  }
+  pthread_mutex_unlock(&n->lock);
+}
+
+/* Whether this process has a writeback fd for the node. */
+bool node_writable(uint32_t node) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  node_lock(n);
+  const bool writable = vtpc_cache.locals[node].wfd != -1;
+  pthread_mutex_unlock(&n->lock);
+  return writable;
+}
+
+static void writeback_begin(uint32_t node, uint32_t frames) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  node_lock(n);
+  local->writeback += frames;
+  n->writeback |= 1ULL << vtpc_cache.slot;
+  pthread_mutex_unlock(&n->lock);
+}
+
+static void writeback_end(uint32_t node, uint32_t frames) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  node_lock(n);
+  local->writeback -= frames;
+  if (local->writeback == 0) {
+    n->writeback &= ~(1ULL << vtpc_cache.slot);
+  }
+  if (n->writeback == 0) {
+    event_wake(&n->idle);
+  }
+  pthread_mutex_unlock(&n->lock);
+}
+
+void node_wait_writeback(uint32_t node) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  node_lock(n);
+  while (n->writeback != 0) {
+    node_wait(n);
+  }
+  pthread_mutex_unlock(&n->lock);
+}
+
+/*
+ * Writeback inside the file takes the truncate lock shared, writes that cut
+ * the file back take it exclusively. It works across processes and is
+ * given back by shm_reap_node when its holder dies.
+ */
+static void truncate_lock(uint32_t node, bool exclusive) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  node_lock(n);
+  while (n->truncating != 0 || (exclusive && n->reading != 0)) {
+    node_wait(n);
+  }
+  if (exclusive) {
+    n->truncating = vtpc_cache.slot + 1;
+  } else {
+    vtpc_cache.locals[node].readers += 1;
+    n->reading |= 1ULL << vtpc_cache.slot;
+  }
+  pthread_mutex_unlock(&n->lock);
+}
+
+static void truncate_unlock(uint32_t node, bool exclusive) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  struct vtpc_node_local* local = &vtpc_cache.locals[node];
+  node_lock(n);
+  if (exclusive) {
+    n->truncating = 0;
+  } else if (--local->readers == 0) {
+    n->reading &= ~(1ULL << vtpc_cache.slot);
+  }
+  if (n->truncating == 0 && n->reading == 0) {
+    event_wake(&n->idle);
+  }
+  pthread_mutex_unlock(&n->lock);
+}
+
+/* A frame taken for writeback and the sectors to write from it. */
+struct vtpc_flush {
+  uint64_t block;
+  uint32_t frame;
+  uint8_t sectors;
+  bool failed;
+};
+
+/* Contiguous sectors of the frame of the `slot`-th flush entry. */
+struct vtpc_span {
+  uint32_t frame;
+  uint32_t slot;
+  uint32_t first;
+  uint32_t count;
+};
+
+static off_t span_pos(const struct vtpc_span* span) {
+  const uint64_t block = key_block(vtpc_cache.frames[span->frame].key);
+  return (off_t)(block * VTPC_BLOCK_SIZE + span->first * VTPC_SECTOR_SIZE);
+}
+
+static off_t span_end(const struct vtpc_span* span) {
+  return span_pos(span) + (off_t)span->count * VTPC_SECTOR_SIZE;
+}
+
+static uint32_t frame_spans(
+    const struct vtpc_flush* entry, uint32_t slot, struct vtpc_span* spans
+) {
+  uint32_t len = 0;
+  uint32_t first = 0;
+  while (first < VTPC_SECTORS) {
+    if ((entry->sectors & (1U << first)) == 0) {
+      first += 1;
+      continue;
+    }
+    uint32_t last = first + 1;
+    while (last < VTPC_SECTORS && (entry->sectors & (1U << last)) != 0) {
+      last += 1;
+    }
+    spans[len++] = (struct vtpc_span){entry->frame, slot, first, last - first};
+    first = last;
+  }
+  return len;
+}
+
+/* The dirty sectors of a frame, widened to the direct I/O alignment. */
+static uint8_t frame_flush_mask(uint32_t frame) {
+  const struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  const uint32_t align = vtpc_cache.nodes[key_node(f->key)].align;
+  const uint32_t unit = (1U << align) - 1;
+
+  uint32_t sectors = 0;
+  for (uint32_t s = 0; s < VTPC_SECTORS; s += align) {
+    if ((f->dirty & (unit << s)) != 0) {
+      sectors |= unit << s;
+    }
+  }
+  return (uint8_t)sectors;
+}
+
+/* A request that writes the run of adjacent spans starting at `start`. */
+static void run_prepare(
+    int fd,
+    const struct vtpc_span* spans,
+    uint32_t start,
+    uint32_t len,
+    struct iovec* iov,
+    struct vtpc_io* io
+) {
+  for (uint32_t i = start; i < start + len; ++i) {
+    const size_t at = (size_t)spans[i].first * VTPC_SECTOR_SIZE;
+    iov[i].iov_base = frame_data(spans[i].frame) + at;
+    iov[i].iov_len = (size_t)spans[i].count * VTPC_SECTOR_SIZE;
+  }
+  *io = (struct vtpc_io){
+      .fd = fd,
+      .op = VTPC_IO_WRITE,
+      .iov = iov + start,
+      .iovcnt = len,
+      .pos = span_pos(&spans[start]),
+  };
+}
+
+static int run_result(const struct vtpc_io* io) {
+  ssize_t expected = 0;
+  for (uint32_t i = 0; i < io->iovcnt; ++i) {
+    expected += (ssize_t)io->iov[i].iov_len;
+  }
+  if (io->result == expected) {
+    return 0;
+  }
+  errno = io->result < 0 ? io->error : EIO;
+  return -1;
+}
+
+/*
+ * Sectors are always written whole, so a run that ends past the logical
+ * size extends the file and has to cut it back. That is done exclusively,
+ * so that it never cuts a write that started after the size grew.
+ */
+static int flush_tail(uint32_t node, struct vtpc_io* io, off_t end) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  truncate_lock(node, true);
+  io_run(io, 1);
+  int result = run_result(io);
+  const off_t size = n->size;
+  if (result == 0 && end > size) {
+    result = ftruncate(io->fd, size);
+    end = size;
+  }
+  if (result == 0) {
+    atomic_max(&n->disk_size, end);
+  }
+  truncate_unlock(node, true);
+  return result;
+}
+
+static off_t run_end(
+    const struct vtpc_span* spans,
+    const struct iovec* iov,
+    const struct vtpc_io* io
+) {
+  return span_end(&spans[io->iov - iov + io->iovcnt - 1]);
+}
+
+static void run_failed(
+    const struct vtpc_span* spans,
+    const struct iovec* iov,
+    const struct vtpc_io* io,
+    struct vtpc_flush* batch
+) {
+  const uint32_t first = (uint32_t)(io->iov - iov);
+  for (uint32_t k = first; k < first + io->iovcnt; ++k) {
+    batch[spans[k].slot].failed = true;
+  }
+}
+
+/*
+ * Writes the spans in runs of adjacent sectors, marks failed entries. Runs
+ * inside the file are submitted together, the ones past its end one by one.
+ * `iov` and `ios` have room for `count` entries, the caller sizes them to
+ * what it writes so that writeback needs little stack on any thread.
+ */
+static int write_spans(
+    uint32_t node,
+    int fd,
+    const struct vtpc_span* spans,
+    uint32_t count,
+    struct vtpc_flush* batch,
+    struct iovec* iov,
+    struct vtpc_io* ios
+) {
+  struct vtpc_node* n = &vtpc_cache.nodes[node];
+  uint32_t inside = 0;
+  uint32_t past = count;
+  uint32_t start = 0;
+  while (start < count) {
+    uint32_t end = start + 1;
+    while (end < count &&
+           span_pos(&spans[end]) == span_end(&spans[end - 1])) {
+      end += 1;
+    }
+    const bool tail = span_end(&spans[end - 1]) > n->size;
+    struct vtpc_io* io = tail ? &ios[--past] : &ios[inside++];
+    run_prepare(fd, spans, start, end - start, iov, io);
+    start = end;
+  }
+
+  truncate_lock(node, false);
+  io_run(ios, inside);
+  truncate_unlock(node, false);
+
+  int result = 0;
+  int error = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (i >= inside && i < past) {
+      continue;
+    }
+    const off_t end = run_end(spans, iov, &ios[i]);
+    const int written = i < inside ? run_result(&ios[i])
+                                   : flush_tail(node, &ios[i], end);
+    if (written == -1) {
+      run_failed(spans, iov, &ios[i], batch);
+      error = errno;
+      result = -1;
+    } else if (i < inside) {
+      atomic_max(&n->disk_size, end);
+    }
+  }
+  errno = error;
+  return result;
+}
+
+/*
+ * Writes back a dirty idle frame. The lock is released for the write, the
+ * frame stays in place under writeback meanwhile. Returns 0 without writing
+ * if someone else takes the frame for writeback first.
+ */
+int frame_writeback(struct vtpc_shard* shard, uint32_t frame) {
+  struct vtpc_frame* f = &vtpc_cache.frames[frame];
+  const uint32_t node = key_node(f->key);
+  const int fd = wfd_acquire(node);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct vtpc_flush entry = {
+      key_block(f->key), frame, frame_flush_mask(frame), false
+  };
+  while ((entry.sectors & ~f->valid) != 0) {
+    if (block_fill(shard, fd, frame) == -1) {
+      wfd_release(node);
+      return -1;
+    }
+    if (f->writeback || f->dirty == 0) {
+      wfd_release(node);
+      return 0;
+    }
+    entry.sectors = frame_flush_mask(frame);
+  }
+  f->owner = (uint8_t)vtpc_cache.slot;
+  f->writeback = true;
+  frame_clean(shard, frame);
+  writeback_begin(node, 1);
+  pthread_mutex_unlock(&shard->lock);
+
+  struct vtpc_span spans[VTPC_FRAME_SPANS];
+  struct iovec iov[VTPC_FRAME_SPANS];
+  struct vtpc_io ios[VTPC_FRAME_SPANS];
+  const uint32_t count = frame_spans(&entry, 0, spans);
+  const int result = write_spans(node, fd, spans, count, &entry, iov, ios);
+  const int error = errno;
+
+  shard_lock(shard);
+  f->writeback = false;
+  if (entry.failed) {
+    frame_set_dirty(shard, frame, entry.sectors);
+  } else {
+    stats_add(VTPC_STAT_WRITEBACKS, 1);
+  }
+  shard_wake(shard);
+  writeback_end(node, 1);
+  wfd_release(node);
+  errno = error;
+  return result;
+}
+
+static int flush_order(const void* lhs, const void* rhs) {
+  const uint64_t a = ((const struct vtpc_flush*)lhs)->block;
+  const uint64_t b = ((const struct vtpc_flush*)rhs)->block;
+  return (a > b) - (a < b);
+}
+
+/*
+ * Takes up to a batch of the node's frames dirtied before `before` from the
+ * dirty heads of its lists in all shards and puts them under writeback.
+ * Cleaning a frame moves it behind the dirty ones.
+ */
+static uint32_t flush_collect(
+    uint32_t node, uint64_t before, struct vtpc_flush* batch
+) {
+  struct vtpc_cache* c = &vtpc_cache;
+  uint32_t len = 0;
+  for (uint32_t s = 0; s < VTPC_SHARDS && len < VTPC_FLUSH_BATCH; ++s) {
+    struct vtpc_shard* shard = &c->shards[s];
+    shard_lock(shard);
+    const uint32_t start = len;
+    uint32_t i = shard->nodes[node].head;
+    while (i != VTPC_NIL && len < VTPC_FLUSH_BATCH && c->frames[i].dirty != 0) {
+      struct vtpc_frame* f = &c->frames[i];
+      const uint32_t next = c->node_links[i].next;
+      if (c->dirtied[i] <= before) {
+        batch[len++] = (struct vtpc_flush){key_block(f->key), i, 0, false};
+        batch[len - 1].sectors = frame_flush_mask(i);
+        f->owner = (uint8_t)c->slot;
+        f->writeback = true;
+        frame_clean(shard, i);
+      }
+      i = next;
+    }
+    if (len > start) {
+      writeback_begin(node, len - start);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return len;
+}
+
+/*
+ * Loads the sectors that alignment adds to the write. A frame may have been
+ * taken while a writer was loading it.
+ */
+static void flush_fill(int fd, struct vtpc_flush* batch, uint32_t len) {
+  for (uint32_t k = 0; k < len; ++k) {
+    const struct vtpc_frame* f = &vtpc_cache.frames[batch[k].frame];
+    struct vtpc_shard* shard = shard_of_frame(batch[k].frame);
+    shard_lock(shard);
+    while (f->loading) {
+      shard_wait(shard);
+    }
+    if ((batch[k].sectors & ~f->valid) != 0 &&
+        block_fill(shard, fd, batch[k].frame) == -1) {
+      batch[k].failed = true;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+static void flush_complete(
+    uint32_t node, const struct vtpc_flush* batch, uint32_t len
+) {
+  for (uint32_t k = 0; k < len; ++k) {
+    const uint32_t frame = batch[k].frame;
+    struct vtpc_shard* shard = shard_of_frame(frame);
+    shard_lock(shard);
+    vtpc_cache.frames[frame].writeback = false;
+    if (batch[k].failed) {
+      frame_set_dirty(shard, frame, batch[k].sectors);
+    } else {
+      stats_add(VTPC_STAT_WRITEBACKS, 1);
+      dedup_merge(frame);
+    }
+    shard_wake(shard);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  writeback_end(node, len);
+}
+
+/*
+ * Writes the spans of a sorted batch, a chunk of frames at a time so that
+ * the requests fit on the stack: a run only breaks where a chunk ends.
+ */
+static int flush_write(
+    uint32_t node, int fd, struct vtpc_flush* batch, uint32_t len
+) {
+  struct vtpc_span spans[VTPC_FLUSH_SPANS];
+  struct iovec iov[VTPC_FLUSH_SPANS];
+  struct vtpc_io ios[VTPC_FLUSH_SPANS];
+  int result = 0;
+  int error = 0;
+  for (uint32_t k = 0; k < len;) {
+    uint32_t count = 0;
+    for (; k < len && count + VTPC_FRAME_SPANS <= VTPC_FLUSH_SPANS; ++k) {
+      if (!batch[k].failed) {
+        count += frame_spans(&batch[k], k, spans + count);
+      }
+    }
+    if (write_spans(node, fd, spans, count, batch, iov, ios) == -1) {
+      error = errno;
+      result = -1;
+    }
+  }
+  errno = error;
+  return result;
+}
+
+/*
+ * Writes back the node's blocks dirtied before `before` (and before the
+ * call), coalescing adjacent dirty sectors into one write. Uses the node's
+ * writeback fd when `fd` is -1. Does not wait for writes started by others.
+ */
+int node_flush(uint32_t node, int fd, uint64_t before) {
+  if (vtpc_cache.nodes[node].dirty == 0) {
+    return 0;
+  }
+  const bool shared = fd == -1;
+  if (shared && (fd = wfd_acquire(node)) == -1) {
+    return -1;
+  }
+  const uint64_t now = cache_now();
+  if (before > now) {
+    before = now;
+  }
+
+  struct vtpc_flush batch[VTPC_FLUSH_BATCH];
+  int result = 0;
+  for (;;) {
+    const uint32_t len = flush_collect(node, before, batch);
+    if (len == 0) {
+      break;
+    }
+
+    flush_fill(fd, batch, len);
+    qsort(batch, len, sizeof(batch[0]), flush_order);
+    int written = flush_write(node, fd, batch, len);
+    for (uint32_t k = 0; k < len; ++k) {
+      written = batch[k].failed ? -1 : written;
+    }
+    const int error = errno;
+    flush_complete(node, batch, len);
+    if (written == -1) {
+      errno = error;
+      result = -1;
+      break;
+    }
+  }
+
+  if (shared) {
+    wfd_release(node);
+  }
+  return result;
+}
+
+/*
+ * Every interval writes back blocks that stayed dirty longer than the expire
+ * time. When the number of dirty blocks goes over the high watermark it is
+ * woken up early and writes back everything until half of it is left. Other
+ * processes of a shared cache that found only dirty blocks they cannot
+ * write back to evict ask for everything to be written back too, and the
+ * state of dead ones is taken back.
+ */
+static void* flusher_main(void* arg) {
+  (void)arg;
+  struct vtpc_cache* c = &vtpc_cache;
+  _Atomic uint32_t* dirty = &c->pool->dirty;
+  uint32_t nodes[VTPC_MAX_FILES];
+
+  uint32_t left = UINT32_MAX;
+  uint32_t requests = c->pool->flush_requests;
+  pthread_mutex_lock(&c->lock);
+  for (;;) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)VTPC_FLUSH_INTERVAL_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    if (*dirty <= c->dirty_high || *dirty >= left) {
+      pthread_cond_timedwait(&c->wakeup, &c->lock, &deadline);
+    }
+
+    const uint64_t now = cache_now();
+    const bool pressure = *dirty > c->dirty_high;
+    const uint32_t requested = c->pool->flush_requests;
+    uint64_t before = 0;
+    if (pressure || requested != requests) {
+      before = now;
+    } else if (now > c->dirty_expire) {
+      before = now - c->dirty_expire;
+    }
+    requests = requested;
+
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+      if (c->locals[i].refs > 0 && c->nodes[i].dirty > 0) {
+        nodes[len++] = i;
+      }
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (c->shared) {
+      shm_reap();
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+      (void)node_flush(nodes[i], -1, before);
+      if (pressure && *dirty <= c->dirty_high / 2) {
+        break;
+      }
+    }
+    pthread_mutex_lock(&c->lock);
+    left = *dirty;
+  }
+  return NULL;
+}
+
+/*
+ * The locks of a shared pool are left alone, the other processes go on
+ * using them and the forking thread holds none of them.
+ */
+static void atfork_prepare(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  pthread_mutex_lock(&c->lock);
+  manifest_atfork_prepare();
+  for (uint32_t i = 0; i < VTPC_SHARDS && !c->shared; ++i) {
+    pthread_mutex_lock(&c->shards[i].lock);
+  }
+  for (uint32_t i = 0; i < VTPC_MAX_FILES && !c->shared; ++i) {
+    pthread_mutex_lock(&c->nodes[i].lock);
+  }
+  tier_atfork_prepare();
+  dedup_atfork_prepare();
+  stats_atfork_prepare();
+}
+
+static void atfork_parent(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  stats_atfork_parent();
+  dedup_atfork_parent();
+  tier_atfork_parent();
+  for (uint32_t i = 0; i < VTPC_MAX_FILES && !c->shared; ++i) {
+    pthread_mutex_unlock(&c->nodes[i].lock);
+  }
+  for (uint32_t i = 0; i < VTPC_SHARDS && !c->shared; ++i) {
+    pthread_mutex_unlock(&c->shards[i].lock);
+  }
+  manifest_atfork_parent();
+  pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Only the forking thread survives fork, so every lock of a private pool is
+ * reinitialized and the work other threads had in flight is undone: loads
+ * are abandoned, writes are redone later by the child. With a shared pool
+ * the parent finishes its work itself and the child attaches as a process
+ * of its own. The flusher is restarted by the next open.
+ */
+static void atfork_child(void) {
+  struct vtpc_cache* c = &vtpc_cache;
+  io_atfork_child();
+  async_atfork_child();
+  stats_atfork_child();
+  tier_atfork_child();
+  dedup_atfork_child();
+  manifest_atfork_child();
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->wakeup, NULL);
+  c->flusher = false;
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    c->locals[i].users = 0;
+    c->locals[i].writeback = 0;
+    c->locals[i].readers = 0;
+    pthread_mutex_init(&c->files[i].lock, NULL);
+    pthread_mutex_init(&c->files[i].streams_lock, NULL);
+  }
+  if (c->shared) {
+    shm_atfork_child();
+    return;
+  }
+
+  for (uint32_t i = 0; i < VTPC_SHARDS; ++i) {
+    struct vtpc_shard* shard = &c->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->changed.waiters = 0;
+  }
+  memset(c->pool->slots[0].pins, 0, c->frame_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < c->frame_count; ++i) {
+    struct vtpc_frame* f = &c->frames[i];
+    f->pins = 0;
+    f->loading = false;
+    if (f->writeback) {
+      f->writeback = false;
+      frame_set_dirty(shard_of_frame(i), i, f->valid);
+    }
+  }
+  for (uint32_t i = 0; i < VTPC_MAX_FILES; ++i) {
+    struct vtpc_node* n = &c->nodes[i];
+    pthread_mutex_init(&n->lock, NULL);
+    n->idle.waiters = 0;
+    n->reading = 0;
+    n->truncating = 0;
+    n->writeback = 0;
+  }
+}
+
+/* Called under the cache lock. */
+int flusher_start(void) {
+  static bool registered = false;
+  if (vtpc_cache.flusher) {
+    return 0;
+  }
+  if (!registered) {
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+    registered = true;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  const int error = pthread_create(&thread, &attr, flusher_main, NULL);
+  pthread_attr_destroy(&attr);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  vtpc_cache.flusher = true;
+  return 0;
+}
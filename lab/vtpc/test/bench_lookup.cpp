@@ -0,0 +1,122 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/bench_lookup";
+constexpr size_t block = 4096;
+constexpr size_t chunk = (1U << 20U);
+constexpr size_t lookups = (1U << 22U);
+constexpr std::array<size_t, 5> budgets = {
+    (4U << 20U), (16U << 20U), (64U << 20U), (256U << 20U), (1U << 30U)
+};
+
+void fill(size_t size) {
+  const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  const std::string data(chunk, 'x');
+  for (size_t pos = 0; fd != -1 && pos < size; pos += chunk) {
+    if (::pwrite(fd, data.data(), chunk, static_cast<off_t>(pos)) == -1) {
+      throw vt::exception() << "failed to write " << path;
+    }
+  }
+  ::close(fd);
+}
+
+/*
+ * Caches a quarter of the bytes the budget allows, then reads one byte of
+ * random cached blocks: every read is a hit, so the time is that of finding
+ * the block in the index.
+ */
+auto measure(size_t budget) -> int {
+  const size_t size = budget / 4;
+  ::setenv("VTPC_MEMORY", std::to_string(budget).c_str(), 1);
+  fill(size);
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  std::string buffer(chunk, ' ');
+  for (size_t pos = 0; pos < size; pos += chunk) {
+    ::vtpc_pread(fd, buffer.data(), chunk, static_cast<off_t>(pos));
+  }
+
+  const size_t blocks = size / block;
+  std::minstd_rand random(0);  // NOLINT
+  vtpc_stats_t before;
+  ::vtpc_stats(fd, &before);
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < lookups; ++i) {
+    const size_t pos = random() % blocks * block;
+    ::vtpc_pread(fd, buffer.data(), 1, static_cast<off_t>(pos));
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  vtpc_stats_t after;
+  ::vtpc_stats(fd, &after);
+  ::vtpc_close(fd);
+
+  const uint64_t misses = after.counters[VTPC_STAT_MISSES] -
+                          before.counters[VTPC_STAT_MISSES];
+  std::cout << std::setw(6) << (budget >> 20U) << " MiB" << std::setw(10)
+            << blocks << std::setw(12) << std::fixed << std::setprecision(2)
+            << static_cast<double>(lookups) / elapsed.count() / 1e6
+            << std::setw(10) << misses << '\n'
+            << std::flush;
+  return 0;
+}
+
+}  // namespace
+
+/*
+ * Lookup throughput as the cache grows: each budget is measured in a fresh
+ * process, the largest ones only when asked with the number to run.
+ */
+auto main(int argc, char** argv) -> int try {
+  size_t count = 4;
+  if (argc == 2) {
+    count = std::min<size_t>(
+        std::strtoul(argv[1], nullptr, 10), budgets.size()
+    );
+  }
+  std::cout << "memory      blocks   Mlookup/s    misses\n" << std::flush;
+  for (size_t i = 0; i < count; ++i) {
+    const pid_t pid = ::fork();
+    if (pid == -1) {
+      throw vt::exception() << "fork failed";
+    }
+    if (pid == 0) {
+      ::_exit(measure(budgets[i]));
+    }
+    int status = 0;
+    if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      throw vt::exception() << "measuring " << budgets[i] << " failed";
+    }
+  }
+  ::unlink(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
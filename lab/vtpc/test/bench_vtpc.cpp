@@ -0,0 +1,436 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+#include "options.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t chunk = (1U << 20U);
+constexpr size_t alignment = 4096;
+
+struct options {
+  std::string path = "/tmp/bench_vtpc";
+  std::vector<std::string> backends = {"libc", "vtpc", "direct"};
+  std::vector<std::string> workloads = {"seq", "uniform", "zipf", "mix"};
+  std::vector<size_t> threads = {1};
+  std::vector<size_t> writes = {0};
+  size_t block = 4096;
+  size_t size = (256U << 20U);
+  size_t cache = (64U << 20U);
+  size_t ops = (1U << 18U);
+  size_t warmup = 0;
+  size_t scan = 20;
+  double theta = 0.99;
+};
+
+constexpr auto usage =
+    "usage: bench_vtpc [name=value...]\n"
+    "  backends=libc,vtpc,direct  workloads=seq,uniform,zipf,mix\n"
+    "  threads=1  writes=0 (percent)  block=4K  size=256M  cache=64M\n"
+    "  ops=262144  warmup=0 (per thread)  scan=20 (percent of mix)\n"
+    "  theta=0.99 (zipf)  path=/tmp/bench_vtpc\n";
+
+auto parse(int argc, char** argv) -> options {
+  options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];  // NOLINT
+    const size_t eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value =
+        eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name == "backends") {
+      o.backends = vt::split(value);
+    } else if (name == "workloads") {
+      o.workloads = vt::split(value);
+    } else if (name == "threads") {
+      o.threads = vt::split_numbers(value);
+    } else if (name == "writes") {
+      o.writes = vt::split_numbers(value);
+    } else if (name == "block") {
+      o.block = vt::parse_size(value);
+    } else if (name == "size") {
+      o.size = vt::parse_size(value);
+    } else if (name == "cache") {
+      o.cache = vt::parse_size(value);
+    } else if (name == "ops") {
+      o.ops = vt::parse_size(value);
+    } else if (name == "warmup") {
+      o.warmup = vt::parse_size(value);
+    } else if (name == "scan") {
+      o.scan = std::stoull(value);
+    } else if (name == "theta") {
+      o.theta = std::stod(value);
+    } else if (name == "path") {
+      o.path = value;
+    } else {
+      throw vt::exception() << "unknown option '" << arg << "'\n" << usage;
+    }
+  }
+  if (!vt::known(o.backends, {"libc", "vtpc", "direct"}) ||
+      !vt::known(o.workloads, {"seq", "uniform", "zipf", "mix"}) ||
+      o.block == 0 || o.block % 512 != 0 || o.size < o.block || o.theta <= 0 ||
+      o.theta == 1 || o.scan > 100 ||
+      std::find(o.threads.begin(), o.threads.end(), 0) != o.threads.end()) {
+    throw vt::exception() << "bad options\n" << usage;
+  }
+  return o;
+}
+
+/*
+ * Ranks of a Zipfian distribution over n items, the most popular first, as
+ * generated by YCSB (Gray et al., "Quickly generating billion-record
+ * synthetic databases").
+ */
+class zipf {
+public:
+  zipf(uint64_t n, double theta)
+      : n_(n), theta_(theta), alpha_(1 / (1 - theta)) {
+    for (uint64_t i = 1; i <= n; ++i) {
+      zetan_ += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    const double zeta2 = 1 + 1 / std::pow(2.0, theta);
+    eta_ = (1 - std::pow(2.0 / static_cast<double>(n), 1 - theta)) /
+           (1 - zeta2 / zetan_);
+  }
+
+  auto operator()(std::mt19937_64& random) const -> uint64_t {
+    const double u = std::uniform_real_distribution<double>(0, 1)(random);
+    const double uz = u * zetan_;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta_)) {
+      return 1;
+    }
+    const auto rank = static_cast<uint64_t>(
+        static_cast<double>(n_) * std::pow(eta_ * u - eta_ + 1, alpha_)
+    );
+    return std::min(rank, n_ - 1);
+  }
+
+private:
+  uint64_t n_;
+  double theta_;
+  double alpha_;
+  double zetan_ = 0;
+  double eta_ = 0;
+};
+
+/*
+ * The blocks one thread accesses. Sequential threads each scan their own
+ * part of the file. Zipfian ranks are scattered over the file so that the
+ * hot set is not one run of blocks. The mix interleaves a sequential scan,
+ * `scan` percent of the accesses, with Zipfian point accesses.
+ */
+class workload {
+public:
+  workload(
+      const options& o,
+      const std::string& name,
+      const zipf& ranks,
+      size_t thread,
+      size_t threads
+  )
+      : name_(name),
+        ranks_(ranks),
+        random_(thread + 1),
+        blocks_(o.size / o.block),
+        cursor_(blocks_ * thread / threads),
+        scan_(o.scan) {
+    stride_ = vt::scatter % blocks_;
+    while (std::gcd(stride_, blocks_) != 1) {
+      stride_ += 1;
+    }
+  }
+
+  auto next() -> uint64_t {
+    if (name_ == "seq" ||
+        (name_ == "mix" && random_() % 100 < scan_)) {
+      cursor_ = (cursor_ + 1) % blocks_;
+      return cursor_;
+    }
+    if (name_ == "uniform") {
+      return random_() % blocks_;
+    }
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(ranks_(random_)) * stride_) %
+        blocks_
+    );
+  }
+
+  auto percent() -> uint64_t {
+    return random_() % 100;
+  }
+
+private:
+  std::string name_;
+  const zipf& ranks_;
+  std::mt19937_64 random_;
+  uint64_t blocks_;
+  uint64_t cursor_;
+  uint64_t scan_;
+  uint64_t stride_ = 1;
+};
+
+void fill(const options& o) {
+  const int fd = ::open(o.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  std::vector<uint64_t> data(chunk / sizeof(uint64_t));
+  std::mt19937_64 random(0);
+  for (size_t pos = 0; fd != -1 && pos < o.size; pos += chunk) {
+    /* Distinct blocks everywhere, nothing for dedup to share. */
+    std::generate(data.begin(), data.end(), std::ref(random));
+    const size_t len = std::min(chunk, o.size - pos);
+    if (::pwrite(fd, data.data(), len, static_cast<off_t>(pos)) !=
+        static_cast<ssize_t>(len)) {
+      throw vt::exception() << "failed to write " << o.path;
+    }
+  }
+  if (fd == -1 || ::fsync(fd) == -1) {
+    throw vt::exception() << "failed to write " << o.path;
+  }
+  ::close(fd);
+}
+
+/* Every backend starts cold: the kernel drops its copy of the file. */
+void drop_page_cache(const options& o) {
+  const int fd = ::open(o.path.c_str(), O_RDONLY);
+  if (fd != -1) {
+    (void)::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+auto open(const options& o, const std::string& backend)
+    -> std::unique_ptr<vt::file> {
+  if (backend == "libc") {
+    return vt::file::open_libc(o.path);
+  }
+  if (backend == "vtpc") {
+    ::setenv("VTPC_MEMORY", std::to_string(o.cache).c_str(), 1);
+    return vt::file::open_vtpc(o.path);
+  }
+  return vt::file::open_direct(o.path);
+}
+
+struct aligned_free {
+  void operator()(char* p) const {
+    std::free(p);  // NOLINT
+  }
+};
+
+/* Runs the accesses of one thread, with the latency of each in ns. */
+void run_thread(
+    vt::file& file,
+    const options& o,
+    workload& work,
+    size_t write_share,
+    size_t ops,
+    std::latch& start,
+    std::vector<uint64_t>& latencies
+) {
+  const std::unique_ptr<char, aligned_free> buffer(
+      static_cast<char*>(std::aligned_alloc(alignment, o.block))
+  );
+  std::memset(buffer.get(), 'w', o.block);
+  const auto access = [&] {
+    const auto offset = static_cast<off_t>(work.next() * o.block);
+    if (work.percent() < write_share) {
+      file.pwrite(buffer.get(), o.block, offset);
+    } else {
+      file.pread(buffer.get(), o.block, offset);
+    }
+  };
+  std::exception_ptr error;
+  try {
+    for (size_t i = 0; i < o.warmup; ++i) {
+      access();
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  latencies.reserve(ops);
+  start.arrive_and_wait();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  for (size_t i = 0; i < ops; ++i) {
+    const auto begin = std::chrono::steady_clock::now();
+    access();
+    const auto end = std::chrono::steady_clock::now();
+    latencies.push_back(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count()
+    ));
+  }
+}
+
+auto percentile(std::vector<uint64_t>& sorted, double p) -> double {
+  const auto at = std::min(
+      sorted.size() - 1,
+      static_cast<size_t>(p * static_cast<double>(sorted.size()))
+  );
+  return static_cast<double>(sorted[at]) / 1e3;
+}
+
+/* Measures one configuration in this process and prints its CSV row. */
+auto measure(
+    const options& o,
+    const std::string& backend,
+    const std::string& name,
+    size_t threads,
+    size_t write_share
+) -> int {
+  drop_page_cache(o);
+  const zipf ranks(o.size / o.block, o.theta);
+  auto file = open(o, backend);
+
+  const size_t per_thread = std::max<size_t>(o.ops / threads, 1);
+  std::vector<workload> works;
+  works.reserve(threads);
+  for (size_t id = 0; id < threads; ++id) {
+    works.emplace_back(o, name, ranks, id, threads);
+  }
+  std::vector<std::vector<uint64_t>> latencies(threads);
+  std::vector<std::exception_ptr> errors(threads);
+  std::latch start(static_cast<ptrdiff_t>(threads) + 1);
+  vtpc_stats_t before{};
+  vtpc_stats_t after{};
+
+  std::vector<std::thread> workers;
+  for (size_t id = 0; id < threads; ++id) {
+    workers.emplace_back([&, id] {
+      try {
+        run_thread(
+            *file,
+            o,
+            works[id],
+            write_share,
+            per_thread,
+            start,
+            latencies[id]
+        );
+      } catch (...) {
+        errors[id] = std::current_exception();
+      }
+    });
+  }
+  ::vtpc_stats(-1, &before);
+  start.arrive_and_wait();
+  const auto begin = std::chrono::steady_clock::now();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  ::vtpc_stats(-1, &after);
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  file.reset();
+
+  std::vector<uint64_t> all;
+  for (const auto& thread : latencies) {
+    all.insert(all.end(), thread.begin(), thread.end());
+  }
+  std::sort(all.begin(), all.end());
+  const auto ops = static_cast<double>(all.size());
+  const uint64_t hits = after.counters[VTPC_STAT_HITS] -
+                        before.counters[VTPC_STAT_HITS];
+  const uint64_t misses = after.counters[VTPC_STAT_MISSES] -
+                          before.counters[VTPC_STAT_MISSES];
+
+  std::cout << backend << ',' << name << ',' << threads << ',' << write_share
+            << ',' << o.block << ',' << o.size << ',' << o.cache << ','
+            << all.size() << ',' << std::fixed << std::setprecision(3)
+            << elapsed.count() << ',' << std::setprecision(0)
+            << ops / elapsed.count() << ',' << std::setprecision(2)
+            << ops * static_cast<double>(o.block) / elapsed.count() / 1e6
+            << ',' << percentile(all, 0.5) << ',' << percentile(all, 0.99)
+            << ',' << percentile(all, 0.999) << ',';
+  if (hits + misses > 0) {
+    std::cout << std::setprecision(4)
+              << static_cast<double>(hits) /
+                     static_cast<double>(hits + misses);
+  }
+  std::cout << '\n' << std::flush;
+  return 0;
+}
+
+}  // namespace
+
+/*
+ * Every combination of backend, workload, thread count and write share is
+ * measured in a fresh process, so each cache starts empty with its budget,
+ * and printed as a CSV row. Latencies are in microseconds, the hit ratio is
+ * that of the cache and is left empty for the other backends. The kernel
+ * page cache used by libc is not limited by `cache`, and writes left dirty
+ * at the end are written back after the clock stops.
+ */
+auto main(int argc, char** argv) -> int try {
+  const options o = parse(argc, argv);
+  fill(o);
+  std::cout << "backend,workload,threads,write_pct,block,size,cache,ops,"
+               "seconds,ops_per_s,mb_per_s,p50_us,p99_us,p999_us,hit_ratio\n"
+            << std::flush;
+  for (const size_t threads : o.threads) {
+    for (const auto& name : o.workloads) {
+      for (const size_t write_share : o.writes) {
+        for (const auto& backend : o.backends) {
+          const pid_t pid = ::fork();
+          if (pid == -1) {
+            throw vt::exception() << "fork failed";
+          }
+          if (pid == 0) {
+            try {
+              ::_exit(measure(o, backend, name, threads, write_share));
+            } catch (const std::exception& e) {
+              std::cerr << "exception: " << e.what() << '\n';
+              ::_exit(1);
+            }
+          }
+          int status = 0;
+          if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+              WEXITSTATUS(status) != 0) {
+            throw vt::exception()
+                << "measuring " << backend << ' ' << name << " failed";
+          }
+        }
+      }
+    }
+  }
+  ::unlink(o.path.c_str());
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
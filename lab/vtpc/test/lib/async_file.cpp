@@ -0,0 +1,227 @@
+#include "async_file.hpp"
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <utility>
+
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace vt {
+
+namespace {
+
+constexpr auto flags = O_RDWR | O_CREAT;
+constexpr auto access = 0777;
+
+enum : int {
+  submitting = 0,
+  suspended = 1,
+  completed = 2,
+};
+
+}  // namespace
+
+auto task::promise_type::get_return_object() -> task {
+  return task(handle::from_promise(*this));
+}
+
+auto task::promise_type::initial_suspend() noexcept -> std::suspend_always {
+  return {};
+}
+
+auto task::promise_type::final_suspend() noexcept -> std::suspend_always {
+  return {};
+}
+
+void task::promise_type::return_void() {
+}
+
+void task::promise_type::unhandled_exception() {
+  error = std::current_exception();
+}
+
+task::task(handle handle) : handle_(handle) {
+}
+
+task::task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {
+}
+
+task::~task() {
+  if (handle_) {
+    handle_.destroy();
+  }
+}
+
+io_loop::io_loop() : eventfd_(::eventfd(0, EFD_CLOEXEC)) {
+  if (eventfd_ == -1) {
+    throw vt::exception() << "failed to create eventfd: "
+                          << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
+  }
+}
+
+io_loop::~io_loop() {
+  const std::lock_guard lock(mutex_);
+  for (auto handle : tasks_) {
+    handle.destroy();
+  }
+  ::close(eventfd_);
+}
+
+void io_loop::spawn(task task) {
+  const auto handle = std::exchange(task.handle_, {});
+  tasks_.push_back(handle);
+  post(handle);
+}
+
+/* The eventfd is written under the lock, so it outlives every post. */
+void io_loop::post(std::coroutine_handle<> handle) {
+  const std::lock_guard lock(mutex_);
+  ready_.push_back(handle);
+  const uint64_t one = 1;
+  (void)::write(eventfd_, &one, sizeof(one));
+}
+
+/* A failed task does not stop the others, its error is thrown at the end. */
+void io_loop::run() {
+  std::vector<std::coroutine_handle<>> ready;
+  std::exception_ptr first;
+  while (!tasks_.empty()) {
+    {
+      const std::lock_guard lock(mutex_);
+      ready.swap(ready_);
+    }
+    if (ready.empty()) {
+      uint64_t count = 0;
+      (void)::read(eventfd_, &count, sizeof(count));
+      continue;
+    }
+    for (auto handle : ready) {
+      handle.resume();
+    }
+    ready.clear();
+
+    for (size_t i = 0; i < tasks_.size();) {
+      const auto handle = tasks_[i];
+      if (!handle.done()) {
+        ++i;
+        continue;
+      }
+      if (!first) {
+        first = handle.promise().error;
+      }
+      handle.destroy();
+      tasks_[i] = tasks_.back();
+      tasks_.pop_back();
+    }
+  }
+  if (first) {
+    std::rethrow_exception(first);
+  }
+}
+
+async_op::async_op(
+    io_loop& loop,
+    int fd,
+    bool write,
+    char* buffer,
+    size_t count,
+    off_t offset
+)
+    : loop_(&loop)
+    , fd_(fd)
+    , write_(write)
+    , buffer_(buffer)
+    , count_(count)
+    , offset_(offset) {
+}
+
+auto async_op::await_ready() const noexcept -> bool {
+  return false;
+}
+
+/*
+ * The operation may complete before it is started or before the coroutine
+ * is suspended, then the coroutine just goes on.
+ */
+auto async_op::await_suspend(std::coroutine_handle<> handle) -> bool {
+  handle_ = handle;
+  async_.callback = &async_op::complete;
+  async_.data = this;
+  async_.eventfd = -1;
+  const int started =
+      write_ ? ::vtpc_write_async(fd_, offset_, buffer_, count_, &async_)
+             : ::vtpc_read_async(fd_, offset_, buffer_, count_, &async_);
+  if (started == -1) {
+    error_ = errno;
+    return false;
+  }
+  int expected = submitting;
+  return state_.compare_exchange_strong(expected, suspended);
+}
+
+auto async_op::await_resume() const -> size_t {
+  const int error = error_ != 0 ? error_ : async_.error;
+  if (error_ != 0 || async_.result < 0) {
+    throw vt::file_exception(-1)
+        << "failed to read/write " << count_ << " bytes at " << offset_
+        << " from file with fd " << fd_ << ": "
+        << strerror(error);  // NOLINT(concurrency-mt-unsafe)
+  }
+  return static_cast<size_t>(async_.result);
+}
+
+void async_op::complete(vtpc_async_t* async) {
+  auto* self = static_cast<async_op*>(async->data);
+  io_loop* loop = self->loop_;
+  const auto handle = self->handle_;
+  if (self->state_.exchange(completed) == suspended) {
+    loop->post(handle);
+  }
+}
+
+async_file::async_file(std::string_view path, io_loop& loop)
+    : loop_(&loop), fd_(::vtpc_open(path.data(), flags, access)) {
+  if (fd_ < 0) {
+    throw vt::file_exception(fd_)
+        << "failed to open file '" << path << "'" << ": "
+        << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
+  }
+}
+
+async_file::~async_file() {
+  (void)::vtpc_close(fd_);
+}
+
+auto async_file::read(char* buffer, size_t count, off_t offset) -> async_op {
+  return {*loop_, fd_, false, buffer, count, offset};
+}
+
+auto async_file::write(const char* buffer, size_t count, off_t offset)
+    -> async_op {
+  return {*loop_, fd_, true, const_cast<char*>(buffer), count, offset};
+}
+
+void async_file::sync() {
+  if (::vtpc_fsync(fd_) == -1) {
+    throw vt::file_exception(-1)
+        << "failed to fsync file with fd " << fd_ << ": "
+        << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
+  }
+}
+
+}  // namespace vt
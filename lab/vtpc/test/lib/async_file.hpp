@@ -0,0 +1,122 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace vt {
+
+class task {
+public:
+  struct promise_type {
+    std::exception_ptr error;
+
+    auto get_return_object() -> task;
+    auto initial_suspend() noexcept -> std::suspend_always;
+    auto final_suspend() noexcept -> std::suspend_always;
+    void return_void();
+    void unhandled_exception();
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+
+  task(const task&) = delete;
+  task(task&& other) noexcept;
+  auto operator=(const task&) -> task& = delete;
+  auto operator=(task&& other) -> task& = delete;
+  ~task();
+
+private:
+  friend class io_loop;
+
+  explicit task(handle handle);
+
+  handle handle_;
+};
+
+/*
+ * Runs tasks on the calling thread. A task waiting for a vtpc operation is
+ * resumed by `run` once the operation completes, so a single thread keeps
+ * many operations in flight.
+ */
+class io_loop {
+public:
+  io_loop();
+  io_loop(const io_loop&) = delete;
+  auto operator=(const io_loop&) -> io_loop& = delete;
+  ~io_loop();
+
+  void spawn(task task);
+  void run();
+
+  /* Schedules the coroutine to be resumed by `run`, from any thread. */
+  void post(std::coroutine_handle<> handle);
+
+private:
+  int eventfd_;
+  std::mutex mutex_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::vector<task::handle> tasks_;
+};
+
+class async_op {
+public:
+  async_op(
+      io_loop& loop,
+      int fd,
+      bool write,
+      char* buffer,
+      size_t count,
+      off_t offset
+  );
+  async_op(const async_op&) = delete;
+  auto operator=(const async_op&) -> async_op& = delete;
+  ~async_op() = default;
+
+  [[nodiscard]] auto await_ready() const noexcept -> bool;
+  auto await_suspend(std::coroutine_handle<> handle) -> bool;
+  auto await_resume() const -> size_t;
+
+private:
+  static void complete(vtpc_async_t* async);
+
+  io_loop* loop_;
+  int fd_;
+  bool write_;
+  char* buffer_;
+  size_t count_;
+  off_t offset_;
+  int error_ = 0;
+  vtpc_async_t async_{};
+  std::coroutine_handle<> handle_;
+  std::atomic<int> state_ = 0;
+};
+
+/* A vtpc file whose positional reads and writes are awaited. */
+class async_file {
+public:
+  async_file(std::string_view path, io_loop& loop);
+  async_file(const async_file&) = delete;
+  auto operator=(const async_file&) -> async_file& = delete;
+  ~async_file();
+
+  auto read(char* buffer, size_t count, off_t offset) -> async_op;
+  auto write(const char* buffer, size_t count, off_t offset) -> async_op;
+  void sync();
+
+private:
+  io_loop* loop_;
+  int fd_;
+};
+
+}  // namespace vt
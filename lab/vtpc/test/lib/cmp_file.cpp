@@ -1,13 +1,16 @@
 #include "cmp_file.hpp"
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <cstddef>
 #include <cstring>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "exception.hpp"
 #include "file.hpp"
@@ -52,17 +55,27 @@ cmp_file::cmp_file(std::unique_ptr<file> lhs, std::unique_ptr<file> rhs)
     : lhs_(std::move(lhs)), file_(std::move(rhs)) {
 }
 
+auto cmp_file::scratch(size_t count) -> char* {
+  if (scratch_.size() < count) {
+    scratch_.resize(count);
+  }
+  return scratch_.data();
+}
+
+void cmp_file::check(const char* lhs, const char* rhs, size_t count) const {
+  if (memcmp(lhs, rhs, count) != 0) {
+    throw vt::cmp_file_exception()
+        << "'" << std::string_view(lhs, count) << "' != '"
+        << std::string_view(rhs, count) << "'";
+  }
+}
+
 auto cmp_file::read(char* buffer, size_t count) -> void {
-  std::string lhs(count, ' ');
-  std::string rhs(count, ' ');
+  char* rhs = scratch(count);
   Compare(
-      [&] { lhs_->read(lhs.data(), count); },
-      [&] { file_->read(rhs.data(), count); }
+      [&] { lhs_->read(buffer, count); }, [&] { file_->read(rhs, count); }
   );
-  if (lhs != rhs) {
-    throw vt::cmp_file_exception() << "'" << lhs << "' != '" << rhs << "'";
-  }
-  memcpy(buffer, lhs.data(), count);
+  check(buffer, rhs, count);
 }
 
 auto cmp_file::write(const char* buffer, size_t count) -> void {
@@ -79,4 +92,55 @@ auto cmp_file::sync() -> void {
   Compare([&] { lhs_->sync(); }, [this] { file_->sync(); });
 }
 
+auto cmp_file::pread(char* buffer, size_t count, off_t offset) -> void {
+  char* rhs = scratch(count);
+  Compare(
+      [&] { lhs_->pread(buffer, count, offset); },
+      [&] { file_->pread(rhs, count, offset); }
+  );
+  check(buffer, rhs, count);
+}
+
+auto cmp_file::pwrite(const char* buffer, size_t count, off_t offset)
+    -> void {
+  Compare(
+      [&] { lhs_->pwrite(buffer, count, offset); },
+      [&] { file_->pwrite(buffer, count, offset); }
+  );
+}
+
+/*
+ * The right side reads into the scratch buffer, split like the caller's
+ * buffers, and each of them is checked against its part.
+ */
+auto cmp_file::preadv(const iovec* iov, int iovcnt, off_t offset) -> void {
+  size_t count = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    count += iov[i].iov_len;
+  }
+  char* rhs = scratch(count);
+  scratch_iov_.assign(iov, iov + iovcnt);
+  size_t at = 0;
+  for (auto& part : scratch_iov_) {
+    part.iov_base = rhs + at;
+    at += part.iov_len;
+  }
+  Compare(
+      [&] { lhs_->preadv(iov, iovcnt, offset); },
+      [&] { file_->preadv(scratch_iov_.data(), iovcnt, offset); }
+  );
+  at = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    check(static_cast<const char*>(iov[i].iov_base), rhs + at, iov[i].iov_len);
+    at += iov[i].iov_len;
+  }
+}
+
+auto cmp_file::pwritev(const iovec* iov, int iovcnt, off_t offset) -> void {
+  Compare(
+      [&] { lhs_->pwritev(iov, iovcnt, offset); },
+      [&] { file_->pwritev(iov, iovcnt, offset); }
+  );
+}
+
 }  // namespace vt
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <cstddef>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "exception.hpp"
 #include "file.hpp"
@@ -24,10 +27,21 @@ public:
   auto write(const char* buffer, size_t count) -> void override;
   auto seek(off_t offset) -> void override;
   auto sync() -> void override;
+  auto pread(char* buffer, size_t count, off_t offset) -> void override;
+  auto pwrite(const char* buffer, size_t count, off_t offset)
+      -> void override;
+  auto preadv(const iovec* iov, int iovcnt, off_t offset) -> void override;
+  auto pwritev(const iovec* iov, int iovcnt, off_t offset) -> void override;
 
 private:
+  auto scratch(size_t count) -> char*;
+  void check(const char* lhs, const char* rhs, size_t count) const;
+
   std::unique_ptr<file> lhs_;
   std::unique_ptr<file> file_;
+  /* The right side reads here, the left one into the caller's buffers. */
+  std::string scratch_;
+  std::vector<iovec> scratch_iov_;
 };
 
 }  // namespace vt
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <charconv>
 #include <exception>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <utility>
 
 namespace vt {
 
@@ -12,18 +16,29 @@ public:
 
   [[nodiscard]]
   auto what() const noexcept -> const char* override {
-    message_ = buffer_.str();
     return message_.c_str();
   }
 
+  /* Text and integers are appended directly, anything else via a stream. */
   template <class T>
   void Append(const T& t) {
-    buffer_ << t;
+    if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+      message_ += std::string_view(t);
+    } else if constexpr (std::is_same_v<T, char>) {
+      message_ += t;
+    } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+      char digits[24];  // NOLINT
+      const auto result = std::to_chars(digits, digits + sizeof(digits), t);
+      message_.append(digits, result.ptr);
+    } else {
+      std::ostringstream stream;
+      stream << t;
+      message_ += stream.str();
+    }
   }
 
 private:
-  mutable std::stringstream buffer_;
-  mutable std::string message_;
+  std::string message_;
 };
 
 template <class E, class T>
@@ -33,4 +48,4 @@ static auto operator<<(E&& e [[clang::lifetimebound]], const T& t) -> E&& {
   return std::forward<E>(e);
 }
 
-}  // namespace vt
\ No newline at end of file
+}  // namespace vt
@@ -4,16 +4,17 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
-#include <functional>
 #include <memory>
 #include <string_view>
-#include <utility>
+#include <type_traits>
+#include <vector>
 
 #include "exception.hpp"
 
 extern "C" {
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "vtpc.h"
@@ -31,15 +32,52 @@ auto file_exception::code() const -> ssize_t {
   return code_;
 }
 
-struct io {
-  std::function<int(const char* path, int mode, int access)> open;
-  std::function<int(int fd)> close;
-  std::function<ssize_t(int fd, void* buf, size_t count)> read;
-  std::function<ssize_t(int fd, const void* buf, size_t count)> write;
-  std::function<off_t(int fd, off_t offset, int whence)> lseek;
-  std::function<int(int fd)> fsync;
+/* Backends are structs of static calls, bound to io_file at compile time. */
+struct libc_io {
+  static constexpr auto open = ::open;
+  static constexpr auto close = ::close;
+  static constexpr auto read = ::read;
+  static constexpr auto write = ::write;
+  static constexpr auto lseek = ::lseek;
+  static constexpr auto fsync = ::fsync;
+  static constexpr auto pread = ::pread;
+  static constexpr auto pwrite = ::pwrite;
+  static constexpr auto preadv = ::preadv;
+  static constexpr auto pwritev = ::pwritev;
 };
 
+struct vtpc_io {
+  static constexpr auto open = ::vtpc_open;
+  static constexpr auto close = ::vtpc_close;
+  static constexpr auto read = ::vtpc_read;
+  static constexpr auto write = ::vtpc_write;
+  static constexpr auto lseek = ::vtpc_lseek;
+  static constexpr auto fsync = ::vtpc_fsync;
+  static constexpr auto pread = ::vtpc_pread;
+  static constexpr auto pwrite = ::vtpc_pwrite;
+  static constexpr auto preadv = ::vtpc_preadv;
+  static constexpr auto pwritev = ::vtpc_pwritev;
+};
+
+struct direct_io : libc_io {
+  static auto open(const char* path, int mode, int access) -> int {
+    return ::open(path, mode | O_DIRECT, access);
+  }
+};
+
+void check_progress(ssize_t local, int fd, size_t count, size_t total) {
+  if (local < 0) {
+    throw vt::file_exception(local)
+        << "failed to read/write " << count << " bytes from file with fd "
+        << fd << ": " << strerror(errno);  // NOLINT(concurrency-mt-unsafe);
+  }
+  if (local == 0) {
+    throw vt::file_exception(0)
+        << "failed to read/write " << count << " bytes from file with fd "
+        << fd << ": " << "EOF after reading " << total << " bytes";
+  }
+}
+
 template <class A, class T>
 void robust_do(A action, int fd, T* buf, size_t count) {
   using B = std::conditional_t<
@@ -52,25 +90,84 @@ void robust_do(A action, int fd, T* buf, size_t count) {
     const size_t tail_count = count - total;
     B* tail_buf = reinterpret_cast<B*>(buf) + total;  // NOLINT
     const ssize_t local = action(fd, tail_buf, tail_count);
-    if (local < 0) {
-      throw vt::file_exception(local)
-          << "failed to read/write " << count << " bytes from file with fd "
-          << fd << ": " << strerror(errno);  // NOLINT(concurrency-mt-unsafe);
+    check_progress(local, fd, count, total);
+    total += local;
+  }
+}
+
+template <class A, class T>
+void robust_do_at(A action, int fd, T* buf, size_t count, off_t offset) {
+  robust_do(
+      [&](int at_fd, T* at_buf, size_t at_count) {
+        return action(at_fd, at_buf, at_count, offset);
+      },
+      fd,
+      buf,
+      count
+  );
+}
+
+/*
+ * Like robust_do, skipping what was transferred before each retry. Only a
+ * partial transfer copies the vector, into `rest`.
+ */
+template <class A>
+void robust_do_vec(
+    A action,
+    int fd,
+    const iovec* iov,
+    int iovcnt,
+    off_t offset,
+    std::vector<iovec>& rest
+) {
+  size_t count = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    count += iov[i].iov_len;  // NOLINT
+  }
+  if (count == 0) {
+    return;
+  }
+
+  ssize_t local = action(fd, iov, iovcnt, offset);
+  check_progress(local, fd, count, 0);
+  if (static_cast<size_t>(local) == count) {
+    return;
+  }
+
+  rest.assign(iov, iov + iovcnt);
+  size_t first = 0;
+  size_t total = 0;
+  while (true) {
+    total += local;
+    if (total == count) {
+      return;
     }
-    if (local == 0) {
-      throw vt::file_exception(0)
-          << "failed to read/write " << count << " bytes from file with fd "
-          << fd << ": " << "EOF after reading " << total << " bytes";
+
+    auto skip = static_cast<size_t>(local);
+    while (skip > 0 && skip >= rest[first].iov_len) {
+      skip -= rest[first].iov_len;
+      ++first;
+    }
+    if (skip > 0) {
+      rest[first].iov_base = static_cast<char*>(rest[first].iov_base) + skip;
+      rest[first].iov_len -= skip;
     }
 
-    total += local;
+    local = action(
+        fd,
+        rest.data() + first,
+        static_cast<int>(rest.size() - first),
+        offset + static_cast<off_t>(total)
+    );
+    check_progress(local, fd, count, total);
   }
 }
 
+template <class IO>
 class io_file final : public file {
 public:
-  explicit io_file(std::string_view path, io io)
-      : fd_(io.open(path.data(), flags, access)), io_(std::move(io)) {
+  explicit io_file(std::string_view path)
+      : fd_(IO::open(path.data(), flags, access)) {
     if (fd_ < 0) {
       throw vt::file_exception(fd_)
           << "failed to open file '" << path << "'" << ": "
@@ -79,19 +176,19 @@ public:
   }
 
   ~io_file() override {
-    (void)io_.close(fd_);
+    (void)IO::close(fd_);
   }
 
   void read(char* buffer, size_t count) override {
-    robust_do(io_.read, fd_, buffer, count);
+    robust_do(IO::read, fd_, buffer, count);
   }
 
   void write(const char* buffer, size_t count) override {
-    robust_do(io_.write, fd_, buffer, count);
+    robust_do(IO::write, fd_, buffer, count);
   }
 
   void seek(off_t offset) override {
-    if (io_.lseek(fd_, offset, SEEK_SET) == -1) {
+    if (IO::lseek(fd_, offset, SEEK_SET) == -1) {
       throw vt::file_exception(-1)
           << "failed to seek to offset " << offset << "file with fd " << fd_
           << ": " << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
@@ -99,42 +196,44 @@ public:
   }
 
   void sync() override {
-    if (io_.fsync(fd_) == -1) {
+    if (IO::fsync(fd_) == -1) {
       throw vt::file_exception(-1)
           << "failed to fsync file with fd " << fd_ << ": "
           << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
     }
   }
 
+  void pread(char* buffer, size_t count, off_t offset) override {
+    robust_do_at(IO::pread, fd_, buffer, count, offset);
+  }
+
+  void pwrite(const char* buffer, size_t count, off_t offset) override {
+    robust_do_at(IO::pwrite, fd_, buffer, count, offset);
+  }
+
+  void preadv(const iovec* iov, int iovcnt, off_t offset) override {
+    robust_do_vec(IO::preadv, fd_, iov, iovcnt, offset, rest_);
+  }
+
+  void pwritev(const iovec* iov, int iovcnt, off_t offset) override {
+    robust_do_vec(IO::pwritev, fd_, iov, iovcnt, offset, rest_);
+  }
+
 private:
   int fd_;
-  io io_;
+  std::vector<iovec> rest_;
 };
 
 auto file::open_libc(std::string_view path) -> std::unique_ptr<file> {
-  io io = {
-      .open = ::open,
-      .close = ::close,
-      .read = ::read,
-      .write = ::write,
-      .lseek = ::lseek,
-      .fsync = ::fsync,
-  };
-
-  return std::make_unique<io_file>(path, std::move(io));
+  return std::make_unique<io_file<libc_io>>(path);
 }
 
 auto file::open_vtpc(std::string_view path) -> std::unique_ptr<file> {
-  io io = {
-      .open = ::vtpc_open,
-      .close = ::vtpc_close,
-      .read = ::vtpc_read,
-      .write = ::vtpc_write,
-      .lseek = ::vtpc_lseek,
-      .fsync = ::vtpc_fsync,
-  };
-
-  return std::make_unique<io_file>(path, std::move(io));
+  return std::make_unique<io_file<vtpc_io>>(path);
+}
+
+auto file::open_direct(std::string_view path) -> std::unique_ptr<file> {
+  return std::make_unique<io_file<direct_io>>(path);
 }
 
 }  // namespace vt
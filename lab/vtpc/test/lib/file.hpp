@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <cstddef>
 #include <memory>
@@ -29,6 +30,14 @@ public:
   virtual auto seek(off_t offset) -> void = 0;
   virtual auto sync() -> void = 0;
 
+  virtual auto pread(char* buffer, size_t count, off_t offset) -> void = 0;
+  virtual auto pwrite(const char* buffer, size_t count, off_t offset)
+      -> void = 0;
+  virtual auto preadv(const iovec* iov, int iovcnt, off_t offset)
+      -> void = 0;
+  virtual auto pwritev(const iovec* iov, int iovcnt, off_t offset)
+      -> void = 0;
+
   auto write(std::string_view text) -> void {
     write(text.data(), text.size());
   }
@@ -41,6 +50,9 @@ public:
 
   static auto open_libc(std::string_view path) -> std::unique_ptr<file>;
   static auto open_vtpc(std::string_view path) -> std::unique_ptr<file>;
+
+  /* Bypasses every cache: buffers, sizes and offsets must be aligned. */
+  static auto open_direct(std::string_view path) -> std::unique_ptr<file>;
 };
 
 }  // namespace vt
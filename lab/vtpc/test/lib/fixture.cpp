@@ -0,0 +1,77 @@
+#include "fixture.hpp"
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace vt {
+
+auto stats_of(int fd) -> vtpc_stats_t {
+  vtpc_stats_t stats;
+  if (::vtpc_stats(fd, &stats) == -1) {
+    throw vt::exception() << "vtpc_stats failed for fd " << fd;
+  }
+  return stats;
+}
+
+auto stat_of(int fd, vtpc_stat_t stat) -> uint64_t {
+  return stats_of(fd).counters[stat];
+}
+
+auto samples(const vtpc_stats_t& stats, vtpc_latency_t kind) -> uint64_t {
+  const auto& buckets = stats.latency[kind];
+  return std::accumulate(std::begin(buckets), std::end(buckets), uint64_t{0});
+}
+
+auto disk_reads() -> uint64_t {
+  return samples(stats_of(-1), VTPC_LATENCY_DISK_READ);
+}
+
+auto open_new(const char* path) -> int {
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path;
+  }
+  return fd;
+}
+
+void write_at(int fd, const std::string& data, size_t pos) {
+  if (::vtpc_pwrite(fd, data.data(), data.size(), static_cast<off_t>(pos)) !=
+      static_cast<ssize_t>(data.size())) {
+    throw vt::exception() << "write at " << pos << " failed";
+  }
+}
+
+auto disk_contents(const char* path) -> std::string {
+  struct stat st {};
+  const int fd = ::open(path, O_RDONLY);
+  if (fd == -1 || ::fstat(fd, &st) == -1) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+    throw vt::exception() << "failed to open " << path;
+  }
+  std::string data(static_cast<size_t>(st.st_size), ' ');
+  const ssize_t got = ::pread(fd, data.data(), data.size(), 0);
+  ::close(fd);
+  if (got != st.st_size) {
+    throw vt::exception() << "failed to read " << path;
+  }
+  return data;
+}
+
+}  // namespace vt
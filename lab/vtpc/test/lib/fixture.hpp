@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include "vtpc.h"
+}
+
+namespace vt {
+
+/* Helpers of the tests of the cache, which throw on any failure. */
+
+auto stats_of(int fd) -> vtpc_stats_t;
+auto stat_of(int fd, vtpc_stat_t stat) -> uint64_t;
+/* How many latencies of the kind the histograms hold. */
+auto samples(const vtpc_stats_t& stats, vtpc_latency_t kind) -> uint64_t;
+/* Reads from disk by the whole process so far. */
+auto disk_reads() -> uint64_t;
+
+/* Opens the file in the cache for reading and writing, emptied. */
+auto open_new(const char* path) -> int;
+void write_at(int fd, const std::string& data, size_t pos);
+/* What the file holds on disk, read around the cache. */
+auto disk_contents(const char* path) -> std::string;
+
+}  // namespace vt
@@ -0,0 +1,470 @@
+#include "mrc.hpp"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include "policy.h"
+}
+
+namespace vt {
+
+namespace {
+
+/* Blocks are sampled by the top bits of their hash, out of this range. */
+constexpr uint32_t hash_range = (1U << 24U);
+constexpr size_t spool_batch = (1U << 16U);
+
+auto block_hash(uint64_t block) -> uint32_t {
+  uint64_t x = block + 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27U)) * 0x94D049BB133111EBULL;
+  x ^= x >> 31U;
+  return static_cast<uint32_t>(x >> 40U);
+}
+
+auto find_policy(const std::string& name) -> const vtpc_policy* {
+  for (const vtpc_policy* policy :
+       {&vtpc_policy_lru, &vtpc_policy_clock, &vtpc_policy_2q,
+        &vtpc_policy_lfu, &vtpc_policy_arc, &vtpc_policy_mru,
+        &vtpc_policy_optimal}) {
+    if (name == policy->name) {
+      return policy;
+    }
+  }
+  throw vt::mrc_exception() << "unknown policy '" << name << "'";
+}
+
+/* Scales a sample of a cache of `size` blocks down to `mini` frames. */
+auto mini_threshold(uint64_t size, size_t mini) -> uint32_t {
+  if (size <= mini) {
+    return hash_range;
+  }
+  const double threshold = static_cast<double>(hash_range) *
+                           static_cast<double>(mini) /
+                           static_cast<double>(size);
+  return std::max<uint32_t>(1, static_cast<uint32_t>(threshold));
+}
+
+/* Counts of live stack entries by time, with prefix sums. */
+class fenwick {
+public:
+  explicit fenwick(size_t size) : tree_(size + 1) {
+  }
+
+  void add(uint64_t at, int64_t delta) {
+    for (uint64_t i = at + 1; i < tree_.size(); i += i & (~i + 1)) {
+      tree_[i] += delta;
+    }
+  }
+
+  /* Sum over [0, at). */
+  auto sum(uint64_t at) const -> int64_t {
+    int64_t total = 0;
+    for (uint64_t i = at; i > 0; i -= i & (~i + 1)) {
+      total += tree_[i];
+    }
+    return total;
+  }
+
+  void clear() {
+    std::fill(tree_.begin(), tree_.end(), 0);
+  }
+
+private:
+  std::vector<int64_t> tree_;
+};
+
+}  // namespace
+
+/*
+ * The LRU stack of the sampled blocks. Each block is stamped with the time
+ * of its last access; its stack distance is the number of blocks stamped
+ * later. Times are renumbered when they run out, so the tree stays bounded.
+ * Each sampled access stands for 1 / rate accesses and its distance is
+ * scaled by the same factor.
+ */
+class mrc::stack {
+public:
+  stack(const std::vector<uint64_t>& sizes, size_t keys)
+      : sizes_(sizes),
+        keys_(keys),
+        times_(2 * (keys + 1)),
+        hits_(sizes.size() + 1) {
+  }
+
+  auto threshold() const -> uint32_t {
+    return threshold_;
+  }
+
+  auto rate() const -> double {
+    return static_cast<double>(threshold_) / hash_range;
+  }
+
+  auto footprint() const -> double {
+    return static_cast<double>(last_.size()) / rate();
+  }
+
+  void access(uint64_t block, uint32_t hash) {
+    if (hash >= threshold_) {
+      return;
+    }
+    const double weight = 1 / rate();
+    sampled_ += weight;
+    const auto [it, added] = last_.try_emplace(block, now_);
+    if (added) {
+      hashes_.emplace(hash, block);
+    } else {
+      const int64_t distance = times_.sum(now_) - times_.sum(it->second + 1);
+      times_.add(it->second, -1);
+      it->second = now_;
+      const double scaled = static_cast<double>(distance + 1) * weight;
+      const auto size = std::lower_bound(
+          sizes_.begin(), sizes_.end(), scaled,
+          [](uint64_t s, double d) { return static_cast<double>(s) < d; }
+      );
+      hits_[size - sizes_.begin()] += weight;
+    }
+    times_.add(now_, 1);
+    now_ += 1;
+    if (last_.size() > keys_) {
+      shrink();
+    }
+    if (now_ == 2 * (keys_ + 1)) {
+      renumber();
+    }
+  }
+
+  /*
+   * Hits by size, corrected so that the sampled accesses add up to all of
+   * them (SHARDS-adj).
+   */
+  auto miss_ratios(uint64_t accesses) const -> std::vector<double> {
+    std::vector<double> ratios;
+    double hits = static_cast<double>(accesses) - sampled_;
+    for (size_t i = 0; i < sizes_.size(); ++i) {
+      hits += hits_[i];
+      const double ratio = 1 - hits / static_cast<double>(accesses);
+      ratios.push_back(std::clamp(ratio, 0.0, 1.0));
+    }
+    return ratios;
+  }
+
+private:
+  /* Drops the blocks with the highest hashes, lowering the rate. */
+  void shrink() {
+    threshold_ = hashes_.top().first;
+    while (!hashes_.empty() && hashes_.top().first >= threshold_) {
+      const auto it = last_.find(hashes_.top().second);
+      times_.add(it->second, -1);
+      last_.erase(it);
+      hashes_.pop();
+    }
+  }
+
+  void renumber() {
+    std::vector<std::pair<uint64_t, uint64_t*>> order;
+    order.reserve(last_.size());
+    for (auto& [block, time] : last_) {
+      order.emplace_back(time, &time);
+    }
+    std::sort(order.begin(), order.end());
+    times_.clear();
+    now_ = 0;
+    for (auto& [time, at] : order) {
+      *at = now_;
+      times_.add(now_, 1);
+      now_ += 1;
+    }
+  }
+
+  const std::vector<uint64_t>& sizes_;
+  size_t keys_;
+  uint32_t threshold_ = hash_range;
+  uint64_t now_ = 0;
+  double sampled_ = 0;
+  fenwick times_;
+  std::unordered_map<uint64_t, uint64_t> last_;
+  std::priority_queue<std::pair<uint32_t, uint64_t>> hashes_;
+  std::vector<double> hits_;
+};
+
+/*
+ * A cache of `frames` blocks run by a vtpc policy, fed the accesses to
+ * blocks whose hash is under `threshold`, as vtpc itself drives it.
+ */
+class mrc::mini_sim {
+public:
+  mini_sim(const vtpc_policy* policy, uint64_t size, uint32_t threshold)
+      : policy_(policy),
+        threshold_(threshold),
+        frames_(std::max<uint32_t>(
+            1,
+            static_cast<uint32_t>(std::llround(
+                static_cast<double>(size) * threshold / hash_range
+            ))
+        )),
+        state_((policy->size(frames_) + sizeof(uint64_t) - 1) /
+               sizeof(uint64_t)),
+        blocks_(frames_),
+        slots_(std::bit_ceil(2 * static_cast<size_t>(frames_)), {empty, 0}) {
+    policy_->init(state_.data(), frames_);
+  }
+
+  void access(uint64_t block, uint32_t hash, uint64_t next = VTPC_NEVER) {
+    if (hash >= threshold_) {
+      return;
+    }
+    accesses_ += 1;
+    uint32_t frame = 0;
+    const size_t slot = probe(block);
+    if (slots_[slot].block == block) {
+      frame = slots_[slot].frame;
+      policy_->touch(state_.data(), frame);
+    } else {
+      misses_ += 1;
+      if (used_ < frames_) {
+        frame = used_++;
+      } else {
+        frame = policy_->victim(state_.data(), block);
+        if (policy_->evict != nullptr) {
+          policy_->evict(state_.data(), frame);
+        }
+        erase(probe(blocks_[frame]));
+      }
+      blocks_[frame] = block;
+      slots_[probe(block)] = {.block = block, .frame = frame};
+      policy_->insert(state_.data(), frame, block);
+    }
+    if (policy_->advise != nullptr) {
+      policy_->advise(state_.data(), frame, block, next);
+    }
+  }
+
+  /*
+   * Misses over the accesses the sample should have had, which corrects
+   * for hot blocks that happen to be in or out of it (SHARDS-adj).
+   */
+  auto miss_ratio(uint64_t accesses) const -> double {
+    const double expected =
+        static_cast<double>(accesses) * threshold_ / hash_range;
+    if (accesses_ == 0 || expected < 1) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    return std::min(1.0, static_cast<double>(misses_) / expected);
+  }
+
+private:
+  static constexpr uint64_t empty = UINT64_MAX;
+
+  struct slot {
+    uint64_t block;
+    uint32_t frame;
+  };
+
+  auto home(uint64_t block) const -> size_t {
+    return static_cast<size_t>((block * 0x9E3779B97F4A7C15ULL) >> 32U) &
+           (slots_.size() - 1);
+  }
+
+  /* The slot of the block, or the empty slot where it would go. */
+  auto probe(uint64_t block) const -> size_t {
+    size_t i = home(block);
+    while (slots_[i].block != empty && slots_[i].block != block) {
+      i = (i + 1) & (slots_.size() - 1);
+    }
+    return i;
+  }
+
+  /* Backward-shift deletion, as in the pending hints of policy_optimal. */
+  void erase(size_t i) {
+    const size_t mask = slots_.size() - 1;
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; slots_[j].block != empty;
+         j = (j + 1) & mask) {
+      if (((j - home(slots_[j].block)) & mask) >= ((j - hole) & mask)) {
+        slots_[hole] = slots_[j];
+        hole = j;
+      }
+    }
+    slots_[hole].block = empty;
+  }
+
+  const vtpc_policy* policy_;
+  uint32_t threshold_;
+  uint32_t frames_;
+  uint32_t used_ = 0;
+  uint64_t accesses_ = 0;
+  uint64_t misses_ = 0;
+  std::vector<uint64_t> state_;
+  std::vector<uint64_t> blocks_;
+  std::vector<slot> slots_;
+};
+
+mrc::mrc(mrc_options options) : options_(std::move(options)) {
+  if (options_.sizes.empty() || options_.sizes.front() == 0 ||
+      !std::is_sorted(options_.sizes.begin(), options_.sizes.end()) ||
+      options_.keys == 0 || options_.mini == 0) {
+    throw vt::mrc_exception() << "bad options";
+  }
+  stack_ = std::make_unique<stack>(options_.sizes, options_.keys);
+  for (const auto& name : options_.policies) {
+    if (name == "lru") {
+      continue;
+    }
+    const vtpc_policy* policy = find_policy(name);
+    if (policy == &vtpc_policy_optimal) {
+      spool_ = std::tmpfile();
+      if (spool_ == nullptr) {
+        throw vt::mrc_exception() << "failed to create a spool file";
+      }
+      continue;
+    }
+    for (const uint64_t size : options_.sizes) {
+      sims_.push_back(std::make_unique<mini_sim>(
+          policy, size, mini_threshold(size, options_.mini)
+      ));
+    }
+  }
+}
+
+mrc::~mrc() {
+  if (spool_ != nullptr) {
+    std::fclose(spool_);
+  }
+}
+
+void mrc::access(uint64_t block) {
+  const uint32_t hash = block_hash(block);
+  accesses_ += 1;
+  stack_->access(block, hash);
+  for (auto& sim : sims_) {
+    sim->access(block, hash);
+  }
+  if (spool_ != nullptr && hash < stack_->threshold()) {
+    std::fwrite(&block, sizeof(block), 1, spool_);
+  }
+}
+
+/*
+ * Belady's policy runs on the blocks the LRU stack ended up sampling, at
+ * most `keys` of them. The spool holds a superset in access order: reading
+ * it backwards gives the next use of each access, which lands in a second
+ * spool in reverse; reading that one backwards feeds the simulations.
+ */
+void mrc::replay_optimal() {
+  const uint32_t threshold = stack_->threshold();
+  for (const uint64_t size : options_.sizes) {
+    optimal_.push_back(std::make_unique<mini_sim>(
+        &vtpc_policy_optimal,
+        size,
+        std::min(threshold, mini_threshold(size, options_.mini))
+    ));
+  }
+  FILE* nexts = std::tmpfile();
+  if (nexts == nullptr || std::fflush(spool_) != 0) {
+    throw vt::mrc_exception() << "failed to create a spool file";
+  }
+  const std::unique_ptr<FILE, int (*)(FILE*)> guard(nexts, std::fclose);
+
+  /* Reads the records of a spool from its end, one batch at a time. */
+  const auto backwards = [](FILE* file, size_t record, auto each) {
+    std::vector<uint64_t> batch(spool_batch * record / sizeof(uint64_t));
+    ::fseeko(file, 0, SEEK_END);
+    off_t end = ::ftello(file);
+    while (end > 0) {
+      const off_t from =
+          std::max<off_t>(0, end - static_cast<off_t>(spool_batch * record));
+      const auto count = static_cast<size_t>(end - from) / record;
+      if (::fseeko(file, from, SEEK_SET) != 0 ||
+          std::fread(batch.data(), record, count, file) != count) {
+        throw vt::mrc_exception() << "failed to read a spool file";
+      }
+      for (size_t i = count; i-- > 0;) {
+        each(&batch[i * record / sizeof(uint64_t)]);
+      }
+      end = from;
+    }
+  };
+
+  std::unordered_map<uint64_t, uint64_t> next_use;
+  uint64_t index = 0;
+  backwards(spool_, sizeof(uint64_t), [&](const uint64_t* block) {
+    index += 1;
+    if (block_hash(*block) >= threshold) {
+      return;
+    }
+    /* Later accesses have smaller indexes here, so the next use is larger. */
+    const auto [it, added] = next_use.try_emplace(*block, index);
+    const uint64_t record[2] = {
+        *block, added ? VTPC_NEVER : UINT64_MAX - it->second
+    };
+    it->second = index;
+    std::fwrite(record, sizeof(record), 1, nexts);
+  });
+  next_use.clear();
+  if (std::fflush(nexts) != 0) {
+    throw vt::mrc_exception() << "failed to write a spool file";
+  }
+
+  backwards(nexts, 2 * sizeof(uint64_t), [&](const uint64_t* record) {
+    const uint32_t hash = block_hash(record[0]);
+    for (auto& sim : optimal_) {
+      sim->access(record[0], hash, record[1]);
+    }
+  });
+}
+
+auto mrc::curves() -> std::vector<mrc_curve> {
+  if (spool_ != nullptr && optimal_.empty()) {
+    replay_optimal();
+  }
+  std::vector<mrc_curve> curves;
+  size_t sim = 0;
+  for (const auto& name : options_.policies) {
+    mrc_curve curve{.policy = name, .miss_ratios = {}};
+    if (name == "lru") {
+      curve.miss_ratios = stack_->miss_ratios(accesses_);
+    } else if (name == "optimal") {
+      for (const auto& optimal : optimal_) {
+        curve.miss_ratios.push_back(optimal->miss_ratio(accesses_));
+      }
+    } else {
+      for (size_t i = 0; i < options_.sizes.size(); ++i) {
+        curve.miss_ratios.push_back(sims_[sim++]->miss_ratio(accesses_));
+      }
+    }
+    curves.push_back(std::move(curve));
+  }
+  return curves;
+}
+
+auto mrc::accesses() const -> uint64_t {
+  return accesses_;
+}
+
+auto mrc::rate() const -> double {
+  return stack_->rate();
+}
+
+auto mrc::footprint() const -> double {
+  return stack_->footprint();
+}
+
+}  // namespace vt
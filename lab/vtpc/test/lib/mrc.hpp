@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+
+namespace vt {
+
+class mrc_exception : public vt::exception {};
+
+struct mrc_options {
+  /* Cache sizes in blocks, in increasing order. */
+  std::vector<uint64_t> sizes;
+  /* "lru", "optimal" or the name of any other vtpc policy. */
+  std::vector<std::string> policies;
+  /* Sampled blocks the LRU stack keeps at most. */
+  size_t keys = (1U << 20U);
+  /* Frames of each miniature simulation. */
+  size_t mini = (1U << 13U);
+};
+
+struct mrc_curve {
+  std::string policy;
+  std::vector<double> miss_ratios;
+};
+
+/*
+ * Miss-ratio curves of a stream of block accesses, for many cache sizes in
+ * one pass and in memory bounded by the options, not by the stream.
+ *
+ * LRU uses Mattson stack distances on a spatially hashed sample of the
+ * blocks (SHARDS, Waldspurger et al., FAST '15) that starts with every
+ * block and drops the highest hashes whenever more than `keys` blocks are
+ * sampled. Other policies run the vtpc policy in a miniature simulation per
+ * size, `mini` frames fed by a sample scaled to match. Belady's optimal
+ * policy needs the next use of every block: its sample is spooled to a
+ * temporary file and read back twice when the curves are computed.
+ */
+class mrc {
+public:
+  explicit mrc(mrc_options options);
+  mrc(const mrc&) = delete;
+  mrc(mrc&&) = delete;
+  auto operator=(const mrc&) -> mrc& = delete;
+  auto operator=(mrc&&) -> mrc& = delete;
+  ~mrc();
+
+  void access(uint64_t block);
+  auto curves() -> std::vector<mrc_curve>;
+
+  auto accesses() const -> uint64_t;
+  /* Share of the blocks in the LRU sample, 1 while it is exact. */
+  auto rate() const -> double;
+  /* Distinct blocks accessed, estimated from the LRU sample. */
+  auto footprint() const -> double;
+
+private:
+  class stack;
+  class mini_sim;
+
+  void replay_optimal();
+
+  mrc_options options_;
+  uint64_t accesses_ = 0;
+  std::unique_ptr<stack> stack_;
+  std::vector<std::unique_ptr<mini_sim>> sims_;
+  std::vector<std::unique_ptr<mini_sim>> optimal_;
+  FILE* spool_ = nullptr;
+};
+
+}  // namespace vt
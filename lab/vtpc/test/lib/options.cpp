@@ -0,0 +1,57 @@
+#include "options.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "exception.hpp"
+
+namespace vt {
+
+auto parse_size(const std::string& text) -> size_t {
+  size_t end = 0;
+  size_t value = std::stoull(text, &end);
+  const std::string suffix = text.substr(end);
+  if (suffix == "K" || suffix == "k") {
+    value <<= 10U;
+  } else if (suffix == "M" || suffix == "m") {
+    value <<= 20U;
+  } else if (suffix == "G" || suffix == "g") {
+    value <<= 30U;
+  } else if (!suffix.empty()) {
+    throw vt::options_exception() << "bad size '" << text << "'";
+  }
+  return value;
+}
+
+auto split(const std::string& text) -> std::vector<std::string> {
+  std::vector<std::string> items;
+  std::istringstream stream(text);
+  for (std::string item; std::getline(stream, item, ',');) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+auto split_numbers(const std::string& text) -> std::vector<size_t> {
+  std::vector<size_t> numbers;
+  for (const auto& item : split(text)) {
+    numbers.push_back(std::stoull(item));
+  }
+  return numbers;
+}
+
+auto known(
+    const std::vector<std::string>& names,
+    std::initializer_list<std::string_view> all
+) -> bool {
+  return std::all_of(names.begin(), names.end(), [&](const auto& name) {
+    return std::find(all.begin(), all.end(), name) != all.end();
+  });
+}
+
+}  // namespace vt
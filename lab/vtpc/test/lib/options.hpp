@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "exception.hpp"
+
+namespace vt {
+
+/*
+ * Options of the tools are given as name=value arguments, lists separated
+ * by commas.
+ */
+class options_exception : public vt::exception {};
+
+/* Odd and about 2^64 over the golden ratio, spreads consecutive numbers. */
+constexpr uint64_t scatter = 0x9E3779B97F4A7C15ULL;
+
+/* A byte count with an optional K, M or G suffix. */
+auto parse_size(const std::string& text) -> size_t;
+
+auto split(const std::string& text) -> std::vector<std::string>;
+auto split_numbers(const std::string& text) -> std::vector<size_t>;
+
+/* Whether every name is one of `all`. */
+auto known(
+    const std::vector<std::string>& names,
+    std::initializer_list<std::string_view> all
+) -> bool;
+
+}  // namespace vt
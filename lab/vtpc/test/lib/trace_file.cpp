@@ -0,0 +1,326 @@
+#include "trace_file.hpp"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace vt {
+
+namespace {
+
+constexpr size_t alignment = 4096;
+
+auto iov_count(const iovec* iov, int iovcnt) -> uint64_t {
+  uint64_t count = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    count += iov[i].iov_len;  // NOLINT
+  }
+  return count;
+}
+
+}  // namespace
+
+trace_file::trace_file(
+    std::unique_ptr<file> file, std::string_view path, size_t capacity
+)
+    : file_(std::move(file)),
+      fd_(::open(
+          std::string(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644
+      )),
+      start_(std::chrono::steady_clock::now()),
+      ring_(std::max<size_t>(capacity, 1)) {
+  if (fd_ == -1 || ::write(fd_, &trace_magic, sizeof(trace_magic)) !=
+                       static_cast<ssize_t>(sizeof(trace_magic))) {
+    if (fd_ != -1) {
+      ::close(fd_);
+    }
+    throw vt::trace_exception()
+        << "failed to create trace '" << path << "': "
+        << strerror(errno);  // NOLINT(concurrency-mt-unsafe)
+  }
+  writer_ = std::thread([this] { stream(); });
+}
+
+trace_file::~trace_file() {
+  {
+    const std::lock_guard guard(lock_);
+    stopping_ = true;
+  }
+  pushed_.notify_one();
+  writer_.join();
+  ::close(fd_);
+}
+
+/*
+ * Writes out what the ring holds until the trace is closed and drained. A
+ * trace that cannot be written is cut back to its last whole record and
+ * stops there, the file keeps going.
+ */
+void trace_file::stream() {
+  std::unique_lock guard(lock_);
+  while (true) {
+    pushed_.wait(guard, [this] { return stopping_ || head_ != tail_; });
+    if (head_ == tail_) {
+      return;
+    }
+    const size_t from = tail_ % ring_.size();
+    const size_t count =
+        std::min<uint64_t>(head_ - tail_, ring_.size() - from);
+    guard.unlock();
+    const auto* data = reinterpret_cast<const char*>(&ring_[from]);  // NOLINT
+    const size_t bytes = count * sizeof(trace_record);
+    for (size_t done = 0; done < bytes && !cut_;) {
+      const ssize_t wrote = ::write(fd_, data + done, bytes - done);  // NOLINT
+      if (wrote == -1 && errno == EINTR) {
+        continue;
+      }
+      if (wrote <= 0) {
+        const uint64_t partial =
+            (written_ - sizeof(trace_magic)) % sizeof(trace_record);
+        (void)::ftruncate(fd_, static_cast<off_t>(written_ - partial));
+        cut_ = true;
+        break;
+      }
+      done += static_cast<size_t>(wrote);
+      written_ += static_cast<uint64_t>(wrote);
+    }
+    guard.lock();
+    tail_ += count;
+    drained_.notify_all();
+  }
+}
+
+void trace_file::push(const trace_record& record) {
+  std::unique_lock guard(lock_);
+  drained_.wait(guard, [this] { return head_ - tail_ < ring_.size(); });
+  ring_[head_ % ring_.size()] = record;
+  head_ += 1;
+  guard.unlock();
+  pushed_.notify_one();
+}
+
+template <class F>
+void trace_file::record(
+    trace_op op, int64_t offset, uint64_t count, F action
+) {
+  trace_record record{
+      .time = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_
+          )
+              .count()
+      ),
+      .offset = offset,
+      .count = count,
+      .op = op,
+      .failed = 0,
+  };
+  try {
+    action();
+  } catch (const vt::file_exception&) {
+    record.failed = 1;
+    push(record);
+    throw;
+  }
+  push(record);
+}
+
+auto trace_file::read(char* buffer, size_t count) -> void {
+  record(trace_op::read, -1, count, [&] { file_->read(buffer, count); });
+}
+
+auto trace_file::write(const char* buffer, size_t count) -> void {
+  record(trace_op::write, -1, count, [&] { file_->write(buffer, count); });
+}
+
+auto trace_file::seek(off_t offset) -> void {
+  record(trace_op::seek, offset, 0, [&] { file_->seek(offset); });
+}
+
+auto trace_file::sync() -> void {
+  record(trace_op::sync, -1, 0, [&] { file_->sync(); });
+}
+
+auto trace_file::pread(char* buffer, size_t count, off_t offset) -> void {
+  record(trace_op::pread, offset, count, [&] {
+    file_->pread(buffer, count, offset);
+  });
+}
+
+auto trace_file::pwrite(const char* buffer, size_t count, off_t offset)
+    -> void {
+  record(trace_op::pwrite, offset, count, [&] {
+    file_->pwrite(buffer, count, offset);
+  });
+}
+
+auto trace_file::preadv(const iovec* iov, int iovcnt, off_t offset)
+    -> void {
+  record(trace_op::preadv, offset, iov_count(iov, iovcnt), [&] {
+    file_->preadv(iov, iovcnt, offset);
+  });
+}
+
+auto trace_file::pwritev(const iovec* iov, int iovcnt, off_t offset)
+    -> void {
+  record(trace_op::pwritev, offset, iov_count(iov, iovcnt), [&] {
+    file_->pwritev(iov, iovcnt, offset);
+  });
+}
+
+namespace {
+
+struct aligned_free {
+  void operator()(char* p) const {
+    std::free(p);  // NOLINT
+  }
+};
+
+/* Runs one record, with a buffer aligned for any backend. */
+class replayer {
+public:
+  explicit replayer(file& file) : file_(file) {
+  }
+
+  void run(const trace_record& r, uint64_t index) {
+    char* data = buffer(r.count);
+    const auto count = static_cast<size_t>(r.count);
+    switch (r.op) {
+      case trace_op::read:
+        file_.read(data, count);
+        break;
+      case trace_op::write:
+        std::memset(data, static_cast<int>('a' + index % 26), count);
+        file_.write(data, count);
+        break;
+      case trace_op::seek:
+        file_.seek(static_cast<off_t>(r.offset));
+        break;
+      case trace_op::sync:
+        file_.sync();
+        break;
+      case trace_op::pread:
+      case trace_op::preadv:
+        file_.pread(data, count, static_cast<off_t>(r.offset));
+        break;
+      case trace_op::pwrite:
+      case trace_op::pwritev:
+        std::memset(data, static_cast<int>('a' + index % 26), count);
+        file_.pwrite(data, count, static_cast<off_t>(r.offset));
+        break;
+      default:
+        throw vt::trace_exception() << "bad operation in record " << index;
+    }
+  }
+
+private:
+  auto buffer(uint64_t count) -> char* {
+    if (count > capacity_) {
+      capacity_ = (count + alignment - 1) / alignment * alignment;
+      buffer_.reset(
+          static_cast<char*>(std::aligned_alloc(alignment, capacity_))
+      );
+    }
+    return buffer_.get();
+  }
+
+  file& file_;
+  std::unique_ptr<char, aligned_free> buffer_;
+  uint64_t capacity_ = 0;
+};
+
+}  // namespace
+
+auto replay(file& file, std::string_view path, bool timed) -> replay_stats {
+  const int fd = ::open(std::string(path).c_str(), O_RDONLY);
+  uint64_t magic = 0;
+  struct stat st = {};
+  if (fd == -1 || ::read(fd, &magic, sizeof(magic)) !=
+                      static_cast<ssize_t>(sizeof(magic)) ||
+      magic != trace_magic || ::fstat(fd, &st) == -1) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+    throw vt::trace_exception() << "'" << path << "' is not a trace";
+  }
+  const auto records = static_cast<uint64_t>(st.st_size) - sizeof(magic);
+  if (records % sizeof(trace_record) != 0) {
+    ::close(fd);
+    throw vt::trace_exception()
+        << "'" << path << "' ends within a record";
+  }
+
+  replay_stats stats;
+  replayer replayer(file);
+  std::vector<trace_record> batch(1024);
+  const auto start = std::chrono::steady_clock::now();
+  auto* bytes = reinterpret_cast<char*>(batch.data());  // NOLINT
+  const size_t capacity = batch.size() * sizeof(trace_record);
+  while (true) {
+    /* Reads may stop anywhere, records are only run once whole. */
+    size_t filled = 0;
+    while (filled < capacity) {
+      const ssize_t got =
+          ::read(fd, bytes + filled, capacity - filled);  // NOLINT
+      if (got == -1 || (got == 0 && filled % sizeof(trace_record) != 0)) {
+        ::close(fd);
+        throw vt::trace_exception() << "failed to read '" << path << "'";
+      }
+      if (got == 0) {
+        break;
+      }
+      filled += static_cast<size_t>(got);
+    }
+    if (filled == 0) {
+      break;
+    }
+    const size_t count = filled / sizeof(trace_record);
+    for (size_t i = 0; i < count; ++i) {
+      const trace_record& r = batch[i];
+      if (timed) {
+        std::this_thread::sleep_until(
+            start + std::chrono::nanoseconds(r.time)
+        );
+      }
+      bool failed = false;
+      try {
+        replayer.run(r, stats.ops);
+      } catch (const vt::file_exception&) {
+        failed = true;
+        stats.failed += 1;
+      }
+      stats.mismatched += failed != (r.failed != 0) ? 1 : 0;
+      stats.ops += 1;
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  ::close(fd);
+  return stats;
+}
+
+}  // namespace vt
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+#include "file.hpp"
+
+namespace vt {
+
+enum class trace_op : uint32_t {
+  read,
+  write,
+  seek,
+  sync,
+  pread,
+  pwrite,
+  preadv,
+  pwritev,
+};
+
+/*
+ * One operation: `time` is when it started, in ns since the trace was
+ * opened, `offset` is where it reads, writes or seeks to, -1 for read and
+ * write at the file offset and for sync, `count` is the byte count, 0 for
+ * seek and sync.
+ */
+struct trace_record {
+  uint64_t time;
+  int64_t offset;
+  uint64_t count;
+  trace_op op;
+  uint32_t failed;
+};
+
+static_assert(sizeof(trace_record) == 32);
+
+/* A trace is this magic followed by records, in the byte order of the host. */
+constexpr uint64_t trace_magic = 0x3145434152545456ULL;  // "VTTRACE1"
+
+class trace_exception : public vt::exception {};
+
+/*
+ * Records every operation on the file into a trace. Records go to a ring
+ * in memory, a thread streams them to the trace file; operations only wait
+ * for it when the ring is full.
+ */
+class trace_file final : public file {
+public:
+  using file::read;
+  using file::write;
+
+  trace_file(
+      std::unique_ptr<file> file,
+      std::string_view path,
+      size_t capacity = (1U << 16U)
+  );
+  trace_file(const trace_file&) = delete;
+  trace_file(trace_file&&) = delete;
+  auto operator=(const trace_file&) -> trace_file& = delete;
+  auto operator=(trace_file&&) -> trace_file& = delete;
+  ~trace_file() override;
+
+  auto read(char* buffer, size_t count) -> void override;
+  auto write(const char* buffer, size_t count) -> void override;
+  auto seek(off_t offset) -> void override;
+  auto sync() -> void override;
+  auto pread(char* buffer, size_t count, off_t offset) -> void override;
+  auto pwrite(const char* buffer, size_t count, off_t offset)
+      -> void override;
+  auto preadv(const iovec* iov, int iovcnt, off_t offset) -> void override;
+  auto pwritev(const iovec* iov, int iovcnt, off_t offset) -> void override;
+
+private:
+  template <class F>
+  void record(trace_op op, int64_t offset, uint64_t count, F action);
+  void push(const trace_record& record);
+  void stream();
+
+  std::unique_ptr<file> file_;
+  int fd_;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<trace_record> ring_;
+  std::mutex lock_;
+  std::condition_variable pushed_;
+  std::condition_variable drained_;
+  uint64_t head_ = 0;
+  uint64_t tail_ = 0;
+  bool stopping_ = false;
+  uint64_t written_ = sizeof(trace_magic);
+  bool cut_ = false;
+  std::thread writer_;
+};
+
+struct replay_stats {
+  uint64_t ops = 0;
+  uint64_t failed = 0;
+  uint64_t mismatched = 0;
+  double seconds = 0;
+};
+
+/*
+ * Runs the operations of a trace on the file, as fast as possible or, if
+ * `timed`, each no earlier than it started in the trace. Written data is
+ * made up, the same for the same trace. Operations that fail are counted,
+ * and also as mismatched when they did not fail in the trace or the other
+ * way round. Vectored operations are replayed with a single buffer. A trace
+ * that ends within a record is refused before anything runs.
+ */
+auto replay(file& file, std::string_view path, bool timed) -> replay_stats;
+
+}  // namespace vt
@@ -0,0 +1,212 @@
+#include <sys/types.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+#include "mrc.hpp"
+#include "options.hpp"
+#include "trace_file.hpp"
+
+namespace {
+
+struct options {
+  std::string trace;
+  std::string format = "auto";
+  size_t block = 4096;
+  size_t min = (1U << 20U);
+  size_t max = (1U << 30U);
+  size_t points = 31;
+  std::vector<std::string> policies = {
+      "lru", "clock", "2q", "lfu", "arc", "optimal"
+  };
+  size_t keys = (1U << 20U);
+  size_t mini = (1U << 13U);
+};
+
+constexpr auto usage =
+    "usage: mrc_sim trace=PATH [name=value...]\n"
+    "  format=auto|trace|list (trace_file records or 'offset len' lines)\n"
+    "  block=4K  min=1M  max=1G  points=31 (cache sizes, geometric)\n"
+    "  policies=lru,clock,2q,lfu,arc,optimal\n"
+    "  keys=1M (blocks sampled for lru and optimal)  mini=8K (frames)\n";
+
+auto parse(int argc, char** argv) -> options {
+  options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];  // NOLINT
+    const size_t eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value =
+        eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name == "trace") {
+      o.trace = value;
+    } else if (name == "format") {
+      o.format = value;
+    } else if (name == "block") {
+      o.block = vt::parse_size(value);
+    } else if (name == "min") {
+      o.min = vt::parse_size(value);
+    } else if (name == "max") {
+      o.max = vt::parse_size(value);
+    } else if (name == "points") {
+      o.points = std::stoull(value);
+    } else if (name == "policies") {
+      o.policies = vt::split(value);
+    } else if (name == "keys") {
+      o.keys = vt::parse_size(value);
+    } else if (name == "mini") {
+      o.mini = vt::parse_size(value);
+    } else {
+      throw vt::exception() << "unknown option '" << arg << "'\n" << usage;
+    }
+  }
+  if (o.trace.empty() ||
+      (o.format != "auto" && o.format != "trace" && o.format != "list") ||
+      o.block == 0 || o.min < o.block || o.max < o.min || o.points == 0) {
+    throw vt::exception() << "bad options\n" << usage;
+  }
+  return o;
+}
+
+/* Cache sizes in blocks, spread geometrically from min to max. */
+auto sizes(const options& o) -> std::vector<uint64_t> {
+  std::vector<uint64_t> sizes;
+  const double low = static_cast<double>(o.min / o.block);
+  const double high = static_cast<double>(o.max / o.block);
+  for (size_t i = 0; i < o.points; ++i) {
+    const double share =
+        o.points == 1 ? 0 : static_cast<double>(i) / (o.points - 1);
+    const auto size =
+        static_cast<uint64_t>(std::llround(low * std::pow(high / low, share)));
+    if (sizes.empty() || size > sizes.back()) {
+      sizes.push_back(size);
+    }
+  }
+  return sizes;
+}
+
+void access_range(
+    vt::mrc& mrc, uint64_t offset, uint64_t count, size_t block
+) {
+  if (count == 0) {
+    return;
+  }
+  for (uint64_t b = offset / block; b <= (offset + count - 1) / block; ++b) {
+    mrc.access(b);
+  }
+}
+
+/*
+ * Replays the positions of a trace_file trace. Failed operations are
+ * skipped, they leave the file offset unknown anyway.
+ */
+void feed_trace(vt::mrc& mrc, std::ifstream& in, size_t block) {
+  uint64_t position = 0;
+  vt::trace_record r{};
+  while (in.read(reinterpret_cast<char*>(&r), sizeof(r))) {  // NOLINT
+    if (r.failed != 0) {
+      continue;
+    }
+    switch (r.op) {
+      case vt::trace_op::read:
+      case vt::trace_op::write:
+        access_range(mrc, position, r.count, block);
+        position += r.count;
+        break;
+      case vt::trace_op::seek:
+        position = static_cast<uint64_t>(r.offset);
+        break;
+      case vt::trace_op::pread:
+      case vt::trace_op::pwrite:
+      case vt::trace_op::preadv:
+      case vt::trace_op::pwritev:
+        access_range(mrc, static_cast<uint64_t>(r.offset), r.count, block);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/* Reads 'offset len' lines, skipping blank lines and '#' comments. */
+void feed_list(vt::mrc& mrc, std::ifstream& in, size_t block) {
+  size_t number = 0;
+  for (std::string line; std::getline(in, line);) {
+    number += 1;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    uint64_t offset = 0;
+    uint64_t count = 0;
+    if (!(fields >> offset >> count)) {
+      throw vt::exception() << "bad line " << number << ": '" << line << "'";
+    }
+    access_range(mrc, offset, count, block);
+  }
+}
+
+}  // namespace
+
+/*
+ * Prints the miss-ratio curve of each policy for a trace as CSV, one row
+ * per cache size in bytes, and a summary of the trace on stderr.
+ */
+auto main(int argc, char** argv) -> int try {
+  const options o = parse(argc, argv);
+  std::ifstream in(o.trace, std::ios::binary);
+  if (!in) {
+    throw vt::exception() << "failed to open '" << o.trace << "'";
+  }
+  uint64_t magic = 0;
+  in.read(reinterpret_cast<char*>(&magic), sizeof(magic));  // NOLINT
+  const bool binary =
+      o.format == "trace" || (o.format == "auto" && magic == vt::trace_magic);
+  if (binary && magic != vt::trace_magic) {
+    throw vt::exception() << "'" << o.trace << "' is not a trace";
+  }
+
+  const auto grid = sizes(o);
+  vt::mrc mrc({
+      .sizes = grid,
+      .policies = o.policies,
+      .keys = o.keys,
+      .mini = o.mini,
+  });
+  if (binary) {
+    feed_trace(mrc, in, o.block);
+  } else {
+    in.clear();
+    in.seekg(0);
+    feed_list(mrc, in, o.block);
+  }
+
+  const auto curves = mrc.curves();
+  std::cerr << "accesses " << mrc.accesses() << ", footprint "
+            << std::llround(mrc.footprint()) << " blocks, lru rate "
+            << mrc.rate() << '\n';
+  std::cout << "cache";
+  for (const auto& curve : curves) {
+    std::cout << ',' << curve.policy;
+  }
+  std::cout << '\n';
+  for (size_t i = 0; i < grid.size(); ++i) {
+    std::cout << grid[i] * o.block;
+    for (const auto& curve : curves) {
+      std::cout << ',' << curve.miss_ratios[i];
+    }
+    std::cout << '\n';
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,608 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "exception.hpp"
+#include "options.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t chunk = (8U << 20U);
+constexpr unsigned tag_shift = 40;
+
+struct options {
+  std::string path = "/tmp/stress_vtpc";
+  std::vector<std::string> modes = {"procs", "threads"};
+  std::vector<std::string> layouts = {"disjoint", "shared"};
+  std::vector<size_t> workers = {1, 2, 4, 8};
+  size_t size = (2ULL << 30U);
+  size_t ops = 10000;
+  size_t batch = (16U << 10U);
+  size_t writes = 50;
+  size_t seeks = 10;
+  size_t syncs = 1;
+  size_t hot = 50;
+  size_t window = (1U << 20U);
+  uint64_t seed = 1;
+};
+
+constexpr auto usage =
+    "usage: stress_vtpc [name=value...]\n"
+    "  modes=procs,threads  layouts=disjoint,shared  workers=1,2,4,8\n"
+    "  size=2G  ops=10000 (per worker)  batch=16K (largest read or write)\n"
+    "  writes=50 (percent of reads and writes)  seeks=10  syncs=1 (percent)\n"
+    "  hot=50 (percent of seeks into the window)  window=1M\n"
+    "  seed=1  path=/tmp/stress_vtpc\n";
+
+auto parse(int argc, char** argv) -> options {
+  options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];  // NOLINT
+    const size_t eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value =
+        eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name == "modes") {
+      o.modes = vt::split(value);
+    } else if (name == "layouts") {
+      o.layouts = vt::split(value);
+    } else if (name == "workers") {
+      o.workers = vt::split_numbers(value);
+    } else if (name == "size") {
+      o.size = vt::parse_size(value);
+    } else if (name == "ops") {
+      o.ops = vt::parse_size(value);
+    } else if (name == "batch") {
+      o.batch = vt::parse_size(value);
+    } else if (name == "writes") {
+      o.writes = std::stoull(value);
+    } else if (name == "seeks") {
+      o.seeks = std::stoull(value);
+    } else if (name == "syncs") {
+      o.syncs = std::stoull(value);
+    } else if (name == "hot") {
+      o.hot = std::stoull(value);
+    } else if (name == "window") {
+      o.window = vt::parse_size(value);
+    } else if (name == "seed") {
+      o.seed = std::stoull(value);
+    } else if (name == "path") {
+      o.path = value;
+    } else {
+      throw vt::exception() << "unknown option '" << arg << "'\n" << usage;
+    }
+  }
+  size_t most = 0;
+  for (const size_t workers : o.workers) {
+    most = std::max(most, workers);
+  }
+  if (!vt::known(o.modes, {"procs", "threads"}) ||
+      !vt::known(o.layouts, {"disjoint", "shared"}) || most == 0 ||
+      std::find(o.workers.begin(), o.workers.end(), 0) != o.workers.end() ||
+      most >= (1U << (64 - tag_shift)) - 1 || o.batch == 0 ||
+      o.window < o.batch || o.size / most < o.window || o.writes > 100 ||
+      o.seeks + o.syncs > 100 || o.hot > 100) {
+    throw vt::exception() << "bad options\n" << usage;
+  }
+  return o;
+}
+
+auto now() -> uint64_t {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()
+      )
+          .count()
+  );
+}
+
+/*
+ * Data is a function of the write that put it there and of its offset, so
+ * any byte of the file tells which write it came from. Tag 0 stands for
+ * the zeros of the file before anything was written.
+ */
+auto pattern_word(uint64_t tag, uint64_t word) -> uint64_t {
+  if (tag == 0) {
+    return 0;
+  }
+  uint64_t x = tag * vt::scatter ^ word;
+  x = (x ^ (x >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27U)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31U);
+}
+
+auto pattern_byte(uint64_t tag, uint64_t at) -> char {
+  return static_cast<char>(pattern_word(tag, at / 8) >> (8 * (at % 8)));
+}
+
+void fill(char* buffer, uint64_t tag, uint64_t offset, size_t count) {
+  if (tag == 0) {
+    std::memset(buffer, 0, count);
+    return;
+  }
+  uint64_t word = pattern_word(tag, offset / 8);
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t at = offset + i;
+    if (at % 8 == 0) {
+      word = pattern_word(tag, at / 8);
+    }
+    buffer[i] = static_cast<char>(word >> (8 * (at % 8)));  // NOLINT
+  }
+}
+
+struct write_record {
+  uint64_t tag;
+  uint64_t offset;
+  uint64_t count;
+  uint64_t start;
+  uint64_t end;
+};
+
+/* What a worker reports through memory shared with the driver. */
+struct worker_result {
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t writes;
+  uint64_t start;
+  uint64_t end;
+};
+
+/*
+ * Which write last covered each range of a worker's region, the shadow a
+ * worker with a region of its own checks its reads against.
+ */
+class shadow {
+public:
+  void write(uint64_t offset, uint64_t count, uint64_t tag) {
+    split(offset);
+    split(offset + count);
+    ranges_.erase(
+        ranges_.lower_bound(offset), ranges_.lower_bound(offset + count)
+    );
+    ranges_.emplace(offset, std::make_pair(offset + count, tag));
+  }
+
+  /* Fills `buffer` with what the range should hold. */
+  void expect(char* buffer, uint64_t offset, uint64_t count) const {
+    auto it = ranges_.upper_bound(offset);
+    if (it != ranges_.begin() && std::prev(it)->second.first > offset) {
+      --it;
+    }
+    uint64_t at = offset;
+    while (at < offset + count) {
+      const bool inside = it != ranges_.end() && it->first <= at;
+      uint64_t until = offset + count;
+      if (it != ranges_.end()) {
+        until = std::min(until, inside ? it->second.first : it->first);
+      }
+      const uint64_t tag = inside ? it->second.second : 0;
+      fill(buffer + (at - offset), tag, at, until - at);
+      if (inside) {
+        ++it;
+      }
+      at = until;
+    }
+  }
+
+private:
+  void split(uint64_t at) {
+    auto it = ranges_.upper_bound(at);
+    if (it == ranges_.begin()) {
+      return;
+    }
+    --it;
+    if (it->first < at && at < it->second.first) {
+      ranges_.emplace(at, it->second);
+      it->second.first = at;
+    }
+  }
+
+  /* Start -> (end, tag). */
+  std::map<uint64_t, std::pair<uint64_t, uint64_t>> ranges_;
+};
+
+auto log_path(const options& o, size_t index) -> std::string {
+  return o.path + ".log." + std::to_string(index);
+}
+
+/*
+ * One stream of random operations on a region of the file, starting when
+ * the driver closes its end of `start`. Sequential reads and writes go on
+ * from the last seek, which lands in the hot window at the start of the
+ * region `hot` percent of the time.
+ */
+auto work(
+    const options& o,
+    bool disjoint,
+    size_t index,
+    size_t count,
+    int start,
+    worker_result* result
+) -> int {
+  const uint64_t from = disjoint ? o.size * index / count : 0;
+  const uint64_t to = disjoint ? o.size * (index + 1) / count : o.size;
+  const uint64_t window = from + o.window;
+  const int fd = ::vtpc_open(o.path.c_str(), O_RDWR, 0);
+  FILE* log = std::fopen(log_path(o, index).c_str(), "wb");
+  if (fd == -1 || log == nullptr) {
+    throw vt::exception() << "worker " << index << " failed to open";
+  }
+
+  std::seed_seq seeds{o.seed, static_cast<uint64_t>(index)};
+  std::mt19937_64 random(seeds);
+  std::uniform_int_distribution<size_t> percent_dist(0, 99);
+  std::uniform_int_distribution<uint64_t> region_dist(from, to - 1);
+  std::uniform_int_distribution<uint64_t> window_dist(from, window - 1);
+  std::uniform_int_distribution<size_t> batch_dist(1, o.batch);
+  std::string buffer(o.batch, ' ');
+  std::string expected(o.batch, ' ');
+  shadow model;
+  uint64_t sequence = 0;
+  uint64_t position = from;
+  if (::vtpc_lseek(fd, static_cast<off_t>(position), SEEK_SET) == -1) {
+    throw vt::exception() << "worker " << index << " failed to seek";
+  }
+
+  char byte = 0;
+  (void)::read(start, &byte, 1);
+  result->start = now();
+  for (size_t i = 0; i < o.ops; ++i) {
+    result->ops += 1;
+    const size_t point = percent_dist(random);
+    if (point < o.seeks) {
+      position = percent_dist(random) < o.hot ? window_dist(random)
+                                              : region_dist(random);
+      if (::vtpc_lseek(fd, static_cast<off_t>(position), SEEK_SET) == -1) {
+        throw vt::exception() << "worker " << index << ": seek failed";
+      }
+      continue;
+    }
+    if (point < o.seeks + o.syncs) {
+      if (::vtpc_fsync(fd) == -1) {
+        throw vt::exception() << "worker " << index << ": fsync failed";
+      }
+      continue;
+    }
+
+    const size_t bytes = batch_dist(random);
+    if (position + bytes > to) {
+      position = from;
+      if (::vtpc_lseek(fd, static_cast<off_t>(position), SEEK_SET) == -1) {
+        throw vt::exception() << "worker " << index << ": seek failed";
+      }
+    }
+    if (percent_dist(random) < o.writes) {
+      sequence += 1;
+      const uint64_t tag = ((index + 1) << tag_shift) | sequence;
+      fill(buffer.data(), tag, position, bytes);
+      write_record record{
+          .tag = tag,
+          .offset = position,
+          .count = bytes,
+          .start = now(),
+          .end = 0,
+      };
+      if (::vtpc_write(fd, buffer.data(), bytes) !=
+          static_cast<ssize_t>(bytes)) {
+        throw vt::exception() << "worker " << index << ": write failed";
+      }
+      record.end = now();
+      std::fwrite(&record, sizeof(record), 1, log);
+      if (disjoint) {
+        model.write(position, bytes, tag);
+      }
+      result->writes += 1;
+    } else {
+      if (::vtpc_read(fd, buffer.data(), bytes) !=
+          static_cast<ssize_t>(bytes)) {
+        throw vt::exception() << "worker " << index << ": read failed";
+      }
+      if (disjoint) {
+        model.expect(expected.data(), position, bytes);
+        if (std::memcmp(buffer.data(), expected.data(), bytes) != 0) {
+          size_t bad = 0;
+          while (buffer[bad] == expected[bad]) {
+            ++bad;
+          }
+          throw vt::exception() << "worker " << index << " read bad data at "
+                                << position + bad;
+        }
+      }
+    }
+    position += bytes;
+    result->bytes += bytes;
+  }
+  result->end = now();
+
+  if (::vtpc_fsync(fd) == -1 || ::vtpc_close(fd) == -1 ||
+      std::fclose(log) != 0) {
+    throw vt::exception() << "worker " << index << " failed to finish";
+  }
+  return 0;
+}
+
+/* Runs `body` in a child process that exits with the code it returns. */
+template <typename F>
+auto spawn(F body) -> pid_t {
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "fork failed";
+  }
+  if (pid == 0) {
+    int code = 1;
+    try {
+      code = body();
+    } catch (const std::exception& e) {
+      std::cerr << "exception: " << e.what() << '\n';
+    }
+    ::_exit(code);
+  }
+  return pid;
+}
+
+auto load_writes(const options& o, size_t workers)
+    -> std::vector<write_record> {
+  std::vector<write_record> records;
+  for (size_t i = 0; i < workers; ++i) {
+    const std::string path = log_path(o, i);
+    FILE* log = std::fopen(path.c_str(), "rb");
+    if (log == nullptr) {
+      throw vt::exception() << "no log from worker " << i;
+    }
+    write_record record{};
+    while (std::fread(&record, sizeof(record), 1, log) == 1) {
+      records.push_back(record);
+    }
+    std::fclose(log);
+    ::unlink(path.c_str());
+  }
+  return records;
+}
+
+/*
+ * Checks the file on disk against the writes of every worker. Each byte
+ * must come from one of the writes that covered it and were not followed,
+ * in real time, by another one that did: of two overlapping writes that
+ * ran at the same time, either may win. Bytes no write covered stay zero.
+ */
+auto verify(const options& o, const std::vector<write_record>& writes)
+    -> bool {
+  std::vector<std::pair<uint64_t, size_t>> edges;
+  for (size_t i = 0; i < writes.size(); ++i) {
+    edges.emplace_back(writes[i].offset, i);
+    edges.emplace_back(writes[i].offset + writes[i].count, i);
+  }
+  std::sort(edges.begin(), edges.end());
+
+  const int fd = ::open(o.path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << o.path;
+  }
+  std::string data(chunk, ' ');
+  std::string expected(chunk, ' ');
+  std::vector<size_t> active;
+  std::vector<uint64_t> winners;
+  size_t edge = 0;
+  uint64_t at = 0;
+  bool good = true;
+  while (good && at < o.size) {
+    while (edge < edges.size() && edges[edge].first == at) {
+      const size_t w = edges[edge++].second;
+      const auto it = std::find(active.begin(), active.end(), w);
+      if (it == active.end()) {
+        active.push_back(w);
+      } else {
+        *it = active.back();
+        active.pop_back();
+      }
+    }
+    const uint64_t next = edge < edges.size() ? edges[edge].first : o.size;
+    uint64_t latest = 0;
+    for (const size_t w : active) {
+      latest = std::max(latest, writes[w].start);
+    }
+    winners.clear();
+    for (const size_t w : active) {
+      if (writes[w].end >= latest) {
+        winners.push_back(writes[w].tag);
+      }
+    }
+    if (winners.empty()) {
+      winners.push_back(0);
+    }
+
+    for (uint64_t from = at; good && from < next; from += chunk) {
+      /* Holes read as zeros, only the data in them needs a look. */
+      if (winners[0] == 0) {
+        const off_t data_at = ::lseek(fd, static_cast<off_t>(from), SEEK_DATA);
+        if (data_at == -1 || static_cast<uint64_t>(data_at) >= next) {
+          break;
+        }
+        from = static_cast<uint64_t>(data_at);
+      }
+      const auto count = static_cast<size_t>(std::min<uint64_t>(
+          chunk, next - from
+      ));
+      if (::pread(fd, data.data(), count, static_cast<off_t>(from)) !=
+          static_cast<ssize_t>(count)) {
+        throw vt::exception() << "short read of " << o.path;
+      }
+      if (winners.size() == 1) {
+        fill(expected.data(), winners[0], from, count);
+        if (std::memcmp(expected.data(), data.data(), count) == 0) {
+          continue;
+        }
+      }
+      for (size_t i = 0; i < count; ++i) {
+        const uint64_t byte = from + i;
+        if (std::none_of(winners.begin(), winners.end(), [&](uint64_t tag) {
+              return pattern_byte(tag, byte) == data[i];
+            })) {
+          std::cerr << "byte " << byte << " is " << (data[i] & 0xFF)
+                    << ", from none of " << winners.size() << " writes\n";
+          good = false;
+          break;
+        }
+      }
+    }
+    at = next;
+  }
+  ::close(fd);
+  return good;
+}
+
+/* One run of `workers` streams, printed as a CSV row. */
+auto run(
+    const options& o,
+    const std::string& mode,
+    const std::string& layout,
+    size_t workers,
+    size_t number
+) -> bool {
+  const int created = ::open(o.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (created == -1 || ::ftruncate(created, static_cast<off_t>(o.size)) == -1) {
+    throw vt::exception() << "failed to create " << o.path;
+  }
+  ::close(created);
+
+  /* Processes only see each other's writes through a shared cache. */
+  const std::string shm = "/vtpc-stress-" + std::to_string(::getpid()) +
+                          "-" + std::to_string(number);
+  if (mode == "procs") {
+    ::setenv("VTPC_SHM", shm.c_str(), 1);
+  } else {
+    ::unsetenv("VTPC_SHM");
+  }
+
+  const size_t bytes = workers * sizeof(worker_result);
+  void* shared = ::mmap(
+      nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0
+  );
+  int start[2];
+  if (shared == MAP_FAILED || ::pipe(start) == -1) {  // NOLINT
+    throw vt::exception() << "failed to set up the workers";
+  }
+  auto* results = static_cast<worker_result*>(shared);
+  const bool disjoint = layout == "disjoint";
+
+  std::vector<pid_t> pids;
+  if (mode == "procs") {
+    for (size_t i = 0; i < workers; ++i) {
+      pids.push_back(spawn([&] {
+        ::close(start[1]);
+        return work(o, disjoint, i, workers, start[0], &results[i]);
+      }));
+    }
+  } else {
+    pids.push_back(spawn([&] {
+      ::close(start[1]);
+      std::vector<std::thread> threads;
+      std::vector<int> codes(workers, 1);
+      for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back([&, i] {
+          try {
+            codes[i] = work(o, disjoint, i, workers, start[0], &results[i]);
+          } catch (const std::exception& e) {
+            std::cerr << "exception: " << e.what() << '\n';
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      return *std::max_element(codes.begin(), codes.end());
+    }));
+  }
+  ::close(start[0]);
+  ::close(start[1]);
+
+  bool good = true;
+  for (const pid_t pid : pids) {
+    int status = 0;
+    if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      good = false;
+    }
+  }
+  if (mode == "procs") {
+    ::shm_unlink(shm.c_str());
+  }
+
+  const auto writes = load_writes(o, workers);
+  good = good && verify(o, writes);
+
+  uint64_t ops = 0;
+  uint64_t moved = 0;
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+  for (size_t i = 0; i < workers; ++i) {
+    ops += results[i].ops;
+    moved += results[i].bytes;
+    first = std::min(first, results[i].start);
+    last = std::max(last, results[i].end);
+  }
+  ::munmap(shared, bytes);
+  const double seconds =
+      last > first ? static_cast<double>(last - first) / 1e9 : 0;
+  const double rate = seconds > 0 ? 1 / seconds : 0;
+  std::cout << mode << ',' << layout << ',' << workers << ',' << ops << ','
+            << seconds << ',' << static_cast<double>(ops) * rate << ','
+            << static_cast<double>(moved) * rate / (1U << 20U) << ','
+            << writes.size() << ',' << (good ? "ok" : "FAIL") << '\n'
+            << std::flush;
+  return good;
+}
+
+}  // namespace
+
+/*
+ * Drives vtpc with N workers, processes sharing a cache or threads of one
+ * process, each running a seeded random stream of reads, writes, seeks
+ * and syncs over its own part of a large file or over all of it. Reports
+ * the throughput for each worker count and checks the file against what
+ * the workers wrote.
+ */
+auto main(int argc, char** argv) -> int try {
+  const options o = parse(argc, argv);
+  std::cout << "mode,layout,workers,ops,seconds,ops_per_s,mb_per_s,writes,"
+               "verified\n"
+            << std::flush;
+  bool good = true;
+  size_t number = 0;
+  for (const auto& mode : o.modes) {
+    for (const auto& layout : o.layouts) {
+      for (const size_t workers : o.workers) {
+        good = run(o, mode, layout, workers, number++) && good;
+      }
+    }
+  }
+  ::unlink(o.path.c_str());
+  return good ? 0 : 1;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,177 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/hint";
+constexpr size_t block = 4096;
+constexpr size_t near_blocks = 128;
+constexpr size_t far_blocks = 512;
+constexpr size_t blocks = near_blocks + far_blocks;
+constexpr size_t small_blocks = 256;
+constexpr size_t stride = 37;
+constexpr time_t hour = 3600;
+
+void fill(size_t count) {
+  const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path;
+  }
+  std::string data(block, ' ');
+  for (size_t i = 0; i < count; ++i) {
+    data.assign(block, static_cast<char>('a' + i % 26));
+    if (::pwrite(fd, data.data(), block, static_cast<off_t>(i * block)) !=
+        static_cast<ssize_t>(block)) {
+      throw vt::exception() << "failed to write " << path;
+    }
+  }
+  ::close(fd);
+}
+
+void advise(int fd, size_t first, size_t count, vtpc_access_hint_t hint) {
+  if (::vtpc_advise(
+          fd,
+          static_cast<off_t>(first * block),
+          static_cast<off_t>(count * block),
+          hint
+      ) == -1) {
+    throw vt::exception() << "advise " << hint.advice << " failed";
+  }
+}
+
+/*
+ * Misses of reading the blocks [first, first + count), out of order so that
+ * no readahead gets in the way, the first block last. The data is checked.
+ */
+auto read_misses(int fd, size_t first, size_t count) -> uint64_t {
+  const uint64_t before = vt::stat_of(fd, VTPC_STAT_MISSES);
+  std::string buffer(block, ' ');
+  for (size_t k = 0; k < count; ++k) {
+    const size_t i = first + (k + 1) * stride % count;
+    const auto pos = static_cast<off_t>(i * block);
+    if (::vtpc_pread(fd, buffer.data(), block, pos) !=
+            static_cast<ssize_t>(block) ||
+        buffer != std::string(block, static_cast<char>('a' + i % 26))) {
+      throw vt::exception() << "bad read of block " << i;
+    }
+  }
+  return vt::stat_of(fd, VTPC_STAT_MISSES) - before;
+}
+
+auto open_file() -> int {
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  return fd;
+}
+
+/*
+ * The smallest cache holds fewer blocks than the file. The first blocks are
+ * said to be needed in an hour with AT, the rest in two hours with AFTER,
+ * before any is cached: the far blocks are the ones evicted while reading
+ * the whole file, so the near ones are all still there afterwards.
+ */
+void check_times() {
+  fill(blocks);
+  const int fd = open_file();
+  timespec now{};
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  advise(fd, 0, near_blocks, {VTPC_ADVICE_AT, {now.tv_sec + hour, 0}});
+  advise(fd, near_blocks, far_blocks, {VTPC_ADVICE_AFTER, {2 * hour, 0}});
+
+  if (read_misses(fd, 0, blocks) != blocks) {
+    throw vt::exception() << "the file was cached before it was read";
+  }
+  const uint64_t near = read_misses(fd, 0, near_blocks);
+  const uint64_t far = read_misses(fd, near_blocks, far_blocks);
+  std::cout << "misses: near = " << near << ", far = " << far << '\n';
+  if (near != 0 || far == 0) {
+    throw vt::exception() << "blocks needed later were not evicted first";
+  }
+  ::vtpc_close(fd);
+}
+
+/* WILLNEED loads the range, so reading it afterwards never misses. */
+void check_willneed() {
+  fill(small_blocks);
+  const int fd = open_file();
+  advise(fd, 0, small_blocks, {VTPC_ADVICE_WILLNEED, {}});
+  const uint64_t misses = read_misses(fd, 0, small_blocks);
+  std::cout << "misses after willneed = " << misses << '\n';
+  if (misses != 0) {
+    throw vt::exception() << "willneed did not load the range";
+  }
+  ::vtpc_close(fd);
+}
+
+/*
+ * With SEQUENTIAL, the blocks read through are dropped, readahead included,
+ * so reading them again misses every one. Without it they stay cached.
+ */
+auto reread_misses(bool sequential) -> uint64_t {
+  const int fd = open_file();
+  if (sequential) {
+    advise(fd, 0, 0, {VTPC_ADVICE_SEQUENTIAL, {}});
+  }
+  std::string buffer(small_blocks * block / 4, ' ');
+  for (size_t pos = 0; pos < small_blocks * block; pos += buffer.size()) {
+    if (::vtpc_read(fd, buffer.data(), buffer.size()) !=
+        static_cast<ssize_t>(buffer.size())) {
+      throw vt::exception() << "short read";
+    }
+  }
+  advise(fd, 0, 0, {VTPC_ADVICE_NORMAL, {}});
+  const uint64_t misses = read_misses(fd, 0, small_blocks);
+  ::vtpc_close(fd);
+  return misses;
+}
+
+void check_sequential() {
+  const uint64_t normal = reread_misses(false);
+  const uint64_t sequential = reread_misses(true);
+  std::cout << "misses of a second pass: normal = " << normal
+            << ", sequential = " << sequential << '\n';
+  if (normal != 0 || sequential != small_blocks) {
+    throw vt::exception() << "sequential did not drop the blocks read";
+  }
+}
+
+}  // namespace
+
+/*
+ * Under the Optimal policy, access times given with AT and AFTER decide
+ * which blocks are evicted. WILLNEED and SEQUENTIAL act on the cache
+ * directly.
+ */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "1M", 1);
+  if (::vtpc_set_policy(VTPC_POLICY_OPTIMAL) == -1) {
+    throw vt::exception() << "vtpc_set_policy failed";
+  }
+  check_times();
+  check_willneed();
+  check_sequential();
+  ::unlink(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,134 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "async_file.hpp"
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/d";
+constexpr size_t tasks = 64;
+constexpr size_t region = (1U << 17U);
+constexpr size_t steps = (1U << 10U);
+constexpr size_t max_batch = (1U << 13U);
+
+/*
+ * Each task owns a region of the file and checks every read of it against
+ * a shadow copy of what it wrote. All of them run on one thread.
+ */
+auto worker(vt::async_file& file, size_t id, std::string& shadow)
+    -> vt::task {
+  std::default_random_engine random(id);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<size_t> offset_dist(0, region - 1);
+  std::uniform_int_distribution<size_t> batch_dist(1, max_batch);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  const auto base = static_cast<off_t>(id * region);
+  co_await file.write(shadow.data(), region, base);
+
+  std::string buffer(max_batch, ' ');
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t offset = offset_dist(random);
+    const size_t batch = std::min(batch_dist(random), region - offset);
+    const auto pos = base + static_cast<off_t>(offset);
+
+    if (action_dist(random) < 70) {  // NOLINT
+      const size_t got = co_await file.read(buffer.data(), batch, pos);
+      if (got != batch ||
+          shadow.compare(offset, batch, buffer, 0, batch) != 0) {
+        throw vt::exception()
+            << "task " << id << " read stale data at " << pos;
+      }
+    } else {
+      for (size_t j = 0; j < batch; ++j) {
+        buffer[j] = static_cast<char>(char_dist(random));
+      }
+      co_await file.write(buffer.data(), batch, pos);
+      shadow.replace(offset, batch, buffer, 0, batch);
+    }
+  }
+}
+
+/* Reads every region back through the C API, waiting on an eventfd. */
+void verify_eventfd(const std::vector<std::string>& shadows) {
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  const int event = ::eventfd(0, EFD_CLOEXEC);
+  if (fd == -1 || event == -1) {
+    throw vt::exception() << "open failed";
+  }
+
+  std::vector<std::string> buffers(tasks, std::string(region, ' '));
+  std::vector<vtpc_async_t> ops(tasks);
+  for (size_t id = 0; id < tasks; ++id) {
+    ops[id].eventfd = event;
+    const auto pos = static_cast<off_t>(id * region);
+    if (::vtpc_read_async(fd, pos, buffers[id].data(), region, &ops[id]) ==
+        -1) {
+      throw vt::exception() << "vtpc_read_async failed";
+    }
+  }
+
+  uint64_t completed = 0;
+  while (completed < tasks) {
+    pollfd ready = {.fd = event, .events = POLLIN, .revents = 0};
+    uint64_t count = 0;
+    if (::poll(&ready, 1, -1) == 1 &&
+        ::read(event, &count, sizeof(count)) == sizeof(count)) {
+      completed += count;
+    }
+  }
+  for (size_t id = 0; id < tasks; ++id) {
+    if (::vtpc_async_done(&ops[id]) == 0 ||
+        ops[id].result != static_cast<ssize_t>(region) ||
+        buffers[id] != shadows[id]) {
+      throw vt::exception() << "region " << id << " differs";
+    }
+  }
+  ::close(event);
+  ::vtpc_close(fd);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::vector<std::string> shadows(tasks, std::string(region, '\0'));
+  const auto start = std::chrono::steady_clock::now();
+  {
+    vt::io_loop loop;
+    vt::async_file file(path, loop);
+    for (size_t id = 0; id < tasks; ++id) {
+      loop.spawn(worker(file, id, shadows[id]));
+    }
+    loop.run();
+    file.sync();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "tasks = " << tasks << ", ops/s = "
+            << static_cast<double>(tasks * steps) / elapsed.count() << '\n';
+
+  verify_eventfd(shadows);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,166 @@
+#include <sys/types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block = 4096;
+constexpr size_t batch = (1U << 16U);
+constexpr std::array<const char*, 3> paths = {
+    "/tmp/d0", "/tmp/d1", "/tmp/d2"
+};
+constexpr std::array<size_t, 3> sizes = {
+    (16U << 20U), (4U << 20U), (4U << 20U)
+};
+
+auto random_string(std::default_random_engine& random, size_t len)
+    -> std::string {
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(len, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  return data;
+}
+
+/* Reads the whole file, checks it and returns how many blocks missed. */
+auto read_all(int fd, const std::string& shadow) -> uint64_t {
+  vtpc_stats_t before;
+  ::vtpc_stats(fd, &before);
+  std::string buffer(batch, ' ');
+  for (size_t pos = 0; pos < shadow.size(); pos += batch) {
+    if (::vtpc_pread(fd, buffer.data(), batch, static_cast<off_t>(pos)) !=
+            static_cast<ssize_t>(batch) ||
+        shadow.compare(pos, batch, buffer) != 0) {
+      throw vt::exception() << "wrong data at " << pos;
+    }
+  }
+  vtpc_stats_t after;
+  ::vtpc_stats(fd, &after);
+  return after.counters[VTPC_STAT_MISSES] - before.counters[VTPC_STAT_MISSES];
+}
+
+void write_at(int fd, std::string& shadow, size_t pos, const std::string& s) {
+  if (::vtpc_pwrite(fd, s.data(), s.size(), static_cast<off_t>(pos)) !=
+      static_cast<ssize_t>(s.size())) {
+    throw vt::exception() << "write failed at " << pos;
+  }
+  shadow.replace(pos, s.size(), s);
+}
+
+}  // namespace
+
+/*
+ * A sparse file and two copies of the same data take twice the blocks
+ * the budget holds without dedup, but few distinct ones: they stay cached
+ * after the first read. Writes to shared blocks only change their own file,
+ * references taken before them keep the old data.
+ */
+auto main() -> int try {
+  ::unsetenv("VTPC_SHM");
+  ::setenv("VTPC_MEMORY", "12M", 1);
+  ::setenv("VTPC_DEDUP", "1", 1);
+
+  std::default_random_engine random(0);  // NOLINT
+  std::array<std::string, 3> shadows = {
+      std::string(sizes[0], '\0'), random_string(random, sizes[1]), ""
+  };
+  shadows[0].replace(sizes[0] / 2, block, random_string(random, block));
+  shadows[2] = shadows[1];
+  for (size_t i = 0; i < paths.size(); ++i) {
+    /* Only the one block of data of the sparse file is written. */
+    const size_t from = i == 0 ? sizes[i] / 2 : 0;
+    const size_t len = i == 0 ? block : sizes[i];
+    const int out = ::open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1 || ::ftruncate(out, static_cast<off_t>(sizes[i])) != 0 ||
+        ::pwrite(
+            out, shadows[i].data() + from, len, static_cast<off_t>(from)
+        ) != static_cast<ssize_t>(len)) {
+      throw vt::exception() << "failed to write " << paths[i];
+    }
+    ::close(out);
+  }
+
+  std::array<int, 3> fds{};
+  for (size_t i = 0; i < paths.size(); ++i) {
+    fds[i] = ::vtpc_open(paths[i], O_RDWR, 0);
+    if (fds[i] == -1) {
+      throw vt::exception() << "open failed";
+    }
+  }
+  uint64_t cold = 0;
+  uint64_t warm = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    cold += read_all(fds[i], shadows[i]);
+  }
+  for (size_t i = 0; i < paths.size(); ++i) {
+    warm += read_all(fds[i], shadows[i]);
+  }
+
+  /* A reference to a shared block keeps the data from before the copy. */
+  const std::string before = shadows[2].substr(7 * block, block);
+  vtpc_ref_t ref;
+  if (::vtpc_read_ref(fds[2], 7 * block, block, &ref) !=
+      static_cast<ssize_t>(block)) {
+    throw vt::exception() << "read_ref failed";
+  }
+  write_at(fds[0], shadows[0], 100 * block + 10, std::string(100, 'x'));
+  write_at(fds[1], shadows[1], 5 * block, random_string(random, block));
+  write_at(fds[2], shadows[2], 7 * block + 1, "y");
+  const std::string seen(static_cast<char*>(ref.iov[0].iov_base), block);
+  ::vtpc_release(&ref);
+  if (seen != before) {
+    throw vt::exception() << "a reference saw the write to a shared block";
+  }
+  uint64_t written = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    written += read_all(fds[i], shadows[i]);
+  }
+
+  vtpc_stats_t stats;
+  ::vtpc_stats(-1, &stats);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (::vtpc_close(fds[i]) != 0) {
+      throw vt::exception() << "close failed";
+    }
+    const int in = ::open(paths[i], O_RDONLY);
+    std::string disk(sizes[i], ' ');
+    if (in == -1 ||
+        ::pread(in, disk.data(), sizes[i], 0) !=
+            static_cast<ssize_t>(sizes[i]) ||
+        disk != shadows[i]) {
+      throw vt::exception() << "wrong data on disk in " << paths[i];
+    }
+    ::close(in);
+    ::unlink(paths[i]);
+  }
+
+  const uint64_t hits = stats.counters[VTPC_STAT_DEDUP_HITS];
+  const uint64_t copies = stats.counters[VTPC_STAT_DEDUP_COPIES];
+  std::cout << "misses: cold = " << cold << ", warm = " << warm
+            << ", written = " << written << "; dedup hits = " << hits
+            << ", copies = " << copies << '\n';
+  if (warm != 0 || written != 0 || hits < sizes[0] / block || copies < 3) {
+    throw vt::exception() << "the blocks were not shared";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,177 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr size_t block = 4096;
+constexpr size_t blocks = 1024;
+constexpr size_t tail = 1000;
+constexpr size_t size = blocks * block + tail;
+constexpr size_t threads = 4;
+constexpr size_t chunk = 3 * block + 100;
+
+struct io_case {
+  const char* path;
+  const char* depth;
+};
+
+/* The ring, then the preadv/pwritev fallback that a depth of 0 forces. */
+constexpr std::array<io_case, 2> cases = {{
+    {"/tmp/io.ring", "32"},
+    {"/tmp/io.sync", "0"},
+}};
+
+auto pattern(char seed) -> std::string {
+  std::string data(size, ' ');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(seed + (i * 7 + i / block) % 26);
+  }
+  return data;
+}
+
+auto read_file(const char* path) -> std::string {
+  const int fd = ::open(path, O_RDONLY);
+  std::string data(size + 1, ' ');
+  const ssize_t got = fd == -1 ? -1 : ::pread(fd, data.data(), data.size(), 0);
+  ::close(fd);
+  if (got != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to read " << path;
+  }
+  data.resize(size);
+  return data;
+}
+
+/*
+ * Threads go through their part of the file at once in chunks that cross
+ * blocks, the last one ending short at the end of the file.
+ */
+void in_parallel(int fd, const std::string& data, bool write) {
+  std::vector<std::exception_ptr> errors(threads);
+  {
+    std::vector<std::jthread> workers;
+    for (size_t id = 0; id < threads; ++id) {
+      workers.emplace_back([&, id] {
+        try {
+          std::string buffer(chunk, ' ');
+          const size_t part = size / threads;
+          const size_t end = id + 1 == threads ? size : (id + 1) * part;
+          for (size_t pos = id * part; pos < end; pos += chunk) {
+            const size_t count = std::min(chunk, end - pos);
+            const auto at = static_cast<off_t>(pos);
+            const ssize_t done =
+                write ? ::vtpc_pwrite(fd, data.data() + pos, count, at)
+                      : ::vtpc_pread(fd, buffer.data(), count, at);
+            if (done != static_cast<ssize_t>(count) ||
+                (!write && data.compare(pos, count, buffer, 0, count) != 0)) {
+              throw vt::exception() << "bad transfer at " << pos;
+            }
+          }
+        } catch (...) {
+          errors[id] = std::current_exception();
+        }
+      });
+    }
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+/*
+ * Reads a file written around the cache, writes it over through the cache,
+ * then reads it back from disk once dropped.
+ */
+void run(const io_case& c) {
+  const std::string before = pattern('a');
+  const int disk = ::open(c.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (disk == -1 || ::pwrite(disk, before.data(), size, 0) !=
+                        static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to write " << c.path;
+  }
+  ::close(disk);
+
+  const int fd = ::vtpc_open(c.path, O_RDWR, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  in_parallel(fd, before, false);
+
+  const std::string after = pattern('A');
+  in_parallel(fd, after, true);
+  if (::vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "fsync failed";
+  }
+  if (read_file(c.path) != after) {
+    throw vt::exception() << "bad data on disk";
+  }
+  const vtpc_access_hint_t dontneed = {VTPC_ADVICE_DONTNEED, {}};
+  if (::vtpc_advise(fd, 0, 0, dontneed) == -1) {
+    throw vt::exception() << "advise failed";
+  }
+  in_parallel(fd, after, false);
+  ::vtpc_close(fd);
+}
+
+}  // namespace
+
+/*
+ * The same reads and writes, with threads and a cache smaller than the
+ * file, give the same data through io_uring as through the fallback.
+ */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "1M", 1);
+  for (const auto& c : cases) {
+    const pid_t pid = ::fork();
+    if (pid == -1) {
+      throw vt::exception() << "fork failed";
+    }
+    if (pid == 0) {
+      try {
+        ::setenv("VTPC_QUEUE_DEPTH", c.depth, 1);
+        run(c);
+        ::_exit(0);
+      } catch (const std::exception& e) {
+        std::cerr << c.path << ": " << e.what() << '\n';
+        ::_exit(1);
+      }
+    }
+    int status = 0;
+    if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      throw vt::exception() << "queue depth " << c.depth << " failed";
+    }
+    std::cout << "queue depth " << c.depth << ": ok\n";
+  }
+  if (read_file(cases[0].path) != read_file(cases[1].path)) {
+    throw vt::exception() << "the ring and the fallback disagree";
+  }
+  for (const auto& c : cases) {
+    ::unlink(c.path);
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,170 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/l";
+constexpr auto manifest_path = "/tmp/l.manifest";
+constexpr size_t size = (1U << 20U);
+constexpr size_t batch = (1U << 16U);
+constexpr useconds_t poll_interval = 20000;
+constexpr size_t quiet_polls = 5;
+constexpr size_t max_polls = 250;
+
+/* Waits until the cache has read nothing from disk for a while. */
+void settle() {
+  uint64_t last = vt::disk_reads();
+  size_t quiet = 0;
+  for (size_t i = 0; i < max_polls && quiet < quiet_polls; ++i) {
+    ::usleep(poll_interval);
+    const uint64_t now = vt::disk_reads();
+    quiet = now == last ? quiet + 1 : 0;
+    last = now;
+  }
+}
+
+/* Writes the file and reads it, the manifest is saved on exit. */
+auto write() -> int {
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(size, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 ||
+      ::vtpc_pwrite(fd, data.data(), size, 0) != static_cast<ssize_t>(size) ||
+      ::vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "failed to write " << path;
+  }
+  std::string buffer(batch, ' ');
+  for (size_t pos = 0; pos < size; pos += batch) {
+    ::vtpc_pread(fd, buffer.data(), batch, static_cast<off_t>(pos));
+  }
+  ::vtpc_close(fd);
+  return 0;
+}
+
+/*
+ * Opens the file, lets the prewarm finish and reads the whole file. With
+ * `warm` every block has to be cached already, otherwise none may be.
+ */
+auto read(bool warm) -> int {
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  settle();
+  const uint64_t prewarmed = vt::disk_reads();
+  std::string buffer(batch, ' ');
+  for (size_t pos = 0; pos < size; pos += batch) {
+    if (::vtpc_pread(fd, buffer.data(), batch, static_cast<off_t>(pos)) !=
+        static_cast<ssize_t>(batch)) {
+      throw vt::exception() << "short read";
+    }
+  }
+  vtpc_stats_t stats;
+  ::vtpc_stats(fd, &stats);
+  const uint64_t misses = stats.counters[VTPC_STAT_MISSES];
+  ::vtpc_close(fd);
+
+  if (warm && (prewarmed == 0 || misses != 0)) {
+    throw vt::exception() << "prewarm missed " << misses << " blocks";
+  }
+  if (!warm && (prewarmed != 0 || misses == 0)) {
+    throw vt::exception() << "a stale manifest was used";
+  }
+  std::cout << (warm ? "warm" : "cold") << ": disk reads = " << prewarmed
+            << ", misses = " << misses << '\n';
+  return 0;
+}
+
+/* Runs this program with `role` in a fresh process. */
+void run(const char* self, const char* role) {
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "fork failed";
+  }
+  if (pid == 0) {
+    ::execl("/proc/self/exe", self, role, nullptr);
+    ::_exit(1);
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << role << " failed";
+  }
+}
+
+void touch() {
+  const int fd = ::open(path, O_WRONLY);
+  if (fd == -1 || ::pwrite(fd, "x", 1, 0) != 1) {
+    throw vt::exception() << "failed to change " << path;
+  }
+  ::close(fd);
+}
+
+void corrupt() {
+  const int fd = ::open(manifest_path, O_WRONLY);
+  const std::string garbage(batch, '\xff');
+  if (fd == -1 || ::pwrite(fd, garbage.data(), garbage.size(), 8) == -1) {
+    throw vt::exception() << "failed to change " << manifest_path;
+  }
+  ::close(fd);
+}
+
+}  // namespace
+
+/*
+ * A process that starts with the manifest of the previous one finds the
+ * file cached without reading it itself. Once the file changes, or the
+ * manifest is damaged, the manifest is ignored.
+ */
+auto main(int argc, char** argv) -> int try {
+  if (argc == 2 && std::strcmp(argv[1], "write") == 0) {
+    return write();
+  }
+  if (argc == 2 && std::strcmp(argv[1], "warm") == 0) {
+    return read(true);
+  }
+  if (argc == 2 && std::strcmp(argv[1], "cold") == 0) {
+    return read(false);
+  }
+
+  ::setenv("VTPC_MANIFEST", manifest_path, 1);
+  ::unlink(manifest_path);
+  run(argv[0], "write");
+  if (::access(manifest_path, R_OK) == -1) {
+    throw vt::exception() << "no manifest was saved";
+  }
+  run(argv[0], "warm");
+  run(argv[0], "warm");
+  touch();
+  run(argv[0], "cold");
+  corrupt();
+  run(argv[0], "cold");
+  ::unlink(manifest_path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
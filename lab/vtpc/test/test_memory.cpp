@@ -0,0 +1,81 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/m";
+constexpr size_t size = (16U << 20U);
+constexpr size_t batch = (1U << 16U);
+
+/* Reads the whole file and returns how many blocks missed. */
+auto read_all(int fd) -> uint64_t {
+  vtpc_stats_t before;
+  ::vtpc_stats(fd, &before);
+  std::string buffer(batch, ' ');
+  for (size_t pos = 0; pos < size; pos += batch) {
+    if (::vtpc_pread(fd, buffer.data(), batch, static_cast<off_t>(pos)) !=
+        static_cast<ssize_t>(batch)) {
+      throw vt::exception() << "short read";
+    }
+  }
+  vtpc_stats_t after;
+  ::vtpc_stats(fd, &after);
+  return after.counters[VTPC_STAT_MISSES] - before.counters[VTPC_STAT_MISSES];
+}
+
+}  // namespace
+
+/*
+ * With a budget well above the size of the file, the whole file stays
+ * cached after the first read.
+ */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "32M", 1);
+
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(size, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  const int out = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out == -1 ||
+      ::pwrite(out, data.data(), size, 0) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to write " << path;
+  }
+  ::close(out);
+
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  const uint64_t cold = read_all(fd);
+  const uint64_t warm = read_all(fd);
+  ::vtpc_close(fd);
+  ::unlink(path);
+
+  std::cout << "misses: cold = " << cold << ", warm = " << warm << '\n';
+  if (cold == 0 || warm != 0) {
+    throw vt::exception() << "the file did not stay cached";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,131 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "exception.hpp"
+#include "mrc.hpp"
+
+namespace {
+
+const std::vector<uint64_t> sizes = {256, 1024, 4096, 16384};
+const std::vector<std::string> policies = {
+    "lru", "clock", "2q", "lfu", "arc", "mru", "optimal"
+};
+constexpr size_t accesses = (1U << 19U);
+constexpr uint64_t hot = 2000;
+constexpr uint64_t cold = 30000;
+constexpr double tolerance = 0.05;
+
+/* Mostly a small hot set, with the rest spread over many more blocks. */
+auto stream() -> std::vector<uint64_t> {
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<uint64_t> hot_dist(0, hot - 1);
+  std::uniform_int_distribution<uint64_t> cold_dist(hot, hot + cold - 1);
+  std::uniform_int_distribution<int> share_dist(0, 99);
+  std::vector<uint64_t> blocks;
+  for (size_t i = 0; i < accesses; ++i) {
+    blocks.push_back(
+        share_dist(random) < 80 ? hot_dist(random) : cold_dist(random)
+    );
+  }
+  return blocks;
+}
+
+/* An LRU cache of `size` blocks, simulated the plain way. */
+auto lru_miss_ratio(const std::vector<uint64_t>& blocks, uint64_t size)
+    -> double {
+  std::list<uint64_t> order;
+  std::unordered_map<uint64_t, std::list<uint64_t>::iterator> index;
+  size_t misses = 0;
+  for (const uint64_t block : blocks) {
+    const auto it = index.find(block);
+    if (it != index.end()) {
+      order.splice(order.begin(), order, it->second);
+      continue;
+    }
+    misses += 1;
+    if (order.size() == size) {
+      index.erase(order.back());
+      order.pop_back();
+    }
+    order.push_front(block);
+    index[block] = order.begin();
+  }
+  return static_cast<double>(misses) / static_cast<double>(blocks.size());
+}
+
+auto run(const std::vector<uint64_t>& blocks, size_t keys, size_t mini)
+    -> std::vector<vt::mrc_curve> {
+  vt::mrc mrc({
+      .sizes = sizes,
+      .policies = policies,
+      .keys = keys,
+      .mini = mini,
+  });
+  for (const uint64_t block : blocks) {
+    mrc.access(block);
+  }
+  return mrc.curves();
+}
+
+}  // namespace
+
+/*
+ * Without sampling the LRU curve matches a plain LRU simulation and the
+ * optimal curve is below every other. Sampling down to a few thousand
+ * blocks keeps every curve close. A loop one block larger than the cache
+ * misses every time with LRU, hardly ever with the optimal policy.
+ */
+auto main() -> int try {
+  const auto blocks = stream();
+  const auto exact = run(blocks, 1U << 20U, 1U << 20U);
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    const double lru = lru_miss_ratio(blocks, sizes[i]);
+    std::cout << "size = " << sizes[i] << ", lru = " << lru;
+    if (std::abs(exact[0].miss_ratios[i] - lru) > 1e-9) {
+      throw vt::exception() << "lru is " << exact[0].miss_ratios[i];
+    }
+    for (const auto& curve : exact) {
+      std::cout << ", " << curve.policy << " = " << curve.miss_ratios[i];
+      if (exact.back().miss_ratios[i] > curve.miss_ratios[i] + 1e-9) {
+        throw vt::exception() << "optimal misses more than " << curve.policy;
+      }
+    }
+    std::cout << '\n';
+  }
+
+  const auto sampled = run(blocks, 8192, 1024);
+  for (size_t p = 0; p < policies.size(); ++p) {
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      const double error =
+          std::abs(sampled[p].miss_ratios[i] - exact[p].miss_ratios[i]);
+      if (!(error <= tolerance)) {
+        throw vt::exception() << policies[p] << " at " << sizes[i]
+                              << " is off by " << error << " when sampled";
+      }
+    }
+  }
+
+  const uint64_t loop = sizes[0] + 1;
+  std::vector<uint64_t> loops;
+  for (uint64_t i = 0; i < 1000 * loop; ++i) {
+    loops.push_back(i % loop);
+  }
+  const auto looped = run(loops, 1U << 20U, 1U << 20U);
+  std::cout << "loop: lru = " << looped[0].miss_ratios[0]
+            << ", optimal = " << looped.back().miss_ratios[0] << '\n';
+  if (looped[0].miss_ratios[0] != 1 || looped.back().miss_ratios[0] > 0.01) {
+    throw vt::exception() << "the loop is wrong";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
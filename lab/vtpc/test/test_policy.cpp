@@ -0,0 +1,366 @@
+#include <sys/types.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "policy.h"
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto hot_path = "/tmp/p.hot";
+constexpr auto scan_path = "/tmp/p.scan";
+constexpr size_t block = 4096;
+constexpr size_t hot_blocks = 128;
+constexpr size_t scan_blocks = 2048;
+constexpr size_t hot_passes = 4;
+constexpr size_t stride = 37;
+
+/* The state of one policy over a handful of frames, driven by hand. */
+class policy_state {
+public:
+  policy_state(const vtpc_policy& policy, uint32_t frames)
+      : policy_(policy),
+        frames_(frames),
+        memory_(policy.size(frames) / sizeof(uint64_t) + 1, 0) {
+    policy_.init(memory_.data(), frames);
+  }
+
+  void reset() {
+    policy_.init(memory_.data(), frames_);
+  }
+
+  void insert(uint32_t frame, uint64_t key) {
+    policy_.insert(memory_.data(), frame, key);
+  }
+
+  void touch(uint32_t frame) {
+    policy_.touch(memory_.data(), frame);
+  }
+
+  void advise(uint32_t frame, uint64_t key, uint64_t when) {
+    if (policy_.advise != nullptr) {
+      policy_.advise(memory_.data(), frame, key, when);
+    }
+  }
+
+  /* The next victim, evicted for good. */
+  auto evict(uint64_t key) -> uint32_t {
+    const uint32_t frame = policy_.victim(memory_.data(), key);
+    if (frame != VTPC_NIL && policy_.evict != nullptr) {
+      policy_.evict(memory_.data(), frame);
+    }
+    return frame;
+  }
+
+  /* Takes victims and gives them back, as the cache does with busy ones. */
+  void set_aside(size_t count, uint64_t key) {
+    std::vector<uint32_t> taken;
+    for (size_t i = 0; i < count; ++i) {
+      taken.push_back(policy_.victim(memory_.data(), key));
+    }
+    for (auto frame = taken.rbegin(); frame != taken.rend(); ++frame) {
+      policy_.restore(memory_.data(), *frame);
+    }
+  }
+
+  /* The victims must come in this order, keys being those to insert. */
+  void expect(std::initializer_list<uint32_t> victims, uint64_t key = 0) {
+    for (const uint32_t expected : victims) {
+      const uint32_t frame = evict(key);
+      if (frame != expected) {
+        throw vt::exception() << policy_.name << ": evicted frame " << frame
+                              << " instead of " << expected;
+      }
+    }
+  }
+
+private:
+  const vtpc_policy& policy_;
+  uint32_t frames_;
+  std::vector<uint64_t> memory_;
+};
+
+/* Frames 0 to 3 hold the blocks with keys 10 to 13, inserted in order. */
+auto filled(const vtpc_policy& policy) -> policy_state {
+  policy_state state(policy, 4);
+  for (uint32_t frame = 0; frame < 4; ++frame) {
+    state.insert(frame, 10 + frame);
+  }
+  return state;
+}
+
+void check_victims() {
+  auto lru = filled(vtpc_policy_lru);
+  lru.touch(0);
+  lru.expect({1, 2, 3, 0, VTPC_NIL});
+
+  auto mru = filled(vtpc_policy_mru);
+  mru.touch(1);
+  mru.expect({1, 3, 2, 0, VTPC_NIL});
+
+  /* The hand clears the bits of frames 0 and 1 and stops at frame 2. */
+  auto clock = filled(vtpc_policy_clock);
+  clock.touch(0);
+  clock.touch(1);
+  clock.expect({2, 3, 0, 1, VTPC_NIL});
+
+  /* Fewest uses first, the least recently used of a count first. */
+  auto lfu = filled(vtpc_policy_lfu);
+  lfu.touch(0);
+  lfu.touch(0);
+  lfu.touch(1);
+  lfu.touch(3);
+  lfu.expect({2, 1, 3, 0, VTPC_NIL});
+
+  /*
+   * Four frames let one block stay in A1in. Touches do not promote, only a
+   * block coming back while remembered in A1out enters Am.
+   */
+  auto twoq = filled(vtpc_policy_2q);
+  twoq.touch(1);
+  twoq.expect({0});
+  twoq.insert(0, 10);
+  twoq.expect({1, 2, 0, 3, VTPC_NIL});
+
+  /*
+   * A touched block moves to T2 and outlives the blocks seen once. The
+   * block evicted from T1 comes back while in B1, so it enters T2 as well
+   * and T1 is given one frame as its target: once down to it, T2 is
+   * evicted instead.
+   */
+  auto arc = filled(vtpc_policy_arc);
+  arc.touch(0);
+  arc.expect({1}, 20);
+  arc.insert(1, 11);
+  arc.expect({2, 0, 1, 3, VTPC_NIL}, 21);
+
+  /* Without hints, the optimal policy falls back to LRU. */
+  auto optimal = filled(vtpc_policy_optimal);
+  optimal.touch(0);
+  optimal.expect({1, 2, 3, 0, VTPC_NIL});
+}
+
+/*
+ * Shard recovery initializes the state of a policy again while in use,
+ * nothing tracked before may come back as a victim.
+ */
+void check_reset() {
+  const std::array<const vtpc_policy*, 7> policies = {
+      &vtpc_policy_lru,
+      &vtpc_policy_mru,
+      &vtpc_policy_clock,
+      &vtpc_policy_lfu,
+      &vtpc_policy_2q,
+      &vtpc_policy_arc,
+      &vtpc_policy_optimal,
+  };
+  for (const auto* policy : policies) {
+    auto state = filled(*policy);
+    state.touch(1);
+    state.reset();
+    state.insert(2, 12);
+    state.expect({2, VTPC_NIL});
+  }
+}
+
+/*
+ * Victims given back, as busy frames are, are where they were: they leave
+ * no ghost in A1out or B1 and B2, do not move to Am or T2, keep their use
+ * count and their hint, and ARC keeps its target. What follows is then the
+ * same as if they were never taken, evicting a frame and bringing its block
+ * back included. The hand of CLOCK moves on, so it is left out.
+ */
+void check_restore() {
+  const std::array<const vtpc_policy*, 6> policies = {
+      &vtpc_policy_lru,
+      &vtpc_policy_mru,
+      &vtpc_policy_lfu,
+      &vtpc_policy_2q,
+      &vtpc_policy_arc,
+      &vtpc_policy_optimal,
+  };
+  for (const auto* policy : policies) {
+    std::array<std::vector<uint32_t>, 2> orders;
+    for (size_t aside = 0; aside < orders.size(); ++aside) {
+      auto state = filled(*policy);
+      state.touch(1);
+      state.touch(3);
+      state.advise(2, 12, UINT64_MAX / 2);
+      state.set_aside(aside * 3, 20);
+      const uint32_t first = state.evict(20);
+      orders[aside].push_back(first);
+      state.insert(first, 10 + first);
+      for (uint32_t frame = 0; frame != VTPC_NIL;) {
+        frame = state.evict(21);
+        orders[aside].push_back(frame);
+      }
+    }
+    if (orders[0] != orders[1]) {
+      throw vt::exception() << policy->name
+                            << ": victims given back were moved";
+    }
+  }
+}
+
+void fill(const char* path, size_t blocks) {
+  const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path;
+  }
+  std::string data(block, ' ');
+  for (size_t i = 0; i < blocks; ++i) {
+    data.assign(block, static_cast<char>('a' + i % 26));
+    if (::pwrite(fd, data.data(), block, static_cast<off_t>(i * block)) !=
+        static_cast<ssize_t>(block)) {
+      throw vt::exception() << "failed to write " << path;
+    }
+  }
+  ::close(fd);
+}
+
+/*
+ * Reads every block of the file once, out of order so that no readahead
+ * gets in the way, checks the data and returns how many blocks missed.
+ */
+auto read_all(int fd, size_t blocks) -> uint64_t {
+  vtpc_stats_t before;
+  ::vtpc_stats(fd, &before);
+  std::string buffer(block, ' ');
+  for (size_t k = 0; k < blocks; ++k) {
+    const size_t i = k * stride % blocks;
+    const auto pos = static_cast<off_t>(i * block);
+    if (::vtpc_pread(fd, buffer.data(), block, pos) !=
+            static_cast<ssize_t>(block) ||
+        buffer != std::string(block, static_cast<char>('a' + i % 26))) {
+      throw vt::exception() << "bad read of block " << i;
+    }
+  }
+  vtpc_stats_t after;
+  ::vtpc_stats(fd, &after);
+  return after.counters[VTPC_STAT_MISSES] - before.counters[VTPC_STAT_MISSES];
+}
+
+/*
+ * In the smallest cache, reads a hot file several times, then scans a file
+ * eight times the size of the cache once, and returns how many hot blocks
+ * missed after the scan.
+ */
+auto hot_misses(vtpc_policy_t policy) -> uint64_t {
+  if (::vtpc_set_policy(policy) == -1) {
+    throw vt::exception() << "vtpc_set_policy failed";
+  }
+  const int hot = ::vtpc_open(hot_path, O_RDONLY, 0);
+  const int scan = ::vtpc_open(scan_path, O_RDONLY, 0);
+  if (hot == -1 || scan == -1) {
+    throw vt::exception() << "open failed";
+  }
+  if (::vtpc_set_policy(VTPC_POLICY_LRU) != -1 || errno != EBUSY) {
+    throw vt::exception() << "the policy changed after the first open";
+  }
+
+  read_all(hot, hot_blocks);
+  for (size_t pass = 1; pass < hot_passes; ++pass) {
+    if (read_all(hot, hot_blocks) != 0) {
+      throw vt::exception() << "the hot file did not stay cached";
+    }
+  }
+  if (read_all(scan, scan_blocks) == 0) {
+    throw vt::exception() << "the scan did not miss";
+  }
+  const uint64_t misses = read_all(hot, hot_blocks);
+  ::vtpc_close(scan);
+  ::vtpc_close(hot);
+  return misses;
+}
+
+struct scan_case {
+  vtpc_policy_t policy;
+  const char* name;
+  bool keeps_hot;
+};
+
+/*
+ * Recency-based policies let a scan flush the hot blocks, those that count
+ * uses or keep the blocks seen twice apart, and MRU, keep them.
+ */
+constexpr std::array<scan_case, 7> scan_cases = {{
+    {VTPC_POLICY_LRU, "lru", false},
+    {VTPC_POLICY_CLOCK, "clock", false},
+    {VTPC_POLICY_2Q, "2q", false},
+    {VTPC_POLICY_LFU, "lfu", true},
+    {VTPC_POLICY_ARC, "arc", true},
+    {VTPC_POLICY_MRU, "mru", true},
+    {VTPC_POLICY_OPTIMAL, "optimal", false},
+}};
+
+/* Each policy runs in a fresh process, since it is fixed by the first open. */
+void check_scans() {
+  ::setenv("VTPC_MEMORY", "1M", 1);
+  fill(hot_path, hot_blocks);
+  fill(scan_path, scan_blocks);
+  for (const auto& c : scan_cases) {
+    const pid_t pid = ::fork();
+    if (pid == -1) {
+      throw vt::exception() << "fork failed";
+    }
+    if (pid == 0) {
+      try {
+        const uint64_t misses = hot_misses(c.policy);
+        std::cout << c.name << ": hot misses after the scan = " << misses
+                  << '\n'
+                  << std::flush;
+        ::_exit(misses == (c.keeps_hot ? 0 : hot_blocks) ? 0 : 2);
+      } catch (const std::exception& e) {
+        std::cerr << c.name << ": " << e.what() << '\n';
+        ::_exit(1);
+      }
+    }
+    int status = 0;
+    if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      throw vt::exception() << "policy " << c.name << " failed";
+    }
+  }
+  ::unlink(scan_path);
+  ::unlink(hot_path);
+}
+
+}  // namespace
+
+/*
+ * Every policy evicts the frames it should when driven directly, forgets
+ * them when initialized again, gives victims back untouched, and keeps or
+ * loses a hot set across a scan as it should when serving a small cache.
+ * The policy can only be chosen before the first open.
+ */
+auto main() -> int try {
+  check_victims();
+  check_reset();
+  check_restore();
+  if (::vtpc_set_policy(static_cast<vtpc_policy_t>(100)) != -1 ||
+      errno != EINVAL) {
+    throw vt::exception() << "an unknown policy was accepted";
+  }
+  check_scans();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
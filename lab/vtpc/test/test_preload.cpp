@@ -0,0 +1,209 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+namespace {
+
+constexpr auto dir = "/tmp/vtpc_preload/";
+constexpr auto in_path = "/tmp/vtpc_preload/in";
+constexpr auto out_path = "/tmp/vtpc_preload/out";
+constexpr auto numbers_path = "/tmp/vtpc_preload/numbers";
+constexpr auto vectored_path = "/tmp/vtpc_preload/vectored";
+constexpr auto stats_path = "/tmp/vtpc_preload.stats";
+constexpr size_t size = (8U << 20U);
+constexpr int numbers = 100000;
+
+auto read_file(const char* path) -> std::string {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), {}};
+}
+
+/* Writes numbers through stdio and reads them back, as the child. */
+auto stdio() -> int {
+  FILE* out = std::fopen(numbers_path, "w");
+  if (out == nullptr) {
+    return 1;
+  }
+  for (int i = 0; i < numbers; ++i) {
+    std::fprintf(out, "%d\n", i);
+  }
+  std::fclose(out);
+
+  FILE* in = std::fopen(numbers_path, "r");
+  if (in == nullptr) {
+    return 1;
+  }
+  int value = 0;
+  for (int i = 0; i < numbers; ++i) {
+    if (std::fscanf(in, "%d", &value) != 1 || value != i) {
+      return 1;
+    }
+  }
+  std::fclose(in);
+  return 0;
+}
+
+/*
+ * Writes "abcdef" with writev at the file offset and "ghi" with pwritev,
+ * then reads them back the same ways, as the child.
+ */
+auto vectored() -> int {
+  const int fd = ::open(vectored_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return 1;
+  }
+  std::string first = "abc";
+  std::string second = "def";
+  std::string third = "ghi";
+  const std::vector<iovec> out = {
+      {first.data(), first.size()}, {second.data(), second.size()}
+  };
+  const iovec last = {third.data(), third.size()};
+  if (::writev(fd, out.data(), 2) != 6 || ::pwritev(fd, &last, 1, 6) != 3 ||
+      ::lseek(fd, 0, SEEK_CUR) != 6 || ::lseek(fd, 3, SEEK_SET) != 3) {
+    return 1;
+  }
+  std::string a(3, ' ');
+  std::string b(3, ' ');
+  const std::vector<iovec> in = {{a.data(), a.size()}, {b.data(), b.size()}};
+  if (::readv(fd, in.data(), 2) != 6 || a != "def" || b != "ghi" ||
+      ::preadv(fd, in.data(), 2, 0) != 6 || a != "abc" || b != "def") {
+    return 1;
+  }
+  return ::close(fd) == 0 ? 0 : 1;
+}
+
+/* Runs the program with the shim loaded and returns what the cache did. */
+auto run(const std::vector<const char*>& args) -> std::string {
+  ::unlink(stats_path);
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "fork failed";
+  }
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (const char* arg : args) {
+      argv.push_back(const_cast<char*>(arg));  // NOLINT
+    }
+    argv.push_back(nullptr);
+    ::execvp(argv[0], argv.data());
+    ::_exit(1);
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << args[0] << " failed";
+  }
+  return read_file(stats_path);
+}
+
+auto counter(const std::string& stats, const std::string& name)
+    -> uint64_t {
+  std::istringstream lines(stats);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (line.starts_with(name + ' ')) {
+      return std::stoull(line.substr(name.size() + 1));
+    }
+  }
+  throw vt::exception() << "no " << name << " in the stats";
+}
+
+}  // namespace
+
+/*
+ * dd and programs using stdio and vectored calls, which know nothing of
+ * the cache, copy and write files under the prefix with the shim loaded:
+ * the data is right on disk and every byte went through the cache.
+ */
+auto main(int argc, char** argv) -> int try {
+  if (argc == 2 && std::strcmp(argv[1], "stdio") == 0) {
+    return stdio();
+  }
+  if (argc == 2 && std::strcmp(argv[1], "vectored") == 0) {
+    return vectored();
+  }
+
+  ::unsetenv("VTPC_SHM");
+  ::setenv("LD_PRELOAD", VTPC_PRELOAD, 1);
+  ::setenv("VTPC_PRELOAD_PREFIX", dir, 1);
+  ::setenv("VTPC_STATS_DUMP", stats_path, 1);
+  ::mkdir(dir, 0755);
+
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(size, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  std::ofstream(in_path, std::ios::binary) << data;
+
+  const std::string dd = run(
+      {"dd", "if=/tmp/vtpc_preload/in", "of=/tmp/vtpc_preload/out", "bs=64K"}
+  );
+  if (read_file(out_path) != data) {
+    throw vt::exception() << "dd copied wrong data";
+  }
+  std::cout << "dd: bytes read = " << counter(dd, "bytes_read")
+            << ", written = " << counter(dd, "bytes_written") << '\n';
+  if (counter(dd, "bytes_read") != size ||
+      counter(dd, "bytes_written") != size) {
+    throw vt::exception() << "dd bypassed the cache";
+  }
+
+  const std::string streams = run({"/proc/self/exe", "stdio"});
+  std::string expected;
+  for (int i = 0; i < numbers; ++i) {
+    expected += std::to_string(i) + '\n';
+  }
+  if (read_file(numbers_path) != expected) {
+    throw vt::exception() << "stdio wrote wrong data";
+  }
+  std::cout << "stdio: bytes read = " << counter(streams, "bytes_read")
+            << ", written = " << counter(streams, "bytes_written") << '\n';
+  if (counter(streams, "bytes_read") != expected.size() ||
+      counter(streams, "bytes_written") != expected.size()) {
+    throw vt::exception() << "stdio bypassed the cache";
+  }
+
+  const std::string vectors = run({"/proc/self/exe", "vectored"});
+  if (read_file(vectored_path) != "abcdefghi") {
+    throw vt::exception() << "vectored calls wrote wrong data";
+  }
+  if (counter(vectors, "bytes_read") != 12 ||
+      counter(vectors, "bytes_written") != 9) {
+    throw vt::exception() << "vectored calls bypassed the cache";
+  }
+
+  for (const char* path : {in_path, out_path, numbers_path, vectored_path}) {
+    ::unlink(path);
+  }
+  ::rmdir(dir);
+  ::unlink(stats_path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -11,20 +11,28 @@
 
 #include "cmp_file.hpp"
 #include "file.hpp"
-#include "log_file.hpp"
+#include "trace_file.hpp"
 
-auto main() -> int try {
+/*
+ * Runs random operations on libc and vtpc side by side. Arguments are the
+ * number of steps and the trace to record, "-" for none: long runs skip the
+ * trace, it grows by 32 bytes a step.
+ */
+auto main(int argc, char** argv) -> int try {
   constexpr size_t seed = 1;
-  constexpr size_t steps = (1U << 16U);
   constexpr size_t size = (1U << 12U);
-  constexpr size_t interval = 100;
+  constexpr size_t interval = (1U << 20U);
+  const size_t steps = argc > 1 ? std::stoull(argv[1]) : (1U << 16U);
+  const std::string trace = argc > 2 ? argv[2] : "/tmp/random.trace";
 
-  std::unique_ptr<vt::file> file = [] {
+  std::unique_ptr<vt::file> file = [&]() -> std::unique_ptr<vt::file> {
     auto libc = vt::file::open_libc("/tmp/a");
     auto vtpc = vt::file::open_vtpc("/tmp/b");
     auto cmp = std::make_unique<vt::cmp_file>(std::move(libc), std::move(vtpc));
-    auto log = std::make_unique<vt::log_file>(std::move(cmp));
-    return log;
+    if (trace == "-") {
+      return cmp;
+    }
+    return std::make_unique<vt::trace_file>(std::move(cmp), trace);
   }();
 
   std::default_random_engine random(seed);  // NOLINT
@@ -34,13 +42,13 @@ auto main() -> int try {
   std::uniform_int_distribution<size_t> batch_dist(0, size / 4);
   std::uniform_int_distribution<uint8_t> char_dist(0);
 
-  const auto random_string = [&](size_t size) {
-    std::string string(size, ' ');
-    for (char& c : string) {
-      c = static_cast<char>(char_dist(random));
-    }
-    return string;
-  };
+  /* Writes take a random slice of random bytes, made once. */
+  std::string noise(2 * size, ' ');
+  for (char& c : noise) {
+    c = static_cast<char>(char_dist(random));
+  }
+  std::uniform_int_distribution<size_t> slice_dist(0, size);
+  std::string buffer(size, ' ');
 
   file->seek(0);
   file->write(std::string(size, ' '));
@@ -55,10 +63,10 @@ auto main() -> int try {
       size_t point = action_dist(random);
       if (point < 40) {  // NOLINT
         size_t batch = batch_dist(random);
-        file->read(batch);
+        file->read(buffer.data(), batch);
       } else if (point < 75) {  // NOLINT
         size_t batch = batch_dist(random);
-        file->write(random_string(batch));
+        file->write(noise.data() + slice_dist(random), batch);
       } else if (point < 95) {  // NOLINT
         file->seek(offset_dist(random));
       } else {
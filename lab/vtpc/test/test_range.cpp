@@ -0,0 +1,107 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto big_path = "/tmp/r";
+constexpr auto wal_path = "/tmp/r.wal";
+constexpr size_t block = 4096;
+constexpr size_t big_size = (16U << 20U);
+constexpr size_t wal_blocks = 4;
+constexpr size_t first = (4U << 20U);
+constexpr size_t last = (8U << 20U);
+
+auto disk_size(const char* path) -> off_t {
+  struct stat st {};
+  if (::stat(path, &st) == -1) {
+    throw vt::exception() << "failed to stat " << path;
+  }
+  return st.st_size;
+}
+
+/* Misses of reading [from, to) of the fd one block at a time. */
+auto read_misses(int fd, size_t from, size_t to) -> uint64_t {
+  const uint64_t before = vt::stat_of(fd, VTPC_STAT_MISSES);
+  std::string buffer(block, ' ');
+  for (size_t pos = from; pos < to; pos += block) {
+    if (::vtpc_pread(fd, buffer.data(), block, static_cast<off_t>(pos)) !=
+        static_cast<ssize_t>(block)) {
+      throw vt::exception() << "short read";
+    }
+  }
+  return vt::stat_of(fd, VTPC_STAT_MISSES) - before;
+}
+
+}  // namespace
+
+/*
+ * Syncing a small file writes back its own blocks only, however many dirty
+ * blocks other files have. Dropping a range of a file writes back and
+ * evicts that range and keeps the rest cached.
+ */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "32M", 1);
+  ::setenv("VTPC_DIRTY_RATIO", "100", 1);
+  ::setenv("VTPC_DIRTY_EXPIRE_MS", "600000", 1);
+
+  const int big = vt::open_new(big_path);
+  const int wal = vt::open_new(wal_path);
+  const std::string data(block, 'x');
+  for (size_t pos = 0; pos < big_size; pos += block) {
+    ::vtpc_pwrite(big, data.data(), block, static_cast<off_t>(pos));
+  }
+  for (size_t i = 0; i < wal_blocks; ++i) {
+    ::vtpc_pwrite(wal, data.data(), block, static_cast<off_t>(i * block));
+  }
+
+  if (::vtpc_fsync(wal) == -1) {
+    throw vt::exception() << "fsync failed";
+  }
+  const uint64_t synced = vt::stat_of(wal, VTPC_STAT_WRITEBACKS);
+  if (synced != wal_blocks || disk_size(big_path) != 0 ||
+      disk_size(wal_path) != static_cast<off_t>(wal_blocks * block)) {
+    throw vt::exception() << "fsync wrote " << synced << " blocks";
+  }
+
+  const vtpc_access_hint_t dontneed = {VTPC_ADVICE_DONTNEED, {}};
+  if (::vtpc_advise(big, first, last - first, dontneed) == -1) {
+    throw vt::exception() << "advise failed";
+  }
+  if (disk_size(big_path) != static_cast<off_t>(last)) {
+    throw vt::exception() << "the range was not written back";
+  }
+  const uint64_t dropped = read_misses(big, first, last);
+  const uint64_t kept = read_misses(big, 0, first) +
+                        read_misses(big, last, big_size);
+  std::cout << "synced = " << synced << ", dropped misses = " << dropped
+            << ", kept misses = " << kept << '\n';
+  if (dropped == 0 || kept != 0) {
+    throw vt::exception() << "the wrong blocks were dropped";
+  }
+
+  ::vtpc_close(wal);
+  ::vtpc_close(big);
+  ::unlink(wal_path);
+  ::unlink(big_path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,171 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/ahead";
+constexpr size_t block = 4096;
+constexpr size_t blocks = 1024;
+constexpr size_t half = blocks / 2;
+constexpr size_t stride = 37;
+constexpr size_t max_disk_reads = 32;
+
+/* Readahead of 4, 8 then 16 blocks has loaded 28 when 8 have been read. */
+constexpr size_t head_blocks = 8;
+constexpr size_t head_loaded = 28;
+
+void expect(uint64_t value, uint64_t expected, const char* what) {
+  std::cout << what << " = " << value << '\n';
+  if (value != expected) {
+    throw vt::exception() << what << " is " << value << ", expected "
+                          << expected;
+  }
+}
+
+void fill() {
+  const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw vt::exception() << "failed to open " << path;
+  }
+  std::string data(block, ' ');
+  for (size_t i = 0; i < blocks; ++i) {
+    data.assign(block, static_cast<char>('a' + i % 26));
+    if (::pwrite(fd, data.data(), block, static_cast<off_t>(i * block)) !=
+        static_cast<ssize_t>(block)) {
+      throw vt::exception() << "failed to write " << path;
+    }
+  }
+  ::close(fd);
+}
+
+auto open_file() -> int {
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  return fd;
+}
+
+void read_block(int fd, size_t i) {
+  std::string buffer(block, ' ');
+  if (::vtpc_pread(fd, buffer.data(), block, static_cast<off_t>(i * block)) !=
+          static_cast<ssize_t>(block) ||
+      buffer != std::string(block, static_cast<char>('a' + i % 26))) {
+    throw vt::exception() << "bad read of block " << i;
+  }
+}
+
+/*
+ * A reader going through a file twice the size of the cache one block at a
+ * time finds every block loaded ahead of it. The window grows to its
+ * maximum, so the file is read from disk in few large reads.
+ */
+void check_sequential() {
+  const int fd = open_file();
+  const uint64_t reads = vt::disk_reads();
+  for (size_t i = 0; i < blocks; ++i) {
+    read_block(fd, i);
+  }
+  const auto stats = vt::stats_of(fd);
+  expect(stats.counters[VTPC_STAT_MISSES], 0, "sequential misses");
+  expect(
+      stats.counters[VTPC_STAT_READAHEAD_HITS], blocks, "sequential readahead"
+  );
+  const uint64_t transfers = vt::disk_reads() - reads;
+  std::cout << "sequential disk reads = " << transfers << '\n';
+  if (transfers > max_disk_reads) {
+    throw vt::exception() << "the readahead window did not grow";
+  }
+  ::vtpc_close(fd);
+}
+
+/*
+ * Blocks loaded ahead of a reader that stops are counted as wasted once
+ * they are dropped unused.
+ */
+void check_wasted() {
+  const int fd = open_file();
+  for (size_t i = 0; i < head_blocks; ++i) {
+    read_block(fd, i);
+  }
+  const vtpc_access_hint_t dontneed = {VTPC_ADVICE_DONTNEED, {}};
+  if (::vtpc_advise(fd, 0, 0, dontneed) == -1) {
+    throw vt::exception() << "advise failed";
+  }
+  const auto stats = vt::stats_of(fd);
+  expect(stats.counters[VTPC_STAT_MISSES], 0, "head misses");
+  expect(
+      stats.counters[VTPC_STAT_READAHEAD_HITS], head_blocks, "head readahead"
+  );
+  expect(
+      stats.counters[VTPC_STAT_PREFETCH_WASTED],
+      head_loaded - head_blocks,
+      "head wasted"
+  );
+  ::vtpc_close(fd);
+}
+
+/* A reader jumping around gets no readahead, every block misses. */
+void check_random() {
+  const int fd = open_file();
+  for (size_t k = 1; k <= half; ++k) {
+    read_block(fd, k * stride % blocks);
+  }
+  const auto stats = vt::stats_of(fd);
+  expect(stats.counters[VTPC_STAT_MISSES], half, "random misses");
+  expect(stats.counters[VTPC_STAT_READAHEAD_HITS], 0, "random readahead");
+  ::vtpc_close(fd);
+}
+
+/*
+ * Two readers interleaved on one fd are told apart. The first read of the
+ * second one, which starts a new stream, is the only miss.
+ */
+void check_streams() {
+  const int fd = open_file();
+  for (size_t i = 0; i < half; ++i) {
+    read_block(fd, i);
+    read_block(fd, half + i);
+  }
+  const auto stats = vt::stats_of(fd);
+  expect(stats.counters[VTPC_STAT_MISSES], 1, "interleaved misses");
+  expect(
+      stats.counters[VTPC_STAT_READAHEAD_HITS],
+      blocks - 1,
+      "interleaved readahead"
+  );
+  ::vtpc_close(fd);
+}
+
+}  // namespace
+
+/* Readahead in the smallest cache, which holds half of the file. */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "1M", 1);
+  fill();
+  check_sequential();
+  check_wasted();
+  check_random();
+  check_streams();
+  ::unlink(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
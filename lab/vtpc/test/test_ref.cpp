@@ -0,0 +1,119 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/f";
+constexpr auto other_path = "/tmp/g";
+constexpr size_t size = (1U << 20U);
+constexpr size_t other_size = (1U << 23U);
+constexpr size_t steps = (1U << 12U);
+constexpr size_t max_batch = (1U << 18U);
+
+auto create(
+    const char* name, size_t bytes, std::default_random_engine& random
+) -> std::string {
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(bytes, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  const int fd = ::vtpc_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 ||
+      ::vtpc_write(fd, data.data(), bytes) != static_cast<ssize_t>(bytes) ||
+      ::vtpc_close(fd) == -1) {
+    throw vt::exception() << "failed to create " << name;
+  }
+  return data;
+}
+
+/* Checks that the reference holds the bytes of `data` at `offset`. */
+void check(const vtpc_ref_t& ref, std::string_view data, size_t offset) {
+  for (int i = 0; i < ref.iovcnt; ++i) {
+    const std::string_view view(
+        static_cast<const char*>(ref.iov[i].iov_base), ref.iov[i].iov_len
+    );
+    if (view != data.substr(offset, view.size())) {
+      throw vt::exception() << "reference differs at " << offset;
+    }
+    offset += view.size();
+  }
+}
+
+/* Reads through the whole of another file, which evicts everything else. */
+void evict_all(size_t bytes) {
+  const int fd = ::vtpc_open(other_path, O_RDONLY, 0);
+  std::string buffer(max_batch, ' ');
+  for (size_t pos = 0; pos < bytes; pos += max_batch) {
+    ::vtpc_pread(fd, buffer.data(), max_batch, static_cast<off_t>(pos));
+  }
+  ::vtpc_close(fd);
+}
+
+}  // namespace
+
+auto main() -> int try {
+  std::default_random_engine random(0);  // NOLINT
+  const auto data = create(path, size, random);
+  (void)create(other_path, other_size, random);
+
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+
+  std::uniform_int_distribution<size_t> offset_dist(0, size - 1);
+  std::uniform_int_distribution<size_t> batch_dist(1, max_batch);
+  size_t total = 0;
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t offset = offset_dist(random);
+    const size_t batch = batch_dist(random);
+    vtpc_ref_t ref;
+    const ssize_t got =
+        ::vtpc_read_ref(fd, static_cast<off_t>(offset), batch, &ref);
+    if (got <= 0) {
+      throw vt::exception() << "vtpc_read_ref failed at " << offset;
+    }
+    check(ref, data, offset);
+    ::vtpc_release(&ref);
+    total += static_cast<size_t>(got);
+  }
+
+  /* Pinned blocks have to survive a scan that evicts the rest. */
+  vtpc_ref_t held;
+  const ssize_t got = ::vtpc_read_ref(fd, 0, max_batch, &held);
+  if (got != static_cast<ssize_t>(VTPC_REF_BLOCKS) * 4096) {
+    throw vt::exception() << "short reference: " << got;
+  }
+  evict_all(other_size);
+  check(held, data, 0);
+  ::vtpc_release(&held);
+
+  vtpc_ref_t end;
+  if (::vtpc_read_ref(fd, size, 1, &end) != 0 || end.iovcnt != 0) {
+    throw vt::exception() << "reference past the end";
+  }
+  ::vtpc_close(fd);
+
+  std::cout << "references = " << steps << ", bytes = " << total << '\n';
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
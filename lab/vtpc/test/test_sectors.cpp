@@ -0,0 +1,138 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/sectors";
+constexpr size_t block = 4096;
+constexpr size_t sector = 512;
+constexpr size_t blocks = 8;
+
+/* Checks the misses and disk reads since the last call. */
+class counts {
+public:
+  explicit counts(int fd)
+      : fd_(fd),
+        misses_(vt::stat_of(fd, VTPC_STAT_MISSES)),
+        reads_(vt::disk_reads()) {}
+
+  void expect(uint64_t misses, uint64_t reads, const char* what) {
+    const uint64_t now_misses = vt::stat_of(fd_, VTPC_STAT_MISSES);
+    const uint64_t now_reads = vt::disk_reads();
+    std::cout << what << ": misses = " << now_misses - misses_
+              << ", disk reads = " << now_reads - reads_ << '\n';
+    if (now_misses - misses_ != misses || now_reads - reads_ != reads) {
+      throw vt::exception() << what << ": expected " << misses
+                            << " misses and " << reads << " disk reads";
+    }
+    misses_ = now_misses;
+    reads_ = now_reads;
+  }
+
+private:
+  int fd_;
+  uint64_t misses_;
+  uint64_t reads_;
+};
+
+void read_at(int fd, const std::string& expected, size_t pos) {
+  std::string buffer(expected.size(), ' ');
+  if (::vtpc_pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(pos)) !=
+          static_cast<ssize_t>(buffer.size()) ||
+      buffer != expected) {
+    throw vt::exception() << "bad read at " << pos;
+  }
+}
+
+}  // namespace
+
+/*
+ * Blocks are cached a sector at a time. Writing whole sectors to a block
+ * that is not cached reads nothing from disk, and neither does reading
+ * them back, even partly. Only a sector that is written partly or read
+ * without having been written loads the block, which keeps the sectors
+ * written before. A sync writes back the written sectors alone.
+ */
+auto main() -> int try {
+  std::string expected(blocks * block, 'd');
+  const int disk = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (disk == -1 ||
+      ::pwrite(disk, expected.data(), expected.size(), 0) !=
+          static_cast<ssize_t>(expected.size())) {
+    throw vt::exception() << "failed to write " << path;
+  }
+  ::close(disk);
+
+  const int fd = ::vtpc_open(path, O_RDWR, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  counts count(fd);
+
+  /* Sectors 1 and 2 of block 3, then sector 5 of block 5. */
+  const size_t whole = 3 * block + sector;
+  const std::string x(2 * sector, 'x');
+  vt::write_at(fd, x, whole);
+  expected.replace(whole, x.size(), x);
+  const size_t other = 5 * block + 5 * sector;
+  const std::string z(sector, 'z');
+  vt::write_at(fd, z, other);
+  expected.replace(other, z.size(), z);
+  count.expect(2, 0, "whole sectors written");
+
+  read_at(fd, x, whole);
+  read_at(fd, x.substr(0, 100), whole + sector + 200);
+  read_at(fd, z.substr(0, 10), other + 500);
+  count.expect(0, 0, "written sectors read");
+
+  /* The rest of block 5 comes from disk, sector 5 stays as written. */
+  read_at(fd, std::string(100, 'd'), other + sector + 50);
+  count.expect(1, 1, "unwritten sector read");
+  read_at(fd, expected.substr(5 * block, block), 5 * block);
+  count.expect(0, 0, "loaded block read");
+
+  /* Part of sector 5 of block 3 needs the rest of it from disk. */
+  const size_t partial = 3 * block + 5 * sector + 100;
+  const std::string y(200, 'y');
+  vt::write_at(fd, y, partial);
+  expected.replace(partial, y.size(), y);
+  count.expect(1, 1, "part of a sector written");
+  read_at(fd, expected.substr(3 * block, block), 3 * block);
+  count.expect(0, 0, "merged block read");
+
+  /* Block 7 is never loaded, its other sectors on disk must survive. */
+  const size_t last = 7 * block + 2 * sector;
+  vt::write_at(fd, z, last);
+  expected.replace(last, z.size(), z);
+  count.expect(1, 0, "sector of another block written");
+
+  if (::vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "fsync failed";
+  }
+  count.expect(0, 0, "sync");
+  if (vt::disk_contents(path) != expected) {
+    throw vt::exception() << "bad data on disk";
+  }
+  ::vtpc_close(fd);
+  ::unlink(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,230 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/j";
+constexpr auto other_path = "/tmp/k";
+constexpr size_t size = (1U << 20U);
+constexpr size_t other_size = (1U << 22U);
+constexpr size_t max_batch = (1U << 16U);
+constexpr size_t max_refs = 4;
+constexpr size_t rounds = 80;
+constexpr unsigned timeout = 120;
+
+auto random_string(size_t bytes, std::default_random_engine& random)
+    -> std::string {
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+  std::string data(bytes, ' ');
+  for (auto& c : data) {
+    c = static_cast<char>(char_dist(random));
+  }
+  return data;
+}
+
+auto read_all(int fd, size_t bytes) -> std::string {
+  std::string data(bytes, ' ');
+  if (::vtpc_pread(fd, data.data(), bytes, 0) != static_cast<ssize_t>(bytes)) {
+    throw vt::exception() << "short read";
+  }
+  return data;
+}
+
+/* Runs `body` in a child process that exits with the code it returns. */
+template <typename F>
+auto spawn(F body) -> pid_t {
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "fork failed";
+  }
+  if (pid == 0) {
+    int code = 1;
+    try {
+      code = body();
+    } catch (const std::exception& e) {
+      std::cerr << "child: " << e.what() << '\n';
+    }
+    ::_exit(code);
+  }
+  return pid;
+}
+
+void join(pid_t pid, const char* what) {
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << what << " failed";
+  }
+}
+
+/*
+ * Started as a process of its own: reads the file that the parent wrote and
+ * did not flush, all of it has to come from the blocks the parent cached.
+ */
+auto reader(const char* expected) -> int {
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  const int disk = ::open(expected, O_RDONLY);
+  std::string data(size, ' ');
+  if (fd == -1 || disk == -1 ||
+      ::read(disk, data.data(), size) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "open failed";
+  }
+  if (read_all(fd, size) != data) {
+    throw vt::exception() << "the reader sees other data";
+  }
+  vtpc_stats_t stats;
+  ::vtpc_stats(fd, &stats);
+  if (stats.counters[VTPC_STAT_MISSES] != 0) {
+    throw vt::exception() << "the reader missed "
+                          << stats.counters[VTPC_STAT_MISSES] << " blocks";
+  }
+  ::vtpc_close(fd);
+  return 0;
+}
+
+/*
+ * Reads and writes both files until it is killed, holding pins on blocks
+ * the parent uses too.
+ */
+auto hammer(unsigned seed) -> int {
+  std::default_random_engine random(seed);  // NOLINT
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  const int other = ::vtpc_open(other_path, O_RDWR, 0);
+  if (fd == -1 || other == -1) {
+    throw vt::exception() << "open failed";
+  }
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size - 1);
+  std::uniform_int_distribution<off_t> other_dist(0, other_size - 1);
+  std::uniform_int_distribution<size_t> batch_dist(1, max_batch);
+  std::vector<vtpc_ref_t> refs(max_refs);
+  size_t held = 0;
+  std::string buffer(max_batch, ' ');
+  for (;;) {
+    const size_t point = action_dist(random);
+    const size_t batch = batch_dist(random);
+    if (point < 30) {  // NOLINT
+      ::vtpc_pread(other, buffer.data(), batch, other_dist(random));
+    } else if (point < 60) {  // NOLINT
+      ::vtpc_pwrite(other, buffer.data(), batch, other_dist(random));
+    } else if (point < 80) {  // NOLINT
+      ::vtpc_pread(fd, buffer.data(), batch, offset_dist(random));
+    } else if (held < max_refs) {
+      if (::vtpc_read_ref(fd, offset_dist(random), batch, &refs[held]) > 0) {
+        held += 1;
+      }
+    } else {
+      while (held > 0) {
+        ::vtpc_release(&refs[--held]);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+/*
+ * Processes sharing a cache see each other's writes before they reach the
+ * disk, and processes killed in the middle of anything leave the others
+ * working. A wedged run is stopped by the alarm.
+ */
+auto main(int argc, char** argv) -> int try {
+  if (argc == 3 && std::strcmp(argv[1], "reader") == 0) {
+    return reader(argv[2]);
+  }
+
+  const std::string name = "/vtpc-test-" + std::to_string(::getpid());
+  ::setenv("VTPC_SHM", name.c_str(), 1);
+  ::alarm(timeout);
+
+  std::default_random_engine random(0);  // NOLINT
+  const auto data = random_string(size, random);
+  const int other = ::vtpc_open(other_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  const auto other_data = random_string(other_size, random);
+  if (other == -1 ||
+      ::vtpc_pwrite(other, other_data.data(), other_size, 0) !=
+          static_cast<ssize_t>(other_size) ||
+      ::vtpc_close(other) == -1) {
+    throw vt::exception() << "failed to create " << other_path;
+  }
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 ||
+      ::vtpc_pwrite(fd, data.data(), size, 0) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to write " << path;
+  }
+
+  /* The expected data goes to a plain file for a fresh process to compare. */
+  const std::string expected = "/tmp/j.expected";
+  const int copy = ::open(expected.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (copy == -1 ||
+      ::write(copy, data.data(), size) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to write " << expected;
+  }
+  ::close(copy);
+  join(
+      spawn([&] {
+        ::execl(
+            "/proc/self/exe", argv[0], "reader", expected.c_str(), nullptr
+        );
+        return 1;
+      }),
+      "reader"
+  );
+
+  std::uniform_int_distribution<useconds_t> delay_dist(1000, 30000);
+  for (size_t round = 0; round < rounds; ++round) {
+    const pid_t pid = spawn([&] { return hammer(round); });
+    ::usleep(delay_dist(random));
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    if (read_all(fd, size) != data) {
+      throw vt::exception() << "data changed after round " << round;
+    }
+  }
+
+  /* Truncating drops every block, it waits for the pins of the dead. */
+  const int again = ::vtpc_open(other_path, O_RDWR | O_TRUNC, 0);
+  if (again == -1 || ::vtpc_close(again) == -1) {
+    throw vt::exception() << "truncate failed";
+  }
+  if (::vtpc_close(fd) == -1) {
+    throw vt::exception() << "close failed";
+  }
+
+  const int disk = ::open(path, O_RDONLY);
+  std::string stored(size, ' ');
+  if (disk == -1 ||
+      ::read(disk, stored.data(), size) != static_cast<ssize_t>(size) ||
+      stored != data) {
+    throw vt::exception() << "the file differs on disk";
+  }
+  ::close(disk);
+  ::shm_unlink(name.c_str());
+
+  std::cout << "rounds = " << rounds << '\n';
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,178 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/e";
+constexpr size_t size = (1U << 20U);
+constexpr size_t batch = (1U << 16U);
+constexpr size_t blocks = size / 4096;
+
+void expect(bool condition, const char* what) {
+  if (!condition) {
+    throw vt::exception() << "unexpected stats: " << what;
+  }
+}
+
+void fill() {
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  const std::string data(size, 'x');
+  const auto before = vt::stats_of(-1);
+  if (::vtpc_write(fd, data.data(), size) != static_cast<ssize_t>(size) ||
+      ::vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "write failed";
+  }
+
+  const auto stats = vt::stats_of(fd);
+  expect(stats.counters[VTPC_STAT_BYTES_WRITTEN] == size, "bytes written");
+  expect(stats.counters[VTPC_STAT_WRITEBACKS] >= blocks, "writebacks");
+  expect(
+      vt::samples(stats, VTPC_LATENCY_WRITE) ==
+          vt::samples(before, VTPC_LATENCY_WRITE) + 1,
+      "write latency"
+  );
+  expect(
+      vt::samples(stats, VTPC_LATENCY_DISK_WRITE) >
+          vt::samples(before, VTPC_LATENCY_DISK_WRITE),
+      "disk write latency"
+  );
+  ::vtpc_close(fd);
+}
+
+/*
+ * Threads count a fd in the entry its number maps to, one of 16. Two fds
+ * sharing one, read in turn by the same thread, each count their own
+ * bytes. A fd opened again under the same number starts from zero, even
+ * with the counts of its last open still in the thread.
+ */
+void check_shared_entry() {
+  std::vector<int> fds;
+  int other = -1;
+  while (other == -1 && fds.size() < 64) {
+    const int fd = ::vtpc_open(path, O_RDONLY, 0);
+    if (fd == -1) {
+      throw vt::exception() << "open failed";
+    }
+    if (!fds.empty() && (fd - fds.front()) % 16 == 0) {
+      other = fd;
+    }
+    fds.push_back(fd);
+  }
+  const int first = fds.front();
+  if (other == -1) {
+    throw vt::exception() << "no fd shares an entry with " << first;
+  }
+  constexpr size_t reads = 8;
+  std::string buffer(4096, ' ');
+  for (size_t i = 0; i < reads; ++i) {
+    const auto at = static_cast<off_t>(i * buffer.size());
+    if (::vtpc_pread(first, buffer.data(), buffer.size(), at) !=
+            static_cast<ssize_t>(buffer.size()) ||
+        ::vtpc_pread(other, buffer.data(), buffer.size(), at) !=
+            static_cast<ssize_t>(buffer.size())) {
+      throw vt::exception() << "read failed";
+    }
+  }
+  for (const int fd : {first, other}) {
+    expect(
+        vt::stat_of(fd, VTPC_STAT_BYTES_READ) == reads * buffer.size(),
+        "bytes read by fds sharing an entry"
+    );
+  }
+
+  ::vtpc_close(other);
+  const int again = ::vtpc_open(path, O_RDONLY, 0);
+  if (again != other) {
+    throw vt::exception() << "fd " << other << " was not reused";
+  }
+  for (const uint64_t counter : vt::stats_of(again).counters) {
+    expect(counter == 0, "counters of a reused fd");
+  }
+  for (const int fd : fds) {
+    ::vtpc_close(fd);
+  }
+}
+
+}  // namespace
+
+/*
+ * Reads a file that is not cached sequentially from another thread and
+ * checks that its counters show up for the fd, which starts from zero, once
+ * the thread is gone. Then fds sharing counters in a thread stay apart.
+ */
+auto main() -> int try {
+  fill();
+
+  const int fd = ::vtpc_open(path, O_RDONLY, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  const auto opened = vt::stats_of(fd);
+  for (const uint64_t counter : opened.counters) {
+    expect(counter == 0, "counters of a new fd");
+  }
+
+  std::thread reader([fd] {
+    std::string buffer(batch, ' ');
+    while (::vtpc_read(fd, buffer.data(), batch) > 0) {
+    }
+  });
+  reader.join();
+
+  const auto stats = vt::stats_of(fd);
+  const auto& counters = stats.counters;
+  expect(counters[VTPC_STAT_BYTES_READ] == size, "bytes read");
+  expect(counters[VTPC_STAT_BYTES_WRITTEN] == 0, "bytes written");
+  expect(
+      counters[VTPC_STAT_HITS] + counters[VTPC_STAT_MISSES] == blocks,
+      "lookups"
+  );
+  expect(counters[VTPC_STAT_READAHEAD_HITS] > blocks / 2, "readahead hits");
+  expect(
+      counters[VTPC_STAT_READAHEAD_HITS] <= counters[VTPC_STAT_HITS],
+      "readahead hits among hits"
+  );
+  expect(
+      vt::samples(stats, VTPC_LATENCY_READ) >=
+          vt::samples(opened, VTPC_LATENCY_READ) + size / batch,
+      "read latency"
+  );
+
+  const auto total = vt::stats_of(-1);
+  for (size_t i = 0; i < VTPC_STAT_COUNT; ++i) {
+    expect(total.counters[i] >= counters[i], "process-wide counters");
+  }
+  vtpc_stats_t ignored;
+  expect(::vtpc_stats(-2, &ignored) == -1, "bad fd");
+  ::vtpc_close(fd);
+  check_shared_entry();
+
+  std::cout << "hits = " << counters[VTPC_STAT_HITS]
+            << ", misses = " << counters[VTPC_STAT_MISSES]
+            << ", readahead hits = " << counters[VTPC_STAT_READAHEAD_HITS]
+            << '\n';
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,195 @@
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/c";
+constexpr size_t region = (1U << 20U);
+constexpr size_t steps = (1U << 13U);
+constexpr size_t max_batch = (1U << 14U);
+
+/*
+ * Each worker owns a region of the shared fd and checks every read of it
+ * against a shadow copy of what it wrote.
+ */
+void worker(int fd, size_t id, std::string& shadow) {
+  std::default_random_engine random(id);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<size_t> offset_dist(0, region - 1);
+  std::uniform_int_distribution<size_t> batch_dist(1, max_batch);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  const auto base = static_cast<off_t>(id * region);
+  std::string buffer(max_batch, ' ');
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t offset = offset_dist(random);
+    const size_t batch = std::min(batch_dist(random), region - offset);
+    const auto pos = base + static_cast<off_t>(offset);
+
+    if (action_dist(random) < 60) {  // NOLINT
+      const ssize_t got = ::vtpc_pread(fd, buffer.data(), batch, pos);
+      if (got != static_cast<ssize_t>(batch)) {
+        throw vt::exception() << "pread returned " << got;
+      }
+      if (shadow.compare(offset, batch, buffer, 0, batch) != 0) {
+        throw vt::exception()
+            << "worker " << id << " read stale data at " << pos;
+      }
+    } else {
+      for (size_t j = 0; j < batch; ++j) {
+        buffer[j] = static_cast<char>(char_dist(random));
+      }
+      const ssize_t put = ::vtpc_pwrite(fd, buffer.data(), batch, pos);
+      if (put != static_cast<ssize_t>(batch)) {
+        throw vt::exception() << "pwrite returned " << put;
+      }
+      shadow.replace(offset, batch, buffer, 0, batch);
+    }
+  }
+}
+
+void verify(size_t threads, const std::vector<std::string>& shadows) {
+  const int fd = ::open(path, O_RDONLY);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  std::string buffer(region, ' ');
+  for (size_t id = 0; id < threads; ++id) {
+    const auto pos = static_cast<off_t>(id * region);
+    const ssize_t got = ::pread(fd, buffer.data(), region, pos);
+    if (got != static_cast<ssize_t>(region) || buffer != shadows[id]) {
+      ::close(fd);
+      throw vt::exception() << "region " << id << " differs on disk";
+    }
+  }
+  ::close(fd);
+}
+
+auto run(size_t threads) -> double {
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0777);  // NOLINT
+  if (fd == -1) {
+    throw vt::exception() << "vtpc_open failed";
+  }
+
+  std::vector<std::string> shadows(threads, std::string(region, '\0'));
+  for (size_t id = 0; id < threads; ++id) {
+    const auto pos = static_cast<off_t>(id * region);
+    if (::vtpc_pwrite(fd, shadows[id].data(), region, pos) !=
+        static_cast<ssize_t>(region)) {
+      throw vt::exception() << "pwrite failed";
+    }
+  }
+
+  std::vector<std::exception_ptr> errors(threads);
+  const auto start = std::chrono::steady_clock::now();
+  {
+    std::vector<std::jthread> workers;
+    for (size_t id = 0; id < threads; ++id) {
+      workers.emplace_back([&, id] {
+        try {
+          worker(fd, id, shadows[id]);
+        } catch (...) {
+          errors[id] = std::current_exception();
+        }
+      });
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  if (::vtpc_fsync(fd) == -1 || ::vtpc_close(fd) == -1) {
+    throw vt::exception() << "fsync or close failed";
+  }
+  verify(threads, shadows);
+  return static_cast<double>(threads * steps) / elapsed.count();
+}
+
+/*
+ * Readers of a block that a writer keeps rewriting whole see one write or
+ * the other, never parts of two.
+ */
+void check_torn() {
+  constexpr size_t block = 4096;
+  constexpr size_t writes = 1U << 15U;
+  constexpr size_t readers = 3;
+  const int fd = ::vtpc_open(path, O_RDWR | O_CREAT | O_TRUNC, 0777);  // NOLINT
+  if (fd == -1) {
+    throw vt::exception() << "vtpc_open failed";
+  }
+  const std::string first(block, 'a');
+  const std::string second(block, 'b');
+  if (::vtpc_pwrite(fd, first.data(), block, 0) !=
+      static_cast<ssize_t>(block)) {
+    throw vt::exception() << "pwrite failed";
+  }
+
+  std::atomic<bool> done = false;
+  std::atomic<size_t> torn = 0;
+  {
+    std::vector<std::jthread> threads;
+    for (size_t id = 0; id < readers; ++id) {
+      threads.emplace_back([&] {
+        std::string buffer(block, ' ');
+        while (!done) {
+          if (::vtpc_pread(fd, buffer.data(), block, 0) !=
+                  static_cast<ssize_t>(block) ||
+              (buffer != first && buffer != second)) {
+            torn += 1;
+          }
+        }
+      });
+    }
+    for (size_t i = 0; i < writes; ++i) {
+      const std::string& data = i % 2 == 0 ? second : first;
+      if (::vtpc_pwrite(fd, data.data(), block, 0) !=
+          static_cast<ssize_t>(block)) {
+        torn += 1;
+      }
+    }
+    done = true;
+  }
+  ::vtpc_close(fd);
+  std::cout << "torn reads = " << torn << '\n';
+  if (torn != 0) {
+    throw vt::exception() << "reads saw parts of two writes";
+  }
+}
+
+}  // namespace
+
+auto main() -> int try {
+  for (size_t threads = 1; threads <= 8; threads *= 2) {  // NOLINT
+    const double ops = run(threads);
+    std::cout << "threads = " << threads << ", ops/s = " << ops << '\n';
+  }
+  check_torn();
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,116 @@
+#include <sys/types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "exception.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/t";
+constexpr size_t block = 4096;
+constexpr size_t size = (12U << 20U);
+constexpr size_t batch = (1U << 16U);
+constexpr size_t rewrites = 64;
+
+/* Text of random words, which compresses about as well as logs do. */
+auto make_text(size_t len) -> std::string {
+  constexpr std::array<const char*, 8> words = {
+      "cache ", "block ", "frame ", "evict ", "read ", "write ", "disk\n",
+      "tier ",
+  };
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<size_t> word_dist(0, words.size() - 1);
+  std::string text;
+  while (text.size() < len) {
+    text += words[word_dist(random)];
+    text += std::to_string(random() % 1000);
+    text += ' ';
+  }
+  text.resize(len);
+  return text;
+}
+
+void read_all(int fd, const std::string& shadow) {
+  std::string buffer(batch, ' ');
+  for (size_t pos = 0; pos < size; pos += batch) {
+    if (::vtpc_pread(fd, buffer.data(), batch, static_cast<off_t>(pos)) !=
+            static_cast<ssize_t>(batch) ||
+        shadow.compare(pos, batch, buffer) != 0) {
+      throw vt::exception() << "wrong data at " << pos;
+    }
+  }
+}
+
+}  // namespace
+
+/*
+ * A file three times the size of the cache is read over and over: blocks
+ * evicted from the cache come back from the compressed tier instead of the
+ * disk, and blocks written in between never come back stale.
+ */
+auto main() -> int try {
+  ::unsetenv("VTPC_SHM");
+  ::setenv("VTPC_MEMORY", "4M", 1);
+  ::setenv("VTPC_TIER_MEMORY", "16M", 1);
+
+  std::string shadow = make_text(size);
+  const int out = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out == -1 ||
+      ::pwrite(out, shadow.data(), size, 0) != static_cast<ssize_t>(size)) {
+    throw vt::exception() << "failed to write " << path;
+  }
+  ::close(out);
+
+  const int fd = ::vtpc_open(path, O_RDWR, 0);
+  if (fd == -1) {
+    throw vt::exception() << "open failed";
+  }
+  read_all(fd, shadow);
+  read_all(fd, shadow);
+
+  std::default_random_engine random(1);  // NOLINT
+  std::uniform_int_distribution<size_t> block_dist(0, size / block - 1);
+  const std::string other = make_text(2 * block);
+  for (size_t i = 0; i < rewrites; ++i) {
+    const size_t pos = block_dist(random) * block;
+    const size_t from = random() % block;
+    shadow.replace(pos, block, other, from, block);
+    ::vtpc_pwrite(fd, other.data() + from, block, static_cast<off_t>(pos));
+  }
+  read_all(fd, shadow);
+  read_all(fd, shadow);
+
+  vtpc_stats_t stats;
+  ::vtpc_stats(fd, &stats);
+  ::vtpc_close(fd);
+  ::unlink(path);
+
+  const uint64_t hits = stats.counters[VTPC_STAT_TIER_HITS];
+  const uint64_t misses = stats.counters[VTPC_STAT_MISSES];
+  const double ratio =
+      static_cast<double>(stats.counters[VTPC_STAT_TIER_BYTES]) /
+      static_cast<double>(stats.counters[VTPC_STAT_TIER_COMPRESSED] + 1);
+  std::cout << "tier hits = " << hits << ", misses = " << misses
+            << ", ratio = " << ratio << '\n';
+  if (hits == 0 || ratio < 1.5) {
+    throw vt::exception() << "the tier was not used";
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,163 @@
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "exception.hpp"
+#include "file.hpp"
+#include "trace_file.hpp"
+
+extern "C" {
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+namespace {
+
+constexpr auto trace_path = "/tmp/t.trace";
+constexpr auto recorded_path = "/tmp/t0";
+constexpr auto libc_path = "/tmp/t1";
+constexpr auto vtpc_path = "/tmp/t2";
+constexpr size_t steps = (1U << 14U);
+constexpr size_t size = (1U << 16U);
+constexpr size_t ring = 16;
+constexpr size_t paced = 20;
+constexpr auto pace = std::chrono::milliseconds(2);
+
+auto read_file(const char* path) -> std::string {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), {}};
+}
+
+/* Runs random operations through a trace, some of them failing at EOF. */
+auto record() -> size_t {
+  vt::trace_file file(vt::file::open_libc(recorded_path), trace_path, ring);
+  std::default_random_engine random(0);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 99);
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(1, size / 16);
+  std::string buffer(size, 'x');
+  size_t failed = 0;
+  for (size_t i = 0; i < steps; ++i) {
+    const size_t action = action_dist(random);
+    const size_t batch = batch_dist(random);
+    const off_t offset = offset_dist(random);
+    try {
+      if (action < 20) {
+        file.read(buffer.data(), batch);
+      } else if (action < 40) {
+        file.write(buffer.data(), batch);
+      } else if (action < 50) {
+        file.seek(offset);
+      } else if (action < 70) {
+        file.pread(buffer.data(), batch, offset);
+      } else if (action < 90) {
+        file.pwrite(buffer.data(), batch, offset);
+      } else if (action < 95) {
+        iovec iov[2] = {{buffer.data(), batch}, {buffer.data(), 1}};
+        file.preadv(iov, 2, offset);
+      } else if (action < 99) {
+        iovec iov[2] = {{buffer.data(), batch}, {buffer.data(), 1}};
+        file.pwritev(iov, 2, offset);
+      } else {
+        file.sync();
+      }
+    } catch (const vt::file_exception&) {
+      failed += 1;
+    }
+  }
+  if (failed == 0) {
+    throw vt::exception() << "no operation failed";
+  }
+  return steps;
+}
+
+}  // namespace
+
+/*
+ * A trace recorded through a small ring holds every operation. Replayed on
+ * libc and on the cache it leaves the same file and the same operations
+ * fail as in the trace. A timed replay takes as long as the trace did, and
+ * a trace cut within a record is refused.
+ */
+auto main() -> int try {
+  for (const char* path : {recorded_path, libc_path, vtpc_path}) {
+    ::unlink(path);
+  }
+  const size_t ops = record();
+  const auto trace_size =
+      static_cast<size_t>(read_file(trace_path).size());
+  if (trace_size != sizeof(uint64_t) + ops * sizeof(vt::trace_record)) {
+    throw vt::exception() << "the trace has " << trace_size << " bytes";
+  }
+
+  vt::replay_stats libc_stats;
+  vt::replay_stats vtpc_stats;
+  {
+    auto libc = vt::file::open_libc(libc_path);
+    auto vtpc = vt::file::open_vtpc(vtpc_path);
+    libc_stats = vt::replay(*libc, trace_path, false);
+    vtpc_stats = vt::replay(*vtpc, trace_path, false);
+  }
+  std::cout << "ops = " << libc_stats.ops << ", failed = " << libc_stats.failed
+            << ", libc " << libc_stats.seconds << " s, vtpc "
+            << vtpc_stats.seconds << " s\n";
+  if (libc_stats.ops != ops || vtpc_stats.ops != ops ||
+      libc_stats.mismatched != 0 || vtpc_stats.mismatched != 0) {
+    throw vt::exception() << "the replay differs from the trace";
+  }
+  if (read_file(libc_path) != read_file(vtpc_path)) {
+    throw vt::exception() << "the replays left different files";
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  {
+    vt::trace_file file(vt::file::open_libc(recorded_path), trace_path);
+    for (size_t i = 0; i < paced; ++i) {
+      file.pwrite("x", 1, 0);
+      std::this_thread::sleep_for(pace);
+    }
+  }
+  const std::chrono::duration<double> span =
+      std::chrono::steady_clock::now() - start;
+  auto file = vt::file::open_vtpc(vtpc_path);
+  const vt::replay_stats timed = vt::replay(*file, trace_path, true);
+  std::cout << "timed: " << timed.seconds << " s for " << span.count()
+            << " s\n";
+  if (timed.ops != paced ||
+      timed.seconds < std::chrono::duration<double>(pace).count() *
+                          static_cast<double>(paced - 1)) {
+    throw vt::exception() << "the timed replay was too fast";
+  }
+
+  const auto paced_size = static_cast<off_t>(read_file(trace_path).size());
+  if (::truncate(trace_path, paced_size - 1) == -1) {
+    throw vt::exception() << "failed to cut the trace";
+  }
+  bool refused = false;
+  try {
+    vt::replay(*file, trace_path, false);
+  } catch (const vt::trace_exception&) {
+    refused = true;
+  }
+  if (!refused) {
+    throw vt::exception() << "a trace cut within a record was replayed";
+  }
+
+  for (const char* path : {trace_path, recorded_path, libc_path, vtpc_path}) {
+    ::unlink(path);
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,100 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cmp_file.hpp"
+#include "file.hpp"
+
+namespace {
+
+constexpr size_t seed = 1;
+constexpr size_t steps = (1U << 15U);
+constexpr size_t size = (1U << 16U);
+constexpr size_t max_batch = (1U << 14U);
+constexpr size_t max_parts = 8;
+
+/* Splits the buffer into up to `max_parts` pieces, some of them empty. */
+auto split(std::string& buffer, std::default_random_engine& random)
+    -> std::vector<iovec> {
+  std::uniform_int_distribution<size_t> parts_dist(1, max_parts);
+  std::uniform_int_distribution<size_t> cut_dist(0, buffer.size());
+  std::vector<size_t> cuts = {0, buffer.size()};
+  for (size_t parts = parts_dist(random); parts > 1; --parts) {
+    cuts.push_back(cut_dist(random));
+  }
+  std::sort(cuts.begin(), cuts.end());
+
+  std::vector<iovec> iov;
+  for (size_t i = 1; i < cuts.size(); ++i) {
+    iov.push_back({buffer.data() + cuts[i - 1], cuts[i] - cuts[i - 1]});
+  }
+  return iov;
+}
+
+}  // namespace
+
+/*
+ * Drives libc and vtpc with the same positional and vectored calls and
+ * compares every result.
+ */
+auto main() -> int try {
+  auto file = std::make_unique<vt::cmp_file>(
+      vt::file::open_libc("/tmp/h"), vt::file::open_vtpc("/tmp/i")
+  );
+
+  std::default_random_engine random(seed);  // NOLINT
+  std::uniform_int_distribution<size_t> action_dist(0, 100);  // NOLINT
+  std::uniform_int_distribution<off_t> offset_dist(0, size);
+  std::uniform_int_distribution<size_t> batch_dist(0, max_batch);
+  std::uniform_int_distribution<uint8_t> char_dist(0);
+
+  const auto random_string = [&](size_t count) {
+    std::string string(count, ' ');
+    for (char& c : string) {
+      c = static_cast<char>(char_dist(random));
+    }
+    return string;
+  };
+
+  file->pwrite(std::string(size, ' ').data(), size, 0);
+  for (size_t i = 0; i < steps; ++i) {
+    const off_t offset = offset_dist(random);
+    std::string buffer(batch_dist(random), ' ');
+    try {
+      const size_t point = action_dist(random);
+      if (point < 25) {  // NOLINT
+        file->pread(buffer.data(), buffer.size(), offset);
+      } else if (point < 50) {  // NOLINT
+        const auto iov = split(buffer, random);
+        file->preadv(iov.data(), static_cast<int>(iov.size()), offset);
+      } else if (point < 70) {  // NOLINT
+        buffer = random_string(buffer.size());
+        file->pwrite(buffer.data(), buffer.size(), offset);
+      } else if (point < 95) {  // NOLINT
+        buffer = random_string(buffer.size());
+        const auto iov = split(buffer, random);
+        file->pwritev(iov.data(), static_cast<int>(iov.size()), offset);
+      } else {
+        file->sync();
+      }
+    } catch (vt::file_exception& e) {  // NOLINT
+      // Reads past the end fail the same way on both sides
+    }
+  }
+
+  std::cout << "steps = " << steps << '\n';
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
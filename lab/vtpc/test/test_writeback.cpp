@@ -0,0 +1,177 @@
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "exception.hpp"
+#include "fixture.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vtpc.h"
+}
+
+namespace {
+
+constexpr auto path = "/tmp/w";
+constexpr size_t block = 4096;
+constexpr size_t cache_blocks = 512;
+constexpr size_t run_blocks = 64;
+constexpr size_t pressure_blocks = 400;
+constexpr size_t record = 100;
+constexpr size_t records = 2000;
+constexpr auto patience = std::chrono::seconds(10);
+
+auto writebacks() -> uint64_t {
+  return vt::stats_of(-1).counters[VTPC_STAT_WRITEBACKS];
+}
+
+auto disk_writes() -> uint64_t {
+  return vt::samples(vt::stats_of(-1), VTPC_LATENCY_DISK_WRITE);
+}
+
+void sync(int fd) {
+  if (::vtpc_fsync(fd) == -1) {
+    throw vt::exception() << "fsync failed";
+  }
+}
+
+/*
+ * Going over the high watermark wakes the flusher, which writes back the
+ * blocks dirty by then without any sync, long before they expire.
+ */
+auto check_pressure() -> int {
+  ::setenv("VTPC_DIRTY_RATIO", "50", 1);
+  const int fd = vt::open_new(path);
+  const std::string data(block, 'p');
+  for (size_t i = 0; i < pressure_blocks; ++i) {
+    vt::write_at(fd, data, i * block);
+  }
+  /* The watermark is half of the smallest cache. */
+  const uint64_t expected = pressure_blocks - cache_blocks / 2;
+  const auto deadline = std::chrono::steady_clock::now() + patience;
+  while (writebacks() < expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::cout << "written back under pressure = " << writebacks() << '\n'
+            << std::flush;
+  if (writebacks() < expected) {
+    throw vt::exception() << "the flusher did not relieve the pressure";
+  }
+  ::vtpc_close(fd);
+  return 0;
+}
+
+/*
+ * Adjacent dirty blocks go to disk as one write, blocks with gaps between
+ * them as one write each.
+ */
+void check_coalescing() {
+  const int fd = vt::open_new(path);
+  const std::string data(block, 'c');
+  for (size_t i = 0; i < run_blocks; ++i) {
+    vt::write_at(fd, data, i * block);
+  }
+  uint64_t writes = disk_writes();
+  sync(fd);
+  const uint64_t contiguous = disk_writes() - writes;
+
+  for (size_t i = 0; i < run_blocks; i += 2) {
+    vt::write_at(fd, data, i * block);
+  }
+  writes = disk_writes();
+  sync(fd);
+  const uint64_t gaps = disk_writes() - writes;
+
+  std::cout << "disk writes: contiguous = " << contiguous
+            << ", with gaps = " << gaps << '\n';
+  if (contiguous != 1 || gaps != run_blocks / 2) {
+    throw vt::exception() << "dirty blocks were not coalesced";
+  }
+  if (vt::disk_contents(path) != std::string(run_blocks * block, 'c')) {
+    throw vt::exception() << "bad data on disk";
+  }
+  ::vtpc_close(fd);
+}
+
+/*
+ * Sectors are written whole, writeback cuts the file back to its size.
+ * It must never cut a write that extends the file meanwhile: a writer
+ * appends records that end inside sectors while another thread syncs.
+ */
+void check_truncate() {
+  const int fd = vt::open_new(path);
+  std::string expected;
+  for (size_t i = 0; i < records; ++i) {
+    expected += std::string(record, static_cast<char>('a' + i % 26));
+  }
+
+  vt::write_at(fd, expected.substr(0, record), 0);
+  sync(fd);
+  if (vt::disk_contents(path) != expected.substr(0, record)) {
+    throw vt::exception() << "the tail was not cut back";
+  }
+
+  std::atomic<bool> done = false;
+  std::thread syncer([&] {
+    while (!done) {
+      sync(fd);
+    }
+  });
+  for (size_t i = 1; i < records; ++i) {
+    vt::write_at(fd, expected.substr(i * record, record), i * record);
+  }
+  done = true;
+  syncer.join();
+  sync(fd);
+
+  const std::string disk = vt::disk_contents(path);
+  std::cout << "size on disk = " << disk.size() << '\n';
+  if (disk != expected) {
+    throw vt::exception() << "appends were lost or cut";
+  }
+  ::vtpc_close(fd);
+}
+
+}  // namespace
+
+/*
+ * Background writeback under pressure in a fresh process of its own, then
+ * how syncs write dirty blocks and the tail of a growing file.
+ */
+auto main() -> int try {
+  ::setenv("VTPC_MEMORY", "1M", 1);
+  ::setenv("VTPC_DIRTY_EXPIRE_MS", "600000", 1);
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    throw vt::exception() << "fork failed";
+  }
+  if (pid == 0) {
+    ::_exit(check_pressure());
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    throw vt::exception() << "background writeback failed";
+  }
+
+  ::setenv("VTPC_DIRTY_RATIO", "100", 1);
+  check_coalescing();
+  check_truncate();
+  ::unlink(path);
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}
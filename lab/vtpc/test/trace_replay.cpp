@@ -0,0 +1,51 @@
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string_view>
+
+#include "file.hpp"
+#include "trace_file.hpp"
+
+namespace {
+
+constexpr auto usage =
+    "usage: trace_replay TRACE FILE [libc|vtpc|direct] [fast|timed]\n";
+
+}  // namespace
+
+/* Replays a trace on a file and prints how it went. */
+auto main(int argc, char** argv) -> int try {
+  if (argc < 3 || argc > 5) {
+    std::cerr << usage;
+    return 2;
+  }
+  const std::string_view backend = argc > 3 ? argv[3] : "vtpc";
+  const std::string_view mode = argc > 4 ? argv[4] : "fast";
+  if (mode != "fast" && mode != "timed") {
+    std::cerr << usage;
+    return 2;
+  }
+
+  std::unique_ptr<vt::file> file;
+  if (backend == "libc") {
+    file = vt::file::open_libc(argv[2]);
+  } else if (backend == "vtpc") {
+    file = vt::file::open_vtpc(argv[2]);
+  } else if (backend == "direct") {
+    file = vt::file::open_direct(argv[2]);
+  } else {
+    std::cerr << usage;
+    return 2;
+  }
+
+  const vt::replay_stats stats = vt::replay(*file, argv[1], mode == "timed");
+  file.reset();
+  std::cout << "ops " << stats.ops << '\n'
+            << "failed " << stats.failed << '\n'
+            << "mismatched " << stats.mismatched << '\n'
+            << "seconds " << stats.seconds << '\n';
+  return stats.mismatched == 0 ? 0 : 1;
+} catch (const std::exception& e) {
+  std::cerr << "exception: " << e.what() << '\n';
+  return 1;
+}